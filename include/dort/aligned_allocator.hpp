@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdlib>
+#include <new>
+
+namespace dort {
+  // Allocator for std::vector that aligns the storage to `Align` bytes (C++14
+  // operator new ignores alignment larger than that of max_align_t).
+  template<class T, size_t Align>
+  struct AlignedAllocator {
+    using value_type = T;
+
+    template<class U>
+    struct rebind {
+      using other = AlignedAllocator<U, Align>;
+    };
+
+    AlignedAllocator() = default;
+    template<class U>
+    AlignedAllocator(const AlignedAllocator<U, Align>&) { }
+
+    T* allocate(size_t count) {
+      void* ptr = nullptr;
+      if(posix_memalign(&ptr, Align, count * sizeof(T)) != 0) {
+        throw std::bad_alloc();
+      }
+      return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t) {
+      std::free(ptr);
+    }
+
+    template<class U>
+    bool operator==(const AlignedAllocator<U, Align>&) const { return true; }
+    template<class U>
+    bool operator!=(const AlignedAllocator<U, Align>&) const { return false; }
+  };
+}
@@ -26,7 +26,7 @@ namespace dort {
 
     float area() const {
       Vec3 r = (this->p_max - this->p_min).v;
-      return 2.f * (r.y * r.z + r.x * r.z + r.y * r.z);
+      return 2.f * (r.x * r.y + r.x * r.z + r.y * r.z);
     }
 
     Point centroid() const {
@@ -56,6 +56,7 @@ namespace dort {
 
   Box union_box(const Box& b1, const Box& b2);
   Box union_box(const Box& box, const Point& pt);
+  Box intersect_box(const Box& b1, const Box& b2);
 
   inline bool is_finite(const Box& box) {
     return is_finite(box.p_min) && is_finite(box.p_max);
@@ -1,23 +1,40 @@
 #pragma once
+#include <array>
 #include <atomic>
+#include <cstring>
+#include <emmintrin.h>
 #include <memory>
-#include <shared_mutex>
 #include <vector>
+#include "dort/aligned_allocator.hpp"
 #include "dort/box.hpp"
+#include "dort/stats.hpp"
+#include "dort/transform.hpp"
 
 namespace dort {
   enum class BvhSplitMethod {
     Middle,
     Sah,
+    FullSah,
+    SpatialSah,
+    Lbvh,
   };
 
   struct BvhOpts {
     BvhSplitMethod split_method = BvhSplitMethod::Middle;
+    uint32_t branch_factor = 2;
+    uint32_t quantization_bits = 0;
     uint32_t leaf_size = 6;
     uint32_t max_leaf_size = 32;
     uint32_t min_elem_infos_per_thread = 5*1000;
     uint32_t min_split_elems_per_thread = 200*1000;
     uint32_t sah_bucket_count = 12;
+    float sah_traversal_cost = 1.f;
+    float sah_intersection_cost = 2.f;
+    float spatial_split_budget = 0.5f;
+    float spatial_split_alpha = 1e-5f;
+    uint32_t lbvh_sah_cluster_size = 0;
+    // used by MeshBvhPrimitive to store the leaf triangles in SoA blocks
+    bool triangle_blocks = false;
   };
 
   template<class Traits>
@@ -28,10 +45,8 @@ namespace dort {
       return Traits::get_bounds(arg, elem);
     }
 
-    static constexpr int32_t SAH_INTERSECTION_COST = 2;
-    static constexpr int32_t SAH_TRAVERSAL_COST = 1;
-
     struct LinearNode {
+      static constexpr uint32_t WIDTH = 2;
       Box bounds;
       uint32_t elem_offset_or_left_child;
       uint16_t elem_count_or_zero;
@@ -39,6 +54,83 @@ namespace dort {
       uint8_t padding[1];
     };
 
+    template<uint32_t N>
+    struct alignas(16) WideNode {
+      static constexpr uint32_t WIDTH = N;
+      // bounds of the children in SoA layout, indexed [axis][min/max][child]
+      float bounds[3][2][N];
+      uint32_t elem_offset_or_child[N];
+      uint16_t elem_count_or_zero[N];
+      uint8_t child_count;
+
+      __m128 load_bounds(uint32_t axis, uint32_t side, uint32_t g) const {
+        return _mm_load_ps(&this->bounds[axis][side][g]);
+      }
+    };
+
+    // Compressed WideNode<4>: the bounds of the children are stored as
+    // `origin + q * 2^scale_exp` with integral q of type Q, rounded outwards.
+    // With 8-bit q, the node occupies a single cache line.
+    template<class Q>
+    struct alignas(sizeof(Q) == 1 ? 64 : 32) QuantNode {
+      static constexpr uint32_t WIDTH = 4;
+      float origin[3];
+      int8_t scale_exp[3];
+      uint8_t child_count;
+      Q bounds[3][2][4];
+      uint32_t elem_offset_or_child[4];
+      uint16_t elem_count_or_zero[4];
+
+      __m128 load_bounds(uint32_t axis, uint32_t side, uint32_t) const {
+        __m128 q = Bvh::dequantize(this->bounds[axis][side]);
+        __m128 scale = _mm_castsi128_ps(_mm_set1_epi32(
+              (int32_t(this->scale_exp[axis]) + 127) << 23));
+        return _mm_add_ps(_mm_mul_ps(q, scale), _mm_set1_ps(this->origin[axis]));
+      }
+    };
+
+    template<class Q>
+    using QuantNodeVector = std::vector<QuantNode<Q>,
+          AlignedAllocator<QuantNode<Q>, alignof(QuantNode<Q>)>>;
+
+    struct WideStackEntry {
+      uint32_t elem_offset_or_node;
+      uint32_t elem_count_or_zero;
+      float t_near;
+    };
+
+    // a node or leaf to be visited by the rays in ray_mask (for binary nodes,
+    // only the elem_offset_or_node is used and t_near is ignored)
+    struct alignas(16) PacketStackEntry {
+      __m128 t_near;
+      uint32_t elem_offset_or_node;
+      uint32_t elem_count_or_zero;
+      uint32_t ray_mask;
+    };
+
+    // rays of a packet in SoA layout; the unused lanes repeat an active ray
+    struct PacketRays {
+      __m128 orig[3];
+      __m128 inv_dir[3];
+      uint32_t dir_is_neg[3];
+      uint32_t lanes[RAY_PACKET_SIZE];
+
+      __m128 load_t_min(const Ray* rays) const {
+        return _mm_setr_ps(rays[lanes[0]].t_min, rays[lanes[1]].t_min,
+            rays[lanes[2]].t_min, rays[lanes[3]].t_min);
+      }
+      __m128 load_t_max(const Ray* rays) const {
+        return _mm_setr_ps(rays[lanes[0]].t_max, rays[lanes[1]].t_max,
+            rays[lanes[2]].t_max, rays[lanes[3]].t_max);
+      }
+    };
+
+    // a leaf range of elements or a child node, as seen from the parent node
+    struct NodeItem {
+      uint32_t elem_offset_or_node;
+      uint32_t elem_count_or_zero;
+    };
+
     struct ElementInfo {
       uint32_t elem_index;
       Box bounds;
@@ -53,11 +145,20 @@ namespace dort {
       uint32_t prefix_count;
     };
 
+    struct SpatialBin {
+      uint32_t entry_count = 0;
+      uint32_t exit_count = 0;
+      Box bounds;
+    };
+
     struct NodeInfo {
       Box bounds;
       Box centroid_bounds;
       uint32_t begin;
       uint32_t end;
+      // the range [end, reserved_end) of build infos is free for references
+      // duplicated by spatial splits
+      uint32_t reserved_end;
       uint32_t linear_idx;
     };
 
@@ -65,29 +166,106 @@ namespace dort {
       Box left_bounds, right_bounds;
       Box left_centroid_bounds, right_centroid_bounds;
       uint32_t mid;
+      uint32_t right_begin, right_end;
+      uint8_t axis;
       bool prefer_leaf;
     };
 
+    struct SahBinning {
+      std::vector<BucketInfo> buckets;
+      float bounds_min[3];
+      float bucket_scale[3];
+      float cost;
+      uint8_t axis;
+      uint32_t bucket;
+    };
+
     struct BuildCtx {
       std::vector<ElementInfo> build_infos;
       std::vector<Element> elems;
       ThreadPool& pool;
       BvhOpts opts;
+      TraitsArg traits_arg;
+      float root_area;
       std::atomic<uint32_t> free_linear_idx;
       std::vector<NodeInfo> todo_serial;
-      std::shared_timed_mutex linear_mutex;
       std::vector<Element> ordered_elems;
       std::vector<LinearNode> linear_nodes;
     };
 
     std::vector<LinearNode> linear_nodes;
+    std::vector<WideNode<4>> wide4_nodes;
+    std::vector<WideNode<8>> wide8_nodes;
+    QuantNodeVector<uint8_t> quant8_nodes;
+    QuantNodeVector<uint16_t> quant16_nodes;
     std::vector<Element> ordered_elems;
+    Box root_bounds;
+    BvhOpts opts;
+    // SAH cost of every node (normalized by the area of the node), measured
+    // from the node bounds before the first refit or after a rebuild
+    std::vector<float> node_costs;
   public:
     Bvh(std::vector<Element> elems, TraitsArg arg,
         const BvhOpts& opts, ThreadPool& pool);
     Box bounds() const;
-    void traverse_elems(const Ray& ray,
-        std::function<bool(const Element&)> callback) const;
+
+    // Recomputes the bounds of all nodes bottom-up after the elements have
+    // moved, keeping the topology of the tree. If `rebuild_threshold` is
+    // positive, the topmost subtrees whose SAH cost grew more than
+    // `rebuild_threshold` times are rebuilt from scratch.
+    void refit(TraitsArg arg, ThreadPool& pool, float rebuild_threshold);
+
+    template<class F>
+    void for_each_elem(F callback) const {
+      for(const Element& elem: this->ordered_elems) {
+        callback(elem);
+      }
+    }
+
+    // The elements may be modified, but their bounds must not change until
+    // the next refit().
+    template<class F>
+    void for_each_elem(F callback) {
+      for(Element& elem: this->ordered_elems) {
+        callback(elem);
+      }
+    }
+
+    // Bounds of the whole tree after a transform, which are tighter than the
+    // transformed root bounds, because the boxes of the top nodes are
+    // transformed separately.
+    Box transformed_bounds(const Transform& transform) const;
+
+    // Calls callback(elem) for the elements whose leaves are hit by the ray,
+    // until the callback returns false. The callback is a template parameter,
+    // so that it can be inlined into the traversal loop.
+    template<class F>
+    void traverse_elems(const Ray& ray, F callback) const;
+
+    // Calls callback(elem_offset, elem_count) for the leaves hit by the ray,
+    // until the callback returns false. The leaf contains the elements at
+    // positions [elem_offset, elem_offset + elem_count) in the order of
+    // for_each_elem().
+    template<class F>
+    void traverse_leaves(const Ray& ray, F callback) const;
+
+    // Calls callback(elem, leaf_ray_mask) for the elements whose leaves are
+    // hit by some of the rays in `ray_mask`, where leaf_ray_mask selects these
+    // rays, until the callback returns false. The callback may shorten the
+    // t_max of the rays.
+    template<class F>
+    void traverse_packet_elems(const Ray* rays, uint32_t ray_mask,
+        F callback) const;
+
+    // Packet version of traverse_leaves(), with
+    // callback(elem_offset, elem_count, leaf_ray_mask). The rays are
+    // traversed together only if their directions have the same signs (so
+    // that they agree on the order of the children); otherwise, and for the
+    // subtrees that are hit by a single ray, we fall back to the single-ray
+    // traversal.
+    template<class F>
+    void traverse_packet_leaves(const Ray* rays, uint32_t ray_mask,
+        F callback) const;
   private:
     static std::vector<ElementInfo> compute_build_infos(
         const std::vector<Element>& elems,
@@ -96,17 +274,578 @@ namespace dort {
         const BvhOpts& opts, ThreadPool& pool);
 
     static void build_node(BuildCtx& ctx, const NodeInfo& node, bool parallel);
-    static void write_linear_node(BuildCtx& ctx,
-        uint32_t idx, const LinearNode& node);
 
     static SplitInfo split_middle(BuildCtx& ctx, const NodeInfo& node,
         uint8_t axis, bool parallel);
+    static void compute_split_bounds(BuildCtx& ctx, SplitInfo& split,
+        uint32_t begin, uint32_t end, bool parallel);
     static SplitInfo split_sah(BuildCtx& ctx, const NodeInfo& node,
-        uint8_t axis, bool parallel);
+        uint8_t axis, bool all_axes, bool parallel);
+    static SplitInfo split_spatial(BuildCtx& ctx, const NodeInfo& node,
+        bool parallel);
+    static SahBinning bin_sah(BuildCtx& ctx, const NodeInfo& node,
+        uint8_t axis, bool all_axes, bool parallel);
+    static SplitInfo apply_sah_binning(BuildCtx& ctx, const NodeInfo& node,
+        const SahBinning& binning, bool parallel);
+    static uint32_t get_sah_bucket_idx(const BvhOpts& opts,
+        const SahBinning& binning, const Point& centroid, uint8_t axis);
+    static void distribute_reserve(BuildCtx& ctx, const NodeInfo& node,
+        SplitInfo& split);
+    static void compact_ordered_elems(BuildCtx& ctx);
+    static void build_lbvh(BuildCtx& ctx, const Box& centroid_bounds);
+    static std::vector<uint32_t> sort_morton_codes(BuildCtx& ctx,
+        const Box& centroid_bounds);
+    static Box build_lbvh_node(BuildCtx& ctx, const std::vector<uint32_t>& codes,
+        uint32_t begin, uint32_t end, uint32_t linear_idx);
+    template<class P>
     static uint32_t partition(BuildCtx& ctx, bool parallel,
-        uint32_t begin, uint32_t end, uint8_t axis, float separator);
+        uint32_t begin, uint32_t end, P predicate);
 
-    static int32_t sah_split_cost(const Box& centroid_bounds,
+    static float sah_split_cost(const BvhOpts& opts, const Box& bounds,
         const BucketInfo& bucket, uint32_t elem_count);
+
+    template<uint32_t N>
+    static std::vector<WideNode<N>> collapse_wide(
+        const std::vector<LinearNode>& linear_nodes);
+    template<class Q>
+    static QuantNodeVector<Q> quantize_wide(
+        const std::vector<WideNode<4>>& wide_nodes);
+    template<class Q>
+    static void quantize_node(const WideNode<4>& wide_node,
+        QuantNode<Q>& quant_node);
+
+    template<class Nodes>
+    void refit_layout(Nodes Bvh::* nodes_member, TraitsArg arg,
+        ThreadPool& pool, float rebuild_threshold);
+    template<class Nodes>
+    Box refit_node(Nodes& nodes, uint32_t node_idx, TraitsArg arg,
+        ThreadPool& pool, uint32_t parallel_depth, bool recompute,
+        std::vector<float>& out_costs);
+    template<class Nodes>
+    void collect_degraded(const Nodes& nodes, uint32_t node_idx,
+        const std::vector<float>& costs, float threshold,
+        std::vector<uint32_t>& out_degraded) const;
+    template<class Nodes>
+    void rebuild_subtree(Nodes Bvh::* nodes_member, uint32_t node_idx,
+        TraitsArg arg, ThreadPool& pool);
+    template<class Nodes>
+    static void get_elem_range(const Nodes& nodes, uint32_t node_idx,
+        uint32_t& begin, uint32_t& end);
+    template<class Nodes>
+    static Nodes layout_nodes(const Nodes& nodes);
+    template<class Nodes>
+    static Box transformed_node_bounds(const Nodes& nodes, uint32_t node_idx,
+        const Transform& transform, uint32_t depth);
+
+    static uint32_t get_node_items(const LinearNode& node,
+        NodeItem* out_items);
+    template<class Node>
+    static uint32_t get_node_items(const Node& node, NodeItem* out_items);
+    static void set_node_child(LinearNode& node, uint32_t item, uint32_t child);
+    template<class Node>
+    static void set_node_child(Node& node, uint32_t item, uint32_t child);
+    static void rebase_node(LinearNode& node,
+        uint32_t elem_shift, uint32_t node_shift);
+    template<class Node>
+    static void rebase_node(Node& node,
+        uint32_t elem_shift, uint32_t node_shift);
+    static Box get_item_bounds(const LinearNode& node, uint32_t item);
+    template<class Node>
+    static Box get_item_bounds(const Node& node, uint32_t item);
+    static void set_node_bounds(LinearNode& node,
+        const Box* item_bounds, uint32_t item_count);
+    template<uint32_t N>
+    static void set_node_bounds(WideNode<N>& node,
+        const Box* item_bounds, uint32_t item_count);
+    template<class Q>
+    static void set_node_bounds(QuantNode<Q>& node,
+        const Box* item_bounds, uint32_t item_count);
+
+    static __m128 dequantize(const uint8_t (&q)[4]) {
+      int32_t bits;
+      std::memcpy(&bits, q, sizeof(bits));
+      __m128i zero = _mm_setzero_si128();
+      __m128i q_epi8 = _mm_cvtsi32_si128(bits);
+      __m128i q_epi16 = _mm_unpacklo_epi8(q_epi8, zero);
+      return _mm_cvtepi32_ps(_mm_unpacklo_epi16(q_epi16, zero));
+    }
+    static __m128 dequantize(const uint16_t (&q)[4]) {
+      __m128i zero = _mm_setzero_si128();
+      __m128i q_epi16 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(q));
+      return _mm_cvtepi32_ps(_mm_unpacklo_epi16(q_epi16, zero));
+    }
+    template<class F>
+    void traverse_binary(const Ray& ray, uint32_t root_idx, F& callback) const;
+    template<class Nodes, class F>
+    void traverse_wide(const Nodes& wide_nodes, const Ray& ray,
+        const WideStackEntry& root, F& callback) const;
+
+    static PacketRays load_packet_rays(const Ray* rays, uint32_t ray_mask);
+    template<class F>
+    void traverse_packet_binary(const Ray* rays, uint32_t ray_mask,
+        F& callback) const;
+    template<class Nodes, class F>
+    void traverse_packet_wide(const Nodes& wide_nodes, const Ray* rays,
+        uint32_t ray_mask, F& callback) const;
   };
+
+  template<class Traits>
+  template<class F>
+  void Bvh<Traits>::traverse_elems(const Ray& ray, F callback) const {
+    this->traverse_leaves(ray, [&](uint32_t elem_offset, uint32_t elem_count) {
+      for(uint32_t i = 0; i < elem_count; ++i) {
+        StatTimer t_elem(TIMER_BVH_TRAVERSE_ELEM);
+        if(!callback(this->ordered_elems.at(elem_offset + i))) {
+          return false;
+        }
+      }
+      return true;
+    });
+  }
+
+  template<class Traits>
+  template<class F>
+  void Bvh<Traits>::traverse_leaves(const Ray& ray, F callback) const {
+    WideStackEntry root { 0, 0, ray.t_min };
+    if(!this->wide4_nodes.empty()) {
+      this->traverse_wide(this->wide4_nodes, ray, root, callback);
+    } else if(!this->wide8_nodes.empty()) {
+      this->traverse_wide(this->wide8_nodes, ray, root, callback);
+    } else if(!this->quant8_nodes.empty()) {
+      this->traverse_wide(this->quant8_nodes, ray, root, callback);
+    } else if(!this->quant16_nodes.empty()) {
+      this->traverse_wide(this->quant16_nodes, ray, root, callback);
+    } else {
+      this->traverse_binary(ray, 0, callback);
+    }
+  }
+
+  template<class Traits>
+  template<class F>
+  void Bvh<Traits>::traverse_packet_elems(const Ray* rays, uint32_t ray_mask,
+      F callback) const
+  {
+    this->traverse_packet_leaves(rays, ray_mask,
+      [&](uint32_t elem_offset, uint32_t elem_count, uint32_t leaf_ray_mask) {
+        for(uint32_t i = 0; i < elem_count; ++i) {
+          StatTimer t_elem(TIMER_BVH_TRAVERSE_ELEM);
+          if(!callback(this->ordered_elems.at(elem_offset + i), leaf_ray_mask)) {
+            return false;
+          }
+        }
+        return true;
+      });
+  }
+
+  template<class Traits>
+  template<class F>
+  void Bvh<Traits>::traverse_packet_leaves(const Ray* rays, uint32_t ray_mask,
+      F callback) const
+  {
+    if(ray_mask == 0) {
+      return;
+    }
+
+    const Ray& first_ray = rays[__builtin_ctz(ray_mask)];
+    bool coherent = true;
+    for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+      if(ray_mask & (1u << i)) {
+        for(uint32_t axis = 0; axis < 3; ++axis) {
+          coherent &= (rays[i].dir.v[axis] < 0.f) == (first_ray.dir.v[axis] < 0.f);
+        }
+      }
+    }
+
+    if(!coherent || (ray_mask & (ray_mask - 1)) == 0) {
+      for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+        if(!(ray_mask & (1u << i))) {
+          continue;
+        }
+        stat_count(COUNTER_BVH_PACKET_FALLBACK);
+        bool keep_going = true;
+        this->traverse_leaves(rays[i], [&](uint32_t elem_offset, uint32_t elem_count) {
+          return keep_going = callback(elem_offset, elem_count, 1u << i);
+        });
+        if(!keep_going) {
+          return;
+        }
+      }
+      return;
+    }
+
+    if(!this->wide4_nodes.empty()) {
+      this->traverse_packet_wide(this->wide4_nodes, rays, ray_mask, callback);
+    } else if(!this->wide8_nodes.empty()) {
+      this->traverse_packet_wide(this->wide8_nodes, rays, ray_mask, callback);
+    } else if(!this->quant8_nodes.empty()) {
+      this->traverse_packet_wide(this->quant8_nodes, rays, ray_mask, callback);
+    } else if(!this->quant16_nodes.empty()) {
+      this->traverse_packet_wide(this->quant16_nodes, rays, ray_mask, callback);
+    } else {
+      this->traverse_packet_binary(rays, ray_mask, callback);
+    }
+  }
+
+  template<class Traits>
+  template<class F>
+  void Bvh<Traits>::traverse_binary(const Ray& ray, uint32_t root_idx,
+      F& callback) const
+  {
+    Vector inv_dir(1.f / ray.dir.v.x, 1.f / ray.dir.v.y, 1.f / ray.dir.v.z);
+    bool dir_is_neg[] = { ray.dir.v.x < 0.f, ray.dir.v.y < 0.f, ray.dir.v.z < 0.f };
+
+    std::array<uint32_t, 64> todo_stack;
+    uint32_t todo_top = 0;
+    uint32_t todo_index = root_idx;
+    uint32_t traversed = 0;
+    for(;;) {
+      StatTimer t_node(TIMER_BVH_TRAVERSE_NODE);
+      const LinearNode& linear_node = this->linear_nodes.at(todo_index);
+      traversed += 1;
+
+      stat_count(COUNTER_BVH_FAST_BOX_INTERSECT_P);
+      if(linear_node.bounds.fast_hit_p(ray, inv_dir, dir_is_neg)) {
+        stat_count(COUNTER_BVH_FAST_BOX_INTERSECT_P_HIT);
+        if(linear_node.elem_count_or_zero == 0) {
+          uint32_t left_child = linear_node.elem_offset_or_left_child;
+          uint32_t right_child = left_child + 1;
+          if(dir_is_neg[linear_node.axis]) {
+            todo_stack.at(todo_top++) = left_child;
+            todo_index = right_child;
+          } else {
+            todo_stack.at(todo_top++) = right_child;
+            todo_index = left_child;
+          }
+          continue;
+        }
+
+        t_node.stop();
+        if(!callback(linear_node.elem_offset_or_left_child,
+              uint32_t(linear_node.elem_count_or_zero)))
+        {
+          stat_sample_int(DISTRIB_INT_BVH_TRAVERSE_COUNT, traversed);
+          return;
+        }
+      }
+
+      if(todo_top == 0) {
+        break;
+      }
+      todo_index = todo_stack.at(--todo_top);
+    }
+
+    stat_sample_int(DISTRIB_INT_BVH_TRAVERSE_COUNT, traversed);
+  }
+
+  template<class Traits>
+  template<class Nodes, class F>
+  void Bvh<Traits>::traverse_wide(const Nodes& wide_nodes, const Ray& ray,
+      const WideStackEntry& root, F& callback) const
+  {
+    using Node = typename Nodes::value_type;
+    constexpr uint32_t N = Node::WIDTH;
+    static_assert(N % 4 == 0, "Wide nodes are tested in groups of four children");
+    uint32_t dir_is_neg[] = { ray.dir.v.x < 0.f, ray.dir.v.y < 0.f, ray.dir.v.z < 0.f };
+    __m128 orig[3], inv_dir[3];
+    for(uint32_t axis = 0; axis < 3; ++axis) {
+      orig[axis] = _mm_set1_ps(ray.orig.v[axis]);
+      inv_dir[axis] = _mm_set1_ps(1.f / ray.dir.v[axis]);
+    }
+
+    std::array<WideStackEntry, 64 * N> todo_stack;
+    uint32_t todo_top = 0;
+    uint32_t traversed = 0;
+    todo_stack.at(todo_top++) = root;
+
+    while(todo_top > 0) {
+      WideStackEntry entry = todo_stack.at(--todo_top);
+      if(entry.t_near > ray.t_max) {
+        continue;
+      }
+
+      if(entry.elem_count_or_zero != 0) {
+        if(!callback(entry.elem_offset_or_node, entry.elem_count_or_zero)) {
+          stat_sample_int(DISTRIB_INT_BVH_TRAVERSE_COUNT, traversed);
+          return;
+        }
+        continue;
+      }
+
+      StatTimer t_node(TIMER_BVH_TRAVERSE_NODE);
+      const Node& node = wide_nodes.at(entry.elem_offset_or_node);
+      traversed += 1;
+      stat_count(COUNTER_BVH_WIDE_NODE_ISECT);
+
+      // slab test of all children at once; the _mm_max_ps and _mm_min_ps
+      // return the second operand if the first is NaN (which happens when the
+      // ray is parallel to a slab), so that the interval is not updated
+      alignas(16) float t_near[N];
+      uint32_t hit_mask = 0;
+      __m128 ray_t_min = _mm_set1_ps(ray.t_min);
+      __m128 ray_t_max = _mm_set1_ps(ray.t_max);
+      for(uint32_t g = 0; g < N; g += 4) {
+        __m128 t0 = ray_t_min;
+        __m128 t1 = ray_t_max;
+        for(uint32_t axis = 0; axis < 3; ++axis) {
+          __m128 near = node.load_bounds(axis, dir_is_neg[axis], g);
+          __m128 far = node.load_bounds(axis, 1 - dir_is_neg[axis], g);
+          t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near, orig[axis]), inv_dir[axis]), t0);
+          t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far, orig[axis]), inv_dir[axis]), t1);
+        }
+        _mm_store_ps(&t_near[g], t0);
+        hit_mask |= uint32_t(_mm_movemask_ps(_mm_cmple_ps(t0, t1))) << g;
+      }
+      hit_mask &= (1u << node.child_count) - 1;
+
+      // sort the hit children from the farthest to the nearest, so that the
+      // nearest child is popped from the stack first
+      std::array<uint32_t, N> hits;
+      uint32_t hit_count = 0;
+      while(hit_mask != 0) {
+        uint32_t child = __builtin_ctz(hit_mask);
+        hit_mask &= hit_mask - 1;
+        uint32_t j = hit_count++;
+        for(; j > 0 && t_near[hits.at(j - 1)] < t_near[child]; --j) {
+          hits.at(j) = hits.at(j - 1);
+        }
+        hits.at(j) = child;
+      }
+      stat_sample_int(DISTRIB_INT_BVH_WIDE_CHILD_HITS, hit_count);
+
+      for(uint32_t i = 0; i < hit_count; ++i) {
+        uint32_t child = hits.at(i);
+        todo_stack.at(todo_top++) = WideStackEntry {
+          node.elem_offset_or_child[child],
+          node.elem_count_or_zero[child],
+          t_near[child],
+        };
+      }
+    }
+
+    stat_sample_int(DISTRIB_INT_BVH_TRAVERSE_COUNT, traversed);
+  }
+
+  template<class Traits>
+  typename Bvh<Traits>::PacketRays Bvh<Traits>::load_packet_rays(
+      const Ray* rays, uint32_t ray_mask)
+  {
+    PacketRays packet;
+    uint32_t first = __builtin_ctz(ray_mask);
+    for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+      packet.lanes[i] = (ray_mask & (1u << i)) ? i : first;
+    }
+
+    const Ray* r[] = {
+      &rays[packet.lanes[0]], &rays[packet.lanes[1]],
+      &rays[packet.lanes[2]], &rays[packet.lanes[3]],
+    };
+    for(uint32_t axis = 0; axis < 3; ++axis) {
+      packet.orig[axis] = _mm_setr_ps(r[0]->orig.v[axis], r[1]->orig.v[axis],
+          r[2]->orig.v[axis], r[3]->orig.v[axis]);
+      packet.inv_dir[axis] = _mm_div_ps(_mm_set1_ps(1.f),
+          _mm_setr_ps(r[0]->dir.v[axis], r[1]->dir.v[axis],
+            r[2]->dir.v[axis], r[3]->dir.v[axis]));
+      packet.dir_is_neg[axis] = rays[first].dir.v[axis] < 0.f;
+    }
+    return packet;
+  }
+
+  template<class Traits>
+  template<class F>
+  void Bvh<Traits>::traverse_packet_binary(const Ray* rays, uint32_t ray_mask,
+      F& callback) const
+  {
+    PacketRays packet = Bvh::load_packet_rays(rays, ray_mask);
+    const uint32_t* dir_is_neg = packet.dir_is_neg;
+
+    std::array<PacketStackEntry, 64> todo_stack;
+    uint32_t todo_top = 0;
+    PacketStackEntry entry { _mm_setzero_ps(), 0, 0, ray_mask };
+    for(;;) {
+      StatTimer t_node(TIMER_BVH_TRAVERSE_NODE);
+      const LinearNode& linear_node = this->linear_nodes.at(entry.elem_offset_or_node);
+      stat_count(COUNTER_BVH_PACKET_NODE_ISECT);
+
+      // the same slab test as Box::fast_hit_p(), including the treatment of
+      // NaNs, for all rays at once
+      __m128 t[3][2];
+      for(uint32_t axis = 0; axis < 3; ++axis) {
+        for(uint32_t side = 0; side < 2; ++side) {
+          __m128 bound = _mm_set1_ps(linear_node.bounds[
+              side == 0 ? dir_is_neg[axis] : 1 - dir_is_neg[axis]].v[axis]);
+          t[axis][side] = _mm_mul_ps(_mm_sub_ps(bound, packet.orig[axis]),
+              packet.inv_dir[axis]);
+        }
+      }
+      __m128 t_min = t[0][0], t_max = t[0][1];
+      __m128 miss = _mm_or_ps(_mm_cmpgt_ps(t_min, t[1][1]), _mm_cmpgt_ps(t[1][0], t_max));
+      t_min = _mm_max_ps(t[1][0], t_min);
+      t_max = _mm_min_ps(t[1][1], t_max);
+      miss = _mm_or_ps(miss, _mm_cmpgt_ps(t_min, t[2][1]));
+      miss = _mm_or_ps(miss, _mm_cmplt_ps(t_max, t[2][0]));
+      t_min = _mm_max_ps(t[2][0], t_min);
+      t_max = _mm_min_ps(t[2][1], t_max);
+      __m128 hit = _mm_andnot_ps(miss, _mm_and_ps(
+            _mm_cmplt_ps(t_min, packet.load_t_max(rays)),
+            _mm_cmpgt_ps(t_max, packet.load_t_min(rays))));
+      uint32_t hit_mask = entry.ray_mask & uint32_t(_mm_movemask_ps(hit));
+
+      if(hit_mask != 0 && (hit_mask & (hit_mask - 1)) == 0) {
+        // the packet has diverged to a single ray
+        stat_count(COUNTER_BVH_PACKET_FALLBACK);
+        t_node.stop();
+        uint32_t lane = __builtin_ctz(hit_mask);
+        bool keep_going = true;
+        auto ray_callback = [&](uint32_t elem_offset, uint32_t elem_count) {
+          return keep_going = callback(elem_offset, elem_count, hit_mask);
+        };
+        this->traverse_binary(rays[lane], entry.elem_offset_or_node, ray_callback);
+        if(!keep_going) {
+          return;
+        }
+      } else if(hit_mask != 0) {
+        if(linear_node.elem_count_or_zero == 0) {
+          uint32_t left_child = linear_node.elem_offset_or_left_child;
+          uint32_t right_child = left_child + 1;
+          bool left_first = !dir_is_neg[linear_node.axis];
+          todo_stack.at(todo_top++) = PacketStackEntry { entry.t_near,
+            left_first ? right_child : left_child, 0, hit_mask };
+          entry = PacketStackEntry { entry.t_near,
+            left_first ? left_child : right_child, 0, hit_mask };
+          continue;
+        }
+
+        t_node.stop();
+        if(!callback(linear_node.elem_offset_or_left_child,
+              uint32_t(linear_node.elem_count_or_zero), hit_mask))
+        {
+          return;
+        }
+      }
+
+      if(todo_top == 0) {
+        break;
+      }
+      entry = todo_stack.at(--todo_top);
+    }
+  }
+
+  template<class Traits>
+  template<class Nodes, class F>
+  void Bvh<Traits>::traverse_packet_wide(const Nodes& wide_nodes,
+      const Ray* rays, uint32_t ray_mask, F& callback) const
+  {
+    using Node = typename Nodes::value_type;
+    constexpr uint32_t N = Node::WIDTH;
+    PacketRays packet = Bvh::load_packet_rays(rays, ray_mask);
+    const uint32_t* dir_is_neg = packet.dir_is_neg;
+
+    std::array<PacketStackEntry, 64 * N> todo_stack;
+    uint32_t todo_top = 0;
+    todo_stack.at(todo_top++) = PacketStackEntry {
+      packet.load_t_min(rays), 0, 0, ray_mask };
+
+    while(todo_top > 0) {
+      PacketStackEntry entry = todo_stack.at(--todo_top);
+      __m128 ray_t_max = packet.load_t_max(rays);
+      uint32_t active_mask = entry.ray_mask &
+        uint32_t(_mm_movemask_ps(_mm_cmple_ps(entry.t_near, ray_t_max)));
+      if(active_mask == 0) {
+        continue;
+      }
+
+      if(entry.elem_count_or_zero != 0) {
+        if(!callback(entry.elem_offset_or_node, entry.elem_count_or_zero, active_mask)) {
+          return;
+        }
+        continue;
+      }
+
+      if((active_mask & (active_mask - 1)) == 0) {
+        // the packet has diverged to a single ray
+        stat_count(COUNTER_BVH_PACKET_FALLBACK);
+        uint32_t lane = __builtin_ctz(active_mask);
+        alignas(16) float t_near[4];
+        _mm_store_ps(t_near, entry.t_near);
+        bool keep_going = true;
+        auto ray_callback = [&](uint32_t elem_offset, uint32_t elem_count) {
+          return keep_going = callback(elem_offset, elem_count, active_mask);
+        };
+        this->traverse_wide(wide_nodes, rays[lane],
+            WideStackEntry { entry.elem_offset_or_node, 0, t_near[lane] },
+            ray_callback);
+        if(!keep_going) {
+          return;
+        }
+        continue;
+      }
+
+      StatTimer t_node(TIMER_BVH_TRAVERSE_NODE);
+      const Node& node = wide_nodes.at(entry.elem_offset_or_node);
+      stat_count(COUNTER_BVH_PACKET_NODE_ISECT);
+
+      alignas(16) float near_bounds[3][N];
+      alignas(16) float far_bounds[3][N];
+      for(uint32_t axis = 0; axis < 3; ++axis) {
+        for(uint32_t g = 0; g < N; g += 4) {
+          _mm_store_ps(&near_bounds[axis][g],
+              node.load_bounds(axis, dir_is_neg[axis], g));
+          _mm_store_ps(&far_bounds[axis][g],
+              node.load_bounds(axis, 1 - dir_is_neg[axis], g));
+        }
+      }
+
+      // the same slab test as in traverse_wide(), but each child is tested
+      // against all rays at once
+      __m128 ray_t_min = packet.load_t_min(rays);
+      std::array<uint32_t, N> hits;
+      std::array<float, N> hit_t_near;
+      std::array<PacketStackEntry, N> child_entries;
+      uint32_t hit_count = 0;
+      for(uint32_t child = 0; child < node.child_count; ++child) {
+        __m128 t0 = ray_t_min;
+        __m128 t1 = ray_t_max;
+        for(uint32_t axis = 0; axis < 3; ++axis) {
+          __m128 near = _mm_set1_ps(near_bounds[axis][child]);
+          __m128 far = _mm_set1_ps(far_bounds[axis][child]);
+          t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near, packet.orig[axis]),
+                packet.inv_dir[axis]), t0);
+          t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far, packet.orig[axis]),
+                packet.inv_dir[axis]), t1);
+        }
+        uint32_t child_mask = active_mask &
+          uint32_t(_mm_movemask_ps(_mm_cmple_ps(t0, t1)));
+        if(child_mask == 0) {
+          continue;
+        }
+
+        child_entries.at(child) = PacketStackEntry { t0,
+          node.elem_offset_or_child[child], node.elem_count_or_zero[child],
+          child_mask };
+
+        // the children are ordered by the nearest entry of any ray
+        alignas(16) float t_near[4];
+        _mm_store_ps(t_near, t0);
+        float min_t_near = INFINITY;
+        for(uint32_t lane = 0; lane < 4; ++lane) {
+          if(child_mask & (1u << lane)) {
+            min_t_near = min(min_t_near, t_near[lane]);
+          }
+        }
+
+        uint32_t j = hit_count++;
+        for(; j > 0 && hit_t_near.at(j - 1) < min_t_near; --j) {
+          hits.at(j) = hits.at(j - 1);
+          hit_t_near.at(j) = hit_t_near.at(j - 1);
+        }
+        hits.at(j) = child;
+        hit_t_near.at(j) = min_t_near;
+      }
+      stat_sample_int(DISTRIB_INT_BVH_WIDE_CHILD_HITS, hit_count);
+
+      for(uint32_t i = 0; i < hit_count; ++i) {
+        todo_stack.at(todo_top++) = child_entries.at(hits.at(i));
+      }
+    }
+  }
 }
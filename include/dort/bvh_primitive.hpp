@@ -1,24 +1,66 @@
 #pragma once
 #include "dort/bvh.hpp"
+#include "dort/mesh_triangle_primitive.hpp"
 #include "dort/primitive.hpp"
+#include "dort/triangle_shape_primitive.hpp"
 
 namespace dort {
   class BvhPrimitive final: public Primitive {
+    // The primitives of common concrete types are stored by value in arrays
+    // of their type and the leaves refer to them by a type tag and an index,
+    // so that the intersection is dispatched by a switch on the tag instead
+    // of a virtual call. The primitives of other types are kept behind
+    // pointers in `other_prims`.
+    enum class LeafType: uint8_t {
+      SphereShape,
+      CubeShape,
+      DiskShape,
+      OtherShape,
+      TriangleShape,
+      MeshTriangle,
+      Frame,
+      Other,
+    };
+
+    struct Leaf {
+      uint32_t index;
+      LeafType type;
+    };
+
     struct BvhTraits {
-      using Element = std::unique_ptr<Primitive>;
-      struct Arg {};
+      using Element = Leaf;
+      using Arg = const BvhPrimitive*;
+      static constexpr bool SPATIAL_SPLITS = false;
 
-      static Box get_bounds(Arg, const std::unique_ptr<Primitive>& prim) {
-        return prim->bounds();
+      static Box get_bounds(Arg arg, const Leaf& leaf) {
+        return arg->leaf_bounds(leaf);
       }
     };
 
+    // these arrays must not be resized after the BVH is built, because the
+    // intersections point to the primitives
+    std::vector<ShapePrimitive> shape_prims;
+    std::vector<TriangleShapePrimitive> triangle_shape_prims;
+    std::vector<MeshTrianglePrimitive> mesh_triangle_prims;
+    std::vector<FramePrimitive> frame_prims;
+    std::vector<std::unique_ptr<Primitive>> other_prims;
     Bvh<BvhTraits> bvh;
   public:
     BvhPrimitive(std::vector<std::unique_ptr<Primitive>> prims,
         const BvhOpts& opts, ThreadPool& pool);
     virtual bool intersect(Ray& ray, Intersection& out_isect) const override final;
     virtual bool intersect_p(const Ray& ray) const override final;
+    virtual uint32_t intersect_packet(Ray* rays, Intersection* out_isects,
+        uint32_t ray_mask) const override final;
     virtual Box bounds() const override final;
+    virtual Box transformed_bounds(const Transform& transform) const override final;
+    virtual void refit(ThreadPool& pool, float rebuild_threshold,
+        RefittedSet& refitted) override final;
+  private:
+    std::vector<Leaf> make_leaves(std::vector<std::unique_ptr<Primitive>> prims);
+    void reorder_leaves();
+    Box leaf_bounds(const Leaf& leaf) const;
+    bool intersect_leaf(const Leaf& leaf, Ray& ray, Intersection& out_isect) const;
+    bool intersect_leaf_p(const Leaf& leaf, const Ray& ray) const;
   };
 }
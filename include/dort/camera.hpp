@@ -38,6 +38,11 @@ namespace dort {
       camera_to_world(camera_to_world), flags(flags) {}
     virtual ~Camera() {}
 
+    /// Returns the origin of the camera coordinates in the world.
+    Point world_origin() const {
+      return this->camera_to_world.apply(Point(0.f, 0.f, 0.f));
+    }
+
     /// Samples a ray from the camera.
     /// Samples a ray emanating from the camera that corresponds to the point
     /// film_pos on the film (with resolution film_res), and returns the
@@ -89,5 +94,10 @@ namespace dort {
     /// sample_pivot_importance().
     virtual float pivot_importance_pdf(Vec2 film_res,
         const Point& p_gen, const Point& pivot_fix) const = 0;
+
+    /// Returns the width of the area seen by a single pixel.
+    /// The area is perpendicular to the view at the given distance from the
+    /// camera origin.
+    virtual float pixel_footprint(Vec2 film_res, float distance) const = 0;
   };
 }
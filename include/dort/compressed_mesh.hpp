@@ -0,0 +1,106 @@
+#pragma once
+#include <array>
+#include <vector>
+#include "dort/geometry.hpp"
+#include "dort/mesh.hpp"
+#include "dort/vec_2.hpp"
+
+namespace dort {
+  // A read-only mesh with compressed storage: the points are quantized to 16
+  // bits per coordinate within the bounds of the mesh, the normals are
+  // octahedral-encoded into 16 bits, the uvs are quantized to 16 bits per
+  // coordinate and the vertices are stored as 16-bit offsets from the base of
+  // a block of triangles. The mesh takes 12 bytes per point (with normals and
+  // uvs) and about 6.5 bytes per triangle, compared to 32 and 12 bytes of Mesh.
+  struct CompressedMesh final {
+    static constexpr uint32_t BLOCK_VERTICES = 3 * 16;
+    static constexpr uint32_t WIDE_BLOCK = 0x80000000;
+
+    struct VertexBlock {
+      uint32_t base;
+      // offset into `short_vertices`, or into `wide_vertices` if WIDE_BLOCK is
+      // set (when the vertices of the block do not fit into 16 bits); the
+      // offset is counted in blocks, because all blocks except the last one
+      // are full, so it does not overflow into the flag
+      uint32_t offset;
+    };
+
+    Point point_min;
+    Vector point_scale;
+    Vec2 uv_min;
+    Vec2 uv_scale;
+    std::vector<uint16_t> points;
+    std::vector<uint16_t> normals;
+    std::vector<uint16_t> uvs;
+    std::vector<VertexBlock> vertex_blocks;
+    std::vector<uint16_t> short_vertices;
+    std::vector<uint32_t> wide_vertices;
+    uint32_t vertex_count = 0;
+
+    Point point(uint32_t idx) const {
+      return Point(
+          this->point_min.v.x + float(this->points.at(3*idx)) * this->point_scale.v.x,
+          this->point_min.v.y + float(this->points.at(3*idx + 1)) * this->point_scale.v.y,
+          this->point_min.v.z + float(this->points.at(3*idx + 2)) * this->point_scale.v.z);
+    }
+
+    Vec2 uv(uint32_t idx) const {
+      return Vec2(
+          this->uv_min.x + float(this->uvs.at(2*idx)) * this->uv_scale.x,
+          this->uv_min.y + float(this->uvs.at(2*idx + 1)) * this->uv_scale.y);
+    }
+
+    Normal normal(uint32_t idx) const {
+      uint16_t code = this->normals.at(idx);
+      float x = float(code & 0xff) * (2.f / 255.f) - 1.f;
+      float y = float(code >> 8) * (2.f / 255.f) - 1.f;
+      float z = 1.f - abs(x) - abs(y);
+      if(z < 0.f) {
+        float old_x = x;
+        x = (1.f - abs(y)) * sign(old_x);
+        y = (1.f - abs(old_x)) * sign(y);
+      }
+      return normalize(Normal(x, y, z));
+    }
+
+    uint32_t vertex(uint32_t index) const {
+      const VertexBlock& block = this->vertex_blocks.at(index / BLOCK_VERTICES);
+      size_t begin = size_t(block.offset & ~WIDE_BLOCK) * BLOCK_VERTICES;
+      uint32_t in_block = index % BLOCK_VERTICES;
+      if(block.offset & WIDE_BLOCK) {
+        return this->wide_vertices.at(begin + in_block);
+      }
+      return block.base + this->short_vertices.at(begin + in_block);
+    }
+
+    // decodes the points of the triangle whose vertices start at `index`;
+    // this is the hot path of intersection, so the block is looked up once
+    // for all three vertices (a block never splits a triangle) and the
+    // arrays are not bounds-checked
+    void triangle_points(uint32_t index, std::array<Point, 3>& out_p) const {
+      assert(index % 3 == 0 && index + 2 < this->vertex_count);
+      const VertexBlock& block = this->vertex_blocks[index / BLOCK_VERTICES];
+      size_t begin = size_t(block.offset & ~WIDE_BLOCK) * BLOCK_VERTICES
+        + index % BLOCK_VERTICES;
+      for(uint32_t i = 0; i < 3; ++i) {
+        uint32_t vertex = (block.offset & WIDE_BLOCK)
+          ? this->wide_vertices[begin + i]
+          : block.base + this->short_vertices[begin + i];
+        const uint16_t* coords = &this->points[3 * vertex];
+        out_p[i] = Point(
+            this->point_min.v.x + float(coords[0]) * this->point_scale.v.x,
+            this->point_min.v.y + float(coords[1]) * this->point_scale.v.y,
+            this->point_min.v.z + float(coords[2]) * this->point_scale.v.z);
+      }
+    }
+
+    bool has_uvs() const { return !this->uvs.empty(); }
+    bool has_normals() const { return !this->normals.empty(); }
+  };
+
+  CompressedMesh compress_mesh(const Mesh& mesh);
+  // compresses the mesh using the given quantization of points (the points
+  // must lie in the quantized range, otherwise they are clamped)
+  CompressedMesh compress_mesh(const Mesh& mesh,
+      const Point& point_min, const Vector& point_scale);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "dort/bvh.hpp"
+#include "dort/compressed_mesh.hpp"
+#include "dort/primitive.hpp"
+#include "dort/triangle.hpp"
+
+namespace dort {
+  // A BVH over the triangles of a CompressedMesh, which is owned by the
+  // primitive. The triangles are decoded on the fly when they are intersected,
+  // so this is slower than MeshBvhPrimitive but needs much less memory for
+  // large meshes. The mesh cannot be deformed.
+  class CompressedMeshBvhPrimitive final: public GeometricPrimitive {
+    struct BvhTraits {
+      using Element = uint32_t;
+      using Arg = const CompressedMesh*;
+      static constexpr bool SPATIAL_SPLITS = true;
+
+      static Box get_bounds(const CompressedMesh* mesh, uint32_t idx) {
+        return Triangle(*mesh, idx).bounds();
+      }
+
+      static Box get_clipped_bounds(const CompressedMesh* mesh, uint32_t idx,
+          const Box& clip)
+      {
+        return Triangle(*mesh, idx).clipped_bounds(clip);
+      }
+    };
+
+    CompressedMesh mesh;
+    std::shared_ptr<Material> material;
+    Bvh<BvhTraits> bvh;
+  public:
+    // The mesh is compressed, the BVH is built and then the mesh is reordered
+    // to follow the leaves of the BVH and compressed again.
+    CompressedMeshBvhPrimitive(Mesh float_mesh,
+        std::shared_ptr<Material> material,
+        const BvhOpts& opts, ThreadPool& pool);
+
+    virtual bool intersect(Ray& ray, Intersection& out_isect) const override final;
+    virtual bool intersect_p(const Ray& ray) const override final;
+    virtual uint32_t intersect_packet(Ray* rays, Intersection* out_isects,
+        uint32_t ray_mask) const override final;
+    virtual Box bounds() const override final;
+    virtual Box transformed_bounds(const Transform& transform) const override final;
+    virtual const Material* get_material(
+        const Intersection& isect) const override final;
+    virtual const Light* get_area_light(
+        const DiffGeom& frame_diff_geom) const override final;
+  private:
+    static std::vector<uint32_t> triangle_indices(const Mesh& mesh);
+  };
+}
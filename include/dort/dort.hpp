@@ -14,7 +14,9 @@ namespace dort {
   class GeometricPrimitive;
   class Grid;
   class Light;
+  class LodFramePrimitive;
   class Material;
+  class MeshBvhPrimitive;
   class Primitive;
   class Progress;
   class Renderer;
@@ -30,6 +32,7 @@ namespace dort {
   struct Box;
   struct Boxi;
   struct Bxdf;
+  struct CompressedMesh;
   struct CtxG;
   struct DiffGeom;
   struct Film;
@@ -15,6 +15,6 @@ namespace dort {
     { }
     virtual void render(CtxG& ctx, Progress& progress) override final;
   protected:
-    Spectrum get_color(Ray& ray) const;
+    Spectrum get_color(const Ray& ray, const Intersection& isect) const;
   };
 }
@@ -1,18 +1,32 @@
 #pragma once
 #include "dort/light.hpp"
 #include "dort/piecewise_distrib_2d.hpp"
+#include "dort/thread_pool.hpp"
 
 namespace dort {
+  // The image and the distribution for sampling the directions are built in
+  // the thread pool; resolve() must be called before the light is used.
   class EnvironmentLight final: public Light {
+    struct Distrib {
+      std::shared_ptr<Image<PixelRgbFloat>> image;
+      PiecewiseDistrib2d distrib;
+      Spectrum average_radiance;
+    };
+
     std::shared_ptr<Image<PixelRgbFloat>> image;
     PiecewiseDistrib2d distrib;
     Vector up, s, t;
     Spectrum average_radiance;
     Spectrum scale;
+    Future<Distrib> pending;
   public:
-    EnvironmentLight(std::shared_ptr<Image<PixelRgbFloat>> image,
+    EnvironmentLight(Future<std::shared_ptr<Image<PixelRgbFloat>>> image,
         const Spectrum& scale, const Vector& up, const Vector& fwd);
 
+    // Waits until the distribution is built; rethrows the exception if the
+    // image could not be read.
+    void resolve();
+
     virtual Spectrum sample_ray_radiance(const Scene& scene, 
         Ray& out_ray, Normal& out_nn, float& out_pos_pdf, float& out_dir_pdf,
         LightRaySample sample) const override final;
@@ -39,5 +53,7 @@ namespace dort {
     Vector dir_uv_to_dir(Vec2 dir_uv, float& out_sin_theta) const;
     Vec2 dir_to_dir_uv(const Vector& dir, float& out_sin_theta) const;
     Spectrum get_radiance(Vec2 dir_uv) const;
+    static Distrib build_distrib(
+        std::shared_ptr<Image<PixelRgbFloat>> image, const Spectrum& scale);
   };
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include <vector>
 #include "dort/atomic_spectrum.hpp"
 #include "dort/image.hpp"
@@ -12,21 +13,47 @@ namespace dort {
     struct Pixel {
       Spectrum color;
       float weight;
-      AtomicSpectrum splat;
+    };
+
+    // The splats are accumulated in separate planes for groups of threads,
+    // so that threads that splat to the same pixels do not fight for the same
+    // cache lines. A film has a single shared plane unless
+    // init_splat_planes() is called. A plane is allocated (and first touched)
+    // by the first thread that splats to it, so films that are never
+    // splatted to do not pay for the splats at all. The array of planes is
+    // allocated with the largest count in the constructor and is never
+    // reallocated, so the film can be read (e.g. for a preview) while the
+    // count grows.
+    struct SplatPlane {
+      std::vector<AtomicSpectrum> splats;
     };
 
     Vec2i res;
     std::vector<Pixel> pixels;
+    std::unique_ptr<std::atomic<SplatPlane*>[]> splat_planes;
+    uint32_t splat_plane_capacity;
+    std::atomic<uint32_t> splat_plane_count;
     SampledFilter filter;
     float splat_scale;
 
     Film(uint32_t x_res, uint32_t y_res, std::shared_ptr<Filter> filter);
     Film(uint32_t x_res, uint32_t y_res, SampledFilter filter);
+    ~Film();
+    // uses a plane for every thread of the pool that can run at the same
+    // time as the others (up to the capacity); must not be called while
+    // splats are added
+    void init_splat_planes(ThreadPool& pool);
     void add_sample(Vec2 pos, const Spectrum& radiance);
     void add_splat(Vec2 pos, const Spectrum& radiance);
     void add_tile(Vec2i pos, const Film& tile);
+    // adds only the rows y_begin <= y < y_end (in the coordinates of this film)
+    void add_tile_rows(Vec2i pos, const Film& tile, int32_t y_begin, int32_t y_end);
     template<class Pix>
     Image<Pix> to_image() const;
+    template<class Pix>
+    Image<Pix> to_image(ThreadPool& pool) const;
+    template<class Pix>
+    void to_image_row(Image<Pix>& img, int32_t y) const;
 
     uint32_t pixel_idx(int32_t x, int32_t y) const {
       assert(x >= 0 && x < int32_t(this->res.x));
@@ -35,5 +62,7 @@ namespace dort {
     }
 
     Recti get_pixel_rect(Vec2 pos) const;
+  private:
+    SplatPlane& get_splat_plane();
   };
 }
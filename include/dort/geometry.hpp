@@ -185,4 +185,8 @@ namespace dort {
     }
   };
 
+  // Maximal number of rays that are traced together by
+  // Primitive::intersect_packet(); one ray per SSE lane.
+  constexpr uint32_t RAY_PACKET_SIZE = 4;
+
 }
@@ -0,0 +1,67 @@
+#pragma once
+#include <vector>
+#include "dort/primitive.hpp"
+#include "dort/triangle.hpp"
+
+namespace dort {
+  // A terrain given by a grid of heights. The samples of the grid cover the
+  // unit square in the XY plane of the local space and the heights are the Z
+  // coordinates; every cell between four samples is split into two triangles
+  // with normals interpolated from the neighboring samples.
+  //
+  // The rays are traced with a 2D-DDA over a pyramid of the minimal and
+  // maximal heights in square blocks of cells, which skips the blocks that
+  // the ray passes above or below, so the triangles are never stored.
+  class HeightfieldPrimitive final: public GeometricPrimitive {
+    struct MinMax {
+      float min;
+      float max;
+    };
+
+    // the blocks of 2^level x 2^level cells
+    struct Level {
+      uint32_t x_res;
+      uint32_t y_res;
+      std::vector<MinMax> blocks;
+    };
+
+    uint32_t x_res;
+    uint32_t y_res;
+    std::vector<float> heights;
+    // levels[i] has level i + 1, because the cells of level 0 are computed
+    // from the heights on the fly; the last level has a single block
+    std::vector<Level> levels;
+    // maps the grid space, where the samples have integer X and Y
+    // coordinates, to the frame
+    Transform grid_to_frame;
+    std::shared_ptr<Material> material;
+  public:
+    HeightfieldPrimitive(uint32_t x_res, uint32_t y_res,
+        std::vector<float> heights, const Transform& local_to_frame,
+        std::shared_ptr<Material> material);
+
+    virtual bool intersect(Ray& ray, Intersection& out_isect) const override final;
+    virtual bool intersect_p(const Ray& ray) const override final;
+    virtual Box bounds() const override final;
+    virtual const Material* get_material(
+        const Intersection& isect) const override final;
+    virtual const Light* get_area_light(
+        const DiffGeom& frame_diff_geom) const override final;
+  private:
+    float height(uint32_t x, uint32_t y) const {
+      return this->heights[size_t(y) * this->x_res + x];
+    }
+    MinMax cell_min_max(uint32_t x, uint32_t y) const;
+    MinMax block_min_max(uint32_t level, uint32_t x, uint32_t y) const;
+    Box block_bounds(uint32_t level, uint32_t x, uint32_t y) const;
+    Triangle cell_triangle(uint32_t x, uint32_t y, uint32_t tri) const;
+    TriangleUv cell_triangle_uv(uint32_t x, uint32_t y, uint32_t tri) const;
+    Normal vertex_normal(uint32_t x, uint32_t y) const;
+
+    // Calls callback(x, y) for the cells whose bounds are hit by the ray, in
+    // the order along the ray, until it returns false. The callback may
+    // shorten the ray.t_max.
+    template<class F>
+    bool traverse(const Ray& ray, F callback) const;
+  };
+}
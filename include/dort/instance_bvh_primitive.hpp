@@ -0,0 +1,54 @@
+#pragma once
+#include "dort/bvh.hpp"
+#include "dort/primitive.hpp"
+
+namespace dort {
+  struct PrimitiveInstance {
+    Transform in_to_out;
+    std::shared_ptr<Primitive> inside;
+  };
+
+  // A BVH over instances of other primitives. Compared to a BvhPrimitive of
+  // FramePrimitives, the transforms and bounds are stored inline in the
+  // leaves, the instances are bounded more tightly and the world DiffGeom is
+  // transformed only once for the nearest hit.
+  class InstanceBvhPrimitive final: public Primitive {
+    struct Instance {
+      Transform in_to_out;
+      Box bounds;
+      const Primitive* inside;
+      // non-null if the inside is a mesh BVH, so that it can be intersected
+      // without a virtual call
+      const MeshBvhPrimitive* inside_mesh_bvh;
+    };
+
+    struct BvhTraits {
+      using Element = Instance;
+      struct Arg {};
+      static constexpr bool SPATIAL_SPLITS = false;
+
+      static Box get_bounds(Arg, const Instance& instance) {
+        return instance.bounds;
+      }
+    };
+
+    std::vector<std::shared_ptr<Primitive>> insides;
+    Bvh<BvhTraits> bvh;
+  public:
+    InstanceBvhPrimitive(std::vector<PrimitiveInstance> instances,
+        const BvhOpts& opts, ThreadPool& pool);
+    virtual bool intersect(Ray& ray, Intersection& out_isect) const override final;
+    virtual bool intersect_p(const Ray& ray) const override final;
+    virtual uint32_t intersect_packet(Ray* rays, Intersection* out_isects,
+        uint32_t ray_mask) const override final;
+    virtual Box bounds() const override final;
+    virtual Box transformed_bounds(const Transform& transform) const override final;
+    virtual void refit(ThreadPool& pool, float rebuild_threshold,
+        RefittedSet& refitted) override final;
+  private:
+    static std::vector<Instance> make_instances(
+        const std::vector<PrimitiveInstance>& instances);
+    static std::vector<std::shared_ptr<Primitive>> collect_insides(
+        const std::vector<PrimitiveInstance>& instances);
+  };
+}
@@ -12,7 +12,12 @@ namespace dort {
     ListPrimitive(std::vector<std::unique_ptr<Primitive>> prims);
     virtual bool intersect(Ray& ray, Intersection& out_isect) const override final;
     virtual bool intersect_p(const Ray& ray) const override final;
+    virtual uint32_t intersect_packet(Ray* rays, Intersection* out_isects,
+        uint32_t ray_mask) const override final;
     virtual Box bounds() const override final;
+    virtual Box transformed_bounds(const Transform& transform) const override final;
+    virtual void refit(ThreadPool& pool, float rebuild_threshold,
+        RefittedSet& refitted) override final;
   };
 }
 
@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include "dort/bvh.hpp"
+#include "dort/instance_bvh_primitive.hpp"
+#include "dort/primitive.hpp"
+
+namespace dort {
+  struct LodLevel {
+    std::shared_ptr<Primitive> prim;
+    // the mesh of the prim, owned by the level, so that the levels that are
+    // not selected for any instance can be freed with the LodPrimitive
+    std::shared_ptr<Mesh> mesh;
+    // estimate of the distance of the surface from the finest level
+    float error;
+  };
+
+  // Levels of detail of a primitive, from the finest to the coarsest. The
+  // builder replaces each instance of a LodPrimitive with a single level
+  // selected by its distance from the camera, so that all rays (and thus all
+  // paths) see the same geometry; when the primitive is intersected directly,
+  // the finest level is used.
+  class LodPrimitive final: public Primitive {
+    std::vector<LodLevel> levels;
+  public:
+    explicit LodPrimitive(std::vector<LodLevel> levels);
+
+    // Returns the coarsest level with error at most max_error.
+    const LodLevel& select_level(float max_error) const;
+    uint32_t level_count() const { return this->levels.size(); }
+
+    virtual bool intersect(Ray& ray, Intersection& out_isect) const override final;
+    virtual bool intersect_p(const Ray& ray) const override final;
+    virtual uint32_t intersect_packet(Ray* rays, Intersection* out_isects,
+        uint32_t ray_mask) const override final;
+    virtual Box bounds() const override final;
+    virtual Box transformed_bounds(const Transform& transform) const override final;
+    virtual void refit(ThreadPool& pool, float rebuild_threshold,
+        RefittedSet& refitted) override final;
+  };
+
+  // A frame that contains instances of LodPrimitives (possibly in nested
+  // frames). The builder keeps the instances, so that each instance of the
+  // frame can be replaced with an aggregate of the levels selected for it;
+  // when the frame is intersected directly, the finest levels are used.
+  class LodFramePrimitive final: public Primitive {
+    std::unique_ptr<Primitive> finest;
+    std::vector<PrimitiveInstance> instances;
+    // the aggregate of the other primitives in the frame (may be null)
+    std::shared_ptr<Primitive> prims;
+    BvhOpts bvh_opts;
+  public:
+    LodFramePrimitive(std::unique_ptr<Primitive> finest,
+        std::vector<PrimitiveInstance> instances,
+        std::shared_ptr<Primitive> prims, const BvhOpts& bvh_opts);
+
+    const std::vector<PrimitiveInstance>& get_instances() const {
+      return this->instances;
+    }
+    const std::shared_ptr<Primitive>& get_prims() const { return this->prims; }
+    const BvhOpts& get_bvh_opts() const { return this->bvh_opts; }
+
+    virtual bool intersect(Ray& ray, Intersection& out_isect) const override final;
+    virtual bool intersect_p(const Ray& ray) const override final;
+    virtual uint32_t intersect_packet(Ray* rays, Intersection* out_isects,
+        uint32_t ray_mask) const override final;
+    virtual Box bounds() const override final;
+    virtual Box transformed_bounds(const Transform& transform) const override final;
+    virtual void refit(ThreadPool& pool, float rebuild_threshold,
+        RefittedSet& refitted) override final;
+  };
+}
@@ -1,9 +1,13 @@
 #pragma once
+#include <map>
 #include <unordered_set>
 #include <vector>
 #include "dort/bvh_primitive.hpp"
+#include "dort/instance_bvh_primitive.hpp"
 #include "dort/lua.hpp"
+#include "dort/thread_pool.hpp"
 #include "dort/transform.hpp"
+#include "dort/vec_2.hpp"
 
 namespace dort {
   constexpr const char SCENE_TNAME[] = "dort.Scene";
@@ -13,12 +17,20 @@ namespace dort {
 
   struct BuilderFrame {
     std::vector<std::unique_ptr<Primitive>> prims;
+    std::vector<PrimitiveInstance> instances;
+    // primitives that are being built in the thread pool; the prims contain a
+    // nullptr at the index of each pending primitive, to keep the order of
+    // primitives deterministic
+    std::vector<std::pair<uint32_t, Future<std::unique_ptr<Primitive>>>> pending_prims;
   };
 
   struct BuilderState {
     Transform local_to_frame;
     std::shared_ptr<Material> material;
     BvhOpts bvh_opts;
+    float lod_pixel_error = 0.f;
+    Vec2 lod_film_res = Vec2(800.f, 600.f);
+    bool compress_meshes = false;
   };
 
   struct Builder {
@@ -32,6 +44,17 @@ namespace dort {
     std::shared_ptr<Camera> camera;
   };
 
+  // the view from which the levels of detail are selected when the scene is
+  // built
+  struct LodSelection {
+    const Camera* camera;
+    Vec2 film_res;
+    float max_pixel_error;
+    // the aggregates already built for the instances of LodFramePrimitives,
+    // keyed by the frame and the primitives selected for its instances
+    std::map<std::vector<const Primitive*>, std::shared_ptr<Primitive>> frames;
+  };
+
   int lua_open_builder(lua_State* l);
 
   int lua_builder_make(lua_State* l);
@@ -54,15 +77,30 @@ namespace dort {
   int lua_builder_add_read_ply_mesh_as_bvh(lua_State* l);
   int lua_builder_add_ply_mesh(lua_State* l);
   int lua_builder_add_ply_mesh_as_bvh(lua_State* l);
+  int lua_builder_add_mesh_as_bvh(lua_State* l);
   int lua_builder_add_voxel_grid(lua_State* l);
+  int lua_builder_add_spheres(lua_State* l);
+  int lua_builder_add_heightfield(lua_State* l);
   int lua_builder_make_triangle(lua_State* l);
+  int lua_builder_make_mesh_lod(lua_State* l);
 
   int lua_builder_get_scene_default_camera(lua_State* l);
+  int lua_builder_refit_scene(lua_State* l);
   int lua_scene_eq(lua_State* l);
   int lua_primitive_eq(lua_State* l);
 
+  void lua_resolve_pending_prims(lua_State* l, BuilderFrame& frame);
+  void lua_resolve_pending_lights(lua_State* l, Builder& builder);
   std::unique_ptr<Primitive> lua_make_aggregate(CtxG& ctx,
       const BuilderState& state, BuilderFrame frame);
+  std::shared_ptr<Primitive> lua_make_frame_primitive(CtxG& ctx,
+      const BuilderState& state, BuilderFrame frame);
+  void lua_select_lod_levels(CtxG& ctx, Builder& builder,
+      LodSelection& selection, std::vector<PrimitiveInstance>& instances,
+      const Transform& frame_to_world);
+  std::shared_ptr<Primitive> lua_select_lod_frame(CtxG& ctx, Builder& builder,
+      LodSelection& selection, const LodFramePrimitive& lod_frame,
+      const Transform& frame_to_world);
 
   std::shared_ptr<Builder> lua_check_builder(lua_State* l, int idx);
   bool lua_test_builder(lua_State* l, int idx);
@@ -1,4 +1,5 @@
 #pragma once
+#include <vector>
 #include "dort/box_i.hpp"
 #include "dort/geometry.hpp"
 #include "dort/lua.hpp"
@@ -24,6 +25,13 @@ namespace dort {
       int params_idx, const char* param_name);
   std::shared_ptr<Material> lua_param_material(lua_State* l,
       int params_idx, const char* param_name);
+  // the arrays are either tables of numbers or strings with packed native
+  // values (as produced by string.pack("f", ...) or string.pack("I4", ...)),
+  // which are much more compact for large arrays
+  std::vector<float> lua_param_float_array(lua_State* l,
+      int params_idx, const char* param_name);
+  std::vector<uint32_t> lua_param_uint32_array(lua_State* l,
+      int params_idx, const char* param_name);
 
   float lua_param_float_opt(lua_State* l, int params_idx,
       const char* param_name, float def);
@@ -16,6 +16,7 @@ namespace dort {
   int lua_shape_make_cube(lua_State* l);
   int lua_shape_make_polygon(lua_State* l);
   int lua_shape_make_mesh(lua_State* l);
+  int lua_shape_set_mesh_points(lua_State* l);
 
   int lua_ply_mesh_read(lua_State* l);
 
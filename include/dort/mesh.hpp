@@ -14,4 +14,12 @@ namespace dort {
     Mesh mesh;
     std::shared_ptr<Material> material;
   };
+
+  // Reorders the triangles of the mesh to follow the order of their first
+  // occurence in `indices` (the indices of the first vertices of triangles,
+  // typically in the order of the leaves of a BVH) and the points to follow
+  // the order of their first use by the triangles, so that the triangles
+  // and points are fetched mostly sequentially. The `indices` are updated to
+  // refer to the reordered triangles.
+  void reorder_mesh_triangles(Mesh& mesh, std::vector<uint32_t>& indices);
 }
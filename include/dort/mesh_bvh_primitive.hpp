@@ -9,25 +9,61 @@ namespace dort {
     struct BvhTraits {
       using Element = uint32_t;
       using Arg = const Mesh*;
+      static constexpr bool SPATIAL_SPLITS = true;
 
       static Box get_bounds(const Mesh* mesh, uint32_t idx) {
         return Triangle(*mesh, idx).bounds();
       }
+
+      static Box get_clipped_bounds(const Mesh* mesh, uint32_t idx,
+          const Box& clip)
+      {
+        return Triangle(*mesh, idx).clipped_bounds(clip);
+      }
+    };
+
+    // vertex 0 and the two edges of four consecutive elements of the BVH in
+    // SoA layout, indexed [axis][lane]
+    struct alignas(16) TriangleBlock {
+      float p0[3][4];
+      float e1[3][4];
+      float e2[3][4];
+      uint32_t index[4];
     };
 
     const Mesh* mesh;
     std::shared_ptr<Material> material;
     Bvh<BvhTraits> bvh;
+    // block i contains the elements 4*i to 4*i + 3; empty unless
+    // BvhOpts::triangle_blocks is set
+    std::vector<TriangleBlock> triangle_blocks;
+    bool use_triangle_blocks;
   public:
     MeshBvhPrimitive(const Mesh* mesh, std::shared_ptr<Material> material,
         std::vector<uint32_t> indices, const BvhOpts& opts, ThreadPool& pool);
 
+    // Reorders the triangles and points of the mesh to follow the order of
+    // the leaves of the BVH, so that the triangles are fetched mostly
+    // sequentially during traversal. The mesh must be the one passed to the
+    // constructor and must not be used by any other primitive.
+    void reorder_mesh(Mesh& mesh);
+
     virtual bool intersect(Ray& ray, Intersection& out_isect) const override final;
     virtual bool intersect_p(const Ray& ray) const override final;
+    virtual uint32_t intersect_packet(Ray* rays, Intersection* out_isects,
+        uint32_t ray_mask) const override final;
     virtual Box bounds() const override final;
+    virtual Box transformed_bounds(const Transform& transform) const override final;
+    virtual void refit(ThreadPool& pool, float rebuild_threshold,
+        RefittedSet& refitted) override final;
     virtual const Material* get_material(
         const Intersection& isect) const override final;
     virtual const Light* get_area_light(
         const DiffGeom& frame_diff_geom) const override final;
+  private:
+    void update_triangle_blocks();
+    template<class F>
+    void hit_triangle_blocks(const Ray& ray, uint32_t elem_offset,
+        uint32_t elem_count, F callback) const;
   };
 }
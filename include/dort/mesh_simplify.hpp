@@ -0,0 +1,13 @@
+#pragma once
+#include "dort/mesh.hpp"
+
+namespace dort {
+  // Simplifies the mesh by edge collapses ordered by the quadric error metric
+  // (Garland and Heckbert), until at most target_triangles triangles remain or
+  // no more edges can be collapsed without flipping a triangle. Vertices at
+  // the same position are merged, so seams in uvs or normals do not open; the
+  // uvs and normals of the vertices are kept. out_error is set to an estimate
+  // of the largest distance of the simplified surface from the original one.
+  Mesh simplify_mesh(const Mesh& mesh, uint32_t target_triangles,
+      float& out_error);
+}
@@ -28,6 +28,8 @@ namespace dort {
         const Point& origin_gen, const Vector& wi_gen) const override final;
     virtual float pivot_importance_pdf(Vec2 film_res,
         const Point& p_gen, const Point& pivot_fix) const override final;
+    virtual float pixel_footprint(Vec2 film_res,
+        float distance) const override final;
   private:
     bool get_film_pos(Vec2 film_res, const Vec3& pivot,
         Vec2& out_film_pos) const;
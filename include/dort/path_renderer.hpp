@@ -44,7 +44,10 @@ namespace dort {
       Vector wo_camera;
     };
 
-    Spectrum sample(Vec2 film_pos, Sampler& sampler) const;
+    // Samples the radiance along a path that starts with the camera ray
+    // `next_ray`, which has already been intersected with the scene.
+    Spectrum sample_path(Ray next_ray, bool isected,
+        Intersection isect, Sampler& sampler) const;
     Spectrum sample_direct_lighting(const LightingGeom& geom,
         const Bsdf& bsdf, Sampler& sampler) const;
 
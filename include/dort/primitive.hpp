@@ -1,4 +1,5 @@
 #pragma once
+#include <unordered_set>
 #include "dort/box.hpp"
 #include "dort/shape.hpp"
 #include "dort/spectrum.hpp"
@@ -23,15 +24,39 @@ namespace dort {
     Spectrum eval_radiance(const Point& pivot) const;
   };
 
+  // The primitives that were already refitted during a refit of the scene.
+  using RefittedSet = std::unordered_set<const Primitive*>;
+
   class Primitive {
   public:
     Primitive() { };
     virtual ~Primitive() { };
     virtual bool intersect(Ray& ray, Intersection& out_isect) const = 0;
     virtual bool intersect_p(const Ray& ray) const = 0;
+    // Intersects the rays selected by the bits of `ray_mask` (out of
+    // RAY_PACKET_SIZE rays) as if by intersect() and returns the mask of the
+    // rays that hit the primitive. Coherent rays can be traced faster than one
+    // by one.
+    virtual uint32_t intersect_packet(Ray* rays, Intersection* out_isects,
+        uint32_t ray_mask) const;
     virtual Box bounds() const = 0;
+    // Bounds of the primitive after the `transform` is applied, which may be
+    // tighter than the transformed bounds().
+    virtual Box transformed_bounds(const Transform& transform) const {
+      return transform.apply(this->bounds());
+    }
+
+    // Updates the acceleration structures after the underlying geometry (such
+    // as the points of a mesh) has changed. The primitives that may be shared
+    // by other primitives are refitted using refit_shared().
+    virtual void refit(ThreadPool&, float, RefittedSet&) { }
   };
 
+  // Refits a primitive that may be referenced from multiple places in the
+  // scene, unless it is already in `refitted`.
+  void refit_shared(Primitive& prim, ThreadPool& pool, float rebuild_threshold,
+      RefittedSet& refitted);
+
   class GeometricPrimitive: public Primitive {
   public:
     virtual const Material* get_material(
@@ -61,6 +86,34 @@ namespace dort {
         const Intersection& isect) const override final;
     virtual const Light* get_area_light(
         const DiffGeom& frame_diff_geom) const override final;
+
+    const Shape& get_shape() const { return *this->shape; }
+
+    // Variants of intersect() and intersect_p() that call the shape as `S`,
+    // which must be the dynamic type of the shape (or a base of it). When `S`
+    // is a final class, the calls to the shape are not virtual.
+    template<class S>
+    bool intersect_shape(Ray& ray, Intersection& out_isect) const {
+      const S& shape = static_cast<const S&>(*this->shape);
+      Ray new_ray(this->shape_to_frame.apply_inv(ray));
+      float t_hit;
+      if(!shape.hit(new_ray, t_hit, out_isect.ray_epsilon,
+          out_isect.frame_diff_geom)) {
+        return false;
+      }
+      out_isect.world_diff_geom = out_isect.frame_diff_geom =
+        this->shape_to_frame.apply(out_isect.frame_diff_geom);
+      out_isect.primitive = this;
+      ray.t_max = t_hit;
+      return true;
+    }
+
+    template<class S>
+    bool intersect_shape_p(const Ray& ray) const {
+      const S& shape = static_cast<const S&>(*this->shape);
+      Ray new_ray(this->shape_to_frame.apply_inv(ray));
+      return shape.hit_p(new_ray);
+    }
   };
 
   class FramePrimitive final: public Primitive {
@@ -73,6 +126,11 @@ namespace dort {
 
     virtual bool intersect(Ray& ray, Intersection& out_isect) const override final;
     virtual bool intersect_p(const Ray& ray) const override final;
+    virtual uint32_t intersect_packet(Ray* rays, Intersection* out_isects,
+        uint32_t ray_mask) const override final;
     virtual Box bounds() const override final;
+    virtual Box transformed_bounds(const Transform& transform) const override final;
+    virtual void refit(ThreadPool& pool, float rebuild_threshold,
+        RefittedSet& refitted) override final;
   };
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <mutex>
+#include <vector>
 #include "dort/dort.hpp"
 
 namespace dort {
@@ -11,25 +12,36 @@ namespace dort {
 
   class Renderer {
   protected:
+    // the tiles are added to the film in bands of rows that are locked
+    // separately, so that tiles in different bands do not wait for each other
+    static constexpr int32_t FILM_BAND_ROWS = 16;
+
     std::shared_ptr<Scene> scene;
     std::shared_ptr<Film> film;
     std::shared_ptr<Sampler> sampler;
     std::shared_ptr<Camera> camera;
     std::mutex film_mutex;
+    std::vector<std::mutex> film_band_mutexes;
     std::mutex sampler_mutex;
   public:
     Renderer(std::shared_ptr<Scene> scene,
         std::shared_ptr<Film> film,
         std::shared_ptr<Sampler> sampler,
-        std::shared_ptr<Camera> camera):
-      scene(scene), film(film), sampler(sampler), camera(camera) { }
+        std::shared_ptr<Camera> camera);
     virtual ~Renderer() {}
     virtual void render(CtxG& ctx, Progress& progress) = 0;
   protected:
     static Vec2i layout_tiles(const CtxG& ctx, Vec2i film_res);
     void iteration_tiled(CtxG& ctx,
         std::function<Spectrum(Vec2i, Vec2&, Sampler&)> render_pixel);
+    // Like iteration_tiled(), but the pixels are rendered in packets of up to
+    // RAY_PACKET_SIZE neighboring pixels (2x2 quads), so that the camera rays
+    // can be traced together with Scene::intersect_packet().
+    void iteration_tiled_packet(CtxG& ctx,
+        std::function<void(const Vec2i*, uint32_t, Vec2*, Spectrum*, Sampler&)>
+          render_packet);
     void iteration_tiled_per_job(CtxG& ctx,
         std::function<void(Film&, Recti, Recti, Sampler&)> render_tile);
+    void add_tile_to_film(Vec2i pos, const Film& tile_film);
   };
 }
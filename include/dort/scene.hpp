@@ -19,6 +19,8 @@ namespace dort {
 
     bool intersect(Ray& ray, Intersection& out_isect) const;
     bool intersect_p(const Ray& ray) const;
+    uint32_t intersect_packet(Ray* rays, Intersection* out_isects,
+        uint32_t ray_mask) const;
   };
 
   DiscreteDistrib1d compute_light_distrib(const Scene& scene,
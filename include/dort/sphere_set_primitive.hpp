@@ -0,0 +1,63 @@
+#pragma once
+#include "dort/bvh.hpp"
+#include "dort/primitive.hpp"
+
+namespace dort {
+  // Spheres in SoA layout: the i-th sphere has center (center_x[i],
+  // center_y[i], center_z[i]), radius radii[i] and material
+  // materials[material_idxs[i]] (material_idxs may be empty if there is only
+  // one material).
+  struct SphereSet {
+    std::vector<float> center_x;
+    std::vector<float> center_y;
+    std::vector<float> center_z;
+    std::vector<float> radii;
+    std::vector<uint32_t> material_idxs;
+    std::vector<std::shared_ptr<Material>> materials;
+
+    uint32_t size() const { return this->radii.size(); }
+    Point center(uint32_t idx) const {
+      return Point(this->center_x[idx], this->center_y[idx], this->center_z[idx]);
+    }
+  };
+
+  // A set of spheres with its own BVH. Every sphere takes only a few words of
+  // memory (compared with a ShapePrimitive with a SphereShape, which holds
+  // pointers and a full Transform), so it is suitable for particles and other
+  // scenes with millions of spheres.
+  class SphereSetPrimitive final: public GeometricPrimitive {
+    struct BvhTraits {
+      using Element = uint32_t;
+      using Arg = const SphereSet*;
+      static constexpr bool SPATIAL_SPLITS = false;
+
+      static Box get_bounds(const SphereSet* spheres, uint32_t idx) {
+        float r = spheres->radii[idx];
+        Vector radius(r, r, r);
+        Point center = spheres->center(idx);
+        return Box(center - radius, center + radius);
+      }
+    };
+
+    SphereSet spheres;
+    Bvh<BvhTraits> bvh;
+  public:
+    SphereSetPrimitive(SphereSet spheres, const BvhOpts& opts, ThreadPool& pool);
+
+    virtual bool intersect(Ray& ray, Intersection& out_isect) const override final;
+    virtual bool intersect_p(const Ray& ray) const override final;
+    virtual uint32_t intersect_packet(Ray* rays, Intersection* out_isects,
+        uint32_t ray_mask) const override final;
+    virtual Box bounds() const override final;
+    virtual Box transformed_bounds(const Transform& transform) const override final;
+    virtual const Material* get_material(
+        const Intersection& isect) const override final;
+    virtual const Light* get_area_light(
+        const DiffGeom& frame_diff_geom) const override final;
+  private:
+    static std::vector<uint32_t> make_indices(uint32_t count);
+    void reorder_spheres();
+    bool hit_sphere(uint32_t idx, const Ray& ray, float& out_t_hit) const;
+    void get_diff_geom(uint32_t idx, const Ray& ray, Intersection& out_isect) const;
+  };
+}
@@ -20,7 +20,9 @@ namespace dort {
     virtual float point_pdf(const Point& pt) const override final;
     virtual float point_pivot_pdf(const Point& pivot,
         const Vector& w) const override final;
-  private:
+
+    // Finds the nearest hit of the ray within its [t_min, t_max] range, like
+    // hit_p(), but also returns the ray parameter.
     bool solve_hit_t(const Ray& ray, float& out_t_hit) const;
   };
 }
@@ -6,8 +6,12 @@ namespace dort {
   enum StatCounter: uint32_t {
     COUNTER_SCENE_INTERSECT,
     COUNTER_SCENE_INTERSECT_P,
+    COUNTER_SCENE_INTERSECT_PACKET,
     COUNTER_BVH_FAST_BOX_INTERSECT_P,
     COUNTER_BVH_FAST_BOX_INTERSECT_P_HIT,
+    COUNTER_BVH_WIDE_NODE_ISECT,
+    COUNTER_BVH_PACKET_NODE_ISECT,
+    COUNTER_BVH_PACKET_FALLBACK,
     COUNTER_BVH_PRIM_INTERSECT,
     COUNTER_BVH_PRIM_INTERSECT_HIT,
     COUNTER_BVH_PRIM_INTERSECT_P,
@@ -16,6 +20,8 @@ namespace dort {
     COUNTER_TRIANGLE_HIT_HIT,
     COUNTER_TRIANGLE_HIT_P,
     COUNTER_TRIANGLE_HIT_P_HIT,
+    COUNTER_TRIANGLE_BLOCK_HIT,
+    COUNTER_TRIANGLE_BLOCK_HIT_HIT,
     COUNTER_POOL_JOBS,
     COUNTER_POOL_NO_WAITS,
     COUNTER_POOL_WAITS,
@@ -28,11 +34,15 @@ namespace dort {
 
   enum StatDistribInt: uint32_t {
     DISTRIB_INT_BVH_TRAVERSE_COUNT,
+    DISTRIB_INT_BVH_WIDE_CHILD_HITS,
     DISTRIB_INT_BVH_BUILD_NODE_PARALLEL_COUNT,
     DISTRIB_INT_BVH_BUILD_NODE_SERIAL_COUNT,
     DISTRIB_INT_BVH_BUILD_SERIAL_COUNT,
-    DISTRIB_INT_BVH_BUILD_LINEAR_RESIZE,
     DISTRIB_INT_BVH_SPLIT_MIDDLE_JOBS,
+    DISTRIB_INT_BVH_SPLIT_SPATIAL_DUPLICATES,
+    DISTRIB_INT_BVH_NODE_BYTES,
+    DISTRIB_INT_BVH_NODE_COUNT,
+    DISTRIB_INT_BVH_REFIT_REBUILD_ELEMS,
     DISTRIB_INT_BSDF_NUM_BXDFS,
     DISTRIB_INT_RENDER_JOBS,
     _DISTRIB_INT_END,
@@ -49,6 +59,7 @@ namespace dort {
     TIMER_RENDERER_ADD_TILE,
     TIMER_SCENE_INTERSECT,
     TIMER_SCENE_INTERSECT_P,
+    TIMER_SCENE_INTERSECT_PACKET,
     TIMER_FILM_ADD_SAMPLE,
     TIMER_FILM_ADD_SPLAT,
     TIMER_FILM_ADD_TILE,
@@ -60,8 +71,6 @@ namespace dort {
     TIMER_BVH_BUILD_NODE_SERIAL,
     TIMER_BVH_BUILD_PARTITION_PARALLEL,
     TIMER_BVH_BUILD_PARTITION_SERIAL,
-    TIMER_BVH_WRITE_LINEAR_NODE,
-    TIMER_BVH_WRITE_LINEAR_NODE_RESIZE,
     TIMER_BVH_SPLIT_MIDDLE,
     TIMER_BVH_SPLIT_MIDDLE_BOUNDS_OUT_PARALLEL,
     TIMER_BVH_SPLIT_MIDDLE_BOUNDS_OUT_SERIAL,
@@ -69,8 +78,22 @@ namespace dort {
     TIMER_BVH_SPLIT_MIDDLE_BOUNDS_IN_SERIAL,
     TIMER_BVH_SPLIT_MEDIAN,
     TIMER_BVH_SPLIT_SAH,
+    TIMER_BVH_SPLIT_SPATIAL,
+    TIMER_BVH_LBVH_MORTON,
+    TIMER_BVH_LBVH_SORT,
+    TIMER_BVH_LBVH_EMIT,
+    TIMER_BVH_COLLAPSE_WIDE,
+    TIMER_BVH_QUANTIZE_WIDE,
+    TIMER_BVH_LAYOUT_NODES,
+    TIMER_BVH_REFIT,
+    TIMER_BVH_REFIT_REBUILD,
     TIMER_BVH_TRAVERSE_NODE,
     TIMER_BVH_TRAVERSE_ELEM,
+    TIMER_WAVEFRONT_SORT,
+    TIMER_WAVEFRONT_EXTEND,
+    TIMER_WAVEFRONT_SHADE,
+    TIMER_WAVEFRONT_DIRECT,
+    TIMER_MESH_REORDER,
     TIMER_POOL_WAIT,
     TIMER_POOL_WORK,
     TIMER_POOL_JOB,
@@ -1,45 +1,132 @@
 #pragma once
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
-#include <list>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
 #include "dort/dort.hpp"
+#include "dort/topology.hpp"
 
 namespace dort {
+  // A pool of worker threads that execute parallel loops. Every thread has a
+  // deque of tasks (ranges of loop iterations); a thread splits its range in
+  // halves, pushes the upper half to the bottom of its deque and continues
+  // with the lower half, while idle threads steal the largest ranges from the
+  // top of the deques of other threads (Chase-Lev work stealing). The thread
+  // that calls loop() participates in the work, so loops can be nested.
+  // Ranges that are not longer than the grain size of the loop are not split
+  // and are passed to the loop function in a single call. The workers may be
+  // pinned to CPUs; the first CPU of the affinity is left for the calling
+  // thread, which is not pinned.
+  //
+  // Threads outside of the pool that call loop() or wait_until() get one of
+  // the caller deques, so that several of them can work in the pool at the
+  // same time (e.g. a render thread and the Lua thread); when all caller
+  // deques are taken, the next caller waits for one of them.
+  //
+  // Independent tasks are spawned as detached loops with a single iteration,
+  // which are deleted by the thread that runs them. Threads outside of the
+  // pool cannot push to a deque, so their tasks go to a shared queue.
   class ThreadPool {
+    static constexpr uint32_t CALLER_SLOTS = 8;
+
     struct Loop {
-      std::function<void(uint32_t)> fun;
+      const std::function<void(uint32_t, uint32_t)>* fun;
       uint32_t count;
-      std::atomic<uint32_t> started_count { 0 };
+      uint32_t grain;
       std::atomic<uint32_t> finished_count { 0 };
-      bool removed_flag = false;
-      bool finished_flag = false;
-      std::condition_variable finished_condvar;
+      std::function<void(uint32_t, uint32_t)> owned_fun;
+      bool detached = false;
+    };
+
+    struct Task {
+      Loop* loop;
+      uint32_t begin;
+      uint32_t end;
+    };
+
+    // The deque may be pushed and popped only by its owner thread, other
+    // threads may steal from it. The capacity is fixed, when the deque is full,
+    // the owner simply stops splitting its range.
+    class Deque {
+      static constexpr int64_t CAPACITY = 256;
+      struct Slot {
+        std::atomic<Loop*> loop;
+        std::atomic<uint64_t> range;
+      };
+
+      std::atomic<int64_t> top;
+      char top_padding[64];
+      std::atomic<int64_t> bottom;
+      char bottom_padding[64];
+      Slot slots[CAPACITY];
+
+      void write_slot(int64_t idx, const Task& task);
+      Task read_slot(int64_t idx) const;
+    public:
+      Deque();
+      bool push(const Task& task);
+      bool pop(Task& out_task);
+      bool steal(Task& out_task);
+      bool is_empty() const;
     };
 
     std::mutex mutex;
     bool stop_flag;
+    ThreadAffinity affinity;
     std::vector<std::thread> workers;
+    // the first CALLER_SLOTS deques belong to the callers, the following
+    // deques to the workers
+    std::vector<std::unique_ptr<Deque>> deques;
+    // the number of deques in use, changed only when no workers are running
+    uint32_t deque_count;
+    // bit i is set when the caller deque i is taken (guarded by mutex)
+    uint32_t busy_callers;
+    std::condition_variable caller_condvar;
     std::condition_variable wakeup_condvar;
-    std::list<Loop*> loop_stack;
+    std::atomic<uint32_t> sleeping_count;
+    std::deque<Task> injected_tasks;
+    std::atomic<uint32_t> injected_count;
   public:
     ThreadPool();
     ~ThreadPool();
 
-    void start(uint32_t thread_count);
+    void start(uint32_t thread_count,
+        ThreadAffinity affinity = ThreadAffinity::None);
     void stop();
     void restart();
     uint32_t thread_count();
+    // index of the calling thread in the pool that it works for, which is
+    // less than thread_count() (threads outside of any pool and the callers
+    // of loops get 0)
+    static uint32_t current_thread_index();
 
     void loop(uint32_t count, std::function<void(uint32_t)> fun);
+    // calls fun(begin, end) for disjoint ranges that cover [0, count); if grain
+    // is zero, it is chosen from the count and the number of threads
+    void loop(uint32_t count, uint32_t grain,
+        std::function<void(uint32_t, uint32_t)> fun);
+
+    // runs fun() in some thread of the pool (fun must not throw); see also
+    // the templated spawn() that returns a Future
+    void spawn(std::function<void()> fun);
+    // works on the tasks in the pool until is_done() returns true; the waiting
+    // thread is woken up only when a loop or a task finishes, so is_done()
+    // must become true inside of a task
+    void wait_until(const std::function<bool()>& is_done);
   private:
-    static void worker_body(ThreadPool& pool);
-    static void work_on_loop(ThreadPool& pool, Loop& loop,
-        std::list<Loop*>::iterator loop_iter, std::unique_lock<std::mutex>& lock,
-        bool wakeup_others);
+    static void worker_body(ThreadPool& pool, uint32_t slot, int64_t cpu);
+    uint32_t enter_caller(bool& out_entered);
+    void leave_caller(uint32_t slot, bool entered);
+    void help_until(uint32_t slot, const std::function<bool()>& is_done);
+    bool find_task(uint32_t slot, Task& out_task);
+    bool has_tasks() const;
+    void run_task(uint32_t slot, Task task);
+    void wakeup_sleeping();
   };
 
   template<class F>
@@ -47,6 +134,15 @@ namespace dort {
     pool.loop(count, fun);
   }
 
+  template<class F>
+  void parallel_for(ThreadPool& pool, uint32_t count, uint32_t grain, F fun) {
+    pool.loop(count, grain, [&](uint32_t begin, uint32_t end) {
+      for(uint32_t i = begin; i < end; ++i) {
+        fun(i);
+      }
+    });
+  }
+
   template<class F>
   void parallel_for_or_serial(ThreadPool& pool, bool serial, uint32_t count, F fun) {
     if(serial) {
@@ -57,4 +153,166 @@ namespace dort {
       pool.loop(count, fun);
     }
   }
+
+  template<class F>
+  void parallel_for_or_serial(ThreadPool& pool, bool serial,
+      uint32_t count, uint32_t grain, F fun)
+  {
+    if(serial) {
+      for(uint32_t i = 0; i < count; ++i) {
+        fun(i);
+      }
+    } else {
+      parallel_for(pool, count, grain, fun);
+    }
+  }
+
+  // The state shared by a Future and the task that produces its value.
+  class FutureStateBase {
+    std::atomic<bool> ready_flag { false };
+    std::mutex mutex;
+    std::vector<std::function<void()>> continuations;
+    std::exception_ptr exception;
+  protected:
+    void set_ready();
+  public:
+    bool is_ready() const {
+      return this->ready_flag.load(std::memory_order_acquire);
+    }
+    void set_exception(std::exception_ptr exception);
+    void rethrow_exception() const;
+    // calls fun() when the state becomes ready (immediately if it is ready)
+    void on_ready(std::function<void()> fun);
+  };
+
+  template<class T>
+  class FutureState final: public FutureStateBase {
+    std::unique_ptr<T> value;
+  public:
+    void set_value(std::unique_ptr<T> value) {
+      this->value = std::move(value);
+      this->set_ready();
+    }
+    T& get() const {
+      this->rethrow_exception();
+      return *this->value;
+    }
+  };
+
+  template<>
+  class FutureState<void> final: public FutureStateBase {
+  public:
+    void set_value() {
+      this->set_ready();
+    }
+    void get() const {
+      this->rethrow_exception();
+    }
+  };
+
+  template<class T, class F>
+  void set_future_result(FutureState<T>& state, F& fun) {
+    std::unique_ptr<T> value;
+    try {
+      value = std::make_unique<T>(fun());
+    } catch(...) {
+      state.set_exception(std::current_exception());
+      return;
+    }
+    state.set_value(std::move(value));
+  }
+
+  template<class F>
+  void set_future_result(FutureState<void>& state, F& fun) {
+    try {
+      fun();
+    } catch(...) {
+      state.set_exception(std::current_exception());
+      return;
+    }
+    state.set_value();
+  }
+
+  // A handle to a value that is computed by a task in the pool. Copies of the
+  // future share the value. Waiting for the value does not block the thread,
+  // the waiting thread works on other tasks in the meantime. If the task
+  // throws, get() rethrows the exception.
+  template<class T>
+  class Future {
+    ThreadPool* pool = nullptr;
+    std::shared_ptr<FutureState<T>> state;
+  public:
+    Future() = default;
+    Future(ThreadPool& pool, std::shared_ptr<FutureState<T>> state):
+      pool(&pool), state(std::move(state)) { }
+
+    bool is_valid() const { return this->state != nullptr; }
+    bool is_ready() const { return this->state->is_ready(); }
+
+    void wait() const {
+      if(!this->state->is_ready()) {
+        const auto& state = *this->state;
+        this->pool->wait_until([&]() { return state.is_ready(); });
+      }
+    }
+
+    // returns a reference to the shared value (or nothing for Future<void>);
+    // the value may be moved out if this future is not used again
+    decltype(auto) get() const {
+      this->wait();
+      return this->state->get();
+    }
+
+    void on_ready(std::function<void()> fun) const {
+      this->state->on_ready(std::move(fun));
+    }
+
+    // spawns fun(*this) when this future is ready and returns the future of
+    // its result
+    template<class F>
+    auto then(F fun) const -> Future<decltype(fun(*this))> {
+      using U = decltype(fun(*this));
+      auto out_state = std::make_shared<FutureState<U>>();
+      ThreadPool* pool = this->pool;
+      Future<T> self = *this;
+      this->state->on_ready([pool, self, out_state, fun]() {
+        pool->spawn([self, out_state, fun]() {
+          auto call = [&]() { return fun(self); };
+          set_future_result(*out_state, call);
+        });
+      });
+      return Future<U>(*pool, std::move(out_state));
+    }
+  };
+
+  template<class F>
+  auto spawn(ThreadPool& pool, F fun) -> Future<decltype(fun())> {
+    using T = decltype(fun());
+    auto state = std::make_shared<FutureState<T>>();
+    pool.spawn([state, fun]() mutable {
+      set_future_result(*state, fun);
+    });
+    return Future<T>(pool, std::move(state));
+  }
+
+  // Returns a future that becomes ready when all the futures are ready; the
+  // values (and exceptions) must be read from the original futures.
+  template<class T>
+  Future<void> when_all(ThreadPool& pool, const std::vector<Future<T>>& futures) {
+    auto out_state = std::make_shared<FutureState<void>>();
+    if(futures.empty()) {
+      out_state->set_value();
+      return Future<void>(pool, std::move(out_state));
+    }
+
+    auto pending = std::make_shared<std::atomic<uint32_t>>(futures.size());
+    for(const auto& future: futures) {
+      future.on_ready([out_state, pending]() {
+        if(pending->fetch_sub(1) == 1) {
+          out_state->set_value();
+        }
+      });
+    }
+    return Future<void>(pool, std::move(out_state));
+  }
 }
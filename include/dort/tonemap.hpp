@@ -2,13 +2,16 @@
 #include "dort/dort.hpp"
 
 namespace dort {
-  Image<PixelRgb8> tonemap_srgb(const Image<PixelRgbFloat>& image, float scale);
+  Image<PixelRgb8> tonemap_srgb(const Image<PixelRgbFloat>& image, float scale,
+      ThreadPool& pool);
   Image<PixelRgb8> tonemap_gamma(const Image<PixelRgbFloat>& image,
-      float gamma, float scale);
+      float gamma, float scale, ThreadPool& pool);
 
   template<class F>
-  Image<PixelRgb8> tonemap_pixel(const Image<PixelRgbFloat>& image, F pixel_map);
+  Image<PixelRgb8> tonemap_pixel(const Image<PixelRgbFloat>& image,
+      ThreadPool& pool, F pixel_map);
   template<class F>
-  Image<PixelRgb8> tonemap_channels(const Image<PixelRgbFloat>& image, F channel_map);
+  Image<PixelRgb8> tonemap_channels(const Image<PixelRgbFloat>& image,
+      ThreadPool& pool, F channel_map);
 
 }
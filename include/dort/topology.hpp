@@ -0,0 +1,58 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "dort/dort.hpp"
+
+namespace dort {
+  // How are the threads of the pool pinned to the logical CPUs:
+  // - None: the threads are not pinned
+  // - Compact: the threads fill the hardware threads of a core, then the cores
+  //   of a package, then the next package
+  // - Scatter: consecutive threads are placed on different packages and
+  //   different cores, hardware threads of a core are used last
+  // - Cores: like Compact, but only one thread is placed on every physical core
+  enum class ThreadAffinity: uint8_t {
+    None,
+    Compact,
+    Scatter,
+    Cores,
+  };
+
+  struct CpuInfo {
+    uint32_t cpu;
+    // index of the physical core (unique across packages)
+    uint32_t core;
+    uint32_t package;
+    uint32_t node;
+  };
+
+  // The logical CPUs that this process may run on, as read from sysfs. If the
+  // topology cannot be read, every CPU is assumed to be a separate core in a
+  // single package and NUMA node.
+  struct CpuTopology {
+    std::vector<CpuInfo> cpus;
+    uint32_t core_count;
+    uint32_t node_count;
+  };
+
+  const CpuTopology& get_cpu_topology();
+  bool parse_thread_affinity(const std::string& name, ThreadAffinity& out_affinity);
+
+  // Returns the CPU for each of the thread_count threads (or an empty vector
+  // for ThreadAffinity::None); when there are more threads than CPUs, the CPUs
+  // are reused in the same order.
+  std::vector<uint32_t> assign_thread_cpus(const CpuTopology& topology,
+      ThreadAffinity affinity, uint32_t thread_count);
+  void pin_current_thread(uint32_t cpu);
+
+  // Asks the kernel to interleave the pages of the memory across all NUMA
+  // nodes, so that large read-mostly data accessed by all threads is not
+  // served from the node of the thread that happened to build it. Does nothing
+  // on machines with a single node and for small ranges.
+  void numa_interleave(const void* ptr, size_t size);
+
+  template<class T, class A>
+  void numa_interleave(const std::vector<T, A>& vec) {
+    numa_interleave(vec.data(), vec.size() * sizeof(T));
+  }
+}
@@ -45,6 +45,8 @@ namespace dort {
     const Mat4x4& get_mat(bool inv) const {
       return inv ? this->mat_inv : this->mat;
     }
+  private:
+    Box apply_projective(bool inv, const Box& box) const;
   };
 
   Transform identity();
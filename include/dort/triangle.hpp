@@ -7,8 +7,12 @@ namespace dort {
     std::array<Point, 3> p;
 
     Triangle(const Mesh& mesh, uint32_t index);
+    Triangle(const CompressedMesh& mesh, uint32_t index);
+    Triangle(const std::array<Point, 3>& p): p(p) { }
+    bool hit(const Ray& ray, float& out_t, float& out_b1, float& out_b2) const;
     bool hit_p(const Ray& ray) const;
     Box bounds() const;
+    Box clipped_bounds(const Box& clip) const;
     float area() const;
     Point sample_point(Vec2 uv, float& out_pos_pdf,
         Normal& out_n, float& out_ray_epsilon) const;
@@ -21,7 +25,13 @@ namespace dort {
     bool has_shading_normals;
 
     TriangleUv(const Mesh& mesh, uint32_t index);
+    TriangleUv(const CompressedMesh& mesh, uint32_t index);
+    TriangleUv(const std::array<Point, 3>& p, const std::array<Vec2, 3>& uv,
+        const std::array<Normal, 3>& n):
+      Triangle(p), uv(uv), n(n), has_shading_normals(true) { }
     bool hit(const Ray& ray, float& out_t_hit,
         float& out_ray_epsilon, DiffGeom& out_diff_geom) const;
+    void get_diff_geom(float t, float b1, float b2,
+        float& out_ray_epsilon, DiffGeom& out_diff_geom) const;
   };
 }
@@ -0,0 +1,135 @@
+#pragma once
+#include <array>
+#include <emmintrin.h>
+#include "dort/geometry.hpp"
+#include "dort/stats.hpp"
+#include "dort/triangle.hpp"
+
+namespace dort {
+  // vector operations on four triples at once, with exactly the same
+  // operations as cross() and dot() of Vector
+  inline void cross_ps(const __m128 a[3], const __m128 b[3], __m128 out[3]) {
+    out[0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+    out[1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+    out[2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+  }
+
+  inline __m128 dot_ps(const __m128 a[3], const __m128 b[3]) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]),
+          _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+  }
+
+  // Moller-Trumbore with exactly the same operations as Triangle::hit(),
+  // including the treatment of NaNs, for four pairs of rays and triangles;
+  // returns the mask of lanes that hit
+  inline uint32_t hit_triangles_ps(const __m128 orig[3], const __m128 dir[3],
+      __m128 t_min, __m128 t_max,
+      const __m128 p0[3], const __m128 e1[3], const __m128 e2[3],
+      __m128& out_t, __m128& out_b1, __m128& out_b2)
+  {
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.f);
+
+    __m128 s1[3];
+    cross_ps(dir, e2, s1);
+    __m128 det = dot_ps(s1, e1);
+    __m128 inv_det = _mm_div_ps(one, det);
+
+    __m128 s[3];
+    for(uint32_t axis = 0; axis < 3; ++axis) {
+      s[axis] = _mm_sub_ps(orig[axis], p0[axis]);
+    }
+    __m128 b1 = _mm_mul_ps(inv_det, dot_ps(s1, s));
+
+    __m128 s2[3];
+    cross_ps(s, e1, s2);
+    __m128 b2 = _mm_mul_ps(inv_det, dot_ps(s2, dir));
+    __m128 t = _mm_mul_ps(inv_det, dot_ps(s2, e2));
+
+    __m128 miss = _mm_cmpeq_ps(det, zero);
+    miss = _mm_or_ps(miss, _mm_cmplt_ps(b1, zero));
+    miss = _mm_or_ps(miss, _mm_cmpgt_ps(b1, one));
+    miss = _mm_or_ps(miss, _mm_cmplt_ps(b2, zero));
+    miss = _mm_or_ps(miss, _mm_cmpgt_ps(_mm_add_ps(b1, b2), one));
+    miss = _mm_or_ps(miss, _mm_cmplt_ps(t, t_min));
+    miss = _mm_or_ps(miss, _mm_cmpgt_ps(t, t_max));
+
+    out_t = t;
+    out_b1 = b1;
+    out_b2 = b2;
+    return ~uint32_t(_mm_movemask_ps(miss)) & 0xf;
+  }
+
+  // Intersects the rays selected by ray_mask with the triangles in the
+  // elements of the BVH, testing each triangle against all rays at once.
+  // get_triangle(elem) returns the Triangle of an element, so it is called
+  // once per element and packet instead of once per ray. The t_max of the
+  // rays is updated and out_hit_indices is UINT32_MAX for the rays that did
+  // not hit anything.
+  template<class B, class F>
+  void intersect_triangle_packet(const B& bvh, Ray* rays, uint32_t ray_mask,
+      F get_triangle, std::array<uint32_t, RAY_PACKET_SIZE>& out_hit_indices,
+      std::array<float, RAY_PACKET_SIZE>& out_hit_b1,
+      std::array<float, RAY_PACKET_SIZE>& out_hit_b2)
+  {
+    out_hit_indices.fill(UINT32_MAX);
+
+    // the unused lanes repeat an active ray
+    uint32_t first = __builtin_ctz(ray_mask);
+    const Ray* lane_rays[RAY_PACKET_SIZE];
+    for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+      lane_rays[i] = &rays[(ray_mask & (1u << i)) ? i : first];
+    }
+    __m128 orig[3], dir[3];
+    for(uint32_t axis = 0; axis < 3; ++axis) {
+      orig[axis] = _mm_setr_ps(lane_rays[0]->orig.v[axis],
+          lane_rays[1]->orig.v[axis], lane_rays[2]->orig.v[axis],
+          lane_rays[3]->orig.v[axis]);
+      dir[axis] = _mm_setr_ps(lane_rays[0]->dir.v[axis],
+          lane_rays[1]->dir.v[axis], lane_rays[2]->dir.v[axis],
+          lane_rays[3]->dir.v[axis]);
+    }
+    __m128 t_min = _mm_setr_ps(lane_rays[0]->t_min, lane_rays[1]->t_min,
+        lane_rays[2]->t_min, lane_rays[3]->t_min);
+
+    bvh.traverse_packet_elems(rays, ray_mask,
+      [&](uint32_t index, uint32_t leaf_ray_mask) {
+        Triangle triangle = get_triangle(index);
+        Vector e1 = triangle.p[1] - triangle.p[0];
+        Vector e2 = triangle.p[2] - triangle.p[0];
+        __m128 p0_ps[3], e1_ps[3], e2_ps[3];
+        for(uint32_t axis = 0; axis < 3; ++axis) {
+          p0_ps[axis] = _mm_set1_ps(triangle.p[0].v[axis]);
+          e1_ps[axis] = _mm_set1_ps(e1.v[axis]);
+          e2_ps[axis] = _mm_set1_ps(e2.v[axis]);
+        }
+        __m128 t_max = _mm_setr_ps(lane_rays[0]->t_max, lane_rays[1]->t_max,
+            lane_rays[2]->t_max, lane_rays[3]->t_max);
+
+        stat_count(COUNTER_TRIANGLE_HIT);
+        __m128 t, b1, b2;
+        uint32_t hit_mask = leaf_ray_mask & hit_triangles_ps(orig, dir,
+            t_min, t_max, p0_ps, e1_ps, e2_ps, t, b1, b2);
+        if(hit_mask == 0) {
+          return true;
+        }
+
+        stat_count(COUNTER_TRIANGLE_HIT_HIT);
+        alignas(16) float t_lanes[4];
+        alignas(16) float b1_lanes[4];
+        alignas(16) float b2_lanes[4];
+        _mm_store_ps(t_lanes, t);
+        _mm_store_ps(b1_lanes, b1);
+        _mm_store_ps(b2_lanes, b2);
+        while(hit_mask != 0) {
+          uint32_t lane = __builtin_ctz(hit_mask);
+          hit_mask &= hit_mask - 1;
+          rays[lane].t_max = t_lanes[lane];
+          out_hit_indices.at(lane) = index;
+          out_hit_b1.at(lane) = b1_lanes[lane];
+          out_hit_b2.at(lane) = b2_lanes[lane];
+        }
+        return true;
+      });
+  }
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <vector>
+#include "dort/discrete_distrib_1d.hpp"
+#include "dort/path_renderer.hpp"
+#include "dort/primitive.hpp"
+#include "dort/renderer.hpp"
+
+namespace dort {
+  // Path tracing with the same estimator as PathRenderer, but the paths of a
+  // whole tile are advanced together, one stage at a time: extension rays,
+  // shading (BSDF and light sampling), shadow rays and the rays that sample
+  // direct lighting from the BSDF. The rays are sorted by direction and origin
+  // before they are traced and the hits are sorted by material before they
+  // are shaded, so that every stage works on coherent data.
+  class WavefrontRenderer final: public Renderer {
+  public:
+    using DirectStrategy = PathRenderer::DirectStrategy;
+  private:
+    uint32_t iteration_count;
+    uint32_t min_depth;
+    uint32_t max_depth;
+    bool only_direct;
+    bool sample_all_lights;
+    DirectStrategy direct_strategy;
+    DiscreteDistrib1d light_distrib;
+  public:
+    WavefrontRenderer(std::shared_ptr<Scene> scene,
+        std::shared_ptr<Film> film,
+        std::shared_ptr<Sampler> sampler,
+        std::shared_ptr<Camera> camera,
+        uint32_t iteration_count,
+        uint32_t min_depth, uint32_t max_depth,
+        bool only_direct, bool sample_all_lights,
+        DirectStrategy direct_strategy):
+      Renderer(scene, film, sampler, camera),
+      iteration_count(iteration_count),
+      min_depth(min_depth), max_depth(max_depth),
+      only_direct(only_direct), sample_all_lights(sample_all_lights),
+      direct_strategy(direct_strategy)
+    { }
+    virtual void render(CtxG& ctx, Progress& progress) override final;
+  private:
+    struct PathState {
+      Vec2 film_pos;
+      Spectrum weight;
+      Spectrum throughput;
+      Spectrum radiance;
+      Ray ray;
+      uint32_t bounces;
+      bool last_bounce_was_delta;
+      bool isected;
+      Intersection isect;
+    };
+
+    // a direct lighting contribution that is added to the path if the ray
+    // passes the test: a shadow ray must be unoccluded, a ray sampled from
+    // the BSDF must hit the `light`
+    struct DirectRay {
+      uint32_t path;
+      Ray ray;
+      Spectrum contrib;
+      const Light* light;
+    };
+
+    struct Batch {
+      std::vector<PathState> paths;
+      std::vector<uint32_t> active;
+      std::vector<DirectRay> shadow_rays;
+      std::vector<DirectRay> bsdf_rays;
+    };
+
+    void render_tile(Film& tile_film, Recti tile_rect, Recti tile_film_rect,
+        Sampler& sampler, bool jitter) const;
+    void generate_paths(Batch& batch, Recti tile_rect,
+        Sampler& sampler, bool jitter) const;
+    void sort_rays(Batch& batch) const;
+    void trace_extension_rays(Batch& batch) const;
+    void add_emitted_radiance(Batch& batch) const;
+    void sort_hits(Batch& batch) const;
+    void shade_hits(Batch& batch, Sampler& sampler) const;
+    void trace_shadow_rays(Batch& batch) const;
+    void trace_bsdf_rays(Batch& batch) const;
+
+    void sample_direct_lighting(Batch& batch, uint32_t path_idx,
+        const Bsdf& bsdf, Sampler& sampler) const;
+    void sample_direct(Batch& batch, uint32_t path_idx, const Light& light,
+        const Bsdf& bsdf, float light_pick_pdf, Sampler& sampler) const;
+  };
+}
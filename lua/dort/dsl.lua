@@ -40,7 +40,7 @@ function dsl.frame(callback) return b.frame(B, callback) end
 function dsl.transform(transform) b.set_transform(B, transform) end
 function dsl.material(material) b.set_material(B, material) end
 function dsl.camera(camera) b.set_camera(B, camera) end
-function dsl.option(opt, ...) b.set_option(B, opt, table.unpack(arg)) end
+function dsl.option(opt, ...) b.set_option(B, opt, ...) end
 
 function dsl.add_shape(shape, ...) b.add_shape(B, shape, ...) end
 function dsl.add_primitive(prim) b.add_primitive(B, prim) end
@@ -52,7 +52,10 @@ function dsl.add_read_ply_mesh_as_bvh(file_name)
 end
 function dsl.add_ply_mesh(mesh) b.add_ply_mesh(B, mesh) end
 function dsl.add_ply_mesh_as_bvh(mesh) b.add_ply_mesh_as_bvh(B, mesh) end
+function dsl.add_mesh_as_bvh(mesh) b.add_mesh_as_bvh(B, mesh) end
 function dsl.add_voxel_grid(params) b.add_voxel_grid(B, params) end
+function dsl.add_spheres(params) b.add_spheres(B, params) end
+function dsl.add_heightfield(params) b.add_heightfield(B, params) end
 function dsl.add_diffuse_light(params) 
   params.transform = apply_builder_transform(params.transform)
   b.add_diffuse_light(B, params)
@@ -157,10 +160,17 @@ function dsl.mesh(params)
   return dort.shape.make_mesh(params)
 end
 
+dsl.set_mesh_points = dort.shape.set_mesh_points
+dsl.refit_scene = b.refit_scene
+
 function dsl.triangle(mesh, index)
   return b.make_triangle(B, mesh, index)
 end
 
+function dsl.mesh_lod(mesh, params)
+  return b.make_mesh_lod(B, mesh, params)
+end
+
 dsl.rgb = dort.spectrum.rgb
 dsl.rgbh = dort.spectrum.rgbh
 
@@ -0,0 +1,52 @@
+// Checks that two threads outside of the pool can run loops at the same time:
+// the first loop cannot finish until the second loop has run, so the check
+// fails (after a timeout) if the callers are serialized.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include "dort/thread_pool.hpp"
+
+using namespace dort;
+
+int main() {
+  ThreadPool pool;
+  pool.start(4);
+
+  std::atomic<bool> second_done(false);
+  std::atomic<bool> timed_out(false);
+  std::atomic<uint32_t> first_sum(0);
+  std::atomic<uint32_t> second_sum(0);
+
+  std::thread first([&]() {
+    parallel_for(pool, 64, [&](uint32_t i) {
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+      while(!second_done.load()) {
+        if(std::chrono::steady_clock::now() > deadline) {
+          timed_out.store(true);
+          break;
+        }
+        std::this_thread::yield();
+      }
+      first_sum.fetch_add(i);
+    });
+  });
+
+  std::thread second([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    parallel_for(pool, 1000, 10, [&](uint32_t i) {
+      second_sum.fetch_add(i);
+    });
+    second_done.store(true);
+  });
+
+  first.join();
+  second.join();
+  pool.stop();
+
+  bool ok = !timed_out.load()
+    && first_sum.load() == 64 * 63 / 2
+    && second_sum.load() == 1000 * 999 / 2;
+  std::printf("concurrent callers: %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
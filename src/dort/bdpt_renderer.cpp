@@ -21,16 +21,24 @@ namespace dort {
       this->init_debug_films();
     }
     this->film->splat_scale = 1.f;
+    if(this->use_t1_paths) {
+      this->film->init_splat_planes(*ctx.pool);
+    }
 
-    parallel_for(*ctx.pool, this->iteration_count, [&](uint32_t i) {
+    // the iterations do not necessarily finish in order, so we scale the
+    // splats by the number of iterations that are done
+    std::atomic<uint32_t> iterations_done(0);
+    parallel_for(*ctx.pool, this->iteration_count, [&](uint32_t) {
       this->iteration_tiled(ctx, [&](Vec2i pixel, Vec2& film_pos, Sampler& sampler) {
         film_pos = Vec2(pixel) + sampler.random_2d();
         return this->sample_path(*this->scene, film_pos, sampler);
       });
 
+      uint32_t done = iterations_done.fetch_add(1) + 1;
       std::unique_lock<std::mutex> film_lock(this->film_mutex);
-      this->film->splat_scale = 1.f / float(i + 1);
+      this->film->splat_scale = 1.f / float(done);
     });
+    this->film->splat_scale = 1.f / float(this->iteration_count);
 
     if(!this->debug_image_dir.empty()) {
       this->save_debug_films();
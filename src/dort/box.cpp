@@ -26,6 +26,25 @@ namespace dort {
           max(box.p_max.v.z, pt.v.z)));
   }
 
+  Box intersect_box(const Box& b1, const Box& b2) {
+    Box box(
+        Point(
+          max(b1.p_min.v.x, b2.p_min.v.x),
+          max(b1.p_min.v.y, b2.p_min.v.y),
+          max(b1.p_min.v.z, b2.p_min.v.z)),
+        Point(
+          min(b1.p_max.v.x, b2.p_max.v.x),
+          min(b1.p_max.v.y, b2.p_max.v.y),
+          min(b1.p_max.v.z, b2.p_max.v.z)));
+    if(box.p_min.v.x > box.p_max.v.x ||
+        box.p_min.v.y > box.p_max.v.y ||
+        box.p_min.v.z > box.p_max.v.z)
+    {
+      return Box();
+    }
+    return box;
+  }
+
   bool Box::hit(const Ray& ray, float& out_t) const {
     float t0 = ray.t_min;
     float t1 = ray.t_max;
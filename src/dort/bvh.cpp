@@ -1,11 +1,57 @@
 #include <algorithm>
+#include <limits>
+#include <type_traits>
 #include "dort/bvh.hpp"
 #include "dort/bvh_primitive.hpp"
+#include "dort/compressed_mesh_bvh_primitive.hpp"
+#include "dort/instance_bvh_primitive.hpp"
 #include "dort/mesh_bvh_primitive.hpp"
+#include "dort/sphere_set_primitive.hpp"
 #include "dort/stats.hpp"
 #include "dort/thread_pool.hpp"
+#include "dort/topology.hpp"
 
 namespace dort {
+  namespace {
+    // Spatial splits need to clip the elements and to store a single element
+    // in multiple leaves, which is only possible for traits that declare
+    // SPATIAL_SPLITS (their elements must be copyable).
+    template<class Traits>
+    Box get_clipped_elem_bounds(std::true_type, typename Traits::Arg arg,
+        const typename Traits::Element& elem, const Box& clip)
+    {
+      return Traits::get_clipped_bounds(arg, elem, clip);
+    }
+
+    template<class Traits>
+    Box get_clipped_elem_bounds(std::false_type, typename Traits::Arg,
+        const typename Traits::Element&, const Box& clip)
+    {
+      assert(false && "The BVH traits do not support spatial splits");
+      return clip;
+    }
+
+    template<class E>
+    void place_elem(std::true_type, E& dst, E& src) {
+      dst = src;
+    }
+
+    template<class E>
+    void place_elem(std::false_type, E& dst, E& src) {
+      dst = std::move(src);
+    }
+
+    // spreads the lower 10 bits of x so that there are two zero bits between
+    // every two bits
+    uint32_t expand_morton_bits(uint32_t x) {
+      x = (x | (x << 16)) & 0x030000ff;
+      x = (x | (x << 8)) & 0x0300f00f;
+      x = (x | (x << 4)) & 0x030c30c3;
+      x = (x | (x << 2)) & 0x09249249;
+      return x;
+    }
+  }
+
   template<class R>
   Bvh<R>::Bvh(std::vector<Element> elems, TraitsArg arg,
       const BvhOpts& opts, ThreadPool& pool) 
@@ -21,37 +67,110 @@ namespace dort {
       std::move(elems),
       pool,
       opts,
-      {}, {}, {}, {}, {},
+      arg,
+      root_bounds.area(),
+      {}, {}, {}, {},
     };
     ctx.opts.max_leaf_size = std::min(ctx.opts.max_leaf_size, 0xffffu);
     ctx.opts.leaf_size = std::min(ctx.opts.leaf_size, ctx.opts.max_leaf_size);
+    if(!R::SPATIAL_SPLITS && ctx.opts.split_method == BvhSplitMethod::SpatialSah) {
+      ctx.opts.split_method = BvhSplitMethod::FullSah;
+    }
+    // the SAH clusters of LBVH are built serially by build_node()
+    ctx.opts.lbvh_sah_cluster_size = std::min(ctx.opts.lbvh_sah_cluster_size,
+        ctx.opts.min_split_elems_per_thread);
+
+    // with spatial splits, the references to elements may be duplicated, so we
+    // reserve space for the additional references at the end of the array
+    uint32_t ref_capacity = ctx.elems.size();
+    if(ctx.opts.split_method == BvhSplitMethod::SpatialSah) {
+      uint64_t max_refs = uint64_t(float(ctx.elems.size())
+          * (1.f + max(0.f, ctx.opts.spatial_split_budget)));
+      ref_capacity = std::min(max_refs, uint64_t(UINT32_MAX));
+      ctx.build_infos.resize(ref_capacity);
+    }
+
+    // every leaf contains at least one reference, so a binary tree has at most
+    // 2*n - 1 nodes; the nodes are allocated by an atomic counter and written
+    // without any synchronization
     ctx.free_linear_idx.store(1);
-    ctx.ordered_elems.resize(ctx.elems.size());
-    ctx.linear_nodes.resize(ctx.elems.size() / ctx.opts.leaf_size);
-
-    NodeInfo root_node {
-      root_bounds,
-      root_centroid_bounds,
-      0, uint32_t(ctx.elems.size()),
-      0
-    };
+    ctx.ordered_elems.resize(ref_capacity);
+    ctx.linear_nodes.resize(std::max(uint64_t(1), 2 * uint64_t(ref_capacity)) - 1);
 
-    Bvh::build_node(ctx, root_node, true);
+    if(ctx.opts.split_method == BvhSplitMethod::Lbvh) {
+      Bvh::build_lbvh(ctx, root_centroid_bounds);
+    } else {
+      NodeInfo root_node {
+        root_bounds,
+        root_centroid_bounds,
+        0, uint32_t(ctx.elems.size()),
+        ref_capacity,
+        0
+      };
 
-    std::sort(ctx.todo_serial.begin(), ctx.todo_serial.end(),
-        [&](const NodeInfo& n1, const NodeInfo& n2) {
-          return (n1.end - n1.begin) > (n2.end - n2.begin);
-        });
-    stat_sample_int(DISTRIB_INT_BVH_BUILD_SERIAL_COUNT, ctx.todo_serial.size());
+      Bvh::build_node(ctx, root_node, true);
 
-    parallel_for(pool, ctx.todo_serial.size(), [&](uint32_t job) {
-        Bvh::build_node(ctx, ctx.todo_serial.at(job), false);
-    });
+      std::sort(ctx.todo_serial.begin(), ctx.todo_serial.end(),
+          [&](const NodeInfo& n1, const NodeInfo& n2) {
+            return (n1.end - n1.begin) > (n2.end - n2.begin);
+          });
+      stat_sample_int(DISTRIB_INT_BVH_BUILD_SERIAL_COUNT, ctx.todo_serial.size());
+
+      parallel_for(pool, ctx.todo_serial.size(), [&](uint32_t job) {
+          Bvh::build_node(ctx, ctx.todo_serial.at(job), false);
+      });
+    }
 
     ctx.linear_nodes.resize(ctx.free_linear_idx.load());
     ctx.linear_nodes.shrink_to_fit();
-    this->linear_nodes = std::move(ctx.linear_nodes);
+    if(ctx.opts.split_method == BvhSplitMethod::SpatialSah) {
+      Bvh::compact_ordered_elems(ctx);
+    }
     this->ordered_elems = std::move(ctx.ordered_elems);
+    this->root_bounds = root_bounds;
+    this->opts = ctx.opts;
+
+    uint32_t node_bytes;
+    uint32_t node_count;
+    if(ctx.opts.quantization_bits == 8 && !this->ordered_elems.empty()) {
+      this->quant8_nodes = Bvh::layout_nodes(Bvh::quantize_wide<uint8_t>(
+          Bvh::collapse_wide<4>(ctx.linear_nodes)));
+      node_bytes = sizeof(QuantNode<uint8_t>);
+      node_count = this->quant8_nodes.size();
+    } else if(ctx.opts.quantization_bits == 16 && !this->ordered_elems.empty()) {
+      this->quant16_nodes = Bvh::layout_nodes(Bvh::quantize_wide<uint16_t>(
+          Bvh::collapse_wide<4>(ctx.linear_nodes)));
+      node_bytes = sizeof(QuantNode<uint16_t>);
+      node_count = this->quant16_nodes.size();
+    } else if(ctx.opts.branch_factor == 4 && !this->ordered_elems.empty()) {
+      this->wide4_nodes = Bvh::layout_nodes(
+          Bvh::collapse_wide<4>(ctx.linear_nodes));
+      node_bytes = sizeof(WideNode<4>);
+      node_count = this->wide4_nodes.size();
+    } else if(ctx.opts.branch_factor == 8 && !this->ordered_elems.empty()) {
+      this->wide8_nodes = Bvh::layout_nodes(
+          Bvh::collapse_wide<8>(ctx.linear_nodes));
+      node_bytes = sizeof(WideNode<8>);
+      node_count = this->wide8_nodes.size();
+    } else {
+      // the empty tree has a single leaf, which get_node_items() would
+      // interpret as a branch
+      this->linear_nodes = this->ordered_elems.empty()
+        ? std::move(ctx.linear_nodes)
+        : Bvh::layout_nodes(ctx.linear_nodes);
+      node_bytes = sizeof(LinearNode);
+      node_count = this->linear_nodes.size();
+    }
+    stat_sample_int(DISTRIB_INT_BVH_NODE_BYTES, node_bytes);
+    stat_sample_int(DISTRIB_INT_BVH_NODE_COUNT, node_count);
+
+    // the tree is read by all threads during the traversal
+    numa_interleave(this->ordered_elems);
+    numa_interleave(this->linear_nodes);
+    numa_interleave(this->wide4_nodes);
+    numa_interleave(this->wide8_nodes);
+    numa_interleave(this->quant8_nodes);
+    numa_interleave(this->quant16_nodes);
   }
 
   template<class R>
@@ -89,7 +208,8 @@ namespace dort {
 
     for(uint32_t i = 0; i < jobs; ++i) {
       out_bounds = union_box(out_bounds, job_bounds.at(i));
-      out_centroid_bounds = union_box(out_centroid_bounds, job_bounds.at(i));
+      out_centroid_bounds = union_box(out_centroid_bounds,
+          job_centroid_bounds.at(i));
     }
 
     return build_infos;
@@ -126,48 +246,59 @@ namespace dort {
           split = Bvh::split_middle(ctx, node, axis, parallel_split);
           break;
         case BvhSplitMethod::Sah:
-          split = Bvh::split_sah(ctx, node, axis, parallel_split);
+          split = Bvh::split_sah(ctx, node, axis, false, parallel_split);
+          break;
+        case BvhSplitMethod::FullSah:
+        case BvhSplitMethod::Lbvh:
+          split = Bvh::split_sah(ctx, node, axis, true, parallel_split);
+          break;
+        case BvhSplitMethod::SpatialSah:
+          split = Bvh::split_spatial(ctx, node, parallel_split);
           break;
       }
 
       make_leaf = split.prefer_leaf && elem_count <= ctx.opts.max_leaf_size;
-      assert(node.begin < split.mid); assert(split.mid + 1 < node.end);
+      assert(node.begin < split.mid); assert(split.right_begin < split.right_end);
+      axis = split.axis;
     }
 
     if(make_leaf) {
       assert(elem_count <= ctx.opts.max_leaf_size);
       for(uint32_t i = node.begin; i < node.end; ++i) {
         uint32_t elem_idx = ctx.build_infos.at(i).elem_index;
-        ctx.ordered_elems.at(i) = std::move(ctx.elems.at(elem_idx));
+        place_elem(std::integral_constant<bool, R::SPATIAL_SPLITS>(),
+            ctx.ordered_elems.at(i), ctx.elems.at(elem_idx));
       }
 
-      LinearNode leaf;
+      LinearNode leaf {};
       leaf.bounds = node.bounds;
       leaf.elem_offset_or_left_child = node.begin;
       leaf.elem_count_or_zero = elem_count;
       leaf.axis = axis;
-      Bvh::write_linear_node(ctx, node.linear_idx, leaf);
+      ctx.linear_nodes.at(node.linear_idx) = leaf;
     } else {
       NodeInfo left;
       left.bounds = split.left_bounds;
       left.centroid_bounds = split.left_centroid_bounds;
       left.begin = node.begin;
       left.end = split.mid;
+      left.reserved_end = split.right_begin;
       left.linear_idx = ctx.free_linear_idx.fetch_add(2);
 
       NodeInfo right;
       right.bounds = split.right_bounds;
       right.centroid_bounds = split.right_centroid_bounds;
-      right.begin = split.mid;
-      right.end = node.end;
+      right.begin = split.right_begin;
+      right.end = split.right_end;
+      right.reserved_end = node.reserved_end;
       right.linear_idx = left.linear_idx + 1;
 
-      LinearNode branch;
+      LinearNode branch {};
       branch.bounds = node.bounds;
       branch.elem_offset_or_left_child = left.linear_idx;
       branch.elem_count_or_zero = 0;
       branch.axis = axis;
-      Bvh::write_linear_node(ctx, node.linear_idx, branch);
+      ctx.linear_nodes.at(node.linear_idx) = branch;
 
       t.stop();
       Bvh::build_node(ctx, left, parallel);
@@ -175,29 +306,6 @@ namespace dort {
     }
   }
 
-  template<class R>
-  void Bvh<R>::write_linear_node(BuildCtx& ctx, uint32_t idx,
-      const LinearNode& node)
-  {
-    StatTimer t(TIMER_BVH_WRITE_LINEAR_NODE);
-    std::shared_lock<std::shared_timed_mutex> write_lock(ctx.linear_mutex);
-    if(ctx.linear_nodes.size() <= idx) {
-      StatTimer t(TIMER_BVH_WRITE_LINEAR_NODE_RESIZE);
-      write_lock.unlock();
-      std::unique_lock<std::shared_timed_mutex> resize_lock(ctx.linear_mutex);
-      ctx.linear_nodes.reserve(std::max(idx + 1, idx * 2 - idx / 2));
-      uint32_t capacity = ctx.linear_nodes.capacity();
-      if(ctx.linear_nodes.size() < capacity) {
-        stat_sample_int(DISTRIB_INT_BVH_BUILD_LINEAR_RESIZE, capacity);
-        ctx.linear_nodes.resize(capacity);
-      }
-      resize_lock.unlock();
-      write_lock.lock();
-    }
-
-    ctx.linear_nodes.at(idx) = node;
-  }
-
   template<class R>
   typename Bvh<R>::SplitInfo Bvh<R>::split_middle(BuildCtx& ctx,
       const NodeInfo& node, uint8_t axis, bool parallel)
@@ -206,11 +314,33 @@ namespace dort {
     uint32_t begin = node.begin;
     uint32_t end = node.end;
     float center = node.centroid_bounds.centroid().v[axis];
-    uint32_t mid = Bvh::partition(ctx, parallel, begin, end, axis, center);
-    if(mid == begin || mid + 1 == end) {
+    uint32_t mid = Bvh::partition(ctx, parallel, begin, end,
+        [&](const ElementInfo& info) {
+          return info.bounds.centroid().v[axis] < center;
+        });
+    if(mid == begin || mid + 1 >= end) {
       mid = begin + (end - begin) / 2;
     }
 
+    SplitInfo split;
+    split.mid = mid;
+    split.right_begin = mid;
+    split.right_end = end;
+    split.axis = axis;
+    split.prefer_leaf = false;
+
+    StatTimer t_out(parallel
+        ? TIMER_BVH_SPLIT_MIDDLE_BOUNDS_OUT_PARALLEL
+        : TIMER_BVH_SPLIT_MIDDLE_BOUNDS_OUT_SERIAL);
+    Bvh::compute_split_bounds(ctx, split, begin, end, parallel);
+    return split;
+  }
+
+  template<class R>
+  void Bvh<R>::compute_split_bounds(BuildCtx& ctx, SplitInfo& split,
+      uint32_t begin, uint32_t end, bool parallel)
+  {
+    uint32_t mid = split.mid;
     uint32_t jobs = !parallel ? 1
       : std::max(ctx.pool.thread_count(),
           (end - begin) / ctx.opts.min_split_elems_per_thread);
@@ -220,9 +350,6 @@ namespace dort {
     std::vector<Box> job_right_bounds(jobs);
     std::vector<Box> job_right_centroid_bounds(jobs);
 
-    StatTimer t_out(parallel
-        ? TIMER_BVH_SPLIT_MIDDLE_BOUNDS_OUT_PARALLEL
-        : TIMER_BVH_SPLIT_MIDDLE_BOUNDS_OUT_SERIAL);
     if(parallel) {
       stat_sample_int(DISTRIB_INT_BVH_SPLIT_MIDDLE_JOBS, jobs);
     }
@@ -256,64 +383,73 @@ namespace dort {
       job_right_centroid_bounds.at(job) = right_centroid_bounds;
     });
 
-    Box left_bounds, left_centroid_bounds;
-    Box right_bounds, right_centroid_bounds;
+    split.left_bounds = split.right_bounds = Box();
+    split.left_centroid_bounds = split.right_centroid_bounds = Box();
     for(uint32_t i = 0; i < jobs; ++i) {
-      left_bounds = union_box(left_bounds, job_left_bounds.at(i));
-      left_centroid_bounds = union_box(left_centroid_bounds,
+      split.left_bounds = union_box(split.left_bounds, job_left_bounds.at(i));
+      split.left_centroid_bounds = union_box(split.left_centroid_bounds,
           job_left_centroid_bounds.at(i));
-      right_bounds = union_box(right_bounds, job_right_bounds.at(i));
-      right_centroid_bounds = union_box(right_centroid_bounds,
+      split.right_bounds = union_box(split.right_bounds, job_right_bounds.at(i));
+      split.right_centroid_bounds = union_box(split.right_centroid_bounds,
           job_right_centroid_bounds.at(i));
     }
-
-    SplitInfo split;
-    split.left_bounds = left_bounds;
-    split.right_bounds = right_bounds;
-    split.left_centroid_bounds = left_centroid_bounds;
-    split.right_centroid_bounds = right_centroid_bounds;
-    split.mid = mid;
-    split.prefer_leaf = false;
-    return split;
   }
 
   template<class R>
   typename Bvh<R>::SplitInfo Bvh<R>::split_sah(BuildCtx& ctx,
-      const NodeInfo& node, uint8_t axis, bool parallel)
+      const NodeInfo& node, uint8_t axis, bool all_axes, bool parallel)
   {
     StatTimer t(TIMER_BVH_SPLIT_SAH);
-    float extent = (node.centroid_bounds.p_max - node.centroid_bounds.p_min).v[axis];
-    float bounds_min = node.centroid_bounds.p_min.v[axis];
-    float inv_extent = 1.f / extent;
+    SahBinning binning = Bvh::bin_sah(ctx, node, axis, all_axes, parallel);
+    return Bvh::apply_sah_binning(ctx, node, binning, parallel);
+  }
+
+  template<class R>
+  typename Bvh<R>::SahBinning Bvh<R>::bin_sah(BuildCtx& ctx,
+      const NodeInfo& node, uint8_t axis, bool all_axes, bool parallel)
+  {
     uint32_t begin = node.begin;
     uint32_t end = node.end;
     uint32_t bucket_count = ctx.opts.sah_bucket_count;
 
+    // if `all_axes` is set, the elements are binned along all three axes in a
+    // single pass and the cheapest split among them is selected
+    uint8_t axis_begin = all_axes ? 0 : axis;
+    uint8_t axis_end = all_axes ? 3 : axis + 1;
+    SahBinning binning;
+    for(uint8_t ax = 0; ax < 3; ++ax) {
+      float extent = node.centroid_bounds.p_max.v[ax]
+        - node.centroid_bounds.p_min.v[ax];
+      binning.bounds_min[ax] = node.centroid_bounds.p_min.v[ax];
+      binning.bucket_scale[ax] = extent > 0.f ? float(bucket_count) / extent : 0.f;
+    }
+
     uint32_t jobs = !parallel ? 1
       : std::max(ctx.pool.thread_count(),
           (end - begin) / ctx.opts.min_split_elems_per_thread);
 
     std::vector<std::vector<BucketInfo>> job_buckets(jobs);
     parallel_for_or_serial(ctx.pool, !parallel, jobs, [&](uint32_t job) {
-      std::vector<BucketInfo> buckets(bucket_count);
+      std::vector<BucketInfo> buckets(3 * bucket_count);
       uint32_t job_begin = begin + uint64_t(end - begin) * job / jobs;
       uint32_t job_end = begin + uint64_t(end - begin) * (job + 1) / jobs;
       for(uint32_t i = job_begin; i < job_end; ++i) {
         auto& elem_info = ctx.build_infos.at(i);
         Point centroid = elem_info.bounds.centroid();
-        float elem_pos = centroid.v[axis] - bounds_min;
-        uint32_t bucket_idx = clamp(
-          uint32_t(floor_int32(float(bucket_count) * elem_pos * inv_extent)),
-          0u, bucket_count - 1);
-        auto& bucket = buckets.at(bucket_idx);
-        bucket.count += 1;
-        bucket.bounds = union_box(bucket.bounds, elem_info.bounds);
-        bucket.centroid_bounds = union_box(bucket.centroid_bounds, centroid);
+        for(uint8_t ax = axis_begin; ax < axis_end; ++ax) {
+          uint32_t bucket_idx = Bvh::get_sah_bucket_idx(
+              ctx.opts, binning, centroid, ax);
+          auto& bucket = buckets.at(ax * bucket_count + bucket_idx);
+          bucket.count += 1;
+          bucket.bounds = union_box(bucket.bounds, elem_info.bounds);
+          bucket.centroid_bounds = union_box(bucket.centroid_bounds, centroid);
+        }
       }
       job_buckets.at(job) = std::move(buckets);
     });
 
-    std::vector<BucketInfo> buckets(bucket_count);
+    auto& buckets = binning.buckets;
+    buckets.resize(3 * bucket_count);
     for(uint32_t j = 0; j < jobs; ++j) {
       for(uint32_t b = 0; b < buckets.size(); ++b) {
         auto& bucket = buckets.at(b);
@@ -325,66 +461,585 @@ namespace dort {
       }
     }
 
-    Box prefix_bounds;
-    uint32_t prefix_count = 0;
-    for(uint32_t b = 0; b < buckets.size(); ++b) {
-      prefix_bounds = union_box(prefix_bounds, buckets.at(b).bounds);
-      prefix_count += buckets.at(b).count;
-      buckets.at(b).prefix_bounds = prefix_bounds;
-      buckets.at(b).prefix_count = prefix_count;
-    }
+    binning.cost = INFINITY;
+    binning.axis = axis;
+    binning.bucket = 0;
+    for(uint8_t ax = axis_begin; ax < axis_end; ++ax) {
+      uint32_t axis_offset = ax * bucket_count;
 
-    Box postfix_bounds;
-    for(uint32_t b = buckets.size(); b-- > 0; ) {
-      buckets.at(b).postfix_bounds = postfix_bounds;
-      postfix_bounds = union_box(postfix_bounds, buckets.at(b).bounds);
-    }
+      Box prefix_bounds;
+      uint32_t prefix_count = 0;
+      for(uint32_t b = 0; b < bucket_count; ++b) {
+        auto& bucket = buckets.at(axis_offset + b);
+        prefix_bounds = union_box(prefix_bounds, bucket.bounds);
+        prefix_count += bucket.count;
+        bucket.prefix_bounds = prefix_bounds;
+        bucket.prefix_count = prefix_count;
+      }
+
+      Box postfix_bounds;
+      for(uint32_t b = bucket_count; b-- > 0; ) {
+        auto& bucket = buckets.at(axis_offset + b);
+        bucket.postfix_bounds = postfix_bounds;
+        postfix_bounds = union_box(postfix_bounds, bucket.bounds);
+      }
 
-    int32_t best_cost = Bvh::sah_split_cost(node.centroid_bounds,
-        buckets.at(0), end - begin);
-    uint32_t best_bucket = 0;
-    for(uint32_t b = 1; b < buckets.size() - 1; ++b) {
-      int32_t cost = Bvh::sah_split_cost(node.centroid_bounds,
-          buckets.at(b), end - begin);
-      if(cost < best_cost) {
-        best_cost = cost;
-        best_bucket = b;
+      for(uint32_t b = 0; b + 1 < bucket_count; ++b) {
+        float cost = Bvh::sah_split_cost(ctx.opts, node.bounds,
+            buckets.at(axis_offset + b), end - begin);
+        if(cost < binning.cost) {
+          binning.cost = cost;
+          binning.axis = ax;
+          binning.bucket = b;
+        }
       }
     }
 
-    int32_t leaf_cost = SAH_INTERSECTION_COST * (end - begin);
-    float separator = float(best_bucket + 1) / float(buckets.size()) * extent 
-      + bounds_min;
+    return binning;
+  }
 
+  template<class R>
+  typename Bvh<R>::SplitInfo Bvh<R>::apply_sah_binning(BuildCtx& ctx,
+      const NodeInfo& node, const SahBinning& binning, bool parallel)
+  {
+    uint32_t begin = node.begin;
+    uint32_t end = node.end;
+    uint32_t bucket_count = ctx.opts.sah_bucket_count;
+    float leaf_cost = ctx.opts.sah_intersection_cost * float(end - begin);
+
+    // the elements are partitioned using the same bucket indices that were
+    // used to compute the bounds, so that the bounds are exact
     SplitInfo split;
-    split.prefer_leaf = leaf_cost < best_cost;
-    split.mid = Bvh::partition(ctx,
-        parallel, begin, end, axis, separator);
+    split.axis = binning.axis;
+    split.prefer_leaf = !(binning.cost < leaf_cost);
+    split.mid = Bvh::partition(ctx, parallel, begin, end,
+        [&](const ElementInfo& info) {
+          return Bvh::get_sah_bucket_idx(ctx.opts, binning,
+              info.bounds.centroid(), binning.axis) <= binning.bucket;
+        });
+    split.right_begin = split.mid;
+    split.right_end = end;
 
-    for(uint32_t b = 0; b < buckets.size(); ++b) {
-      if(b <= best_bucket) {
-        split.left_bounds = union_box(split.left_bounds, buckets.at(b).bounds);
+    uint32_t axis_offset = binning.axis * bucket_count;
+    for(uint32_t b = 0; b < bucket_count; ++b) {
+      auto& bucket = binning.buckets.at(axis_offset + b);
+      if(b <= binning.bucket) {
+        split.left_bounds = union_box(split.left_bounds, bucket.bounds);
         split.left_centroid_bounds = union_box(split.left_centroid_bounds,
-            buckets.at(b).centroid_bounds);
+            bucket.centroid_bounds);
       } else {
-        split.right_bounds = union_box(split.right_bounds, buckets.at(b).bounds);
+        split.right_bounds = union_box(split.right_bounds, bucket.bounds);
         split.right_centroid_bounds = union_box(split.right_centroid_bounds,
-            buckets.at(b).centroid_bounds);
+            bucket.centroid_bounds);
+      }
+    }
+
+    // a split with a single element on one side is a valid SAH split; only
+    // when all elements fall into one bucket (all centroids coincide on the
+    // axis) do we split at the median, with the real bounds of the children
+    if(split.mid == begin || split.mid == end) {
+      split.mid = split.right_begin = begin + (end - begin) / 2;
+      Bvh::compute_split_bounds(ctx, split, begin, end, parallel);
+    }
+
+    return split;
+  }
+
+  template<class R>
+  uint32_t Bvh<R>::get_sah_bucket_idx(const BvhOpts& opts,
+      const SahBinning& binning, const Point& centroid, uint8_t axis)
+  {
+    float elem_pos = centroid.v[axis] - binning.bounds_min[axis];
+    return uint32_t(clamp(floor_int32(elem_pos * binning.bucket_scale[axis]),
+          0, int32_t(opts.sah_bucket_count) - 1));
+  }
+
+  template<class R>
+  typename Bvh<R>::SplitInfo Bvh<R>::split_spatial(BuildCtx& ctx,
+      const NodeInfo& node, bool parallel)
+  {
+    StatTimer t(TIMER_BVH_SPLIT_SPATIAL);
+    using SpatialSplits = std::integral_constant<bool, R::SPATIAL_SPLITS>;
+    uint32_t begin = node.begin;
+    uint32_t end = node.end;
+    uint32_t elem_count = end - begin;
+    uint32_t bin_count = ctx.opts.sah_bucket_count;
+    SahBinning binning = Bvh::bin_sah(ctx, node, 0, true, parallel);
+
+    // spatial splits are only considered when the children of the best object
+    // split overlap significantly (relative to the whole tree) and there is
+    // some free space for the duplicated references
+    float overlap_area = INFINITY;
+    if(binning.cost < INFINITY) {
+      const auto& bucket = binning.buckets.at(
+          binning.axis * bin_count + binning.bucket);
+      float e[3];
+      for(uint8_t ax = 0; ax < 3; ++ax) {
+        e[ax] = max(0.f,
+            min(bucket.prefix_bounds.p_max.v[ax], bucket.postfix_bounds.p_max.v[ax]) -
+            max(bucket.prefix_bounds.p_min.v[ax], bucket.postfix_bounds.p_min.v[ax]));
+      }
+      overlap_area = 2.f * (e[0] * e[1] + e[0] * e[2] + e[1] * e[2]);
+    }
+
+    bool try_spatial = node.reserved_end > end
+      && overlap_area > ctx.opts.spatial_split_alpha * ctx.root_area;
+
+    float spatial_cost = INFINITY;
+    uint8_t spatial_axis = 0;
+    uint32_t spatial_bin = 0;
+    float bins_min[3];
+    float bin_scale[3];
+    float bin_width[3];
+    for(uint8_t ax = 0; ax < 3; ++ax) {
+      float extent = node.bounds.p_max.v[ax] - node.bounds.p_min.v[ax];
+      bins_min[ax] = node.bounds.p_min.v[ax];
+      bin_scale[ax] = extent > 0.f ? float(bin_count) / extent : 0.f;
+      bin_width[ax] = extent / float(bin_count);
+    }
+    auto get_bin_idx = [&](float pos, uint8_t ax) {
+      return uint32_t(clamp(floor_int32((pos - bins_min[ax]) * bin_scale[ax]),
+            0, int32_t(bin_count) - 1));
+    };
+
+    if(try_spatial) {
+      uint32_t jobs = !parallel ? 1
+        : std::max(ctx.pool.thread_count(),
+            elem_count / ctx.opts.min_split_elems_per_thread);
+
+      std::vector<std::vector<SpatialBin>> job_bins(jobs);
+      parallel_for_or_serial(ctx.pool, !parallel, jobs, [&](uint32_t job) {
+        std::vector<SpatialBin> bins(3 * bin_count);
+        uint32_t job_begin = begin + uint64_t(elem_count) * job / jobs;
+        uint32_t job_end = begin + uint64_t(elem_count) * (job + 1) / jobs;
+        for(uint32_t i = job_begin; i < job_end; ++i) {
+          const auto& elem_info = ctx.build_infos.at(i);
+          const auto& elem = ctx.elems.at(elem_info.elem_index);
+          for(uint8_t ax = 0; ax < 3; ++ax) {
+            if(bin_scale[ax] == 0.f) {
+              continue;
+            }
+            uint32_t first_bin = get_bin_idx(elem_info.bounds.p_min.v[ax], ax);
+            uint32_t last_bin = get_bin_idx(elem_info.bounds.p_max.v[ax], ax);
+            bins.at(ax * bin_count + first_bin).entry_count += 1;
+            bins.at(ax * bin_count + last_bin).exit_count += 1;
+
+            if(first_bin == last_bin) {
+              auto& bin = bins.at(ax * bin_count + first_bin);
+              bin.bounds = union_box(bin.bounds, elem_info.bounds);
+              continue;
+            }
+
+            for(uint32_t b = first_bin; b <= last_bin; ++b) {
+              Box clip = elem_info.bounds;
+              if(b != first_bin) {
+                clip.p_min.v[ax] = bins_min[ax] + float(b) * bin_width[ax];
+              }
+              if(b != last_bin) {
+                clip.p_max.v[ax] = bins_min[ax] + float(b + 1) * bin_width[ax];
+              }
+              auto& bin = bins.at(ax * bin_count + b);
+              bin.bounds = union_box(bin.bounds, get_clipped_elem_bounds<R>(
+                    SpatialSplits(), ctx.traits_arg, elem, clip));
+            }
+          }
+        }
+        job_bins.at(job) = std::move(bins);
+      });
+
+      std::vector<SpatialBin> bins(3 * bin_count);
+      for(uint32_t j = 0; j < jobs; ++j) {
+        for(uint32_t b = 0; b < bins.size(); ++b) {
+          auto& bin = bins.at(b);
+          auto& job_bin = job_bins.at(j).at(b);
+          bin.entry_count += job_bin.entry_count;
+          bin.exit_count += job_bin.exit_count;
+          bin.bounds = union_box(bin.bounds, job_bin.bounds);
+        }
       }
+
+      float node_area = node.bounds.area();
+      uint32_t ref_capacity = node.reserved_end - begin;
+      std::vector<Box> postfix_bounds(bin_count);
+      std::vector<uint32_t> postfix_counts(bin_count);
+      for(uint8_t ax = 0; ax < 3; ++ax) {
+        if(bin_scale[ax] == 0.f) {
+          continue;
+        }
+        uint32_t axis_offset = ax * bin_count;
+
+        Box bounds_r;
+        uint32_t count_r = 0;
+        for(uint32_t b = bin_count; b-- > 0; ) {
+          bounds_r = union_box(bounds_r, bins.at(axis_offset + b).bounds);
+          count_r += bins.at(axis_offset + b).exit_count;
+          postfix_bounds.at(b) = bounds_r;
+          postfix_counts.at(b) = count_r;
+        }
+
+        Box bounds_l;
+        uint32_t count_l = 0;
+        for(uint32_t b = 0; b + 1 < bin_count; ++b) {
+          bounds_l = union_box(bounds_l, bins.at(axis_offset + b).bounds);
+          count_l += bins.at(axis_offset + b).entry_count;
+          count_r = postfix_counts.at(b + 1);
+          if(count_l == 0 || count_r == 0 || count_l + count_r > ref_capacity) {
+            continue;
+          }
+
+          float isects = (bounds_l.area() * float(count_l) +
+              postfix_bounds.at(b + 1).area() * float(count_r)) / node_area;
+          float cost = ctx.opts.sah_traversal_cost
+            + isects * ctx.opts.sah_intersection_cost;
+          if(cost < spatial_cost) {
+            spatial_cost = cost;
+            spatial_axis = ax;
+            spatial_bin = b;
+          }
+        }
+      }
+    }
+
+    float leaf_cost = ctx.opts.sah_intersection_cost * float(elem_count);
+    float best_cost = min(spatial_cost, binning.cost);
+    if(!(best_cost < leaf_cost) && elem_count <= ctx.opts.max_leaf_size) {
+      SplitInfo split = Bvh::apply_sah_binning(ctx, node, binning, parallel);
+      split.prefer_leaf = true;
+      return split;
     }
 
-    if(split.mid == begin || split.mid + 1 == end) {
-      split.mid = begin + (end - begin) / 2;
-      split.left_bounds = split.right_bounds = node.bounds;
-      split.left_centroid_bounds = split.right_centroid_bounds = node.centroid_bounds;
+    if(spatial_cost < binning.cost) {
+      // distribute the references to the left and right child, references
+      // that straddle the split plane are clipped and put into both children
+      uint8_t axis = spatial_axis;
+      float plane = bins_min[axis] + float(spatial_bin + 1) * bin_width[axis];
+      uint32_t jobs = !parallel ? 1
+        : std::max(ctx.pool.thread_count(),
+            elem_count / ctx.opts.min_split_elems_per_thread);
+
+      std::vector<std::vector<ElementInfo>> job_left_infos(jobs);
+      std::vector<std::vector<ElementInfo>> job_right_infos(jobs);
+      std::vector<SplitInfo> job_splits(jobs);
+      parallel_for_or_serial(ctx.pool, !parallel, jobs, [&](uint32_t job) {
+        uint32_t job_begin = begin + uint64_t(elem_count) * job / jobs;
+        uint32_t job_end = begin + uint64_t(elem_count) * (job + 1) / jobs;
+        auto& left_infos = job_left_infos.at(job);
+        auto& right_infos = job_right_infos.at(job);
+        auto& job_split = job_splits.at(job);
+
+        auto push_left = [&](const ElementInfo& info) {
+          left_infos.push_back(info);
+          job_split.left_bounds = union_box(job_split.left_bounds, info.bounds);
+          job_split.left_centroid_bounds = union_box(
+              job_split.left_centroid_bounds, info.bounds.centroid());
+        };
+        auto push_right = [&](const ElementInfo& info) {
+          right_infos.push_back(info);
+          job_split.right_bounds = union_box(job_split.right_bounds, info.bounds);
+          job_split.right_centroid_bounds = union_box(
+              job_split.right_centroid_bounds, info.bounds.centroid());
+        };
+
+        for(uint32_t i = job_begin; i < job_end; ++i) {
+          const auto& elem_info = ctx.build_infos.at(i);
+          uint32_t first_bin = get_bin_idx(elem_info.bounds.p_min.v[axis], axis);
+          uint32_t last_bin = get_bin_idx(elem_info.bounds.p_max.v[axis], axis);
+          if(last_bin <= spatial_bin) {
+            push_left(elem_info);
+          } else if(first_bin > spatial_bin) {
+            push_right(elem_info);
+          } else {
+            const auto& elem = ctx.elems.at(elem_info.elem_index);
+            Box left_clip = elem_info.bounds;
+            Box right_clip = elem_info.bounds;
+            left_clip.p_max.v[axis] = plane;
+            right_clip.p_min.v[axis] = plane;
+            Box left_bounds = get_clipped_elem_bounds<R>(
+                SpatialSplits(), ctx.traits_arg, elem, left_clip);
+            Box right_bounds = get_clipped_elem_bounds<R>(
+                SpatialSplits(), ctx.traits_arg, elem, right_clip);
+            if(is_finite(left_bounds)) {
+              push_left(ElementInfo { elem_info.elem_index, left_bounds });
+            }
+            if(is_finite(right_bounds)) {
+              push_right(ElementInfo { elem_info.elem_index, right_bounds });
+            }
+          }
+        }
+      });
+
+      uint32_t count_l = 0;
+      uint32_t count_r = 0;
+      SplitInfo split;
+      for(uint32_t j = 0; j < jobs; ++j) {
+        count_l += job_left_infos.at(j).size();
+        count_r += job_right_infos.at(j).size();
+        const auto& job_split = job_splits.at(j);
+        split.left_bounds = union_box(split.left_bounds, job_split.left_bounds);
+        split.left_centroid_bounds = union_box(split.left_centroid_bounds,
+            job_split.left_centroid_bounds);
+        split.right_bounds = union_box(split.right_bounds, job_split.right_bounds);
+        split.right_centroid_bounds = union_box(split.right_centroid_bounds,
+            job_split.right_centroid_bounds);
+      }
+
+      // the clipping may leave one of the sides empty, in which case we
+      // fall back to the object split
+      uint32_t ref_capacity = node.reserved_end - begin;
+      if(count_l != 0 && count_r != 0 && count_l + count_r <= ref_capacity) {
+        uint32_t reserve = ref_capacity - count_l - count_r;
+        uint32_t reserve_l = uint64_t(reserve) * count_l / (count_l + count_r);
+        split.axis = axis;
+        split.prefer_leaf = false;
+        split.mid = begin + count_l;
+        split.right_begin = split.mid + reserve_l;
+        split.right_end = split.right_begin + count_r;
+
+        uint32_t left_offset = begin;
+        uint32_t right_offset = split.right_begin;
+        for(uint32_t j = 0; j < jobs; ++j) {
+          std::copy(job_left_infos.at(j).begin(), job_left_infos.at(j).end(),
+              ctx.build_infos.begin() + left_offset);
+          std::copy(job_right_infos.at(j).begin(), job_right_infos.at(j).end(),
+              ctx.build_infos.begin() + right_offset);
+          left_offset += job_left_infos.at(j).size();
+          right_offset += job_right_infos.at(j).size();
+        }
+
+        stat_sample_int(DISTRIB_INT_BVH_SPLIT_SPATIAL_DUPLICATES,
+            count_l + count_r - elem_count);
+        return split;
+      }
     }
 
+    SplitInfo split = Bvh::apply_sah_binning(ctx, node, binning, parallel);
+    split.prefer_leaf = false;
+    Bvh::distribute_reserve(ctx, node, split);
     return split;
   }
 
   template<class R>
+  void Bvh<R>::distribute_reserve(BuildCtx& ctx, const NodeInfo& node,
+      SplitInfo& split)
+  {
+    // divide the free space after the node between the children, in proportion
+    // to the number of their references
+    uint32_t reserve = node.reserved_end - node.end;
+    if(reserve == 0) {
+      return;
+    }
+
+    uint32_t count_l = split.mid - node.begin;
+    uint32_t count_r = node.end - split.mid;
+    uint32_t reserve_l = uint64_t(reserve) * count_l / (count_l + count_r);
+    std::move_backward(
+        ctx.build_infos.begin() + split.mid,
+        ctx.build_infos.begin() + node.end,
+        ctx.build_infos.begin() + node.end + reserve_l);
+    split.right_begin = split.mid + reserve_l;
+    split.right_end = node.end + reserve_l;
+  }
+
+  template<class R>
+  void Bvh<R>::compact_ordered_elems(BuildCtx& ctx) {
+    // with spatial splits, the leaves do not cover the whole array of
+    // elements, so we move them together to close the gaps
+    std::vector<uint32_t> leaf_idxs;
+    for(uint32_t i = 0; i < ctx.linear_nodes.size(); ++i) {
+      if(ctx.linear_nodes.at(i).elem_count_or_zero != 0) {
+        leaf_idxs.push_back(i);
+      }
+    }
+    std::sort(leaf_idxs.begin(), leaf_idxs.end(), [&](uint32_t i1, uint32_t i2) {
+      return ctx.linear_nodes.at(i1).elem_offset_or_left_child <
+        ctx.linear_nodes.at(i2).elem_offset_or_left_child;
+    });
+
+    uint32_t free_offset = 0;
+    for(uint32_t leaf_idx: leaf_idxs) {
+      LinearNode& leaf = ctx.linear_nodes.at(leaf_idx);
+      for(uint32_t i = 0; i < leaf.elem_count_or_zero; ++i) {
+        ctx.ordered_elems.at(free_offset + i) = std::move(
+            ctx.ordered_elems.at(leaf.elem_offset_or_left_child + i));
+      }
+      leaf.elem_offset_or_left_child = free_offset;
+      free_offset += leaf.elem_count_or_zero;
+    }
+
+    ctx.ordered_elems.resize(free_offset);
+    ctx.ordered_elems.shrink_to_fit();
+  }
+
+  template<class R>
+  void Bvh<R>::build_lbvh(BuildCtx& ctx, const Box& centroid_bounds) {
+    std::vector<uint32_t> codes = Bvh::sort_morton_codes(ctx, centroid_bounds);
+    StatTimer t(TIMER_BVH_LBVH_EMIT);
+    Bvh::build_lbvh_node(ctx, codes, 0, ctx.build_infos.size(), 0);
+  }
+
+  template<class R>
+  std::vector<uint32_t> Bvh<R>::sort_morton_codes(BuildCtx& ctx,
+      const Box& centroid_bounds)
+  {
+    uint32_t elem_count = ctx.build_infos.size();
+    uint32_t jobs = std::min(ctx.pool.thread_count(),
+        std::max(1u, elem_count / ctx.opts.min_elem_infos_per_thread));
+    auto job_begin = [&](uint32_t job) {
+      return uint32_t(uint64_t(job) * elem_count / jobs);
+    };
+
+    // the keys contain the 30-bit Morton code of the centroid in the upper half
+    // and the index of the build info in the lower half
+    std::vector<uint64_t> keys(elem_count);
+    {
+      StatTimer t(TIMER_BVH_LBVH_MORTON);
+      float scale[3];
+      for(uint8_t axis = 0; axis < 3; ++axis) {
+        float extent = centroid_bounds.p_max.v[axis] - centroid_bounds.p_min.v[axis];
+        scale[axis] = extent > 0.f ? 1024.f / extent : 0.f;
+      }
+
+      parallel_for(ctx.pool, elem_count, ctx.opts.min_elem_infos_per_thread,
+          [&](uint32_t i) {
+        Point centroid = ctx.build_infos.at(i).bounds.centroid();
+        uint32_t code = 0;
+        for(uint8_t axis = 0; axis < 3; ++axis) {
+          float pos = (centroid.v[axis] - centroid_bounds.p_min.v[axis])
+            * scale[axis];
+          uint32_t cell = uint32_t(clamp(pos, 0.f, 1023.f));
+          code |= expand_morton_bits(cell) << (2 - axis);
+        }
+        keys.at(i) = (uint64_t(code) << 32) | uint64_t(i);
+      });
+    }
+
+    {
+      // parallel LSD radix sort on the codes; every job scatters its range of
+      // keys in order, so the sort is stable
+      StatTimer t(TIMER_BVH_LBVH_SORT);
+      const uint32_t DIGIT_BITS = 10;
+      const uint32_t DIGIT_COUNT = 1 << DIGIT_BITS;
+      std::vector<uint64_t> sorted_keys(elem_count);
+      std::vector<uint32_t> job_offsets(jobs * DIGIT_COUNT);
+      for(uint32_t shift = 32; shift < 62; shift += DIGIT_BITS) {
+        auto get_digit = [&](uint64_t key) {
+          return uint32_t(key >> shift) & (DIGIT_COUNT - 1);
+        };
+
+        std::fill(job_offsets.begin(), job_offsets.end(), 0);
+        parallel_for(ctx.pool, jobs, [&](uint32_t job) {
+          uint32_t* counts = &job_offsets.at(job * DIGIT_COUNT);
+          for(uint32_t i = job_begin(job); i < job_begin(job + 1); ++i) {
+            counts[get_digit(keys.at(i))] += 1;
+          }
+        });
+
+        uint32_t offset = 0;
+        for(uint32_t digit = 0; digit < DIGIT_COUNT; ++digit) {
+          for(uint32_t job = 0; job < jobs; ++job) {
+            uint32_t count = job_offsets.at(job * DIGIT_COUNT + digit);
+            job_offsets.at(job * DIGIT_COUNT + digit) = offset;
+            offset += count;
+          }
+        }
+
+        parallel_for(ctx.pool, jobs, [&](uint32_t job) {
+          uint32_t* offsets = &job_offsets.at(job * DIGIT_COUNT);
+          for(uint32_t i = job_begin(job); i < job_begin(job + 1); ++i) {
+            uint64_t key = keys.at(i);
+            sorted_keys.at(offsets[get_digit(key)]++) = key;
+          }
+        });
+        std::swap(keys, sorted_keys);
+      }
+    }
+
+    std::vector<ElementInfo> sorted_infos(elem_count);
+    std::vector<uint32_t> codes(elem_count);
+    parallel_for(ctx.pool, elem_count, ctx.opts.min_elem_infos_per_thread,
+        [&](uint32_t i) {
+      uint64_t key = keys.at(i);
+      sorted_infos.at(i) = ctx.build_infos.at(uint32_t(key));
+      codes.at(i) = uint32_t(key >> 32);
+    });
+    ctx.build_infos = std::move(sorted_infos);
+    return codes;
+  }
+
+  template<class R>
+  Box Bvh<R>::build_lbvh_node(BuildCtx& ctx, const std::vector<uint32_t>& codes,
+      uint32_t begin, uint32_t end, uint32_t linear_idx)
+  {
+    uint32_t elem_count = end - begin;
+    if(elem_count <= ctx.opts.lbvh_sah_cluster_size
+        && elem_count > ctx.opts.leaf_size)
+    {
+      // the small clusters of elements that are close in the Morton order are
+      // refined by the usual (serial) SAH build
+      Box bounds, centroid_bounds;
+      for(uint32_t i = begin; i < end; ++i) {
+        bounds = union_box(bounds, ctx.build_infos.at(i).bounds);
+        centroid_bounds = union_box(centroid_bounds,
+            ctx.build_infos.at(i).bounds.centroid());
+      }
+      NodeInfo node { bounds, centroid_bounds, begin, end, end, linear_idx };
+      Bvh::build_node(ctx, node, false);
+      return bounds;
+    }
+
+    if(elem_count <= ctx.opts.leaf_size) {
+      LinearNode leaf {};
+      for(uint32_t i = begin; i < end; ++i) {
+        uint32_t elem_idx = ctx.build_infos.at(i).elem_index;
+        place_elem(std::integral_constant<bool, R::SPATIAL_SPLITS>(),
+            ctx.ordered_elems.at(i), ctx.elems.at(elem_idx));
+        leaf.bounds = union_box(leaf.bounds, ctx.build_infos.at(i).bounds);
+      }
+      leaf.elem_offset_or_left_child = begin;
+      leaf.elem_count_or_zero = elem_count;
+      leaf.axis = 0;
+      ctx.linear_nodes.at(linear_idx) = leaf;
+      return leaf.bounds;
+    }
+
+    // split at the highest bit in which the codes of the node differ; the codes
+    // are sorted, so the elements with this bit unset come first
+    uint32_t mid;
+    uint8_t axis;
+    uint32_t diff = codes.at(begin) ^ codes.at(end - 1);
+    if(diff == 0) {
+      mid = begin + elem_count / 2;
+      axis = 0;
+    } else {
+      uint32_t bit = 31 - __builtin_clz(diff);
+      mid = std::partition_point(codes.begin() + begin, codes.begin() + end,
+          [&](uint32_t code) { return (code & (1u << bit)) == 0; })
+        - codes.begin();
+      axis = 2 - bit % 3;
+    }
+
+    uint32_t left_idx = ctx.free_linear_idx.fetch_add(2);
+    Box child_bounds[2];
+    bool serial = elem_count < ctx.opts.min_elem_infos_per_thread;
+    parallel_for_or_serial(ctx.pool, serial, 2, [&](uint32_t child) {
+      child_bounds[child] = child == 0
+        ? Bvh::build_lbvh_node(ctx, codes, begin, mid, left_idx)
+        : Bvh::build_lbvh_node(ctx, codes, mid, end, left_idx + 1);
+    });
+
+    LinearNode branch {};
+    branch.bounds = union_box(child_bounds[0], child_bounds[1]);
+    branch.elem_offset_or_left_child = left_idx;
+    branch.elem_count_or_zero = 0;
+    branch.axis = axis;
+    ctx.linear_nodes.at(linear_idx) = branch;
+    return branch.bounds;
+  }
+
+  template<class R>
+  template<class P>
   uint32_t Bvh<R>::partition(BuildCtx& ctx, bool parallel,
-      uint32_t begin, uint32_t end, uint8_t axis, float separator)
+      uint32_t begin, uint32_t end, P predicate)
   {
     StatTimer t(parallel
         ? TIMER_BVH_BUILD_PARTITION_PARALLEL
@@ -392,90 +1047,642 @@ namespace dort {
     auto mid = std::partition(
         ctx.build_infos.begin() + begin,
         ctx.build_infos.begin() + end,
-        [&](const ElementInfo& info) {
-          return info.bounds.centroid().v[axis] < separator;
-        });
+        predicate);
     return mid - ctx.build_infos.begin();
   }
 
   template<class R>
-  int32_t Bvh<R>::sah_split_cost(const Box& centroid_bounds,
+  float Bvh<R>::sah_split_cost(const BvhOpts& opts, const Box& bounds,
       const BucketInfo& bucket, uint32_t elem_count)
   {
     uint32_t count_l = bucket.prefix_count;
     uint32_t count_r = elem_count - count_l;
     if(count_l == 0 || count_r == 0) {
-      return INT32_MAX;
+      return INFINITY;
     }
 
+    float area = bounds.area();
     float area_l = bucket.prefix_bounds.area();
     float area_r = bucket.postfix_bounds.area();
-    float isects = (area_l * float(count_l) + area_r * float(count_r)) /
-      centroid_bounds.area();
-    return SAH_TRAVERSAL_COST + floor_int32(isects * float(SAH_INTERSECTION_COST));
+    float isects = area > 0.f
+      ? (area_l * float(count_l) + area_r * float(count_r)) / area
+      : float(elem_count);
+    return opts.sah_traversal_cost + isects * opts.sah_intersection_cost;
   }
 
   template<class R>
-  void Bvh<R>::traverse_elems(const Ray& ray,
-      std::function<bool(const Element&)> callback) const 
+  template<uint32_t N>
+  std::vector<typename Bvh<R>::template WideNode<N>> Bvh<R>::collapse_wide(
+      const std::vector<LinearNode>& linear_nodes)
   {
-    Vector inv_dir(1.f / ray.dir.v.x, 1.f / ray.dir.v.y, 1.f / ray.dir.v.z);
-    bool dir_is_neg[] = { ray.dir.v.x < 0.f, ray.dir.v.y < 0.f, ray.dir.v.z < 0.f };
-
-    std::array<uint32_t, 64> todo_stack;
-    uint32_t todo_top = 0;
-    uint32_t todo_index = 0;
-    uint32_t traversed = 0;
-    for(;;) {
-      StatTimer t_node(TIMER_BVH_TRAVERSE_NODE);
-      const LinearNode& linear_node = this->linear_nodes.at(todo_index);
-      traversed += 1;
-
-      stat_count(COUNTER_BVH_FAST_BOX_INTERSECT_P);
-      if(linear_node.bounds.fast_hit_p(ray, inv_dir, dir_is_neg)) {
-        stat_count(COUNTER_BVH_FAST_BOX_INTERSECT_P_HIT);
-        if(linear_node.elem_count_or_zero == 0) {
-          uint32_t left_child = linear_node.elem_offset_or_left_child;
-          uint32_t right_child = left_child + 1;
-          if(dir_is_neg[linear_node.axis]) {
-            todo_stack.at(todo_top++) = left_child;
-            todo_index = right_child;
+    StatTimer t(TIMER_BVH_COLLAPSE_WIDE);
+    std::vector<WideNode<N>> wide_nodes;
+    std::vector<std::pair<uint32_t, uint32_t>> todo;
+    wide_nodes.emplace_back();
+    todo.push_back(std::make_pair(0, 0));
+
+    while(!todo.empty()) {
+      uint32_t linear_idx = todo.back().first;
+      uint32_t wide_idx = todo.back().second;
+      todo.pop_back();
+
+      // gather the children of the wide node by repeatedly opening the inner
+      // child with the largest surface area
+      std::array<uint32_t, N> children;
+      uint32_t child_count = 0;
+      const LinearNode& linear_node = linear_nodes.at(linear_idx);
+      if(linear_node.elem_count_or_zero != 0) {
+        children.at(child_count++) = linear_idx;
+      } else {
+        children.at(child_count++) = linear_node.elem_offset_or_left_child;
+        children.at(child_count++) = linear_node.elem_offset_or_left_child + 1;
+      }
+
+      while(child_count < N) {
+        uint32_t open_i = N;
+        float open_area = -INFINITY;
+        for(uint32_t i = 0; i < child_count; ++i) {
+          const LinearNode& child = linear_nodes.at(children.at(i));
+          if(child.elem_count_or_zero == 0 && child.bounds.area() > open_area) {
+            open_i = i;
+            open_area = child.bounds.area();
+          }
+        }
+        if(open_i == N) {
+          break;
+        }
+
+        uint32_t left_child = linear_nodes.at(children.at(open_i))
+          .elem_offset_or_left_child;
+        children.at(open_i) = left_child;
+        children.at(child_count++) = left_child + 1;
+      }
+
+      WideNode<N> wide_node;
+      wide_node.child_count = child_count;
+      for(uint32_t i = 0; i < N; ++i) {
+        Box bounds;
+        uint32_t elem_offset_or_child = 0;
+        uint16_t elem_count_or_zero = 0;
+        if(i < child_count) {
+          const LinearNode& child = linear_nodes.at(children.at(i));
+          bounds = child.bounds;
+          if(child.elem_count_or_zero != 0) {
+            elem_offset_or_child = child.elem_offset_or_left_child;
+            elem_count_or_zero = child.elem_count_or_zero;
           } else {
-            todo_stack.at(todo_top++) = right_child;
-            todo_index = left_child;
+            elem_offset_or_child = wide_nodes.size();
+            wide_nodes.emplace_back();
+            todo.push_back(std::make_pair(children.at(i), elem_offset_or_child));
           }
-          continue;
         }
 
-        t_node.stop();
-        for(uint32_t i = 0; i < linear_node.elem_count_or_zero; ++i) {
-          StatTimer t_elem(TIMER_BVH_TRAVERSE_ELEM);
-          uint32_t elem_idx = linear_node.elem_offset_or_left_child + i;
-          const auto& elem = this->ordered_elems.at(elem_idx);
-          if(!callback(elem)) {
-            stat_sample_int(DISTRIB_INT_BVH_TRAVERSE_COUNT, traversed);
-            return;
+        for(uint32_t axis = 0; axis < 3; ++axis) {
+          wide_node.bounds[axis][0][i] = bounds.p_min.v[axis];
+          wide_node.bounds[axis][1][i] = bounds.p_max.v[axis];
+        }
+        wide_node.elem_offset_or_child[i] = elem_offset_or_child;
+        wide_node.elem_count_or_zero[i] = elem_count_or_zero;
+      }
+      wide_nodes.at(wide_idx) = wide_node;
+    }
+
+    wide_nodes.shrink_to_fit();
+    return wide_nodes;
+  }
+
+  template<class R>
+  template<class Q>
+  typename Bvh<R>::template QuantNodeVector<Q> Bvh<R>::quantize_wide(
+      const std::vector<WideNode<4>>& wide_nodes)
+  {
+    StatTimer t(TIMER_BVH_QUANTIZE_WIDE);
+    QuantNodeVector<Q> quant_nodes(wide_nodes.size());
+
+    for(uint32_t node_i = 0; node_i < wide_nodes.size(); ++node_i) {
+      Bvh::quantize_node(wide_nodes.at(node_i), quant_nodes.at(node_i));
+    }
+
+    return quant_nodes;
+  }
+
+  template<class R>
+  template<class Q>
+  void Bvh<R>::quantize_node(const WideNode<4>& wide_node,
+      QuantNode<Q>& quant_node)
+  {
+    constexpr uint32_t q_max = std::numeric_limits<Q>::max();
+    quant_node.child_count = wide_node.child_count;
+    for(uint32_t i = 0; i < 4; ++i) {
+      quant_node.elem_offset_or_child[i] = wide_node.elem_offset_or_child[i];
+      quant_node.elem_count_or_zero[i] = wide_node.elem_count_or_zero[i];
+    }
+
+    for(uint32_t axis = 0; axis < 3; ++axis) {
+      float origin = INFINITY;
+      float extent_max = -INFINITY;
+      for(uint32_t i = 0; i < wide_node.child_count; ++i) {
+        origin = min(origin, wide_node.bounds[axis][0][i]);
+        extent_max = max(extent_max, wide_node.bounds[axis][1][i]);
+      }
+      quant_node.origin[axis] = origin;
+
+      // find the smallest power-of-two scale such that all children can be
+      // represented; the decoding must be computed exactly as in
+      // load_bounds(), so that the rounding is conservative
+      int32_t exp = -126;
+      float extent = extent_max - origin;
+      if(extent > 0.f) {
+        exp = max(-126, ilogb(extent / float(q_max)));
+      }
+
+      for(;; ++exp) {
+        assert(exp <= 127);
+        float scale = ldexp(1.f, exp);
+        auto decode = [&](uint32_t q) { return float(q) * scale + origin; };
+        bool fits = true;
+        for(uint32_t i = 0; i < 4 && fits; ++i) {
+          if(i >= wide_node.child_count) {
+            quant_node.bounds[axis][0][i] = q_max;
+            quant_node.bounds[axis][1][i] = 0;
+            continue;
+          }
+
+          float child_min = wide_node.bounds[axis][0][i];
+          float child_max = wide_node.bounds[axis][1][i];
+          float q_min = max(0.f, floor((child_min - origin) / scale));
+          float q_max_f = ceil((child_max - origin) / scale);
+          if(q_max_f > float(q_max)) {
+            fits = false;
+            break;
           }
+
+          uint32_t q_lo = uint32_t(min(q_min, float(q_max)));
+          uint32_t q_hi = uint32_t(q_max_f);
+          while(q_lo > 0 && decode(q_lo) > child_min) {
+            q_lo -= 1;
+          }
+          while(q_hi < q_max && decode(q_hi) < child_max) {
+            q_hi += 1;
+          }
+          fits = decode(q_lo) <= child_min && decode(q_hi) >= child_max;
+          quant_node.bounds[axis][0][i] = q_lo;
+          quant_node.bounds[axis][1][i] = q_hi;
+        }
+
+        if(fits) {
+          break;
         }
       }
+      quant_node.scale_exp[axis] = exp;
+    }
+  }
+
+  template<class R>
+  void Bvh<R>::refit(TraitsArg arg, ThreadPool& pool, float rebuild_threshold) {
+    StatTimer t(TIMER_BVH_REFIT);
+    if(this->ordered_elems.empty()) {
+      return;
+    }
+
+    if(!this->wide4_nodes.empty()) {
+      this->refit_layout(&Bvh::wide4_nodes, arg, pool, rebuild_threshold);
+    } else if(!this->wide8_nodes.empty()) {
+      this->refit_layout(&Bvh::wide8_nodes, arg, pool, rebuild_threshold);
+    } else if(!this->quant8_nodes.empty()) {
+      this->refit_layout(&Bvh::quant8_nodes, arg, pool, rebuild_threshold);
+    } else if(!this->quant16_nodes.empty()) {
+      this->refit_layout(&Bvh::quant16_nodes, arg, pool, rebuild_threshold);
+    } else {
+      this->refit_layout(&Bvh::linear_nodes, arg, pool, rebuild_threshold);
+    }
+  }
+
+  template<class R>
+  template<class Nodes>
+  void Bvh<R>::refit_layout(Nodes Bvh::* nodes_member, TraitsArg arg,
+      ThreadPool& pool, float rebuild_threshold)
+  {
+    using Node = typename Nodes::value_type;
+    Nodes& nodes = this->*nodes_member;
+
+    // the subtrees below this depth are refitted serially
+    uint32_t parallel_depth = 0;
+    for(uint32_t jobs = 1; jobs < 4 * pool.thread_count(); jobs *= Node::WIDTH) {
+      parallel_depth += 1;
+    }
+
+    // the node bounds have not been modified since the build, so they give us
+    // the baseline costs
+    if(this->node_costs.size() != nodes.size()) {
+      this->node_costs.resize(nodes.size());
+      this->refit_node(nodes, 0, arg, pool, parallel_depth,
+          false, this->node_costs);
+    }
+
+    std::vector<float> costs(nodes.size());
+    this->root_bounds = this->refit_node(nodes, 0, arg, pool, parallel_depth,
+        true, costs);
+    if(!(rebuild_threshold > 0.f)) {
+      return;
+    }
+
+    std::vector<uint32_t> degraded;
+    this->collect_degraded(nodes, 0, costs, rebuild_threshold, degraded);
+    if(degraded.empty()) {
+      return;
+    }
+
+    StatTimer t_rebuild(TIMER_BVH_REFIT_REBUILD);
+    for(uint32_t node_idx: degraded) {
+      this->rebuild_subtree(nodes_member, node_idx, arg, pool);
+    }
 
-      if(todo_top == 0) {
-        break;
+    // the replaced subtrees are now unreachable, so we drop them and restart
+    // the cost baseline
+    nodes = Bvh::layout_nodes(nodes);
+    this->node_costs.assign(nodes.size(), 0.f);
+    this->refit_node(nodes, 0, arg, pool, parallel_depth,
+        false, this->node_costs);
+  }
+
+  template<class R>
+  template<class Nodes>
+  Box Bvh<R>::refit_node(Nodes& nodes, uint32_t node_idx, TraitsArg arg,
+      ThreadPool& pool, uint32_t parallel_depth, bool recompute,
+      std::vector<float>& out_costs)
+  {
+    using Node = typename Nodes::value_type;
+    constexpr uint32_t N = Node::WIDTH;
+    Node& node = nodes.at(node_idx);
+    std::array<NodeItem, N> items;
+    uint32_t item_count = Bvh::get_node_items(node, items.data());
+
+    std::array<Box, N> item_bounds;
+    std::array<float, N> item_costs;
+    parallel_for_or_serial(pool, parallel_depth == 0, item_count, [&](uint32_t i) {
+      const NodeItem& item = items.at(i);
+      if(item.elem_count_or_zero != 0) {
+        Box bounds;
+        if(recompute) {
+          uint32_t end = item.elem_offset_or_node + item.elem_count_or_zero;
+          for(uint32_t j = item.elem_offset_or_node; j < end; ++j) {
+            bounds = union_box(bounds,
+                Bvh::get_elem_bounds(arg, this->ordered_elems.at(j)));
+          }
+        } else {
+          bounds = Bvh::get_item_bounds(node, i);
+        }
+        item_bounds.at(i) = bounds;
+        item_costs.at(i) = this->opts.sah_intersection_cost
+          * float(item.elem_count_or_zero);
+      } else {
+        uint32_t child_depth = parallel_depth > 0 ? parallel_depth - 1 : 0;
+        item_bounds.at(i) = this->refit_node(nodes, item.elem_offset_or_node,
+            arg, pool, child_depth, recompute, out_costs);
+        item_costs.at(i) = out_costs.at(item.elem_offset_or_node);
       }
-      todo_index = todo_stack.at(--todo_top);
+    });
+
+    Box bounds;
+    for(uint32_t i = 0; i < item_count; ++i) {
+      bounds = union_box(bounds, item_bounds.at(i));
+    }
+
+    float area = bounds.area();
+    float cost = this->opts.sah_traversal_cost;
+    for(uint32_t i = 0; i < item_count; ++i) {
+      float area_ratio = area > 0.f ? item_bounds.at(i).area() / area : 1.f;
+      cost += area_ratio * item_costs.at(i);
     }
+    out_costs.at(node_idx) = cost;
 
-    stat_sample_int(DISTRIB_INT_BVH_TRAVERSE_COUNT, traversed);
+    if(recompute) {
+      Bvh::set_node_bounds(node, item_bounds.data(), item_count);
+    }
+    return bounds;
   }
 
   template<class R>
-  Box Bvh<R>::bounds() const {
-    if(this->linear_nodes.empty()) {
+  template<class Nodes>
+  void Bvh<R>::collect_degraded(const Nodes& nodes, uint32_t node_idx,
+      const std::vector<float>& costs, float threshold,
+      std::vector<uint32_t>& out_degraded) const
+  {
+    if(costs.at(node_idx) > threshold * this->node_costs.at(node_idx)) {
+      out_degraded.push_back(node_idx);
+      return;
+    }
+
+    std::array<NodeItem, Nodes::value_type::WIDTH> items;
+    uint32_t item_count = Bvh::get_node_items(nodes.at(node_idx), items.data());
+    for(uint32_t i = 0; i < item_count; ++i) {
+      if(items.at(i).elem_count_or_zero == 0) {
+        this->collect_degraded(nodes, items.at(i).elem_offset_or_node,
+            costs, threshold, out_degraded);
+      }
+    }
+  }
+
+  template<class R>
+  template<class Nodes>
+  void Bvh<R>::rebuild_subtree(Nodes Bvh::* nodes_member, uint32_t node_idx,
+      TraitsArg arg, ThreadPool& pool)
+  {
+    // the leaves of a subtree cover a contiguous range of ordered_elems
+    Nodes& nodes = this->*nodes_member;
+    uint32_t begin = UINT32_MAX;
+    uint32_t end = 0;
+    Bvh::get_elem_range(nodes, node_idx, begin, end);
+    stat_sample_int(DISTRIB_INT_BVH_REFIT_REBUILD_ELEMS, end - begin);
+
+    std::vector<Element> elems;
+    elems.reserve(end - begin);
+    for(uint32_t i = begin; i < end; ++i) {
+      elems.push_back(std::move(this->ordered_elems.at(i)));
+    }
+
+    // the subtree must not duplicate any references, so that it fits into the
+    // original range of elements
+    BvhOpts sub_opts = this->opts;
+    if(sub_opts.split_method == BvhSplitMethod::SpatialSah) {
+      sub_opts.split_method = BvhSplitMethod::FullSah;
+    }
+    Bvh sub_bvh(std::move(elems), arg, sub_opts, pool);
+    assert(sub_bvh.ordered_elems.size() == end - begin);
+    for(uint32_t i = begin; i < end; ++i) {
+      this->ordered_elems.at(i) = std::move(sub_bvh.ordered_elems.at(i - begin));
+    }
+
+    // the root of the subtree replaces the original node and the other nodes
+    // are appended
+    Nodes& sub_nodes = sub_bvh.*nodes_member;
+    assert(!sub_nodes.empty());
+    uint32_t node_shift = nodes.size() - 1;
+    for(auto& sub_node: sub_nodes) {
+      Bvh::rebase_node(sub_node, begin, node_shift);
+    }
+    nodes.at(node_idx) = sub_nodes.at(0);
+    nodes.insert(nodes.end(), sub_nodes.begin() + 1, sub_nodes.end());
+  }
+
+  template<class R>
+  template<class Nodes>
+  void Bvh<R>::get_elem_range(const Nodes& nodes, uint32_t node_idx,
+      uint32_t& begin, uint32_t& end)
+  {
+    std::array<NodeItem, Nodes::value_type::WIDTH> items;
+    uint32_t item_count = Bvh::get_node_items(nodes.at(node_idx), items.data());
+    for(uint32_t i = 0; i < item_count; ++i) {
+      const NodeItem& item = items.at(i);
+      if(item.elem_count_or_zero != 0) {
+        begin = std::min(begin, item.elem_offset_or_node);
+        end = std::max(end, item.elem_offset_or_node + item.elem_count_or_zero);
+      } else {
+        Bvh::get_elem_range(nodes, item.elem_offset_or_node, begin, end);
+      }
+    }
+  }
+
+  template<class R>
+  template<class Nodes>
+  Nodes Bvh<R>::layout_nodes(const Nodes& nodes) {
+    // copies the reachable nodes in a cache-friendly order: the tree is cut
+    // into treelets of about a page of nodes, each treelet is stored
+    // contiguously in breadth-first order and the treelets are stored in
+    // depth-first order. the children of a node are always placed next to each
+    // other, as required by the binary layout.
+    StatTimer t(TIMER_BVH_LAYOUT_NODES);
+    using Node = typename Nodes::value_type;
+    const uint32_t treelet_size = std::max(Node::WIDTH + 1,
+        uint32_t(4096 / sizeof(Node)));
+
+    Nodes layout;
+    layout.reserve(nodes.size());
+    layout.push_back(nodes.at(0));
+
+    // the placed nodes whose children have not been placed yet
+    std::vector<uint32_t> treelet_roots;
+    treelet_roots.push_back(0);
+    std::vector<uint32_t> queue;
+    std::vector<uint32_t> frontier;
+
+    while(!treelet_roots.empty()) {
+      queue.clear();
+      frontier.clear();
+      queue.push_back(treelet_roots.back());
+      treelet_roots.pop_back();
+      uint32_t treelet_count = 0;
+
+      for(uint32_t head = 0; head < queue.size(); ++head) {
+        uint32_t layout_idx = queue.at(head);
+        std::array<NodeItem, Node::WIDTH> items;
+        uint32_t item_count = Bvh::get_node_items(
+            layout.at(layout_idx), items.data());
+        uint32_t child_count = 0;
+        for(uint32_t i = 0; i < item_count; ++i) {
+          child_count += items.at(i).elem_count_or_zero == 0 ? 1 : 0;
+        }
+        if(child_count == 0) {
+          continue;
+        } else if(treelet_count + child_count > treelet_size) {
+          frontier.push_back(layout_idx);
+          continue;
+        }
+
+        for(uint32_t i = 0; i < item_count; ++i) {
+          if(items.at(i).elem_count_or_zero != 0) {
+            continue;
+          }
+          uint32_t child_idx = layout.size();
+          layout.push_back(nodes.at(items.at(i).elem_offset_or_node));
+          Bvh::set_node_child(layout.at(layout_idx), i, child_idx);
+          queue.push_back(child_idx);
+        }
+        treelet_count += child_count;
+      }
+
+      // the first node of the frontier will be expanded next
+      treelet_roots.insert(treelet_roots.end(),
+          frontier.rbegin(), frontier.rend());
+    }
+
+    layout.shrink_to_fit();
+    return layout;
+  }
+
+  template<class R>
+  Box Bvh<R>::transformed_bounds(const Transform& transform) const {
+    if(this->ordered_elems.empty()) {
       return Box();
+    } else if(!this->wide4_nodes.empty()) {
+      return Bvh::transformed_node_bounds(this->wide4_nodes, 0, transform, 3);
+    } else if(!this->wide8_nodes.empty()) {
+      return Bvh::transformed_node_bounds(this->wide8_nodes, 0, transform, 2);
+    } else if(!this->quant8_nodes.empty()) {
+      return Bvh::transformed_node_bounds(this->quant8_nodes, 0, transform, 3);
+    } else if(!this->quant16_nodes.empty()) {
+      return Bvh::transformed_node_bounds(this->quant16_nodes, 0, transform, 3);
+    } else {
+      return Bvh::transformed_node_bounds(this->linear_nodes, 0, transform, 6);
     }
-    return this->linear_nodes.at(0).bounds;
+  }
+
+  template<class R>
+  template<class Nodes>
+  Box Bvh<R>::transformed_node_bounds(const Nodes& nodes, uint32_t node_idx,
+      const Transform& transform, uint32_t depth)
+  {
+    using Node = typename Nodes::value_type;
+    const Node& node = nodes.at(node_idx);
+    std::array<NodeItem, Node::WIDTH> items;
+    uint32_t item_count = Bvh::get_node_items(node, items.data());
+
+    Box bounds;
+    if(depth == 0) {
+      for(uint32_t i = 0; i < item_count; ++i) {
+        bounds = union_box(bounds, Bvh::get_item_bounds(node, i));
+      }
+      return transform.apply(bounds);
+    }
+
+    for(uint32_t i = 0; i < item_count; ++i) {
+      const NodeItem& item = items.at(i);
+      if(item.elem_count_or_zero != 0) {
+        bounds = union_box(bounds,
+            transform.apply(Bvh::get_item_bounds(node, i)));
+      } else {
+        bounds = union_box(bounds, Bvh::transformed_node_bounds(nodes,
+              item.elem_offset_or_node, transform, depth - 1));
+      }
+    }
+    return bounds;
+  }
+
+  template<class R>
+  uint32_t Bvh<R>::get_node_items(const LinearNode& node, NodeItem* out_items) {
+    if(node.elem_count_or_zero != 0) {
+      out_items[0] = NodeItem { node.elem_offset_or_left_child,
+        node.elem_count_or_zero };
+      return 1;
+    }
+    out_items[0] = NodeItem { node.elem_offset_or_left_child, 0 };
+    out_items[1] = NodeItem { node.elem_offset_or_left_child + 1, 0 };
+    return 2;
+  }
+
+  template<class R>
+  template<class Node>
+  uint32_t Bvh<R>::get_node_items(const Node& node, NodeItem* out_items) {
+    for(uint32_t i = 0; i < node.child_count; ++i) {
+      out_items[i] = NodeItem { node.elem_offset_or_child[i],
+        node.elem_count_or_zero[i] };
+    }
+    return node.child_count;
+  }
+
+  template<class R>
+  void Bvh<R>::set_node_child(LinearNode& node, uint32_t item, uint32_t child) {
+    // the right child is always next to the left child
+    if(item == 0) {
+      node.elem_offset_or_left_child = child;
+    } else {
+      assert(node.elem_offset_or_left_child + item == child);
+    }
+  }
+
+  template<class R>
+  template<class Node>
+  void Bvh<R>::set_node_child(Node& node, uint32_t item, uint32_t child) {
+    node.elem_offset_or_child[item] = child;
+  }
+
+  template<class R>
+  void Bvh<R>::rebase_node(LinearNode& node,
+      uint32_t elem_shift, uint32_t node_shift)
+  {
+    node.elem_offset_or_left_child += node.elem_count_or_zero != 0
+      ? elem_shift : node_shift;
+  }
+
+  template<class R>
+  template<class Node>
+  void Bvh<R>::rebase_node(Node& node,
+      uint32_t elem_shift, uint32_t node_shift)
+  {
+    for(uint32_t i = 0; i < node.child_count; ++i) {
+      node.elem_offset_or_child[i] += node.elem_count_or_zero[i] != 0
+        ? elem_shift : node_shift;
+    }
+  }
+
+  template<class R>
+  Box Bvh<R>::get_item_bounds(const LinearNode& node, uint32_t) {
+    return node.bounds;
+  }
+
+  template<class R>
+  template<class Node>
+  Box Bvh<R>::get_item_bounds(const Node& node, uint32_t item) {
+    Box bounds;
+    for(uint32_t axis = 0; axis < 3; ++axis) {
+      alignas(16) float lane_min[4];
+      alignas(16) float lane_max[4];
+      _mm_store_ps(lane_min, node.load_bounds(axis, 0, item & ~3u));
+      _mm_store_ps(lane_max, node.load_bounds(axis, 1, item & ~3u));
+      bounds.p_min.v[axis] = lane_min[item & 3];
+      bounds.p_max.v[axis] = lane_max[item & 3];
+    }
+    return bounds;
+  }
+
+  template<class R>
+  void Bvh<R>::set_node_bounds(LinearNode& node,
+      const Box* item_bounds, uint32_t item_count)
+  {
+    Box bounds;
+    for(uint32_t i = 0; i < item_count; ++i) {
+      bounds = union_box(bounds, item_bounds[i]);
+    }
+    node.bounds = bounds;
+  }
+
+  template<class R>
+  template<uint32_t N>
+  void Bvh<R>::set_node_bounds(WideNode<N>& node,
+      const Box* item_bounds, uint32_t item_count)
+  {
+    for(uint32_t i = 0; i < item_count; ++i) {
+      for(uint32_t axis = 0; axis < 3; ++axis) {
+        node.bounds[axis][0][i] = item_bounds[i].p_min.v[axis];
+        node.bounds[axis][1][i] = item_bounds[i].p_max.v[axis];
+      }
+    }
+  }
+
+  template<class R>
+  template<class Q>
+  void Bvh<R>::set_node_bounds(QuantNode<Q>& node,
+      const Box* item_bounds, uint32_t item_count)
+  {
+    WideNode<4> wide_node;
+    wide_node.child_count = node.child_count;
+    for(uint32_t i = 0; i < 4; ++i) {
+      wide_node.elem_offset_or_child[i] = node.elem_offset_or_child[i];
+      wide_node.elem_count_or_zero[i] = node.elem_count_or_zero[i];
+    }
+    Bvh::set_node_bounds(wide_node, item_bounds, item_count);
+    Bvh::quantize_node(wide_node, node);
+  }
+
+  template<class R>
+  Box Bvh<R>::bounds() const {
+    return this->root_bounds;
   }
 
   template class Bvh<BvhPrimitive::BvhTraits>;
   template class Bvh<MeshBvhPrimitive::BvhTraits>;
+  template class Bvh<InstanceBvhPrimitive::BvhTraits>;
+  template class Bvh<SphereSetPrimitive::BvhTraits>;
+  template class Bvh<CompressedMeshBvhPrimitive::BvhTraits>;
 }
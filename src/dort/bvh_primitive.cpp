@@ -1,17 +1,22 @@
 #include "dort/bvh_primitive.hpp"
+#include "dort/cube_shape.hpp"
+#include "dort/disk_shape.hpp"
+#include "dort/sphere_shape.hpp"
 #include "dort/stats.hpp"
 
 namespace dort {
   BvhPrimitive::BvhPrimitive(std::vector<std::unique_ptr<Primitive>> prims,
       const BvhOpts& opts, ThreadPool& pool):
-    bvh(std::move(prims), BvhTraits::Arg(), opts, pool)
-  { }
+    bvh(this->make_leaves(std::move(prims)), this, opts, pool)
+  {
+    this->reorder_leaves();
+  }
 
   bool BvhPrimitive::intersect(Ray& ray, Intersection& out_isect) const {
     stat_count(COUNTER_BVH_PRIM_INTERSECT);
     bool found = false;
-    this->bvh.traverse_elems(ray, [&](const std::unique_ptr<Primitive>& prim) {
-      if(prim->intersect(ray, out_isect)) {
+    this->bvh.traverse_elems(ray, [&](const Leaf& leaf) {
+      if(this->intersect_leaf(leaf, ray, out_isect)) {
         found = true;
       }
       return true;
@@ -22,11 +27,36 @@ namespace dort {
     return found;
   }
 
+  uint32_t BvhPrimitive::intersect_packet(Ray* rays,
+      Intersection* out_isects, uint32_t ray_mask) const
+  {
+    uint32_t hit_mask = 0;
+    this->bvh.traverse_packet_elems(rays, ray_mask,
+      [&](const Leaf& leaf, uint32_t leaf_ray_mask) {
+        if(leaf.type == LeafType::Frame) {
+          hit_mask |= this->frame_prims[leaf.index].intersect_packet(
+              rays, out_isects, leaf_ray_mask);
+        } else if(leaf.type == LeafType::Other) {
+          hit_mask |= this->other_prims[leaf.index]->intersect_packet(
+              rays, out_isects, leaf_ray_mask);
+        } else {
+          for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+            if((leaf_ray_mask & (1u << i)) &&
+                this->intersect_leaf(leaf, rays[i], out_isects[i])) {
+              hit_mask |= 1u << i;
+            }
+          }
+        }
+        return true;
+      });
+    return hit_mask;
+  }
+
   bool BvhPrimitive::intersect_p(const Ray& ray) const {
     stat_count(COUNTER_BVH_PRIM_INTERSECT_P);
     bool found = false;
-    this->bvh.traverse_elems(ray, [&](const std::unique_ptr<Primitive>& prim) {
-      if(prim->intersect_p(ray)) {
+    this->bvh.traverse_elems(ray, [&](const Leaf& leaf) {
+      if(this->intersect_leaf_p(leaf, ray)) {
         found = true;
         return false;
       } else {
@@ -42,4 +72,185 @@ namespace dort {
   Box BvhPrimitive::bounds() const {
     return this->bvh.bounds();
   }
+
+  Box BvhPrimitive::transformed_bounds(const Transform& transform) const {
+    return this->bvh.transformed_bounds(transform);
+  }
+
+  void BvhPrimitive::refit(ThreadPool& pool, float rebuild_threshold,
+      RefittedSet& refitted)
+  {
+    // the children must be refitted first, because the bounds of the BVH
+    // depend on their bounds (shapes and triangles have nothing to refit)
+    for(auto& prim: this->mesh_triangle_prims) {
+      prim.refit(pool, rebuild_threshold, refitted);
+    }
+    for(auto& prim: this->frame_prims) {
+      prim.refit(pool, rebuild_threshold, refitted);
+    }
+    for(auto& prim: this->other_prims) {
+      prim->refit(pool, rebuild_threshold, refitted);
+    }
+    this->bvh.refit(this, pool, rebuild_threshold);
+  }
+
+  std::vector<BvhPrimitive::Leaf> BvhPrimitive::make_leaves(
+      std::vector<std::unique_ptr<Primitive>> prims)
+  {
+    std::vector<Leaf> leaves;
+    leaves.reserve(prims.size());
+    for(auto& prim: prims) {
+      Leaf leaf;
+      if(auto shape_prim = dynamic_cast<ShapePrimitive*>(prim.get())) {
+        const Shape* shape = &shape_prim->get_shape();
+        if(dynamic_cast<const SphereShape*>(shape)) {
+          leaf.type = LeafType::SphereShape;
+        } else if(dynamic_cast<const CubeShape*>(shape)) {
+          leaf.type = LeafType::CubeShape;
+        } else if(dynamic_cast<const DiskShape*>(shape)) {
+          leaf.type = LeafType::DiskShape;
+        } else {
+          leaf.type = LeafType::OtherShape;
+        }
+        leaf.index = this->shape_prims.size();
+        this->shape_prims.push_back(std::move(*shape_prim));
+      } else if(auto triangle_prim =
+          dynamic_cast<TriangleShapePrimitive*>(prim.get())) {
+        leaf.type = LeafType::TriangleShape;
+        leaf.index = this->triangle_shape_prims.size();
+        this->triangle_shape_prims.push_back(std::move(*triangle_prim));
+      } else if(auto mesh_prim =
+          dynamic_cast<MeshTrianglePrimitive*>(prim.get())) {
+        leaf.type = LeafType::MeshTriangle;
+        leaf.index = this->mesh_triangle_prims.size();
+        this->mesh_triangle_prims.push_back(std::move(*mesh_prim));
+      } else if(auto frame_prim = dynamic_cast<FramePrimitive*>(prim.get())) {
+        leaf.type = LeafType::Frame;
+        leaf.index = this->frame_prims.size();
+        this->frame_prims.push_back(std::move(*frame_prim));
+      } else {
+        leaf.type = LeafType::Other;
+        leaf.index = this->other_prims.size();
+        this->other_prims.push_back(std::move(prim));
+      }
+      leaves.push_back(leaf);
+    }
+    return leaves;
+  }
+
+  void BvhPrimitive::reorder_leaves() {
+    // store the primitives in the order of the leaves, so that the primitives
+    // that are close in the tree are also close in memory
+    std::vector<ShapePrimitive> shape_prims;
+    std::vector<TriangleShapePrimitive> triangle_shape_prims;
+    std::vector<MeshTrianglePrimitive> mesh_triangle_prims;
+    std::vector<FramePrimitive> frame_prims;
+    std::vector<std::unique_ptr<Primitive>> other_prims;
+    shape_prims.reserve(this->shape_prims.size());
+    triangle_shape_prims.reserve(this->triangle_shape_prims.size());
+    mesh_triangle_prims.reserve(this->mesh_triangle_prims.size());
+    frame_prims.reserve(this->frame_prims.size());
+    other_prims.reserve(this->other_prims.size());
+
+    auto move_prim = [](auto& old_prims, auto& new_prims, uint32_t& index) {
+      new_prims.push_back(std::move(old_prims.at(index)));
+      index = new_prims.size() - 1;
+    };
+
+    this->bvh.for_each_elem([&](Leaf& leaf) {
+      switch(leaf.type) {
+        case LeafType::SphereShape:
+        case LeafType::CubeShape:
+        case LeafType::DiskShape:
+        case LeafType::OtherShape:
+          move_prim(this->shape_prims, shape_prims, leaf.index); break;
+        case LeafType::TriangleShape:
+          move_prim(this->triangle_shape_prims, triangle_shape_prims, leaf.index); break;
+        case LeafType::MeshTriangle:
+          move_prim(this->mesh_triangle_prims, mesh_triangle_prims, leaf.index); break;
+        case LeafType::Frame:
+          move_prim(this->frame_prims, frame_prims, leaf.index); break;
+        case LeafType::Other:
+          move_prim(this->other_prims, other_prims, leaf.index); break;
+      }
+    });
+
+    this->shape_prims = std::move(shape_prims);
+    this->triangle_shape_prims = std::move(triangle_shape_prims);
+    this->mesh_triangle_prims = std::move(mesh_triangle_prims);
+    this->frame_prims = std::move(frame_prims);
+    this->other_prims = std::move(other_prims);
+  }
+
+  Box BvhPrimitive::leaf_bounds(const Leaf& leaf) const {
+    switch(leaf.type) {
+      case LeafType::SphereShape:
+      case LeafType::CubeShape:
+      case LeafType::DiskShape:
+      case LeafType::OtherShape:
+        return this->shape_prims[leaf.index].bounds();
+      case LeafType::TriangleShape:
+        return this->triangle_shape_prims[leaf.index].bounds();
+      case LeafType::MeshTriangle:
+        return this->mesh_triangle_prims[leaf.index].bounds();
+      case LeafType::Frame:
+        return this->frame_prims[leaf.index].bounds();
+      case LeafType::Other:
+        return this->other_prims[leaf.index]->bounds();
+    }
+    assert(false && "invalid leaf type");
+    return Box();
+  }
+
+  bool BvhPrimitive::intersect_leaf(const Leaf& leaf,
+      Ray& ray, Intersection& out_isect) const
+  {
+    switch(leaf.type) {
+      case LeafType::SphereShape:
+        return this->shape_prims[leaf.index]
+          .intersect_shape<SphereShape>(ray, out_isect);
+      case LeafType::CubeShape:
+        return this->shape_prims[leaf.index]
+          .intersect_shape<CubeShape>(ray, out_isect);
+      case LeafType::DiskShape:
+        return this->shape_prims[leaf.index]
+          .intersect_shape<DiskShape>(ray, out_isect);
+      case LeafType::OtherShape:
+        return this->shape_prims[leaf.index]
+          .intersect_shape<Shape>(ray, out_isect);
+      case LeafType::TriangleShape:
+        return this->triangle_shape_prims[leaf.index].intersect(ray, out_isect);
+      case LeafType::MeshTriangle:
+        return this->mesh_triangle_prims[leaf.index].intersect(ray, out_isect);
+      case LeafType::Frame:
+        return this->frame_prims[leaf.index].intersect(ray, out_isect);
+      case LeafType::Other:
+        return this->other_prims[leaf.index]->intersect(ray, out_isect);
+    }
+    assert(false && "invalid leaf type");
+    return false;
+  }
+
+  bool BvhPrimitive::intersect_leaf_p(const Leaf& leaf, const Ray& ray) const {
+    switch(leaf.type) {
+      case LeafType::SphereShape:
+        return this->shape_prims[leaf.index].intersect_shape_p<SphereShape>(ray);
+      case LeafType::CubeShape:
+        return this->shape_prims[leaf.index].intersect_shape_p<CubeShape>(ray);
+      case LeafType::DiskShape:
+        return this->shape_prims[leaf.index].intersect_shape_p<DiskShape>(ray);
+      case LeafType::OtherShape:
+        return this->shape_prims[leaf.index].intersect_shape_p<Shape>(ray);
+      case LeafType::TriangleShape:
+        return this->triangle_shape_prims[leaf.index].intersect_p(ray);
+      case LeafType::MeshTriangle:
+        return this->mesh_triangle_prims[leaf.index].intersect_p(ray);
+      case LeafType::Frame:
+        return this->frame_prims[leaf.index].intersect_p(ray);
+      case LeafType::Other:
+        return this->other_prims[leaf.index]->intersect_p(ray);
+    }
+    assert(false && "invalid leaf type");
+    return false;
+  }
 }
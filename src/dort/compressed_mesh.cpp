@@ -0,0 +1,142 @@
+#include "dort/box.hpp"
+#include "dort/compressed_mesh.hpp"
+
+namespace dort {
+  namespace {
+    uint16_t quantize(float x, float min, float scale) {
+      if(scale == 0.f) {
+        return 0;
+      }
+      return uint16_t(clamp(floor((x - min) / scale + 0.5f), 0.f, 65535.f));
+    }
+
+    // scale that maps [min, max] to [0, 65535]
+    float quantize_scale(float min, float max) {
+      return max > min ? (max - min) / 65535.f : 0.f;
+    }
+
+    uint16_t encode_octahedral(const Normal& n) {
+      float l1 = abs(n.v.x) + abs(n.v.y) + abs(n.v.z);
+      float x = n.v.x / l1;
+      float y = n.v.y / l1;
+      if(n.v.z < 0.f) {
+        float old_x = x;
+        x = (1.f - abs(y)) * sign(old_x);
+        y = (1.f - abs(old_x)) * sign(y);
+      }
+
+      // try the four neighboring codes and pick the most precise one
+      float qx = (x + 1.f) * (255.f / 2.f);
+      float qy = (y + 1.f) * (255.f / 2.f);
+      CompressedMesh decoder;
+      decoder.normals.push_back(0);
+      uint16_t best_code = 0;
+      float best_dot = -INFINITY;
+      for(float cx: {floor(qx), floor(qx) + 1.f}) {
+        for(float cy: {floor(qy), floor(qy) + 1.f}) {
+          uint16_t code = uint16_t(clamp(cx, 0.f, 255.f))
+            | (uint16_t(clamp(cy, 0.f, 255.f)) << 8);
+          decoder.normals.at(0) = code;
+          float d = dot(decoder.normal(0), n);
+          if(d > best_dot) {
+            best_dot = d;
+            best_code = code;
+          }
+        }
+      }
+      return best_code;
+    }
+  }
+
+  CompressedMesh compress_mesh(const Mesh& mesh) {
+    Point point_min;
+    Vector point_scale;
+    Box bounds;
+    for(const Point& pt: mesh.points) {
+      bounds = union_box(bounds, pt);
+    }
+    if(!mesh.points.empty()) {
+      point_min = bounds.p_min;
+      point_scale = Vector(
+          quantize_scale(bounds.p_min.v.x, bounds.p_max.v.x),
+          quantize_scale(bounds.p_min.v.y, bounds.p_max.v.y),
+          quantize_scale(bounds.p_min.v.z, bounds.p_max.v.z));
+    }
+    return compress_mesh(mesh, point_min, point_scale);
+  }
+
+  CompressedMesh compress_mesh(const Mesh& mesh,
+      const Point& point_min, const Vector& point_scale)
+  {
+    CompressedMesh out;
+    out.point_min = point_min;
+    out.point_scale = point_scale;
+    out.points.reserve(3 * mesh.points.size());
+    for(const Point& pt: mesh.points) {
+      for(uint32_t axis = 0; axis < 3; ++axis) {
+        out.points.push_back(quantize(pt.v[axis],
+              out.point_min.v[axis], out.point_scale.v[axis]));
+      }
+    }
+
+    if(!mesh.uvs.empty()) {
+      Vec2 uv_min(INFINITY, INFINITY);
+      Vec2 uv_max(-INFINITY, -INFINITY);
+      for(const Vec2& uv: mesh.uvs) {
+        uv_min = Vec2(min(uv_min.x, uv.x), min(uv_min.y, uv.y));
+        uv_max = Vec2(max(uv_max.x, uv.x), max(uv_max.y, uv.y));
+      }
+      out.uv_min = uv_min;
+      out.uv_scale = Vec2(quantize_scale(uv_min.x, uv_max.x),
+          quantize_scale(uv_min.y, uv_max.y));
+      out.uvs.reserve(2 * mesh.uvs.size());
+      for(const Vec2& uv: mesh.uvs) {
+        out.uvs.push_back(quantize(uv.x, out.uv_min.x, out.uv_scale.x));
+        out.uvs.push_back(quantize(uv.y, out.uv_min.y, out.uv_scale.y));
+      }
+    }
+
+    out.normals.reserve(mesh.normals.size());
+    for(const Normal& n: mesh.normals) {
+      out.normals.push_back(encode_octahedral(n));
+    }
+
+    out.vertex_count = mesh.vertices.size();
+    out.vertex_blocks.reserve((mesh.vertices.size() + CompressedMesh::BLOCK_VERTICES - 1)
+        / CompressedMesh::BLOCK_VERTICES);
+    out.short_vertices.reserve(mesh.vertices.size());
+    for(uint32_t begin = 0; begin < mesh.vertices.size();
+        begin += CompressedMesh::BLOCK_VERTICES)
+    {
+      uint32_t end = min(begin + CompressedMesh::BLOCK_VERTICES,
+          uint32_t(mesh.vertices.size()));
+      uint32_t base = UINT32_MAX;
+      uint32_t top = 0;
+      for(uint32_t i = begin; i < end; ++i) {
+        base = min(base, mesh.vertices.at(i));
+        top = max(top, mesh.vertices.at(i));
+      }
+
+      CompressedMesh::VertexBlock block;
+      block.base = base;
+      if(top - base <= UINT16_MAX) {
+        assert(out.short_vertices.size() % CompressedMesh::BLOCK_VERTICES == 0);
+        block.offset = out.short_vertices.size() / CompressedMesh::BLOCK_VERTICES;
+        for(uint32_t i = begin; i < end; ++i) {
+          out.short_vertices.push_back(uint16_t(mesh.vertices.at(i) - base));
+        }
+      } else {
+        assert(out.wide_vertices.size() % CompressedMesh::BLOCK_VERTICES == 0);
+        block.offset = (out.wide_vertices.size() / CompressedMesh::BLOCK_VERTICES)
+          | CompressedMesh::WIDE_BLOCK;
+        for(uint32_t i = begin; i < end; ++i) {
+          out.wide_vertices.push_back(mesh.vertices.at(i));
+        }
+      }
+      out.vertex_blocks.push_back(block);
+    }
+    out.short_vertices.shrink_to_fit();
+    out.wide_vertices.shrink_to_fit();
+    return out;
+  }
+}
@@ -0,0 +1,135 @@
+#include "dort/compressed_mesh_bvh_primitive.hpp"
+#include "dort/topology.hpp"
+#include "dort/triangle_packet.hpp"
+
+namespace dort {
+  CompressedMeshBvhPrimitive::CompressedMeshBvhPrimitive(Mesh float_mesh,
+      std::shared_ptr<Material> material,
+      const BvhOpts& opts, ThreadPool& pool):
+    mesh(compress_mesh(float_mesh)), material(material),
+    bvh(triangle_indices(float_mesh), &this->mesh, opts, pool)
+  {
+    // reordering drops the points that are not referenced by any triangle,
+    // which may shrink the bounds of the mesh, so we must keep the original
+    // quantization; otherwise the decoded triangles would move and would no
+    // longer lie in the bounds of the BVH
+    std::vector<uint32_t> indices;
+    this->bvh.for_each_elem([&](uint32_t index) {
+      indices.push_back(index);
+    });
+    reorder_mesh_triangles(float_mesh, indices);
+    this->mesh = compress_mesh(float_mesh,
+        this->mesh.point_min, this->mesh.point_scale);
+
+    uint32_t i = 0;
+    this->bvh.for_each_elem([&](uint32_t& index) {
+      index = indices.at(i++);
+    });
+
+    numa_interleave(this->mesh.points);
+    numa_interleave(this->mesh.normals);
+    numa_interleave(this->mesh.uvs);
+    numa_interleave(this->mesh.short_vertices);
+    numa_interleave(this->mesh.wide_vertices);
+  }
+
+  bool CompressedMeshBvhPrimitive::intersect(Ray& ray,
+      Intersection& out_isect) const
+  {
+    uint32_t hit_index = UINT32_MAX;
+    float hit_b1, hit_b2;
+    this->bvh.traverse_elems(ray, [&](uint32_t index) {
+      float t, b1, b2;
+      if(Triangle(this->mesh, index).hit(ray, t, b1, b2)) {
+        ray.t_max = t;
+        hit_index = index;
+        hit_b1 = b1;
+        hit_b2 = b2;
+      }
+      return true;
+    });
+
+    if(hit_index == UINT32_MAX) {
+      return false;
+    }
+    TriangleUv(this->mesh, hit_index).get_diff_geom(ray.t_max, hit_b1, hit_b2,
+        out_isect.ray_epsilon, out_isect.frame_diff_geom);
+    out_isect.world_diff_geom = out_isect.frame_diff_geom;
+    out_isect.primitive = this;
+    return true;
+  }
+
+  uint32_t CompressedMeshBvhPrimitive::intersect_packet(Ray* rays,
+      Intersection* out_isects, uint32_t ray_mask) const
+  {
+    if(ray_mask == 0) {
+      return 0;
+    }
+
+    // the triangles are decoded once for the whole packet
+    std::array<uint32_t, RAY_PACKET_SIZE> hit_indices;
+    std::array<float, RAY_PACKET_SIZE> hit_b1, hit_b2;
+    intersect_triangle_packet(this->bvh, rays, ray_mask,
+      [&](uint32_t index) { return Triangle(this->mesh, index); },
+      hit_indices, hit_b1, hit_b2);
+
+    uint32_t hit_mask = 0;
+    for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+      if(hit_indices.at(i) == UINT32_MAX) {
+        continue;
+      }
+      Intersection& isect = out_isects[i];
+      TriangleUv(this->mesh, hit_indices.at(i)).get_diff_geom(rays[i].t_max,
+          hit_b1.at(i), hit_b2.at(i), isect.ray_epsilon, isect.frame_diff_geom);
+      isect.world_diff_geom = isect.frame_diff_geom;
+      isect.primitive = this;
+      hit_mask |= 1u << i;
+    }
+    return hit_mask;
+  }
+
+  bool CompressedMeshBvhPrimitive::intersect_p(const Ray& ray) const {
+    bool found = false;
+    this->bvh.traverse_elems(ray, [&](uint32_t index) {
+      if(Triangle(this->mesh, index).hit_p(ray)) {
+        found = true;
+        return false;
+      } else {
+        return true;
+      }
+    });
+    return found;
+  }
+
+  Box CompressedMeshBvhPrimitive::bounds() const {
+    return this->bvh.bounds();
+  }
+
+  Box CompressedMeshBvhPrimitive::transformed_bounds(
+      const Transform& transform) const
+  {
+    return this->bvh.transformed_bounds(transform);
+  }
+
+  const Material* CompressedMeshBvhPrimitive::get_material(
+      const Intersection&) const
+  {
+    return this->material.get();
+  }
+
+  const Light* CompressedMeshBvhPrimitive::get_area_light(
+      const DiffGeom&) const
+  {
+    return nullptr;
+  }
+
+  std::vector<uint32_t> CompressedMeshBvhPrimitive::triangle_indices(
+      const Mesh& mesh)
+  {
+    std::vector<uint32_t> indices;
+    for(uint32_t index = 0; index + 2 < mesh.vertices.size(); index += 3) {
+      indices.push_back(index);
+    }
+    return indices;
+  }
+}
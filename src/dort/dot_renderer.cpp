@@ -1,3 +1,4 @@
+#include <array>
 #include "dort/bsdf.hpp"
 #include "dort/camera.hpp"
 #include "dort/dot_renderer.hpp"
@@ -11,27 +12,37 @@ namespace dort {
   void DotRenderer::render(CtxG& ctx, Progress&) {
     bool jitter = this->iteration_count > 1;
     for(uint32_t i = 0; i < this->iteration_count; ++i) {
-      this->iteration_tiled(ctx, [&](Vec2i pixel, Vec2& film_pos, Sampler& sampler) {
-        Vec2 pixel_pos = jitter ? sampler.random_2d() : Vec2(0.5f, 0.5f);
-        film_pos = Vec2(pixel) + pixel_pos;
-
-        Ray ray;
-        float ray_pos_pdf;
-        float ray_dir_pdf;
-        Spectrum importance = this->camera->sample_ray_importance(Vec2(this->film->res),
-          film_pos, ray, ray_pos_pdf, ray_dir_pdf, CameraSample(sampler.rng));
-        Spectrum color = this->get_color(ray);
-        return color * importance / (ray_pos_pdf * ray_dir_pdf);
+      this->iteration_tiled_packet(ctx, [&](const Vec2i* pixels, uint32_t pixel_count,
+          Vec2* film_pos, Spectrum* contribs, Sampler& sampler)
+      {
+        std::array<Ray, RAY_PACKET_SIZE> rays;
+        std::array<Spectrum, RAY_PACKET_SIZE> importances;
+        std::array<float, RAY_PACKET_SIZE> ray_pdfs;
+        for(uint32_t i = 0; i < pixel_count; ++i) {
+          Vec2 pixel_pos = jitter ? sampler.random_2d() : Vec2(0.5f, 0.5f);
+          film_pos[i] = Vec2(pixels[i]) + pixel_pos;
+
+          float ray_pos_pdf;
+          float ray_dir_pdf;
+          importances.at(i) = this->camera->sample_ray_importance(
+              Vec2(this->film->res), film_pos[i], rays.at(i),
+              ray_pos_pdf, ray_dir_pdf, CameraSample(sampler.rng));
+          ray_pdfs.at(i) = ray_pos_pdf * ray_dir_pdf;
+        }
+
+        std::array<Intersection, RAY_PACKET_SIZE> isects;
+        uint32_t hit_mask = this->scene->intersect_packet(
+            rays.data(), isects.data(), (1u << pixel_count) - 1);
+        for(uint32_t i = 0; i < pixel_count; ++i) {
+          Spectrum color = (hit_mask & (1u << i))
+            ? this->get_color(rays.at(i), isects.at(i)) : Spectrum(0.f);
+          contribs[i] = color * importances.at(i) / ray_pdfs.at(i);
+        }
       });
     }
   }
 
-  Spectrum DotRenderer::get_color(Ray& ray) const {
-    Intersection isect;
-    if(!this->scene->intersect(ray, isect)) {
-      return Spectrum(0.f);
-    }
-
+  Spectrum DotRenderer::get_color(const Ray& ray, const Intersection& isect) const {
     auto bsdf = isect.get_bsdf();
     float isect_dot = dot(-normalize(ray.dir), isect.world_diff_geom.nn);
 
@@ -3,15 +3,35 @@
 #include "dort/monte_carlo.hpp"
 
 namespace dort {
-  EnvironmentLight::EnvironmentLight(std::shared_ptr<Image<PixelRgbFloat>> image,
+  EnvironmentLight::EnvironmentLight(
+      Future<std::shared_ptr<Image<PixelRgbFloat>>> image,
       const Spectrum& scale, const Vector& up, const Vector& fwd):
     Light(LightFlags(LIGHT_BACKGROUND | LIGHT_DISTANT)),
-    image(image), scale(scale)
+    scale(scale)
   {
     this->up = normalize(up);
     this->t = normalize(cross(up, fwd));
     this->s = cross(this->up, this->t);
+    this->pending = image.then(
+      [scale](const Future<std::shared_ptr<Image<PixelRgbFloat>>>& image) {
+        return build_distrib(image.get(), scale);
+      });
+  }
 
+  void EnvironmentLight::resolve() {
+    if(!this->pending.is_valid()) {
+      return;
+    }
+    Distrib& distrib = this->pending.get();
+    this->image = std::move(distrib.image);
+    this->distrib = std::move(distrib.distrib);
+    this->average_radiance = distrib.average_radiance;
+    this->pending = Future<Distrib>();
+  }
+
+  EnvironmentLight::Distrib EnvironmentLight::build_distrib(
+      std::shared_ptr<Image<PixelRgbFloat>> image, const Spectrum& scale)
+  {
     std::vector<float> values(image->res.x * image->res.y);
     Spectrum value_sum(0.f);
     float value_weight = 0.f;
@@ -27,8 +47,9 @@ namespace dort {
         value_weight += cos_theta;
       }
     }
-    this->distrib = PiecewiseDistrib2d(image->res.x, image->res.y, std::move(values));
-    this->average_radiance = this->scale * value_sum / value_weight;
+    PiecewiseDistrib2d distrib(image->res.x, image->res.y, std::move(values));
+    Spectrum average_radiance = scale * value_sum / value_weight;
+    return Distrib { std::move(image), std::move(distrib), average_radiance };
   }
 
   Spectrum EnvironmentLight::sample_ray_radiance(const Scene& scene, 
@@ -1,8 +1,16 @@
 #include "dort/film.hpp"
 #include "dort/filter.hpp"
 #include "dort/stats.hpp"
+#include "dort/thread_pool.hpp"
+#include "dort/topology.hpp"
 
 namespace dort {
+  namespace {
+    // the planes are shared by more threads when they would take too much
+    // memory
+    const size_t MAX_SPLAT_BYTES = size_t(256) << 20;
+  }
+
   Film::Film(uint32_t x_res, uint32_t y_res, std::shared_ptr<Filter> filter):
     Film(x_res, y_res, SampledFilter(filter, Vec2i(12, 12)))
   { }
@@ -11,7 +19,37 @@ namespace dort {
     res(x_res, y_res), pixels(x_res * y_res),
     filter(std::move(filter)),
     splat_scale(0.f)
-  { }
+  {
+    numa_interleave(this->pixels);
+
+    // threads on the same CPU do not contend with each other, so there is no
+    // point in having more planes than CPUs
+    uint32_t cpu_count = std::max(size_t(1), get_cpu_topology().cpus.size());
+    size_t plane_bytes = std::max(size_t(1),
+        size_t(this->res.x) * this->res.y * sizeof(AtomicSpectrum));
+    this->splat_plane_capacity = std::min(size_t(cpu_count),
+        std::max(size_t(1), MAX_SPLAT_BYTES / plane_bytes));
+    this->splat_planes.reset(
+        new std::atomic<SplatPlane*>[this->splat_plane_capacity]);
+    for(uint32_t i = 0; i < this->splat_plane_capacity; ++i) {
+      this->splat_planes[i].store(nullptr, std::memory_order_relaxed);
+    }
+    this->splat_plane_count.store(1, std::memory_order_relaxed);
+  }
+
+  Film::~Film() {
+    for(uint32_t i = 0; i < this->splat_plane_capacity; ++i) {
+      delete this->splat_planes[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  void Film::init_splat_planes(ThreadPool& pool) {
+    uint32_t plane_count = std::min(pool.thread_count(),
+        this->splat_plane_capacity);
+    if(plane_count > this->splat_plane_count.load(std::memory_order_relaxed)) {
+      this->splat_plane_count.store(plane_count, std::memory_order_release);
+    }
+  }
 
   void Film::add_sample(Vec2 pos, const Spectrum& radiance) {
     assert(is_finite(radiance));
@@ -31,6 +69,7 @@ namespace dort {
 
   void Film::add_splat(Vec2 pos, const Spectrum& radiance) {
     assert(is_finite(radiance));
+    SplatPlane& plane = this->get_splat_plane();
     StatTimer t(TIMER_FILM_ADD_SPLAT);
     Recti rect = this->get_pixel_rect(pos);
     uint32_t rect_x = rect.p_max.x - rect.p_min.x + 1;
@@ -60,29 +99,53 @@ namespace dort {
     for(int32_t pix_y = rect.p_min.y; pix_y <= rect.p_max.y; ++pix_y) {
       for(int32_t pix_x = rect.p_min.x; pix_x <= rect.p_max.x; ++pix_x) {
         float filter_w = filter_w_at(pix_x, pix_y);
-        Film::Pixel& pixel = this->pixels.at(this->pixel_idx(pix_x, pix_y));
-        pixel.splat.add_relaxed(radiance * (filter_w * inv_filter_sum));
+        AtomicSpectrum& splat = plane.splats.at(this->pixel_idx(pix_x, pix_y));
+        splat.add_relaxed(radiance * (filter_w * inv_filter_sum));
       }
     }
   }
 
+  Film::SplatPlane& Film::get_splat_plane() {
+    uint32_t plane_i = ThreadPool::current_thread_index()
+      % this->splat_plane_count.load(std::memory_order_relaxed);
+    std::atomic<SplatPlane*>& plane_ptr = this->splat_planes[plane_i];
+    SplatPlane* plane = plane_ptr.load(std::memory_order_acquire);
+    if(plane != nullptr) {
+      return *plane;
+    }
+
+    auto new_plane = std::make_unique<SplatPlane>();
+    new_plane->splats = std::vector<AtomicSpectrum>(this->res.x * this->res.y);
+    if(plane_ptr.compare_exchange_strong(plane, new_plane.get(),
+          std::memory_order_acq_rel, std::memory_order_acquire)) {
+      return *new_plane.release();
+    }
+    // another thread that shares the plane was faster
+    return *plane;
+  }
+
   void Film::add_tile(Vec2i pos, const Film& tile) {
+    this->add_tile_rows(pos, tile, 0, this->res.y);
+  }
+
+  void Film::add_tile_rows(Vec2i pos, const Film& tile,
+      int32_t y_begin, int32_t y_end)
+  {
     StatTimer t(TIMER_FILM_ADD_TILE);
 
-    uint32_t y_min = max(0, -pos.y);
-    uint32_t x_min = max(0, -pos.x);
-    uint32_t y_max = min(tile.res.y, this->res.y - pos.y);
-    uint32_t x_max = min(tile.res.x, this->res.x - pos.x);
+    int32_t y_min = max(max(0, -pos.y), y_begin - pos.y);
+    int32_t x_min = max(0, -pos.x);
+    int32_t y_max = min(min(tile.res.y, this->res.y - pos.y), y_end - pos.y);
+    int32_t x_max = min(tile.res.x, this->res.x - pos.x);
 
-    for(uint32_t y = y_min; y < y_max; ++y) {
-      for(uint32_t x = x_min; x < x_max; ++x) {
+    for(int32_t y = y_min; y < y_max; ++y) {
+      for(int32_t x = x_min; x < x_max; ++x) {
         uint32_t this_idx = this->pixel_idx(pos.x + x, pos.y + y);
         Film::Pixel& this_pixel = this->pixels.at(this_idx);
         uint32_t tile_idx = tile.pixel_idx(x, y);
         const Film::Pixel& tile_pixel = tile.pixels.at(tile_idx);
         this_pixel.color += tile_pixel.color;
         this_pixel.weight += tile_pixel.weight;
-        assert(tile_pixel.splat.load_relaxed() == Spectrum(0.f));
       }
     }
   }
@@ -91,20 +154,49 @@ namespace dort {
   Image<Pix> Film::to_image() const {
     Image<Pix> img(this->res.x, this->res.y);
     for(int32_t y = 0; y < this->res.y; ++y) {
-      for(int32_t x = 0; x < this->res.x; ++x) {
-        const Film::Pixel& pixel = this->pixels.at(this->pixel_idx(x, y));
-        Spectrum color(0.f);
-        if(pixel.weight != 0.f) {
-          color += pixel.color / pixel.weight;
+      this->to_image_row(img, y);
+    }
+    return img;
+  }
+
+  template<class Pix>
+  Image<Pix> Film::to_image(ThreadPool& pool) const {
+    Image<Pix> img(this->res.x, this->res.y);
+    parallel_for(pool, this->res.y, 0, [&](uint32_t y) {
+      this->to_image_row(img, y);
+    });
+    return img;
+  }
+
+  template<class Pix>
+  void Film::to_image_row(Image<Pix>& img, int32_t y) const {
+    std::vector<const SplatPlane*> planes;
+    if(this->splat_scale != 0.f) {
+      uint32_t plane_count = this->splat_plane_count.load(std::memory_order_acquire);
+      for(uint32_t i = 0; i < plane_count; ++i) {
+        if(auto plane = this->splat_planes[i].load(std::memory_order_acquire)) {
+          planes.push_back(plane);
         }
-        if(this->splat_scale != 0.f) {
-          color += pixel.splat.load_relaxed() * this->splat_scale;
+      }
+    }
+
+    for(int32_t x = 0; x < this->res.x; ++x) {
+      uint32_t idx = this->pixel_idx(x, y);
+      const Film::Pixel& pixel = this->pixels.at(idx);
+      Spectrum color(0.f);
+      if(pixel.weight != 0.f) {
+        color += pixel.color / pixel.weight;
+      }
+      if(!planes.empty()) {
+        Spectrum splat(0.f);
+        for(const SplatPlane* plane: planes) {
+          splat += plane->splats.at(idx).load_relaxed();
         }
-        assert(is_finite(color));
-        img.set_rgb(x, y, color);
+        color += splat * this->splat_scale;
       }
+      assert(is_finite(color));
+      img.set_rgb(x, y, color);
     }
-    return img;
   }
 
   Recti Film::get_pixel_rect(Vec2 pos) const {
@@ -122,4 +214,6 @@ namespace dort {
 
   template Image<PixelRgb8> Film::to_image() const;
   template Image<PixelRgbFloat> Film::to_image() const;
+  template Image<PixelRgb8> Film::to_image(ThreadPool& pool) const;
+  template Image<PixelRgbFloat> Film::to_image(ThreadPool& pool) const;
 }
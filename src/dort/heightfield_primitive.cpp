@@ -0,0 +1,314 @@
+#include <array>
+#include "dort/heightfield_primitive.hpp"
+
+namespace dort {
+  namespace {
+    // the offsets of the vertices of the two triangles in a cell, ordered so
+    // that the geometric normal points to +Z
+    const uint32_t TRIANGLE_VERTICES[2][3][2] = {
+      {{0, 0}, {1, 1}, {1, 0}},
+      {{0, 0}, {0, 1}, {1, 1}},
+    };
+  }
+
+  HeightfieldPrimitive::HeightfieldPrimitive(uint32_t x_res, uint32_t y_res,
+      std::vector<float> heights, const Transform& local_to_frame,
+      std::shared_ptr<Material> material):
+    x_res(x_res), y_res(y_res), heights(std::move(heights)),
+    grid_to_frame(local_to_frame * scale(
+          1.f / float(x_res - 1), 1.f / float(y_res - 1), 1.f)),
+    material(material)
+  {
+    assert(x_res >= 2 && y_res >= 2);
+    assert(this->heights.size() == size_t(x_res) * size_t(y_res));
+
+    // every level is built from the 2x2 blocks of the previous level
+    uint32_t prev_x_res = x_res - 1;
+    uint32_t prev_y_res = y_res - 1;
+    do {
+      Level level;
+      level.x_res = (prev_x_res + 1) / 2;
+      level.y_res = (prev_y_res + 1) / 2;
+      level.blocks.reserve(size_t(level.x_res) * size_t(level.y_res));
+      for(uint32_t y = 0; y < level.y_res; ++y) {
+        for(uint32_t x = 0; x < level.x_res; ++x) {
+          MinMax block { INFINITY, -INFINITY };
+          for(uint32_t i = 0; i < 4; ++i) {
+            uint32_t prev_x = 2*x + (i & 1);
+            uint32_t prev_y = 2*y + (i >> 1);
+            if(prev_x >= prev_x_res || prev_y >= prev_y_res) {
+              continue;
+            }
+            MinMax prev_block = this->levels.empty()
+              ? this->cell_min_max(prev_x, prev_y)
+              : this->levels.back().blocks.at(size_t(prev_y) * prev_x_res + prev_x);
+            block.min = min(block.min, prev_block.min);
+            block.max = max(block.max, prev_block.max);
+          }
+          level.blocks.push_back(block);
+        }
+      }
+
+      prev_x_res = level.x_res;
+      prev_y_res = level.y_res;
+      this->levels.push_back(std::move(level));
+    } while(prev_x_res > 1 || prev_y_res > 1);
+  }
+
+  bool HeightfieldPrimitive::intersect(Ray& ray, Intersection& out_isect) const {
+    // we only record the closest hit and compute the diff geom at the end
+    Ray grid_ray(this->grid_to_frame.apply_inv(ray));
+    uint32_t hit_x = 0, hit_y = 0, hit_tri = 2;
+    float hit_b1 = 0.f, hit_b2 = 0.f;
+    this->traverse(grid_ray, [&](uint32_t x, uint32_t y) {
+      for(uint32_t tri = 0; tri < 2; ++tri) {
+        float t, b1, b2;
+        if(this->cell_triangle(x, y, tri).hit(grid_ray, t, b1, b2)) {
+          grid_ray.t_max = t;
+          hit_x = x;
+          hit_y = y;
+          hit_tri = tri;
+          hit_b1 = b1;
+          hit_b2 = b2;
+        }
+      }
+      return true;
+    });
+    if(hit_tri == 2) {
+      return false;
+    }
+
+    this->cell_triangle_uv(hit_x, hit_y, hit_tri).get_diff_geom(grid_ray.t_max,
+        hit_b1, hit_b2, out_isect.ray_epsilon, out_isect.frame_diff_geom);
+    out_isect.world_diff_geom = out_isect.frame_diff_geom =
+      this->grid_to_frame.apply(out_isect.frame_diff_geom);
+    out_isect.primitive = this;
+    ray.t_max = grid_ray.t_max;
+    return true;
+  }
+
+  bool HeightfieldPrimitive::intersect_p(const Ray& ray) const {
+    Ray grid_ray(this->grid_to_frame.apply_inv(ray));
+    return !this->traverse(grid_ray, [&](uint32_t x, uint32_t y) {
+      return !this->cell_triangle(x, y, 0).hit_p(grid_ray) &&
+        !this->cell_triangle(x, y, 1).hit_p(grid_ray);
+    });
+  }
+
+  Box HeightfieldPrimitive::bounds() const {
+    return this->grid_to_frame.apply(
+        this->block_bounds(this->levels.size(), 0, 0));
+  }
+
+  const Material* HeightfieldPrimitive::get_material(const Intersection&) const {
+    return this->material.get();
+  }
+
+  const Light* HeightfieldPrimitive::get_area_light(const DiffGeom&) const {
+    return nullptr;
+  }
+
+  HeightfieldPrimitive::MinMax HeightfieldPrimitive::cell_min_max(
+      uint32_t x, uint32_t y) const
+  {
+    float h00 = this->height(x, y);
+    float h10 = this->height(x + 1, y);
+    float h01 = this->height(x, y + 1);
+    float h11 = this->height(x + 1, y + 1);
+    return MinMax { min(min(h00, h10), min(h01, h11)),
+      max(max(h00, h10), max(h01, h11)) };
+  }
+
+  HeightfieldPrimitive::MinMax HeightfieldPrimitive::block_min_max(
+      uint32_t level, uint32_t x, uint32_t y) const
+  {
+    if(level == 0) {
+      return this->cell_min_max(x, y);
+    }
+    const Level& blocks = this->levels[level - 1];
+    return blocks.blocks[size_t(y) * blocks.x_res + x];
+  }
+
+  Box HeightfieldPrimitive::block_bounds(uint32_t level,
+      uint32_t x, uint32_t y) const
+  {
+    MinMax block = this->block_min_max(level, x, y);
+    uint64_t x0 = uint64_t(x) << level;
+    uint64_t y0 = uint64_t(y) << level;
+    uint64_t x1 = min(uint64_t(x + 1) << level, uint64_t(this->x_res - 1));
+    uint64_t y1 = min(uint64_t(y + 1) << level, uint64_t(this->y_res - 1));
+    // the bounds are slightly enlarged, so that rounding errors in the box
+    // test do not cull rays that graze the triangles
+    float pad_xy = 1e-3f;
+    float pad_z = 1e-4f * max(block.max - block.min,
+        max(abs(block.min), abs(block.max)));
+    return Box(Point(float(x0) - pad_xy, float(y0) - pad_xy, block.min - pad_z),
+        Point(float(x1) + pad_xy, float(y1) + pad_xy, block.max + pad_z));
+  }
+
+  Triangle HeightfieldPrimitive::cell_triangle(uint32_t x,
+      uint32_t y, uint32_t tri) const
+  {
+    std::array<Point, 3> p;
+    for(uint32_t i = 0; i < 3; ++i) {
+      uint32_t vx = x + TRIANGLE_VERTICES[tri][i][0];
+      uint32_t vy = y + TRIANGLE_VERTICES[tri][i][1];
+      p.at(i) = Point(float(vx), float(vy), this->height(vx, vy));
+    }
+    return Triangle(p);
+  }
+
+  TriangleUv HeightfieldPrimitive::cell_triangle_uv(uint32_t x,
+      uint32_t y, uint32_t tri) const
+  {
+    std::array<Vec2, 3> uv;
+    std::array<Normal, 3> n;
+    for(uint32_t i = 0; i < 3; ++i) {
+      uint32_t vx = x + TRIANGLE_VERTICES[tri][i][0];
+      uint32_t vy = y + TRIANGLE_VERTICES[tri][i][1];
+      uv.at(i) = Vec2(float(vx) / float(this->x_res - 1),
+          float(vy) / float(this->y_res - 1));
+      n.at(i) = this->vertex_normal(vx, vy);
+    }
+    return TriangleUv(this->cell_triangle(x, y, tri).p, uv, n);
+  }
+
+  Normal HeightfieldPrimitive::vertex_normal(uint32_t x, uint32_t y) const {
+    // central differences (one-sided at the borders)
+    uint32_t x0 = x > 0 ? x - 1 : x;
+    uint32_t x1 = x + 1 < this->x_res ? x + 1 : x;
+    uint32_t y0 = y > 0 ? y - 1 : y;
+    uint32_t y1 = y + 1 < this->y_res ? y + 1 : y;
+    float dhdx = (this->height(x1, y) - this->height(x0, y)) / float(x1 - x0);
+    float dhdy = (this->height(x, y1) - this->height(x, y0)) / float(y1 - y0);
+    return normalize(Normal(-dhdx, -dhdy, 1.f));
+  }
+
+  template<class F>
+  bool HeightfieldPrimitive::traverse(const Ray& ray, F callback) const {
+    // the traversal is a 2D-DDA over the blocks of the min/max pyramid: we
+    // step along the projection of the ray to the XY plane from block to
+    // block, descend to the finer level when the heights of the ray over the
+    // block overlap the heights in the block, and ascend again when the ray
+    // leaves the parent block
+    const float PAD_XY = 1e-3f;
+    float dir_x = ray.dir.v.x, dir_y = ray.dir.v.y, dir_z = ray.dir.v.z;
+    float inv_dir_x = 1.f / dir_x, inv_dir_y = 1.f / dir_y;
+
+    // clip the ray to the (slightly enlarged) XY extent of the grid
+    float t_begin = ray.t_min;
+    float t_end = ray.t_max;
+    float grid_max[2] = { float(this->x_res - 1), float(this->y_res - 1) };
+    for(uint32_t i = 0; i < 2; ++i) {
+      float orig = ray.orig.v[i];
+      if(ray.dir.v[i] == 0.f) {
+        if(orig < -PAD_XY || orig > grid_max[i] + PAD_XY) {
+          return true;
+        }
+        continue;
+      }
+      float inv_dir = i == 0 ? inv_dir_x : inv_dir_y;
+      float t_near = (-PAD_XY - orig) * inv_dir;
+      float t_far = (grid_max[i] + PAD_XY - orig) * inv_dir;
+      if(t_near > t_far) {
+        std::swap(t_near, t_far);
+      }
+      t_begin = max(t_begin, t_near);
+      t_end = min(t_end, t_far);
+    }
+    if(!(t_begin <= t_end)) {
+      return true;
+    }
+
+    // the heights of the ray are extended by the distance in Z that
+    // corresponds to PAD_XY in the XY plane, so that rounding errors do not
+    // cull rays that graze the triangles
+    float z_pad_ray = abs(dir_z) * PAD_XY / max(abs(dir_x), abs(dir_y));
+
+    uint32_t top_level = this->levels.size();
+    uint32_t level = top_level;
+    Point begin = ray.point_t(t_begin);
+    uint32_t cell_x = uint32_t(clamp(floor_int32(begin.v.x),
+          0, int32_t(this->x_res) - 2));
+    uint32_t cell_y = uint32_t(clamp(floor_int32(begin.v.y),
+          0, int32_t(this->y_res) - 2));
+    float t = t_begin;
+
+    for(;;) {
+      uint32_t block_x = cell_x >> level;
+      uint32_t block_y = cell_y >> level;
+      uint32_t block_x0 = block_x << level;
+      uint32_t block_y0 = block_y << level;
+      uint32_t block_x1 = min((block_x + 1) << level, this->x_res - 1);
+      uint32_t block_y1 = min((block_y + 1) << level, this->y_res - 1);
+
+      float t_exit_x = dir_x == 0.f ? INFINITY
+        : (float(dir_x > 0.f ? block_x1 : block_x0) - ray.orig.v.x) * inv_dir_x;
+      float t_exit_y = dir_y == 0.f ? INFINITY
+        : (float(dir_y > 0.f ? block_y1 : block_y0) - ray.orig.v.y) * inv_dir_y;
+      float t_exit = min(min(t_exit_x, t_exit_y), t_end);
+      float t_last = min(t_exit, ray.t_max);
+
+      float z_0 = ray.orig.v.z + t * dir_z;
+      float z_1 = ray.orig.v.z + t_last * dir_z;
+      MinMax block = this->block_min_max(level, block_x, block_y);
+      float z_pad = z_pad_ray + 1e-4f * max(block.max - block.min,
+          max(abs(block.min), abs(block.max)));
+      bool overlaps = min(z_0, z_1) - z_pad <= block.max &&
+        max(z_0, z_1) + z_pad >= block.min;
+
+      if(overlaps) {
+        if(level > 0) {
+          --level;
+          continue;
+        }
+        if(!callback(cell_x, cell_y)) {
+          return false;
+        }
+      }
+      if(t_exit >= min(t_end, ray.t_max)) {
+        return true;
+      }
+
+      // step to the neighbor block; the cell in the other axis is clamped to
+      // the current block, so that rounding errors cannot move us backwards
+      uint32_t prev_x = cell_x, prev_y = cell_y;
+      if(t_exit_x <= t_exit_y) {
+        if(dir_x > 0.f) {
+          if(block_x1 >= this->x_res - 1) {
+            return true;
+          }
+          cell_x = block_x1;
+        } else {
+          if(block_x0 == 0) {
+            return true;
+          }
+          cell_x = block_x0 - 1;
+        }
+        cell_y = uint32_t(clamp(floor_int32(ray.orig.v.y + t_exit * dir_y),
+              int32_t(block_y0), int32_t(block_y1) - 1));
+      } else {
+        if(dir_y > 0.f) {
+          if(block_y1 >= this->y_res - 1) {
+            return true;
+          }
+          cell_y = block_y1;
+        } else {
+          if(block_y0 == 0) {
+            return true;
+          }
+          cell_y = block_y0 - 1;
+        }
+        cell_x = uint32_t(clamp(floor_int32(ray.orig.v.x + t_exit * dir_x),
+              int32_t(block_x0), int32_t(block_x1) - 1));
+      }
+      t = t_exit;
+
+      while(level < top_level &&
+          ((prev_x ^ cell_x) | (prev_y ^ cell_y)) >> (level + 1) != 0)
+      {
+        ++level;
+      }
+    }
+  }
+}
@@ -6,6 +6,7 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
 #include <cstring>
+#include <stdexcept>
 #include <stb_image.h>
 #include <stb_image_write.h>
 #include "dort/image.hpp"
@@ -29,7 +30,14 @@ namespace dort {
     int x_res, y_res;
     float* data = stbi_loadf_from_file(input, &x_res, &y_res, 0, 3);
 
-    assert(data);
+    // the image may be decoded in the thread pool, so we report the error
+    // with an exception; note that stb keeps the failure reason in a global
+    // variable, so with concurrent decodes the reason may belong to another
+    // image
+    if(!data) {
+      throw std::runtime_error(std::string("Error reading image: ")
+          + stbi_failure_reason());
+    }
     assert(x_res >= 0); assert(y_res >= 0);
     Image<PixelRgbFloat> img(x_res, y_res);
     std::memcpy(img.storage.data(), data, 
@@ -0,0 +1,141 @@
+#include <array>
+#include <unordered_set>
+#include "dort/instance_bvh_primitive.hpp"
+#include "dort/mesh_bvh_primitive.hpp"
+#include "dort/stats.hpp"
+
+namespace dort {
+  InstanceBvhPrimitive::InstanceBvhPrimitive(
+      std::vector<PrimitiveInstance> instances,
+      const BvhOpts& opts, ThreadPool& pool):
+    insides(InstanceBvhPrimitive::collect_insides(instances)),
+    bvh(InstanceBvhPrimitive::make_instances(instances),
+        BvhTraits::Arg(), opts, pool)
+  { }
+
+  bool InstanceBvhPrimitive::intersect(Ray& ray, Intersection& out_isect) const {
+    stat_count(COUNTER_BVH_PRIM_INTERSECT);
+    const Instance* hit_instance = nullptr;
+    this->bvh.traverse_elems(ray, [&](const Instance& instance) {
+      Ray inside_ray(instance.in_to_out.apply_inv(ray));
+      bool hit = instance.inside_mesh_bvh
+        ? instance.inside_mesh_bvh->intersect(inside_ray, out_isect)
+        : instance.inside->intersect(inside_ray, out_isect);
+      if(hit) {
+        ray.t_max = inside_ray.t_max;
+        hit_instance = &instance;
+      }
+      return true;
+    });
+
+    if(hit_instance == nullptr) {
+      return false;
+    }
+    stat_count(COUNTER_BVH_PRIM_INTERSECT_HIT);
+    out_isect.world_diff_geom = hit_instance->in_to_out.apply(
+        out_isect.world_diff_geom);
+    return true;
+  }
+
+  uint32_t InstanceBvhPrimitive::intersect_packet(Ray* rays,
+      Intersection* out_isects, uint32_t ray_mask) const
+  {
+    std::array<const Instance*, RAY_PACKET_SIZE> hit_instances;
+    hit_instances.fill(nullptr);
+    this->bvh.traverse_packet_elems(rays, ray_mask,
+      [&](const Instance& instance, uint32_t leaf_ray_mask) {
+        std::array<Ray, RAY_PACKET_SIZE> inside_rays;
+        for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+          if(leaf_ray_mask & (1u << i)) {
+            inside_rays.at(i) = instance.in_to_out.apply_inv(rays[i]);
+          }
+        }
+
+        uint32_t hit_mask = instance.inside_mesh_bvh
+          ? instance.inside_mesh_bvh->intersect_packet(
+              inside_rays.data(), out_isects, leaf_ray_mask)
+          : instance.inside->intersect_packet(
+              inside_rays.data(), out_isects, leaf_ray_mask);
+        for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+          if(hit_mask & (1u << i)) {
+            rays[i].t_max = inside_rays.at(i).t_max;
+            hit_instances.at(i) = &instance;
+          }
+        }
+        return true;
+      });
+
+    uint32_t hit_mask = 0;
+    for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+      if(hit_instances.at(i) != nullptr) {
+        out_isects[i].world_diff_geom = hit_instances.at(i)->in_to_out.apply(
+            out_isects[i].world_diff_geom);
+        hit_mask |= 1u << i;
+      }
+    }
+    return hit_mask;
+  }
+
+  bool InstanceBvhPrimitive::intersect_p(const Ray& ray) const {
+    stat_count(COUNTER_BVH_PRIM_INTERSECT_P);
+    bool found = false;
+    this->bvh.traverse_elems(ray, [&](const Instance& instance) {
+      Ray inside_ray(instance.in_to_out.apply_inv(ray));
+      found = instance.inside_mesh_bvh
+        ? instance.inside_mesh_bvh->intersect_p(inside_ray)
+        : instance.inside->intersect_p(inside_ray);
+      return !found;
+    });
+    if(found) {
+      stat_count(COUNTER_BVH_PRIM_INTERSECT_P_HIT);
+    }
+    return found;
+  }
+
+  Box InstanceBvhPrimitive::bounds() const {
+    return this->bvh.bounds();
+  }
+
+  Box InstanceBvhPrimitive::transformed_bounds(const Transform& transform) const {
+    return this->bvh.transformed_bounds(transform);
+  }
+
+  void InstanceBvhPrimitive::refit(ThreadPool& pool, float rebuild_threshold,
+      RefittedSet& refitted)
+  {
+    for(const auto& inside: this->insides) {
+      refit_shared(*inside, pool, rebuild_threshold, refitted);
+    }
+    this->bvh.for_each_elem([&](Instance& instance) {
+      instance.bounds = instance.inside->transformed_bounds(instance.in_to_out);
+    });
+    this->bvh.refit(BvhTraits::Arg(), pool, rebuild_threshold);
+  }
+
+  std::vector<InstanceBvhPrimitive::Instance> InstanceBvhPrimitive::make_instances(
+      const std::vector<PrimitiveInstance>& instances)
+  {
+    std::vector<Instance> elems;
+    elems.reserve(instances.size());
+    for(const auto& instance: instances) {
+      Instance elem;
+      elem.in_to_out = instance.in_to_out;
+      elem.bounds = instance.inside->transformed_bounds(instance.in_to_out);
+      elem.inside = instance.inside.get();
+      elem.inside_mesh_bvh = dynamic_cast<const MeshBvhPrimitive*>(
+          instance.inside.get());
+      elems.push_back(elem);
+    }
+    return elems;
+  }
+
+  std::vector<std::shared_ptr<Primitive>> InstanceBvhPrimitive::collect_insides(
+      const std::vector<PrimitiveInstance>& instances)
+  {
+    std::unordered_set<std::shared_ptr<Primitive>> insides;
+    for(const auto& instance: instances) {
+      insides.insert(instance.inside);
+    }
+    return std::vector<std::shared_ptr<Primitive>>(insides.begin(), insides.end());
+  }
+}
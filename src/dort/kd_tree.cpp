@@ -16,58 +16,6 @@ namespace dort {
     }
   }
 
-  template<class Traits>
-  void KdTree<Traits>::lookup(const Point& p, float radius_square,
-      std::function<float(const Element&, float, float)> callback) const
-  {
-    if(this->elements.empty()) {
-      return;
-    }
-
-    std::array<uint32_t, 30> todo_stack;
-    uint32_t todo_top = 0;
-    uint32_t todo_node_idx = 0;
-
-    for(;;) {
-      uint32_t node_idx = todo_node_idx;
-      const Node& node = this->nodes.at(node_idx);
-      const Element& elem = this->elements.at(node_idx);
-      uint8_t axis = node.split_axis();
-
-      float point_dist_square = length_squared(p - Traits::element_point(elem));
-      if(point_dist_square <= radius_square) {
-        radius_square = callback(elem, point_dist_square, radius_square);
-      }
-
-      if(axis != 3) {
-        uint32_t left_idx = node_idx + 1;
-        uint32_t right_idx = node.right_child();
-        float split_dist_square = square(p.v[axis] - node.split_pos);
-
-        if(p.v[axis] < node.split_pos) {
-          if(right_idx != Node::NO_RIGHT && split_dist_square < radius_square) {
-            todo_stack.at(todo_top++) = right_idx;
-          }
-          todo_node_idx = left_idx;
-          continue;
-        } else {
-          if(split_dist_square < radius_square) {
-            todo_stack.at(todo_top++) = left_idx;
-          }
-          if(right_idx != Node::NO_RIGHT) {
-            todo_node_idx = right_idx;
-            continue;
-          }
-        }
-      }
-
-      if(todo_top == 0) {
-        break;
-      }
-      todo_node_idx = todo_stack.at(--todo_top);
-    }
-  }
-
   template<class Traits>
   void KdTree<Traits>::build_node(uint32_t begin, uint32_t end) {
     assert(begin < end); assert(end <= this->elements.size());
@@ -17,6 +17,7 @@ namespace dort {
       this->film->res.x * this->film->res.y;
     uint32_t job_count = ctx.pool->thread_count() * 16;
     this->light_distrib = compute_light_distrib(*this->scene);
+    this->film->init_splat_planes(*ctx.pool);
 
     std::mutex film_mutex;
     std::atomic<uint32_t> jobs_done(0);
@@ -1,3 +1,4 @@
+#include <array>
 #include "dort/list_primitive.hpp"
 
 namespace dort {
@@ -25,6 +26,37 @@ namespace dort {
     return any_hit;
   }
 
+  uint32_t ListPrimitive::intersect_packet(Ray* rays,
+      Intersection* out_isects, uint32_t ray_mask) const
+  {
+    std::array<Vector, RAY_PACKET_SIZE> inv_dirs;
+    std::array<std::array<bool, 3>, RAY_PACKET_SIZE> dirs_are_neg;
+    for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+      if(!(ray_mask & (1u << i))) {
+        continue;
+      }
+      const Vector& dir = rays[i].dir;
+      inv_dirs.at(i) = Vector(1.f / dir.v.x, 1.f / dir.v.y, 1.f / dir.v.z);
+      dirs_are_neg.at(i) = {{ dir.v.x < 0.f, dir.v.y < 0.f, dir.v.z < 0.f }};
+    }
+
+    uint32_t hit_mask = 0;
+    for(uint32_t i = 0; i < this->prims.size(); ++i) {
+      uint32_t box_mask = 0;
+      for(uint32_t j = 0; j < RAY_PACKET_SIZE; ++j) {
+        if((ray_mask & (1u << j)) && this->prim_bounds.at(i).fast_hit_p(
+              rays[j], inv_dirs.at(j), dirs_are_neg.at(j).data()))
+        {
+          box_mask |= 1u << j;
+        }
+      }
+      if(box_mask != 0) {
+        hit_mask |= this->prims.at(i)->intersect_packet(rays, out_isects, box_mask);
+      }
+    }
+    return hit_mask;
+  }
+
   bool ListPrimitive::intersect_p(const Ray& ray) const {
     Vector inv_dir(1.f / ray.dir.v.x, 1.f / ray.dir.v.y, 1.f / ray.dir.v.z);
     bool dir_is_neg[] = { ray.dir.v.x < 0.f, ray.dir.v.y < 0.f, ray.dir.v.z < 0.f };
@@ -42,4 +74,24 @@ namespace dort {
   Box ListPrimitive::bounds() const {
     return this->total_bounds;
   }
+
+  Box ListPrimitive::transformed_bounds(const Transform& transform) const {
+    Box bounds;
+    for(const auto& prim: this->prims) {
+      bounds = union_box(bounds, prim->transformed_bounds(transform));
+    }
+    return bounds;
+  }
+
+  void ListPrimitive::refit(ThreadPool& pool, float rebuild_threshold,
+      RefittedSet& refitted)
+  {
+    this->total_bounds = Box();
+    for(uint32_t i = 0; i < this->prims.size(); ++i) {
+      this->prims.at(i)->refit(pool, rebuild_threshold, refitted);
+      Box bounds = this->prims.at(i)->bounds();
+      this->prim_bounds.at(i) = bounds;
+      this->total_bounds = union_box(this->total_bounds, bounds);
+    }
+  }
 }
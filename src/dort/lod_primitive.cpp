@@ -0,0 +1,83 @@
+#include "dort/lod_primitive.hpp"
+
+namespace dort {
+  LodPrimitive::LodPrimitive(std::vector<LodLevel> levels):
+    levels(std::move(levels))
+  {
+    assert(!this->levels.empty());
+  }
+
+  const LodLevel& LodPrimitive::select_level(float max_error) const {
+    uint32_t level = 0;
+    while(level + 1 < this->levels.size() &&
+        this->levels.at(level + 1).error <= max_error) {
+      ++level;
+    }
+    return this->levels.at(level);
+  }
+
+  bool LodPrimitive::intersect(Ray& ray, Intersection& out_isect) const {
+    return this->levels.at(0).prim->intersect(ray, out_isect);
+  }
+
+  bool LodPrimitive::intersect_p(const Ray& ray) const {
+    return this->levels.at(0).prim->intersect_p(ray);
+  }
+
+  uint32_t LodPrimitive::intersect_packet(Ray* rays,
+      Intersection* out_isects, uint32_t ray_mask) const
+  {
+    return this->levels.at(0).prim->intersect_packet(rays, out_isects, ray_mask);
+  }
+
+  Box LodPrimitive::bounds() const {
+    return this->levels.at(0).prim->bounds();
+  }
+
+  Box LodPrimitive::transformed_bounds(const Transform& transform) const {
+    return this->levels.at(0).prim->transformed_bounds(transform);
+  }
+
+  void LodPrimitive::refit(ThreadPool& pool, float rebuild_threshold,
+      RefittedSet& refitted)
+  {
+    for(const LodLevel& level: this->levels) {
+      refit_shared(*level.prim, pool, rebuild_threshold, refitted);
+    }
+  }
+
+  LodFramePrimitive::LodFramePrimitive(std::unique_ptr<Primitive> finest,
+      std::vector<PrimitiveInstance> instances,
+      std::shared_ptr<Primitive> prims, const BvhOpts& bvh_opts):
+    finest(std::move(finest)), instances(std::move(instances)),
+    prims(std::move(prims)), bvh_opts(bvh_opts)
+  { }
+
+  bool LodFramePrimitive::intersect(Ray& ray, Intersection& out_isect) const {
+    return this->finest->intersect(ray, out_isect);
+  }
+
+  bool LodFramePrimitive::intersect_p(const Ray& ray) const {
+    return this->finest->intersect_p(ray);
+  }
+
+  uint32_t LodFramePrimitive::intersect_packet(Ray* rays,
+      Intersection* out_isects, uint32_t ray_mask) const
+  {
+    return this->finest->intersect_packet(rays, out_isects, ray_mask);
+  }
+
+  Box LodFramePrimitive::bounds() const {
+    return this->finest->bounds();
+  }
+
+  Box LodFramePrimitive::transformed_bounds(const Transform& transform) const {
+    return this->finest->transformed_bounds(transform);
+  }
+
+  void LodFramePrimitive::refit(ThreadPool& pool, float rebuild_threshold,
+      RefittedSet& refitted)
+  {
+    this->finest->refit(pool, rebuild_threshold, refitted);
+  }
+}
@@ -24,24 +24,36 @@
 // - @{dort.grid} for `Grid`
 //
 // @module dort.builder
+#include <algorithm>
+#include <stdexcept>
 #include "dort/bvh_primitive.hpp"
 #include "dort/camera.hpp"
+#include "dort/compressed_mesh_bvh_primitive.hpp"
 #include "dort/ctx.hpp"
+#include "dort/environment_light.hpp"
 #include "dort/grid.hpp"
+#include "dort/heightfield_primitive.hpp"
+#include "dort/image.hpp"
 #include "dort/light.hpp"
 #include "dort/list_primitive.hpp"
 #include "dort/lua_builder.hpp"
 #include "dort/lua_camera.hpp"
 #include "dort/lua_geometry.hpp"
 #include "dort/lua_helpers.hpp"
+#include "dort/lua_image.hpp"
 #include "dort/lua_light.hpp"
 #include "dort/lua_material.hpp"
 #include "dort/lua_params.hpp"
 #include "dort/lua_shape.hpp"
+#include "dort/lua_texture_magic.hpp"
+#include "dort/lod_primitive.hpp"
 #include "dort/mesh_bvh_primitive.hpp"
+#include "dort/mesh_simplify.hpp"
 #include "dort/mesh_triangle_primitive.hpp"
 #include "dort/ply_mesh.hpp"
 #include "dort/scene.hpp"
+#include "dort/sphere_set_primitive.hpp"
+#include "dort/texture.hpp"
 #include "dort/thread_pool.hpp"
 #include "dort/triangle_shape.hpp"
 #include "dort/triangle_shape_primitive.hpp"
@@ -87,8 +99,13 @@ namespace dort {
       {"add_read_ply_mesh_as_bvh", lua_builder_add_read_ply_mesh_as_bvh},
       {"add_ply_mesh", lua_builder_add_ply_mesh},
       {"add_ply_mesh_as_bvh", lua_builder_add_ply_mesh_as_bvh},
+      {"add_mesh_as_bvh", lua_builder_add_mesh_as_bvh},
       {"add_voxel_grid", lua_builder_add_voxel_grid},
+      {"add_spheres", lua_builder_add_spheres},
+      {"add_heightfield", lua_builder_add_heightfield},
       {"make_triangle", lua_builder_make_triangle},
+      {"make_mesh_lod", lua_builder_make_mesh_lod},
+      {"refit_scene", lua_builder_refit_scene},
       {0, 0},
     };
 
@@ -120,6 +137,15 @@ namespace dort {
       return luaL_error(l, "State stack is not empty");
     }
 
+    lua_resolve_pending_prims(l, builder->frame);
+    lua_resolve_pending_lights(l, *builder);
+    if(builder->state.lod_pixel_error > 0.f && builder->camera) {
+      LodSelection selection { builder->camera.get(),
+        builder->state.lod_film_res, builder->state.lod_pixel_error, {} };
+      lua_select_lod_levels(*lua_get_ctx(l), *builder, selection,
+          builder->frame.instances, identity());
+    }
+
     auto scene = std::make_shared<Scene>();
     scene->primitive = lua_make_aggregate(*lua_get_ctx(l),
         builder->state, std::move(builder->frame));
@@ -208,14 +234,15 @@ namespace dort {
       return luaL_error(l, "State stack is empty (not balanced)");
     }
 
-    auto primitive = lua_make_aggregate(*lua_get_ctx(l),
+    lua_resolve_pending_prims(l, builder->frame);
+    auto primitive = lua_make_frame_primitive(*lua_get_ctx(l),
         builder->state, std::move(builder->frame));
     builder->frame = std::move(builder->frame_stack.back());
     builder->state = std::move(builder->state_stack.back());
     builder->frame_stack.pop_back();
     builder->state_stack.pop_back();
 
-    lua_push_primitive(l, std::shared_ptr<Primitive>(std::move(primitive)));
+    lua_push_primitive(l, std::move(primitive));
     return 1;
   }
 
@@ -280,11 +307,61 @@ namespace dort {
   // The available options are:
   //
   // - `bvh_split_method` -- defines the method for separating primitives when
-  // splitting a BVH node, possible values are `sah` (surface area heuristic) or
-  // `middle` (split the primitives in the geometric center).
+  // splitting a BVH node, possible values are `sah` (surface area heuristic
+  // along the longest axis), `full_sah` (surface area heuristic evaluated along
+  // all three axes, builds slower but produces better trees for elongated
+  // geometry), `spatial_sah` (like `full_sah`, but triangles of meshes may
+  // also be clipped and referenced from both children, which helps with
+  // large triangles; other primitives use `full_sah`), `middle` (split the
+  // primitives in the geometric center) or `lbvh` (sort the primitives along a
+  // Morton curve and split them by the bits of their Morton codes, which is
+  // very fast and parallel, but produces worse trees; good for previews).
+  // - `bvh_sah_traversal_cost` and `bvh_sah_intersection_cost` -- relative
+  // costs of traversing a BVH node and intersecting a primitive used by the
+  // `sah`, `full_sah` and `spatial_sah` split methods (defaults are 1 and 2).
+  // - `bvh_spatial_split_budget` -- maximal number of references to triangles
+  // that may be added by `spatial_sah`, as a fraction of the number of
+  // triangles (default is 0.5).
+  // - `bvh_spatial_split_alpha` -- spatial splits are considered only when the
+  // children of the best object split overlap by more than this fraction of
+  // the area of the whole tree (default is 1e-5).
+  // - `bvh_lbvh_sah_cluster_size` -- subtrees of the `lbvh` split method with at
+  // most this number of primitives are built using `full_sah`, which improves
+  // the quality of the tree at a moderate cost (default is 0, which disables
+  // this refinement).
+  // - `bvh_triangle_blocks` -- if true, BVHs of meshes store a copy of the
+  // vertices and edges of their triangles in the order of the leaves, grouped
+  // by four, so that the triangles can be intersected using SIMD instructions.
+  // This is faster, but needs 40 additional bytes per triangle (default is
+  // false).
   // - `bvh_leaf_size` and `bvh_max_leaf_size` -- sets the usual and maximal number
   // of primitives in the leaves of the BVH tree. The algorithm may make leaves
   // larger or smaller, but they will never be larger than the maximum.
+  // - `bvh_branch_factor` -- number of children of BVH nodes: 2 (binary BVH),
+  // 4 or 8 (wide BVH, the children of a node are tested together using SIMD
+  // instructions).
+  // - `bvh_quantization_bits` -- if 8 or 16, the BVH is stored as 4-wide nodes
+  // with the bounds of children quantized to this number of bits, which
+  // reduces the memory traffic during traversal (the 8-bit nodes fit into a
+  // single cache line); 0 (the default) stores full-precision bounds. This
+  // option overrides `bvh_branch_factor`.
+  // - `lod_pixel_error` -- when the scene is built, every instance of a
+  // primitive from `make_mesh_lod` (also in nested frames) is replaced with
+  // its coarsest level whose error, seen from the default camera, spans at
+  // most `lod_pixel_error` pixels (1 is a good choice). The default is 0,
+  // which always uses the finest level.
+  // - `lod_x_res`, `lod_y_res` -- the resolution of the film that is used to
+  // compute the size of the pixels for `lod_pixel_error` (default is 800x600,
+  // the default resolution of `render`). Set them to the resolution that
+  // you render at.
+  // - `compress_meshes` -- if true, the meshes added by
+  // `add_read_ply_mesh_as_bvh` and `add_ply_mesh_as_bvh` are stored with
+  // quantized points, normals and uvs and compressed vertices (default is
+  // false). The mesh takes less than half of the memory, but the BVH is not
+  // compressed, so the whole primitive shrinks only by about 20 % (combine
+  // with `bvh_quantization_bits` to shrink the BVH too). The triangles are
+  // decoded when they are intersected, which makes the rendering about 5 %
+  // slower. The points are quantized to 1/65535 of the extent of the mesh.
   //
   // @function set_option
   // @param B
@@ -298,6 +375,12 @@ namespace dort {
       std::string method = luaL_checkstring(l, 3);
       if(method == "sah") {
         builder->state.bvh_opts.split_method = BvhSplitMethod::Sah;
+      } else if(method == "full_sah") {
+        builder->state.bvh_opts.split_method = BvhSplitMethod::FullSah;
+      } else if(method == "spatial_sah") {
+        builder->state.bvh_opts.split_method = BvhSplitMethod::SpatialSah;
+      } else if(method == "lbvh") {
+        builder->state.bvh_opts.split_method = BvhSplitMethod::Lbvh;
       } else if(method == "middle") {
         builder->state.bvh_opts.split_method = BvhSplitMethod::Middle;
       } else {
@@ -307,6 +390,40 @@ namespace dort {
       builder->state.bvh_opts.leaf_size = luaL_checkinteger(l, 3);
     } else if(option == "bvh_max_leaf_size") {
       builder->state.bvh_opts.max_leaf_size = luaL_checkinteger(l, 3);
+    } else if(option == "bvh_branch_factor") {
+      uint32_t branch_factor = luaL_checkinteger(l, 3);
+      if(branch_factor != 2 && branch_factor != 4 && branch_factor != 8) {
+        luaL_error(l, "bvh branch factor must be 2, 4 or 8: %d", branch_factor);
+      }
+      builder->state.bvh_opts.branch_factor = branch_factor;
+    } else if(option == "bvh_quantization_bits") {
+      uint32_t bits = luaL_checkinteger(l, 3);
+      if(bits != 0 && bits != 8 && bits != 16) {
+        luaL_error(l, "bvh quantization bits must be 0, 8 or 16: %d", bits);
+      }
+      builder->state.bvh_opts.quantization_bits = bits;
+    } else if(option == "bvh_sah_traversal_cost") {
+      builder->state.bvh_opts.sah_traversal_cost = luaL_checknumber(l, 3);
+    } else if(option == "bvh_sah_intersection_cost") {
+      builder->state.bvh_opts.sah_intersection_cost = luaL_checknumber(l, 3);
+    } else if(option == "bvh_spatial_split_budget") {
+      builder->state.bvh_opts.spatial_split_budget = luaL_checknumber(l, 3);
+    } else if(option == "bvh_spatial_split_alpha") {
+      builder->state.bvh_opts.spatial_split_alpha = luaL_checknumber(l, 3);
+    } else if(option == "bvh_lbvh_sah_cluster_size") {
+      builder->state.bvh_opts.lbvh_sah_cluster_size = luaL_checkinteger(l, 3);
+    } else if(option == "bvh_triangle_blocks") {
+      luaL_checkany(l, 3);
+      builder->state.bvh_opts.triangle_blocks = lua_toboolean(l, 3);
+    } else if(option == "compress_meshes") {
+      luaL_checkany(l, 3);
+      builder->state.compress_meshes = lua_toboolean(l, 3);
+    } else if(option == "lod_pixel_error") {
+      builder->state.lod_pixel_error = luaL_checknumber(l, 3);
+    } else if(option == "lod_x_res") {
+      builder->state.lod_film_res.x = luaL_checkinteger(l, 3);
+    } else if(option == "lod_y_res") {
+      builder->state.lod_film_res.y = luaL_checkinteger(l, 3);
     } else {
       luaL_error(l, "unknown option: %s", option.c_str());
     }
@@ -358,8 +475,7 @@ namespace dort {
     auto builder = lua_check_builder(l, 1);
     auto primitive = lua_check_primitive(l, 2);
     auto transform = builder->state.local_to_frame;
-    auto frame_prim = std::make_unique<FramePrimitive>(transform, primitive);
-    builder->frame.prims.push_back(std::move(frame_prim));
+    builder->frame.instances.push_back(PrimitiveInstance { transform, primitive });
     return 0;
   }
 
@@ -454,6 +570,9 @@ namespace dort {
   // large meshes is much more efficient than separate primitives for each
   // triangle. However, the triangles are not "visible" to the acceleration
   // structure of the frame, so for smaller meshes the performance may be worse.
+  //
+  // The mesh is read and the BVH is built in the background, so errors in the
+  // file are reported by the following `pop_frame` or `build_scene`.
   // @function add_read_ply_mesh_as_bvh
   // @param B
   // @param file_name
@@ -474,20 +593,39 @@ namespace dort {
       return 0;
     }
 
-    std::vector<uint32_t> indices;
+    // the mesh is read and its BVH is built in the thread pool, so that
+    // multiple meshes are loaded concurrently with each other and with the
+    // rest of the scene script
     auto mesh = std::make_shared<Mesh>();
-    bool ok = read_ply_to_mesh(file, transform, *mesh,
-      [&](uint32_t index) { indices.push_back(index); });
-    std::fclose(file);
+    std::string file_name_str(file_name);
+    BvhOpts bvh_opts = builder->state.bvh_opts;
+    bool compress = builder->state.compress_meshes;
+    ThreadPool& pool = *lua_get_ctx(l)->pool;
+    auto future = spawn(pool, [=, &pool]() -> std::unique_ptr<Primitive> {
+      std::vector<uint32_t> indices;
+      bool ok = read_ply_to_mesh(file, transform, *mesh,
+        [&](uint32_t index) { indices.push_back(index); });
+      std::fclose(file);
+      if(!ok) {
+        throw std::runtime_error("Could not read ply file: " + file_name_str);
+      }
 
-    if(!ok) {
-      return luaL_error(l, "Could not read ply file: %s", file_name);
+      if(compress) {
+        return std::make_unique<CompressedMeshBvhPrimitive>(
+            std::move(*mesh), material, bvh_opts, pool);
+      }
+      auto prim = std::make_unique<MeshBvhPrimitive>(
+          mesh.get(), material, std::move(indices), bvh_opts, pool);
+      prim->reorder_mesh(*mesh);
+      return prim;
+    });
+
+    builder->frame.pending_prims.emplace_back(
+        builder->frame.prims.size(), std::move(future));
+    builder->frame.prims.push_back(nullptr);
+    if(!compress) {
+      builder->meshes.insert(mesh);
     }
-
-    builder->frame.prims.push_back(std::make_unique<MeshBvhPrimitive>(
-        mesh.get(), material, std::move(indices), builder->state.bvh_opts,
-        *lua_get_ctx(l)->pool));
-    builder->meshes.insert(mesh);
     return 0;
   }
 
@@ -544,16 +682,63 @@ namespace dort {
       return 0;
     }
 
-    std::vector<uint32_t> indices;
-    for(uint32_t t = 0; t < ply_mesh->triangle_count; ++t) {
-      indices.push_back(t * 3);
+    auto mesh = std::make_shared<Mesh>();
+    BvhOpts bvh_opts = builder->state.bvh_opts;
+    bool compress = builder->state.compress_meshes;
+    ThreadPool& pool = *lua_get_ctx(l)->pool;
+    auto future = spawn(pool, [=, &pool]() -> std::unique_ptr<Primitive> {
+      std::vector<uint32_t> indices;
+      for(uint32_t t = 0; t < ply_mesh->triangle_count; ++t) {
+        indices.push_back(t * 3);
+      }
+
+      mesh->vertices = ply_mesh->vertices;
+      mesh->points.reserve(ply_mesh->points.size());
+      for(const Point& pt: ply_mesh->points) {
+        mesh->points.push_back(transform.apply(pt));
+      }
+
+      if(compress) {
+        return std::make_unique<CompressedMeshBvhPrimitive>(
+            std::move(*mesh), material, bvh_opts, pool);
+      }
+      auto prim = std::make_unique<MeshBvhPrimitive>(
+          mesh.get(), material, std::move(indices), bvh_opts, pool);
+      prim->reorder_mesh(*mesh);
+      return prim;
+    });
+
+    builder->frame.pending_prims.emplace_back(
+        builder->frame.prims.size(), std::move(future));
+    builder->frame.prims.push_back(nullptr);
+    if(!compress) {
+      builder->meshes.insert(mesh);
     }
+    return 0;
+  }
 
-    auto mesh = std::make_shared<Mesh>();
-    mesh->vertices = ply_mesh->vertices;
-    mesh->points.reserve(ply_mesh->points.size());
-    for(Point& pt: ply_mesh->points) {
-      mesh->points.push_back(transform.apply(pt));
+  /// Add a `Mesh` as an efficient specialized BVH.
+  // Adds all triangles from `mesh` as a single primitive into the frame, using
+  // the current material. Like in `add_triangle`, the current transform is
+  // ignored and the points of the mesh are used directly, so the mesh can be
+  // later deformed using `dort.shape.set_mesh_points` and `refit_scene`.
+  // @function add_mesh_as_bvh
+  // @param B
+  // @param mesh
+  // @within Meshes
+  int lua_builder_add_mesh_as_bvh(lua_State* l) {
+    auto builder = lua_check_builder(l, 1);
+    auto mesh = lua_check_mesh(l, 2);
+
+    auto material = builder->state.material;
+    if(!material) {
+      luaL_error(l, "no material is set");
+      return 0;
+    }
+
+    std::vector<uint32_t> indices;
+    for(uint32_t index = 0; index + 2 < mesh->vertices.size(); index += 3) {
+      indices.push_back(index);
     }
 
     builder->frame.prims.push_back(std::make_unique<MeshBvhPrimitive>(
@@ -647,6 +832,184 @@ namespace dort {
     return 0;
   }
 
+  /// Add a large set of spheres.
+  // Adds the spheres as a single primitive with its own BVH, which uses much
+  // less memory per sphere than @{add_shape}. Like in `add_mesh_as_bvh`, the
+  // current transform is ignored and the coordinates are used directly.
+  //
+  // The `params` are:
+  //
+  // - `centers` -- array with the coordinates `x, y, z` of the center of each
+  //   sphere.
+  // - `radii` -- array with the radius of each sphere.
+  // - `radius` -- the radius of all spheres, if `radii` is not given.
+  // - `materials` -- table of materials (the current material by default).
+  // - `material_indices` -- array with the (1-based) index into `materials`
+  //   for each sphere (all spheres use the first material by default).
+  //
+  // The arrays can be tables of numbers or strings with packed native values
+  // (32-bit floats for `centers` and `radii`, 32-bit unsigned integers for
+  // `material_indices`), as produced by `string.pack`.
+  //
+  // @function add_spheres
+  // @param B
+  // @param params
+  // @within Adding
+  int lua_builder_add_spheres(lua_State* l) {
+    auto builder = lua_check_builder(l, 1);
+
+    int p = 2;
+    SphereSet spheres;
+    std::vector<float> centers = lua_param_float_array(l, p, "centers");
+    if(centers.size() % 3 != 0) {
+      return luaL_error(l, "The number of center coordinates must be divisible by 3");
+    }
+    uint32_t sphere_count = centers.size() / 3;
+    if(sphere_count == 0) {
+      return luaL_error(l, "At least one sphere must be given");
+    }
+    spheres.center_x.reserve(sphere_count);
+    spheres.center_y.reserve(sphere_count);
+    spheres.center_z.reserve(sphere_count);
+    for(uint32_t i = 0; i < sphere_count; ++i) {
+      spheres.center_x.push_back(centers.at(3*i));
+      spheres.center_y.push_back(centers.at(3*i + 1));
+      spheres.center_z.push_back(centers.at(3*i + 2));
+    }
+    centers = std::vector<float>();
+
+    if(lua_param_is_set(l, p, "radii")) {
+      spheres.radii = lua_param_float_array(l, p, "radii");
+      if(spheres.radii.size() != sphere_count) {
+        return luaL_error(l, "The number of radii must match the number of spheres");
+      }
+    } else {
+      spheres.radii.assign(sphere_count, lua_param_float(l, p, "radius"));
+    }
+
+    if(lua_param_is_set(l, p, "materials")) {
+      if(lua_getfield(l, p, "materials") != LUA_TTABLE) {
+        return luaL_error(l, "Expected an array of materials");
+      }
+      uint32_t material_count = lua_rawlen(l, -1);
+      for(uint32_t i = 1; i <= material_count; ++i) {
+        lua_rawgeti(l, -1, i);
+        spheres.materials.push_back(lua_check_material(l, -1));
+        lua_pop(l, 1);
+      }
+      lua_pop(l, 1);
+      lua_pushnil(l);
+      lua_setfield(l, p, "materials");
+    } else if(builder->state.material) {
+      spheres.materials.push_back(builder->state.material);
+    }
+    if(spheres.materials.empty()) {
+      return luaL_error(l, "no material is set");
+    }
+
+    if(lua_param_is_set(l, p, "material_indices")) {
+      spheres.material_idxs = lua_param_uint32_array(l, p, "material_indices");
+      if(spheres.material_idxs.size() != sphere_count) {
+        return luaL_error(l, "The number of material indices must match "
+            "the number of spheres");
+      }
+      for(uint32_t& material_idx: spheres.material_idxs) {
+        if(material_idx < 1 || material_idx > spheres.materials.size()) {
+          return luaL_error(l, "Material index %d is out of range", int(material_idx));
+        }
+        material_idx -= 1;
+      }
+    }
+
+    lua_params_check_unused(l, p);
+
+    builder->frame.prims.push_back(std::make_unique<SphereSetPrimitive>(
+        std::move(spheres), builder->state.bvh_opts, *lua_get_ctx(l)->pool));
+    return 0;
+  }
+
+  /// Add a heightfield.
+  // Adds a terrain given by a grid of heights, positioned with the current
+  // transform and using the current material. The samples of the grid cover
+  // the unit square in the XY plane and the heights give the Z coordinates.
+  // The terrain is traced directly from the heights, so even very large
+  // grids are cheap in memory.
+  //
+  // The `params` are:
+  //
+  // - `image` -- a float image with the heights (the average of the RGB
+  //   channels is used), the pixel `(x, y)` gives the height at the point
+  //   `(x / (x_res - 1), y / (y_res - 1))`.
+  // - `heights` -- array with the heights, row by row, given as a table of
+  //   numbers or a string of packed 32-bit floats (see `add_spheres`).
+  // - `texture` -- a `Vec2 -> float` texture that gives the height at a point
+  //   of the unit square, used if neither `image` nor `heights` is given.
+  // - `x_res`, `y_res` -- the number of samples along each axis (`res` sets
+  //   both), used with `heights` and `texture`.
+  //
+  // @function add_heightfield
+  // @param B
+  // @param params
+  // @within Adding
+  int lua_builder_add_heightfield(lua_State* l) {
+    auto builder = lua_check_builder(l, 1);
+    auto transform = builder->state.local_to_frame;
+    auto material = builder->state.material;
+    if(!material) {
+      return luaL_error(l, "no material is set");
+    }
+
+    int p = 2;
+    uint32_t x_res, y_res;
+    std::vector<float> heights;
+    if(lua_param_is_set(l, p, "image")) {
+      auto image = lua_param_image_f(l, p, "image");
+      x_res = image->res.x;
+      y_res = image->res.y;
+      if(x_res < 2 || y_res < 2) {
+        return luaL_error(l, "The heightfield must have at least 2x2 samples");
+      }
+      heights.reserve(size_t(x_res) * size_t(y_res));
+      for(uint32_t y = 0; y < y_res; ++y) {
+        for(uint32_t x = 0; x < x_res; ++x) {
+          PixelRgbFloat pixel = image->get_pixel(x, y);
+          heights.push_back((pixel.r + pixel.g + pixel.b) / 3.f);
+        }
+      }
+    } else if(lua_param_is_set(l, p, "heights")) {
+      heights = lua_param_float_array(l, p, "heights");
+      uint32_t res = lua_param_uint32_opt(l, p, "res", 0);
+      x_res = lua_param_uint32_opt(l, p, "x_res", res);
+      y_res = lua_param_uint32_opt(l, p, "y_res", res);
+      if(x_res < 2 || y_res < 2) {
+        return luaL_error(l, "The heightfield must have at least 2x2 samples");
+      }
+      if(heights.size() != size_t(x_res) * size_t(y_res)) {
+        return luaL_error(l, "The number of heights must be x_res * y_res");
+      }
+    } else {
+      auto texture = lua_param_texture(l, p, "texture").check<float, Vec2>(l);
+      uint32_t res = lua_param_uint32_opt(l, p, "res", 256);
+      x_res = lua_param_uint32_opt(l, p, "x_res", res);
+      y_res = lua_param_uint32_opt(l, p, "y_res", res);
+      if(x_res < 2 || y_res < 2) {
+        return luaL_error(l, "The heightfield must have at least 2x2 samples");
+      }
+      heights.reserve(size_t(x_res) * size_t(y_res));
+      for(uint32_t y = 0; y < y_res; ++y) {
+        for(uint32_t x = 0; x < x_res; ++x) {
+          Vec2 uv(float(x) / float(x_res - 1), float(y) / float(y_res - 1));
+          heights.push_back(texture->evaluate(uv));
+        }
+      }
+    }
+    lua_params_check_unused(l, p);
+
+    builder->frame.prims.push_back(std::make_unique<HeightfieldPrimitive>(
+        x_res, y_res, std::move(heights), transform, material));
+    return 0;
+  }
+
   /// Make a triangle `Shape`.
   // Creates a triangle shape from the `mesh` at `index`. This must refer to a
   // builder `B` because all meshes must be registered with the builder to
@@ -666,6 +1029,86 @@ namespace dort {
     return 1;
   }
 
+  /// Make a primitive with levels of detail of a `Mesh`.
+  // Simplifies the `mesh` to a chain of meshes with fewer and fewer triangles
+  // and returns a `Primitive` with a BVH for each of them, using the current
+  // material. Like in `add_mesh_as_bvh`, the current transform is ignored; the
+  // primitive is meant to be added many times using `add_primitive`, and the
+  // level for each instance is selected when the scene is built (see the
+  // option `lod_pixel_error` in `set_option`). The levels that are not
+  // selected for any instance are freed with the primitive.
+  //
+  // The `params` are:
+  //
+  // - `levels` -- the number of levels including the original mesh (default
+  //   4). Fewer levels are produced when the mesh cannot be simplified further.
+  // - `ratio` -- the ratio of the number of triangles of consecutive levels
+  //   (default 0.25).
+  //
+  // @function make_mesh_lod
+  // @param B
+  // @param mesh
+  // @param[opt] params
+  // @within Meshes
+  int lua_builder_make_mesh_lod(lua_State* l) {
+    auto builder = lua_check_builder(l, 1);
+    auto mesh = lua_check_mesh(l, 2);
+    if(lua_isnoneornil(l, 3)) {
+      lua_settop(l, 2);
+      lua_newtable(l);
+    }
+
+    int p = 3;
+    uint32_t level_count = lua_param_uint32_opt(l, p, "levels", 4);
+    float ratio = lua_param_float_opt(l, p, "ratio", 0.25f);
+    lua_params_check_unused(l, p);
+    if(level_count < 1) {
+      return luaL_error(l, "At least one level is needed");
+    }
+    if(!(ratio > 0.f && ratio < 1.f)) {
+      return luaL_error(l, "The ratio must be between 0 and 1");
+    }
+
+    auto material = builder->state.material;
+    if(!material) {
+      return luaL_error(l, "no material is set");
+    }
+
+    auto make_level = [&](const Mesh* level_mesh) {
+      std::vector<uint32_t> indices;
+      for(uint32_t index = 0; index + 2 < level_mesh->vertices.size(); index += 3) {
+        indices.push_back(index);
+      }
+      return std::make_shared<MeshBvhPrimitive>(level_mesh, material,
+          std::move(indices), builder->state.bvh_opts, *lua_get_ctx(l)->pool);
+    };
+
+    std::vector<LodLevel> levels;
+    levels.push_back(LodLevel { make_level(mesh.get()), mesh, 0.f });
+
+    uint32_t triangle_count = mesh->vertices.size() / 3;
+    while(levels.size() < level_count) {
+      uint32_t target_count = uint32_t(float(triangle_count) * ratio);
+      float error;
+      auto level_mesh = std::make_shared<Mesh>(
+          simplify_mesh(*mesh, target_count, error));
+      uint32_t level_triangle_count = level_mesh->vertices.size() / 3;
+      // stop when the simplification got stuck
+      if(level_triangle_count == 0 ||
+          float(level_triangle_count) > 0.9f * float(triangle_count)) {
+        break;
+      }
+
+      auto prim = make_level(level_mesh.get());
+      prim->reorder_mesh(*level_mesh);
+      levels.push_back(LodLevel { std::move(prim), std::move(level_mesh), error });
+      triangle_count = level_triangle_count;
+    }
+
+    lua_push_primitive(l, std::make_shared<LodPrimitive>(std::move(levels)));
+    return 1;
+  }
+
   /// Get the default camera of a `Scene`.
   // @function get_scene_default_camera
   // @param scene
@@ -676,6 +1119,30 @@ namespace dort {
     return 1;
   }
 
+  /// Update a `Scene` after its meshes have changed.
+  // Refits the bounds of all BVHs in the `scene` to the current points of the
+  // meshes, which is much faster than building the scene again. If
+  // `rebuild_threshold` is given, the parts of the BVHs whose SAH cost grew
+  // more than `rebuild_threshold` times are rebuilt. The scene must not be
+  // rendered while it is updated.
+  // @function refit_scene
+  // @param scene
+  // @param[opt] rebuild_threshold
+  // @within Scene
+  int lua_builder_refit_scene(lua_State* l) {
+    auto scene = lua_check_scene(l, 1);
+    float rebuild_threshold = luaL_optnumber(l, 2, 0.0);
+
+    // a primitive may be shared by multiple frames, but it is refitted only
+    // once
+    RefittedSet refitted;
+    scene->primitive->refit(*lua_get_ctx(l)->pool, rebuild_threshold, refitted);
+    scene->bounds = scene->primitive->bounds();
+    scene->centroid = scene->bounds.centroid();
+    scene->radius = scene->bounds.radius();
+    return 0;
+  }
+
   int lua_scene_eq(lua_State* l) {
     if(lua_test_scene(l, 1) ^ lua_test_scene(l, 2)) {
       lua_pushboolean(l, false);
@@ -696,9 +1163,65 @@ namespace dort {
   }
 
 
+  void lua_resolve_pending_prims(lua_State* l, BuilderFrame& frame) {
+    std::string error;
+    for(auto& pending: frame.pending_prims) {
+      try {
+        frame.prims.at(pending.first) = std::move(pending.second.get());
+      } catch(const std::exception& exn) {
+        if(error.empty()) {
+          error = exn.what();
+        }
+      }
+    }
+    frame.pending_prims.clear();
+
+    if(!error.empty()) {
+      // the primitives that failed to build are left as nullptr
+      frame.prims.erase(std::remove(frame.prims.begin(), frame.prims.end(),
+            nullptr), frame.prims.end());
+      luaL_error(l, "%s", error.c_str());
+    }
+  }
+
+  void lua_resolve_pending_lights(lua_State* l, Builder& builder) {
+    std::string error;
+    auto failed = std::remove_if(builder.lights.begin(), builder.lights.end(),
+        [&](const std::shared_ptr<Light>& light) {
+          auto env_light = dynamic_cast<EnvironmentLight*>(light.get());
+          if(env_light == nullptr) {
+            return false;
+          }
+          try {
+            env_light->resolve();
+          } catch(const std::exception& exn) {
+            if(error.empty()) {
+              error = exn.what();
+            }
+            return true;
+          }
+          return false;
+        });
+
+    if(!error.empty()) {
+      // the lights that failed to build are removed
+      builder.lights.erase(failed, builder.lights.end());
+      luaL_error(l, "%s", error.c_str());
+    }
+  }
+
   std::unique_ptr<Primitive> lua_make_aggregate(CtxG& ctx,
       const BuilderState& state, BuilderFrame frame)
   {
+    if(frame.instances.size() == 1) {
+      PrimitiveInstance& instance = frame.instances.at(0);
+      frame.prims.push_back(std::make_unique<FramePrimitive>(
+            instance.in_to_out, std::move(instance.inside)));
+    } else if(frame.instances.size() > 1) {
+      frame.prims.push_back(std::make_unique<InstanceBvhPrimitive>(
+            std::move(frame.instances), state.bvh_opts, *ctx.pool));
+    }
+
     if(frame.prims.size() == 1) {
       return std::move(frame.prims.at(0));
     } else if(frame.prims.size() <= state.bvh_opts.leaf_size) {
@@ -710,6 +1233,113 @@ namespace dort {
   }
 
 
+  std::shared_ptr<Primitive> lua_make_frame_primitive(CtxG& ctx,
+      const BuilderState& state, BuilderFrame frame)
+  {
+    bool has_lod = std::any_of(frame.instances.begin(), frame.instances.end(),
+        [](const PrimitiveInstance& instance) {
+          return dynamic_cast<const LodPrimitive*>(instance.inside.get()) ||
+            dynamic_cast<const LodFramePrimitive*>(instance.inside.get());
+        });
+    if(!has_lod) {
+      return lua_make_aggregate(ctx, state, std::move(frame));
+    }
+
+    // we keep the instances, so that the levels can be selected separately
+    // for each instance of this frame when the scene is built
+    std::shared_ptr<Primitive> prims;
+    if(!frame.prims.empty()) {
+      BuilderFrame prims_frame;
+      prims_frame.prims = std::move(frame.prims);
+      frame.prims.clear();
+      prims = lua_make_aggregate(ctx, state, std::move(prims_frame));
+    }
+    std::vector<PrimitiveInstance> instances = frame.instances;
+    if(prims) {
+      frame.instances.push_back(PrimitiveInstance { identity(), prims });
+    }
+    auto finest = lua_make_aggregate(ctx, state, std::move(frame));
+    return std::make_shared<LodFramePrimitive>(std::move(finest),
+        std::move(instances), std::move(prims), state.bvh_opts);
+  }
+
+  void lua_select_lod_levels(CtxG& ctx, Builder& builder,
+      LodSelection& selection, std::vector<PrimitiveInstance>& instances,
+      const Transform& frame_to_world)
+  {
+    Point origin = selection.camera->world_origin();
+    for(PrimitiveInstance& instance: instances) {
+      Transform in_to_world = frame_to_world * instance.in_to_out;
+      if(auto lod_frame = dynamic_cast<const LodFramePrimitive*>(
+            instance.inside.get()))
+      {
+        instance.inside = lua_select_lod_frame(ctx, builder,
+            selection, *lod_frame, in_to_world);
+        continue;
+      }
+
+      auto lod = dynamic_cast<const LodPrimitive*>(instance.inside.get());
+      if(lod == nullptr) {
+        continue;
+      }
+
+      Box bounds = lod->transformed_bounds(in_to_world);
+      Vector outside;
+      for(uint32_t axis = 0; axis < 3; ++axis) {
+        outside.v.coords[axis] = std::max(0.f, std::max(
+            bounds.p_min.v[axis] - origin.v[axis],
+            origin.v[axis] - bounds.p_max.v[axis]));
+      }
+
+      // the errors of the levels are measured in the coordinates of the mesh,
+      // so we scale the allowed error by the largest scale of the transform
+      float scale = std::max(
+          length(in_to_world.apply(Vector(1.f, 0.f, 0.f))), std::max(
+          length(in_to_world.apply(Vector(0.f, 1.f, 0.f))),
+          length(in_to_world.apply(Vector(0.f, 0.f, 1.f)))));
+      float pixel = selection.camera->pixel_footprint(
+          selection.film_res, length(outside));
+      const LodLevel& level = lod->select_level(
+          selection.max_pixel_error * pixel / scale);
+      builder.meshes.insert(level.mesh);
+      instance.inside = level.prim;
+    }
+  }
+
+  std::shared_ptr<Primitive> lua_select_lod_frame(CtxG& ctx, Builder& builder,
+      LodSelection& selection, const LodFramePrimitive& lod_frame,
+      const Transform& frame_to_world)
+  {
+    std::vector<PrimitiveInstance> instances = lod_frame.get_instances();
+    lua_select_lod_levels(ctx, builder, selection, instances, frame_to_world);
+
+    // the instances of the frame that selected the same levels share the
+    // aggregate
+    std::vector<const Primitive*> key;
+    key.push_back(&lod_frame);
+    for(const PrimitiveInstance& instance: instances) {
+      key.push_back(instance.inside.get());
+    }
+    auto found = selection.frames.find(key);
+    if(found != selection.frames.end()) {
+      return found->second;
+    }
+
+    BuilderFrame frame;
+    frame.instances = std::move(instances);
+    if(lod_frame.get_prims()) {
+      frame.instances.push_back(PrimitiveInstance {
+          identity(), lod_frame.get_prims() });
+    }
+    BuilderState state;
+    state.bvh_opts = lod_frame.get_bvh_opts();
+    std::shared_ptr<Primitive> aggregate = lua_make_aggregate(
+        ctx, state, std::move(frame));
+    selection.frames.insert(std::make_pair(std::move(key), aggregate));
+    return aggregate;
+  }
+
+
   std::shared_ptr<Builder> lua_check_builder(lua_State* l, int idx) {
     return lua_check_shared_obj<Builder, BUILDER_TNAME>(l, idx);
   }
@@ -7,7 +7,9 @@
 //   channel.
 //
 // @module dort.image
+#include <stdexcept>
 #include "dort/convergence_test.hpp"
+#include "dort/ctx.hpp"
 #include "dort/image.hpp"
 #include "dort/lua_geometry.hpp"
 #include "dort/lua_helpers.hpp"
@@ -66,7 +68,13 @@ namespace dort {
     }
 
     if(hdr) {
-      auto image = std::make_shared<Image<PixelRgbFloat>>(read_image_f(file));
+      std::shared_ptr<Image<PixelRgbFloat>> image;
+      try {
+        image = std::make_shared<Image<PixelRgbFloat>>(read_image_f(file));
+      } catch(const std::runtime_error&) {
+        std::fclose(file);
+        return luaL_error(l, "Could not read image file: %s", file_name);
+      }
       lua_push_image_f(l, image);
     } else {
       auto image = std::make_shared<Image<PixelRgb8>>(read_image_8(file));
@@ -122,7 +130,7 @@ namespace dort {
   int lua_image_tonemap_srgb(lua_State* l) {
     auto image = lua_check_image_f(l, 1);
     float scale = lua_gettop(l) >= 2 ? luaL_checknumber(l, 2) : 1.0;
-    auto out_image = tonemap_srgb(*image, scale);
+    auto out_image = tonemap_srgb(*image, scale, *lua_get_ctx(l)->pool);
     lua_push_image_8(l, std::make_shared<Image<PixelRgb8>>(std::move(out_image)));
     return 1;
   }
@@ -139,7 +147,7 @@ namespace dort {
     auto image = lua_check_image_f(l, 1);
     float gamma = lua_gettop(l) >= 2 ? luaL_checknumber(l, 2) : 1.0;
     float scale = lua_gettop(l) >= 3 ? luaL_checknumber(l, 3) : 1.0;
-    auto out_image = tonemap_gamma(*image, gamma, scale);
+    auto out_image = tonemap_gamma(*image, gamma, scale, *lua_get_ctx(l)->pool);
     lua_push_image_8(l, std::make_shared<Image<PixelRgb8>>(std::move(out_image)));
     return 1;
   }
@@ -1,9 +1,13 @@
 /// Lights.
 // @module dort.light
+#include <cstdio>
+#include <stdexcept>
 #include "dort/beam_light.hpp"
+#include "dort/ctx.hpp"
 #include "dort/diffuse_light.hpp"
 #include "dort/directional_light.hpp"
 #include "dort/environment_light.hpp"
+#include "dort/image.hpp"
 #include "dort/infinite_light.hpp"
 #include "dort/lua_builder.hpp"
 #include "dort/lua_geometry.hpp"
@@ -116,6 +120,9 @@ namespace dort {
   //
   // - `image` -- the `Image.RgbFloat`, a HDR image mapped to the infinite
   // sphere surrounding the scene.
+  // - `image_file` -- the name of a HDR image file to use instead of `image`.
+  // The file is decoded in the background, while the rest of the scene is
+  // built.
   // - `up` -- the `Vector` that determines the "up" direction for the sphere
   // - `forward` -- the `Vector` that determines the "forward" direction for the
   // sphere.
@@ -127,7 +134,32 @@ namespace dort {
   // @param params
   int lua_light_make_environment(lua_State* l) {
     int p = 1;
-    auto image = lua_param_image_f(l, p, "image");
+    ThreadPool& pool = *lua_get_ctx(l)->pool;
+    Future<std::shared_ptr<Image<PixelRgbFloat>>> image;
+    if(lua_param_is_set(l, p, "image_file")) {
+      std::string file_name = lua_param_string_opt(l, p, "image_file", "");
+      FILE* file = std::fopen(file_name.c_str(), "r");
+      if(!file) {
+        return luaL_error(l, "Could not open image file for reading: %s",
+            file_name.c_str());
+      }
+      image = spawn(pool, [file, file_name]() {
+        std::shared_ptr<Image<PixelRgbFloat>> image;
+        try {
+          image = std::make_shared<Image<PixelRgbFloat>>(read_image_f(file));
+        } catch(const std::runtime_error&) {
+          // the reason reported by stb may come from another decode running
+          // concurrently in the pool, so we report just the file name
+          std::fclose(file);
+          throw std::runtime_error("Could not read image file: " + file_name);
+        }
+        std::fclose(file);
+        return image;
+      });
+    } else {
+      auto ready_image = lua_param_image_f(l, p, "image");
+      image = spawn(pool, [ready_image]() { return ready_image; });
+    }
     auto up = lua_param_vector(l, p, "up");
     auto forward = lua_param_vector(l, p, "forward");
     auto scale = lua_param_spectrum_opt(l, p, "scale", Spectrum(1.f));
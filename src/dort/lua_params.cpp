@@ -1,3 +1,5 @@
+#include <cstring>
+#include <type_traits>
 #include "dort/geometry.hpp"
 #include "dort/lua_builder.hpp"
 #include "dort/lua_camera.hpp"
@@ -14,6 +16,49 @@
 #include "dort/spectrum.hpp"
 
 namespace dort {
+  namespace {
+    template<class T>
+    std::vector<T> lua_param_packed_array(lua_State* l,
+        int params_idx, const char* param_name)
+    {
+      std::vector<T> values;
+      int type = lua_getfield(l, params_idx, param_name);
+      if(type == LUA_TSTRING) {
+        size_t len;
+        const char* str = lua_tolstring(l, -1, &len);
+        if(len % sizeof(T) != 0) {
+          luaL_error(l, "Parameter '%s' has a length that is not a multiple of %d",
+              param_name, int(sizeof(T)));
+        }
+        values.resize(len / sizeof(T));
+        std::memcpy(values.data(), str, len);
+      } else if(type == LUA_TTABLE) {
+        uint32_t len = lua_rawlen(l, -1);
+        values.reserve(len);
+        for(uint32_t i = 1; i <= len; ++i) {
+          lua_rawgeti(l, -1, i);
+          if(!lua_isnumber(l, -1)) {
+            luaL_error(l, "Parameter '%s' must contain only numbers", param_name);
+          }
+          if(std::is_integral<T>::value) {
+            lua_Integer num = lua_tointeger(l, -1);
+            if(num < 0) {
+              luaL_error(l, "Parameter '%s' must contain unsigned integers", param_name);
+            }
+            values.push_back(T(num));
+          } else {
+            values.push_back(T(lua_tonumber(l, -1)));
+          }
+          lua_pop(l, 1);
+        }
+      } else {
+        luaL_error(l, "Parameter '%s' must be a table or a packed string", param_name);
+      }
+      lua_pushnil(l); lua_setfield(l, params_idx, param_name); lua_pop(l, 1);
+      return values;
+    }
+  }
+
   float lua_param_float(lua_State* l, int params_idx, const char* param_name) {
     lua_getfield(l, params_idx, param_name);
     if(!lua_isnumber(l, -1)) {
@@ -111,6 +156,16 @@ namespace dort {
     lua_pushnil(l); lua_setfield(l, params_idx, param_name); lua_pop(l, 1);
     return material;
   }
+  std::vector<float> lua_param_float_array(lua_State* l,
+      int params_idx, const char* param_name)
+  {
+    return lua_param_packed_array<float>(l, params_idx, param_name);
+  }
+  std::vector<uint32_t> lua_param_uint32_array(lua_State* l,
+      int params_idx, const char* param_name)
+  {
+    return lua_param_packed_array<uint32_t>(l, params_idx, param_name);
+  }
 
   float lua_param_float_opt(lua_State* l, int params_idx,
       const char* param_name, float def)
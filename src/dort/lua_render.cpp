@@ -5,6 +5,7 @@
 #include <gio/gio.h>
 #endif
 #include "dort/bdpt_renderer.hpp"
+#include "dort/ctx.hpp"
 #include "dort/dot_renderer.hpp"
 #include "dort/film.hpp"
 #include "dort/filter.hpp"
@@ -20,6 +21,7 @@
 #include "dort/sppm_renderer.hpp"
 #include "dort/stats.hpp"
 #include "dort/vcm_renderer.hpp"
+#include "dort/wavefront_renderer.hpp"
 
 namespace dort {
   int lua_open_render(lua_State* l) {
@@ -74,6 +76,11 @@ namespace dort {
   //    combine using MIS), `bsdf` (sample from BSDF), `light` (sample from
   //    light).
   //
+  // - `wpt` (or `wavefront`) -- path tracing with the same estimator and the
+  // same parameters as `pt`, but the paths of a whole tile are traced together
+  // in separate stages (extension rays, shading, shadow rays), with rays
+  // sorted by direction and hits sorted by material between the stages
+  //
   // - `lt` (or `light`) -- light tracing
   //    - `min_depth`, `max_depth` -- lower and upper bound on the number of
   //    bounces
@@ -122,7 +129,9 @@ namespace dort {
     if(method == "dot") {
       renderer = std::make_shared<DotRenderer>(scene, film, sampler,
           camera, iteration_count);
-    } else if(method == "pt" || method == "path") {
+    } else if(method == "pt" || method == "path"
+        || method == "wpt" || method == "wavefront")
+    {
       uint32_t min_depth = lua_param_uint32_opt(l, p, "min_depth", 0);
       uint32_t max_depth = lua_param_uint32_opt(l, p, "max_depth", 5);
       bool only_direct = lua_param_bool_opt(l, p, "only_direct", false);
@@ -140,9 +149,15 @@ namespace dort {
         return luaL_error(l, "Unknown direct strategy '%s'", strategy_str.c_str());
       }
 
-      renderer = std::make_shared<PathRenderer>(
-          scene, film, sampler, camera, iteration_count,
-          min_depth, max_depth, only_direct, sample_all_lights, direct_strategy);
+      if(method == "wpt" || method == "wavefront") {
+        renderer = std::make_shared<WavefrontRenderer>(
+            scene, film, sampler, camera, iteration_count,
+            min_depth, max_depth, only_direct, sample_all_lights, direct_strategy);
+      } else {
+        renderer = std::make_shared<PathRenderer>(
+            scene, film, sampler, camera, iteration_count,
+            min_depth, max_depth, only_direct, sample_all_lights, direct_strategy);
+      }
     } else if(method == "lt" || method == "light") {
       uint32_t min_length = lua_param_uint32_opt(l, p, "min_depth", 0) + 2;
       uint32_t max_length = lua_param_uint32_opt(l, p, "max_depth", 5) + 2;
@@ -387,14 +402,15 @@ namespace dort {
     bool hdr = lua_param_bool_opt(l, p, "hdr", false);
     lua_params_check_unused(l, p);
 
+    CtxG& ctx = *lua_get_ctx(l);
     auto film = render_job->film;
     if(hdr) {
       auto image = std::make_shared<Image<PixelRgbFloat>>(
-          film->to_image<PixelRgbFloat>());
+          film->to_image<PixelRgbFloat>(*ctx.pool));
       lua_push_image_f(l, image);
     } else {
       auto image = std::make_shared<Image<PixelRgb8>>(
-          film->to_image<PixelRgb8>());
+          film->to_image<PixelRgb8>(*ctx.pool));
       lua_push_image_8(l, image);
     }
     return 1;
@@ -40,6 +40,7 @@ namespace dort {
       {"make_cube", lua_shape_make_cube},
       {"make_polygon", lua_shape_make_polygon},
       {"make_mesh", lua_shape_make_mesh},
+      {"set_mesh_points", lua_shape_set_mesh_points},
       {"read_ply_mesh", lua_ply_mesh_read},
       {0, 0},
     };
@@ -219,6 +220,38 @@ namespace dort {
     return 1;
   }
 
+  /// Replace the points of a `Mesh`.
+  // The list of `points` must have the same length as the points of the mesh,
+  // the optional `transform` is applied to them. The primitives that use the
+  // mesh see the new points immediately, but the scene must be updated using
+  // `dort.builder.refit_scene` before it is rendered again.
+  // @function set_mesh_points
+  // @param mesh
+  // @param points
+  // @param[opt] transform
+  int lua_shape_set_mesh_points(lua_State* l) {
+    auto mesh = lua_check_mesh(l, 1);
+    luaL_checktype(l, 2, LUA_TTABLE);
+    Transform transform = lua_isnoneornil(l, 3)
+      ? identity() : lua_check_transform(l, 3);
+
+    uint32_t point_count = lua_rawlen(l, 2);
+    if(point_count != mesh->points.size()) {
+      return luaL_error(l, "Mesh has %d points, but %d points were given",
+          int(mesh->points.size()), int(point_count));
+    }
+
+    std::vector<Point> points;
+    points.reserve(point_count);
+    for(uint32_t i = 1; i <= point_count; ++i) {
+      lua_rawgeti(l, 2, i);
+      points.push_back(transform.apply(lua_check_point(l, -1)));
+      lua_pop(l, 1);
+    }
+    mesh->points = std::move(points);
+    return 0;
+  }
+
   /// Read a `Mesh` from a PLY file.
   // @function mesh_read
   // @param file_name
@@ -24,11 +24,12 @@
 #include "dort/main.hpp"
 #include "dort/stats.hpp"
 #include "dort/thread_pool.hpp"
+#include "dort/topology.hpp"
 
 namespace dort {
   const char* const SHORT_USAGE =
 R"(Usage: dort [options] [--] <program.lua> [program args]
-  Options: -t <count> | -s <word> | -S <word> | -h | -v
+  Options: -t <count>[:<affinity>] | -s <word> | -S <word> | -h | -v
   Use --help for longer help
 )";
 
@@ -37,8 +38,16 @@ R"(Usage: dort [options] [--] <program.lua> [program args]
   Executes the Lua program in file <program.lua>, and passes [program args] to
   the program. [options] are:
 
-    -t, --threads <count>
-      Use <count> threads in the shared thread pool.
+    -t, --threads <count> | <affinity> | <count>:<affinity>
+      Use <count> threads in the shared thread pool and pin them to CPUs
+      according to <affinity>, which is one of:
+        none: do not pin the threads (the default)
+        compact: fill the hardware threads of a core, then the cores of a
+          package, then the next package
+        scatter: spread consecutive threads over packages and cores
+        cores: one thread per physical core
+      If <count> is omitted, it is the number of CPUs (or the number of
+      physical cores for `cores`).
     -s, --enable-stats <word>
       Enable statistics matching <word>. If the argument is used at least once,
       statistics will be printed at the end of execution. This option can be
@@ -62,6 +71,7 @@ R"(Usage: dort [options] [--] <program.lua> [program args]
   int main(uint32_t argc, char** argv) {
     stat_init_global();
     uint32_t thread_count = std::thread::hardware_concurrency();
+    ThreadAffinity thread_affinity = ThreadAffinity::None;
     std::vector<std::string> lua_argv;
     const char* input_file = nullptr;
 
@@ -73,9 +83,28 @@ R"(Usage: dort [options] [--] <program.lua> [program args]
         arg_i += 1; break;
       } else if(arg == "-t" || arg == "--threads") {
         if(arg_i + 1 >= argc) { args_ok = false; break; }
-        if(std::sscanf(argv[arg_i + 1], "%u", &thread_count) != 1) {
+        std::string threads_arg(argv[arg_i + 1]);
+        size_t colon = threads_arg.find(':');
+        std::string count_arg = threads_arg.substr(0, colon);
+        std::string affinity_arg = colon != std::string::npos
+          ? threads_arg.substr(colon + 1) : "";
+        if(colon == std::string::npos &&
+            parse_thread_affinity(threads_arg, thread_affinity)) {
+          count_arg = "";
+        } else if(!affinity_arg.empty() &&
+            !parse_thread_affinity(affinity_arg, thread_affinity)) {
           args_ok = false; break;
         }
+
+        if(!count_arg.empty()) {
+          if(std::sscanf(count_arg.c_str(), "%u", &thread_count) != 1) {
+            args_ok = false; break;
+          }
+        } else if(thread_affinity == ThreadAffinity::Cores) {
+          thread_count = get_cpu_topology().core_count;
+        } else {
+          thread_count = get_cpu_topology().cpus.size();
+        }
         arg_i += 2;
       } else if(arg == "-s" || arg == "--enable-stats") {
         if(arg_i + 1 >= argc) { args_ok = false; break; }
@@ -116,7 +145,7 @@ R"(Usage: dort [options] [--] <program.lua> [program args]
     CtxG ctx_g;
     ctx_g.pool = std::make_shared<ThreadPool>();
     ctx_g.argv = std::move(lua_argv);
-    ctx_g.pool->start(thread_count);
+    ctx_g.pool->start(thread_count, thread_affinity);
 
     lua_State* l = luaL_newstate();
     lua_set_ctx(l, &ctx_g);
@@ -0,0 +1,63 @@
+#include <type_traits>
+#include "dort/geometry.hpp"
+#include "dort/mesh.hpp"
+#include "dort/stats.hpp"
+#include "dort/vec_2.hpp"
+
+namespace dort {
+  void reorder_mesh_triangles(Mesh& mesh, std::vector<uint32_t>& indices) {
+    StatTimer t(TIMER_MESH_REORDER);
+
+    // the triangles are placed in the order of their first reference from the
+    // indices (spatial splits may reference a triangle from multiple leaves)
+    std::vector<uint32_t> new_indices(mesh.vertices.size() / 3, UINT32_MAX);
+    std::vector<uint32_t> new_vertices;
+    new_vertices.reserve(mesh.vertices.size());
+    auto place_triangle = [&](uint32_t index) {
+      uint32_t& new_index = new_indices.at(index / 3);
+      if(new_index == UINT32_MAX) {
+        new_index = new_vertices.size();
+        for(uint32_t i = 0; i < 3; ++i) {
+          new_vertices.push_back(mesh.vertices.at(index + i));
+        }
+      }
+      return new_index;
+    };
+
+    for(uint32_t& index: indices) {
+      index = place_triangle(index);
+    }
+    for(uint32_t index = 0; index + 2 < mesh.vertices.size(); index += 3) {
+      place_triangle(index);
+    }
+
+    // the points are placed in the order of their first use by the triangles
+    std::vector<uint32_t> new_points(mesh.points.size(), UINT32_MAX);
+    std::vector<uint32_t> old_points;
+    old_points.reserve(mesh.points.size());
+    for(uint32_t& vertex: new_vertices) {
+      uint32_t& new_point = new_points.at(vertex);
+      if(new_point == UINT32_MAX) {
+        new_point = old_points.size();
+        old_points.push_back(vertex);
+      }
+      vertex = new_point;
+    }
+
+    auto permute = [&](auto& values) {
+      if(values.empty()) {
+        return;
+      }
+      std::remove_reference_t<decltype(values)> new_values;
+      new_values.reserve(old_points.size());
+      for(uint32_t old_point: old_points) {
+        new_values.push_back(values.at(old_point));
+      }
+      values = std::move(new_values);
+    };
+    permute(mesh.points);
+    permute(mesh.uvs);
+    permute(mesh.normals);
+    mesh.vertices = std::move(new_vertices);
+  }
+}
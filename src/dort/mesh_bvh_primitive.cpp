@@ -1,38 +1,129 @@
+#include <array>
 #include "dort/bsdf.hpp"
 #include "dort/material.hpp"
 #include "dort/mesh_bvh_primitive.hpp"
+#include "dort/stats.hpp"
+#include "dort/topology.hpp"
+#include "dort/triangle_packet.hpp"
 
 namespace dort {
   MeshBvhPrimitive::MeshBvhPrimitive(const Mesh* mesh,
       std::shared_ptr<Material> material, std::vector<uint32_t> indices,
       const BvhOpts& opts, ThreadPool& pool):
     mesh(mesh), material(material),
-    bvh(std::move(indices), mesh, opts, pool)
-  { }
+    bvh(std::move(indices), mesh, opts, pool),
+    use_triangle_blocks(opts.triangle_blocks)
+  {
+    this->update_triangle_blocks();
+  }
 
-  bool MeshBvhPrimitive::intersect(Ray& ray, Intersection& out_isect) const {
-    bool found = false;
-    this->bvh.traverse_elems(ray, [&](uint32_t index) {
-      float t_hit;
-      if(TriangleUv(*this->mesh, index).hit(ray, t_hit, out_isect.ray_epsilon,
-          out_isect.frame_diff_geom)) 
-      {
-        found = true;
-        ray.t_max = t_hit;
-      }
-      return true;
+  void MeshBvhPrimitive::reorder_mesh(Mesh& mesh) {
+    assert(&mesh == this->mesh);
+    std::vector<uint32_t> indices;
+    this->bvh.for_each_elem([&](uint32_t index) {
+      indices.push_back(index);
     });
+    reorder_mesh_triangles(mesh, indices);
+
+    uint32_t i = 0;
+    this->bvh.for_each_elem([&](uint32_t& index) {
+      index = indices.at(i++);
+    });
+    this->update_triangle_blocks();
+
+    numa_interleave(mesh.points);
+    numa_interleave(mesh.uvs);
+    numa_interleave(mesh.normals);
+    numa_interleave(mesh.vertices);
+  }
+
+  bool MeshBvhPrimitive::intersect(Ray& ray, Intersection& out_isect) const {
+    // during the traversal, we only record the closest hit and compute the
+    // diff geom once at the end
+    uint32_t hit_index = UINT32_MAX;
+    float hit_b1, hit_b2;
+    auto record_hit = [&](uint32_t index, float t, float b1, float b2) {
+      ray.t_max = t;
+      hit_index = index;
+      hit_b1 = b1;
+      hit_b2 = b2;
+    };
 
-    if(found) {
-      out_isect.world_diff_geom = out_isect.frame_diff_geom;
-      out_isect.primitive = this;
+    if(this->use_triangle_blocks) {
+      this->bvh.traverse_leaves(ray, [&](uint32_t elem_offset, uint32_t elem_count) {
+        this->hit_triangle_blocks(ray, elem_offset, elem_count,
+          [&](uint32_t index, float t, float b1, float b2) {
+            // the lanes were tested against the t_max from the start of the
+            // block
+            if(t <= ray.t_max) {
+              record_hit(index, t, b1, b2);
+            }
+            return true;
+          });
+        return true;
+      });
+    } else {
+      this->bvh.traverse_elems(ray, [&](uint32_t index) {
+        float t, b1, b2;
+        if(Triangle(*this->mesh, index).hit(ray, t, b1, b2)) {
+          record_hit(index, t, b1, b2);
+        }
+        return true;
+      });
     }
 
-    return found;
+    if(hit_index == UINT32_MAX) {
+      return false;
+    }
+    TriangleUv(*this->mesh, hit_index).get_diff_geom(ray.t_max, hit_b1, hit_b2,
+        out_isect.ray_epsilon, out_isect.frame_diff_geom);
+    out_isect.world_diff_geom = out_isect.frame_diff_geom;
+    out_isect.primitive = this;
+    return true;
+  }
+
+  uint32_t MeshBvhPrimitive::intersect_packet(Ray* rays,
+      Intersection* out_isects, uint32_t ray_mask) const
+  {
+    if(ray_mask == 0) {
+      return 0;
+    }
+
+    std::array<uint32_t, RAY_PACKET_SIZE> hit_indices;
+    std::array<float, RAY_PACKET_SIZE> hit_b1, hit_b2;
+    intersect_triangle_packet(this->bvh, rays, ray_mask,
+      [&](uint32_t index) { return Triangle(*this->mesh, index); },
+      hit_indices, hit_b1, hit_b2);
+
+    uint32_t hit_mask = 0;
+    for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+      if(hit_indices.at(i) == UINT32_MAX) {
+        continue;
+      }
+      Intersection& isect = out_isects[i];
+      TriangleUv(*this->mesh, hit_indices.at(i)).get_diff_geom(rays[i].t_max,
+          hit_b1.at(i), hit_b2.at(i), isect.ray_epsilon, isect.frame_diff_geom);
+      isect.world_diff_geom = isect.frame_diff_geom;
+      isect.primitive = this;
+      hit_mask |= 1u << i;
+    }
+    return hit_mask;
   }
 
   bool MeshBvhPrimitive::intersect_p(const Ray& ray) const {
     bool found = false;
+    if(this->use_triangle_blocks) {
+      this->bvh.traverse_leaves(ray, [&](uint32_t elem_offset, uint32_t elem_count) {
+        this->hit_triangle_blocks(ray, elem_offset, elem_count,
+          [&](uint32_t, float, float, float) {
+            found = true;
+            return false;
+          });
+        return !found;
+      });
+      return found;
+    }
+
     this->bvh.traverse_elems(ray, [&](uint32_t index) {
       if(Triangle(*this->mesh, index).hit_p(ray)) {
         found = true;
@@ -48,6 +139,17 @@ namespace dort {
     return this->bvh.bounds();
   }
 
+  Box MeshBvhPrimitive::transformed_bounds(const Transform& transform) const {
+    return this->bvh.transformed_bounds(transform);
+  }
+
+  void MeshBvhPrimitive::refit(ThreadPool& pool, float rebuild_threshold,
+      RefittedSet&)
+  {
+    this->bvh.refit(this->mesh, pool, rebuild_threshold);
+    this->update_triangle_blocks();
+  }
+
   const Material* MeshBvhPrimitive::get_material(const Intersection&) const {
     return this->material.get();
   }
@@ -55,4 +157,83 @@ namespace dort {
   const Light* MeshBvhPrimitive::get_area_light(const DiffGeom&) const {
     return nullptr;
   }
+
+  void MeshBvhPrimitive::update_triangle_blocks() {
+    if(!this->use_triangle_blocks) {
+      return;
+    }
+
+    std::vector<uint32_t> indices;
+    this->bvh.for_each_elem([&](uint32_t index) {
+      indices.push_back(index);
+    });
+
+    this->triangle_blocks.assign((indices.size() + 3) / 4, TriangleBlock());
+    for(uint32_t i = 0; i < indices.size(); ++i) {
+      TriangleBlock& block = this->triangle_blocks.at(i / 4);
+      uint32_t lane = i % 4;
+      Triangle triangle(*this->mesh, indices.at(i));
+      Vector e1 = triangle.p[1] - triangle.p[0];
+      Vector e2 = triangle.p[2] - triangle.p[0];
+      for(uint32_t axis = 0; axis < 3; ++axis) {
+        block.p0[axis][lane] = triangle.p[0].v[axis];
+        block.e1[axis][lane] = e1.v[axis];
+        block.e2[axis][lane] = e2.v[axis];
+      }
+      block.index[lane] = indices.at(i);
+    }
+  }
+
+  template<class F>
+  void MeshBvhPrimitive::hit_triangle_blocks(const Ray& ray,
+      uint32_t elem_offset, uint32_t elem_count, F callback) const
+  {
+    __m128 orig[3], dir[3];
+    for(uint32_t axis = 0; axis < 3; ++axis) {
+      orig[axis] = _mm_set1_ps(ray.orig.v[axis]);
+      dir[axis] = _mm_set1_ps(ray.dir.v[axis]);
+    }
+
+    uint32_t elem_end = elem_offset + elem_count;
+    for(uint32_t b = elem_offset / 4; 4 * b < elem_end; ++b) {
+      stat_count(COUNTER_TRIANGLE_BLOCK_HIT);
+      const TriangleBlock& block = this->triangle_blocks.at(b);
+      __m128 p0[3], e1[3], e2[3];
+      for(uint32_t axis = 0; axis < 3; ++axis) {
+        p0[axis] = _mm_load_ps(block.p0[axis]);
+        e1[axis] = _mm_load_ps(block.e1[axis]);
+        e2[axis] = _mm_load_ps(block.e2[axis]);
+      }
+
+      __m128 t, b1, b2;
+      uint32_t hit_mask = hit_triangles_ps(orig, dir,
+          _mm_set1_ps(ray.t_min), _mm_set1_ps(ray.t_max),
+          p0, e1, e2, t, b1, b2);
+
+      // mask out the lanes outside of the leaf
+      uint32_t lane_begin = max(elem_offset, 4 * b) - 4 * b;
+      uint32_t lane_end = min(elem_end, 4 * b + 4) - 4 * b;
+      hit_mask &= ((1u << lane_end) - 1) & ~((1u << lane_begin) - 1);
+      if(hit_mask == 0) {
+        continue;
+      }
+
+      alignas(16) float t_lanes[4];
+      alignas(16) float b1_lanes[4];
+      alignas(16) float b2_lanes[4];
+      _mm_store_ps(t_lanes, t);
+      _mm_store_ps(b1_lanes, b1);
+      _mm_store_ps(b2_lanes, b2);
+      while(hit_mask != 0) {
+        uint32_t lane = __builtin_ctz(hit_mask);
+        hit_mask &= hit_mask - 1;
+        stat_count(COUNTER_TRIANGLE_BLOCK_HIT_HIT);
+        if(!callback(block.index[lane], t_lanes[lane],
+              b1_lanes[lane], b2_lanes[lane]))
+        {
+          return;
+        }
+      }
+    }
+  }
 }
@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include "dort/geometry.hpp"
+#include "dort/mesh_simplify.hpp"
+#include "dort/vec_2.hpp"
+
+namespace dort {
+  namespace {
+    // sum of squared distances from a set of planes, stored as the upper
+    // triangle of a symmetric 4x4 matrix:
+    // aa ab ac ad bb bc bd cc cd dd
+    struct Quadric {
+      std::array<double, 10> m;
+
+      Quadric() { this->m.fill(0.0); }
+
+      static Quadric plane(const Vector& n, const Point& p) {
+        double a = n.v.x, b = n.v.y, c = n.v.z;
+        double d = -(a * p.v.x + b * p.v.y + c * p.v.z);
+        Quadric q;
+        q.m = {{a*a, a*b, a*c, a*d, b*b, b*c, b*d, c*c, c*d, d*d}};
+        return q;
+      }
+
+      void add(const Quadric& q) {
+        for(uint32_t i = 0; i < 10; ++i) {
+          this->m.at(i) += q.m.at(i);
+        }
+      }
+
+      double eval(const Point& p) const {
+        const auto& m = this->m;
+        double x = p.v.x, y = p.v.y, z = p.v.z;
+        double err = m[0]*x*x + 2.0*m[1]*x*y + 2.0*m[2]*x*z + 2.0*m[3]*x
+          + m[4]*y*y + 2.0*m[5]*y*z + 2.0*m[6]*y
+          + m[7]*z*z + 2.0*m[8]*z + m[9];
+        return std::max(err, 0.0);
+      }
+
+      // finds the point with the smallest error, if it is unique
+      bool minimize(Point& out_p) const {
+        const auto& m = this->m;
+        double c00 = m[4]*m[7] - m[5]*m[5];
+        double c01 = m[2]*m[5] - m[1]*m[7];
+        double c02 = m[1]*m[5] - m[2]*m[4];
+        double det = m[0]*c00 + m[1]*c01 + m[2]*c02;
+        if(std::abs(det) <= 1e-9 * std::abs(m[0] * m[4] * m[7])
+            || det == 0.0) {
+          return false;
+        }
+        double c11 = m[0]*m[7] - m[2]*m[2];
+        double c12 = m[1]*m[2] - m[0]*m[5];
+        double c22 = m[0]*m[4] - m[1]*m[1];
+        double inv_det = 1.0 / det;
+        double x = -(c00*m[3] + c01*m[6] + c02*m[8]) * inv_det;
+        double y = -(c01*m[3] + c11*m[6] + c12*m[8]) * inv_det;
+        double z = -(c02*m[3] + c12*m[6] + c22*m[8]) * inv_det;
+        out_p = Point(float(x), float(y), float(z));
+        return true;
+      }
+    };
+
+    struct Collapse {
+      double cost;
+      uint32_t keep;
+      uint32_t remove;
+      uint32_t keep_version;
+      uint32_t remove_version;
+      Point target;
+
+      bool operator>(const Collapse& other) const {
+        return this->cost > other.cost;
+      }
+    };
+
+    struct PointKey {
+      std::array<uint32_t, 3> bits;
+
+      explicit PointKey(const Point& p) {
+        std::memcpy(this->bits.data(), &p.v.x, sizeof(float));
+        std::memcpy(this->bits.data() + 1, &p.v.y, sizeof(float));
+        std::memcpy(this->bits.data() + 2, &p.v.z, sizeof(float));
+      }
+
+      bool operator==(const PointKey& other) const {
+        return this->bits == other.bits;
+      }
+    };
+
+    struct PointKeyHash {
+      size_t operator()(const PointKey& key) const {
+        uint64_t h = key.bits.at(0);
+        h = h * 0x9e3779b97f4a7c15ull + key.bits.at(1);
+        h = h * 0x9e3779b97f4a7c15ull + key.bits.at(2);
+        return std::hash<uint64_t>()(h);
+      }
+    };
+
+    uint64_t edge_key(uint32_t v0, uint32_t v1) {
+      return v0 < v1
+        ? (uint64_t(v0) << 32) | v1
+        : (uint64_t(v1) << 32) | v0;
+    }
+
+    Vector triangle_normal(const Point& p0, const Point& p1, const Point& p2) {
+      return cross(p1 - p0, p2 - p0);
+    }
+
+    class Simplifier {
+      // the vertices are the distinct points of the mesh
+      std::vector<Point> points;
+      std::vector<Quadric> quadrics;
+      std::vector<uint32_t> versions;
+      std::vector<bool> removed;
+      std::vector<std::vector<uint32_t>> vertex_tris;
+      std::vector<std::array<uint32_t, 3>> tris;
+      // index of the mesh vertex that gives the uv and normal of each corner
+      std::vector<std::array<uint32_t, 3>> tri_corners;
+      std::vector<bool> tri_alive;
+      uint32_t alive_count = 0;
+      std::priority_queue<Collapse, std::vector<Collapse>,
+        std::greater<Collapse>> collapses;
+    public:
+      explicit Simplifier(const Mesh& mesh);
+      float simplify(uint32_t target_triangles);
+      Mesh extract(const Mesh& mesh) const;
+    private:
+      void push_collapse(uint32_t keep, uint32_t remove);
+      bool collapse(const Collapse& collapse);
+    };
+
+    Simplifier::Simplifier(const Mesh& mesh) {
+      std::unordered_map<PointKey, uint32_t, PointKeyHash> point_vertices;
+      std::vector<uint32_t> mesh_vertices(mesh.points.size());
+      for(uint32_t i = 0; i < mesh.points.size(); ++i) {
+        auto inserted = point_vertices.insert(std::make_pair(
+              PointKey(mesh.points.at(i)), uint32_t(this->points.size())));
+        if(inserted.second) {
+          this->points.push_back(mesh.points.at(i));
+        }
+        mesh_vertices.at(i) = inserted.first->second;
+      }
+
+      uint32_t vertex_count = this->points.size();
+      this->quadrics.resize(vertex_count);
+      this->versions.assign(vertex_count, 0);
+      this->removed.assign(vertex_count, false);
+      this->vertex_tris.resize(vertex_count);
+
+      std::unordered_map<uint64_t, uint32_t> edge_tris;
+      for(uint32_t index = 0; index + 2 < mesh.vertices.size(); index += 3) {
+        std::array<uint32_t, 3> corners = {{
+          mesh.vertices.at(index),
+          mesh.vertices.at(index + 1),
+          mesh.vertices.at(index + 2),
+        }};
+        std::array<uint32_t, 3> tri = {{
+          mesh_vertices.at(corners.at(0)),
+          mesh_vertices.at(corners.at(1)),
+          mesh_vertices.at(corners.at(2)),
+        }};
+        if(tri.at(0) == tri.at(1) || tri.at(1) == tri.at(2) ||
+            tri.at(2) == tri.at(0)) {
+          continue;
+        }
+
+        Vector n = triangle_normal(this->points.at(tri.at(0)),
+            this->points.at(tri.at(1)), this->points.at(tri.at(2)));
+        if(length_squared(n) == 0.f) {
+          continue;
+        }
+        Quadric plane = Quadric::plane(normalize(n), this->points.at(tri.at(0)));
+
+        uint32_t tri_idx = this->tris.size();
+        for(uint32_t k = 0; k < 3; ++k) {
+          this->quadrics.at(tri.at(k)).add(plane);
+          this->vertex_tris.at(tri.at(k)).push_back(tri_idx);
+          edge_tris[edge_key(tri.at(k), tri.at((k + 1) % 3))] += 1;
+        }
+        this->tris.push_back(tri);
+        this->tri_corners.push_back(corners);
+        this->tri_alive.push_back(true);
+        this->alive_count += 1;
+      }
+
+      // constrain the boundary edges by planes perpendicular to the triangle,
+      // so that the boundary does not shrink
+      for(uint32_t tri_idx = 0; tri_idx < this->tris.size(); ++tri_idx) {
+        const auto& tri = this->tris.at(tri_idx);
+        for(uint32_t k = 0; k < 3; ++k) {
+          uint32_t v0 = tri.at(k), v1 = tri.at((k + 1) % 3);
+          if(edge_tris.at(edge_key(v0, v1)) != 1) {
+            continue;
+          }
+          const Point& p0 = this->points.at(v0);
+          const Point& p1 = this->points.at(v1);
+          Vector n = triangle_normal(p0, p1, this->points.at(tri.at((k + 2) % 3)));
+          Vector side = cross(p1 - p0, n);
+          if(length_squared(side) == 0.f) {
+            continue;
+          }
+          Quadric plane = Quadric::plane(normalize(side), p0);
+          this->quadrics.at(v0).add(plane);
+          this->quadrics.at(v1).add(plane);
+        }
+      }
+
+      for(const auto& edge: edge_tris) {
+        this->push_collapse(edge.first >> 32, edge.first & 0xffffffff);
+      }
+    }
+
+    float Simplifier::simplify(uint32_t target_triangles) {
+      double max_cost = 0.0;
+      while(this->alive_count > target_triangles && !this->collapses.empty()) {
+        Collapse collapse = this->collapses.top();
+        this->collapses.pop();
+        if(this->removed.at(collapse.keep) || this->removed.at(collapse.remove) ||
+            this->versions.at(collapse.keep) != collapse.keep_version ||
+            this->versions.at(collapse.remove) != collapse.remove_version) {
+          continue;
+        }
+        if(this->collapse(collapse)) {
+          max_cost = std::max(max_cost, collapse.cost);
+        }
+      }
+      return float(std::sqrt(max_cost));
+    }
+
+    void Simplifier::push_collapse(uint32_t keep, uint32_t remove) {
+      Quadric quadric = this->quadrics.at(keep);
+      quadric.add(this->quadrics.at(remove));
+
+      const Point& p0 = this->points.at(keep);
+      const Point& p1 = this->points.at(remove);
+      Point mid = 0.5f * (p0 + p1);
+      Point target;
+      // the minimum of the quadric is used only if it is close to the edge;
+      // otherwise the quadric is nearly singular and we pick the best of the
+      // endpoints and the midpoint
+      if(!quadric.minimize(target) ||
+          length_squared(target - mid) > length_squared(p1 - p0)) {
+        target = p0;
+        double best_cost = quadric.eval(p0);
+        for(const Point& p: {p1, mid}) {
+          double cost = quadric.eval(p);
+          if(cost < best_cost) {
+            best_cost = cost;
+            target = p;
+          }
+        }
+      }
+
+      Collapse collapse;
+      collapse.cost = quadric.eval(target);
+      collapse.keep = keep;
+      collapse.remove = remove;
+      collapse.keep_version = this->versions.at(keep);
+      collapse.remove_version = this->versions.at(remove);
+      collapse.target = target;
+      this->collapses.push(collapse);
+    }
+
+    bool Simplifier::collapse(const Collapse& collapse) {
+      uint32_t keep = collapse.keep;
+      uint32_t remove = collapse.remove;
+
+      // reject the collapse if it would flip (or rotate too much) any of the
+      // triangles that remain
+      for(uint32_t v: {keep, remove}) {
+        for(uint32_t tri_idx: this->vertex_tris.at(v)) {
+          if(!this->tri_alive.at(tri_idx)) {
+            continue;
+          }
+          const auto& tri = this->tris.at(tri_idx);
+          if(std::count(tri.begin(), tri.end(), keep) +
+              std::count(tri.begin(), tri.end(), remove) == 2) {
+            continue;
+          }
+
+          std::array<Point, 3> old_p, new_p;
+          for(uint32_t k = 0; k < 3; ++k) {
+            old_p.at(k) = this->points.at(tri.at(k));
+            new_p.at(k) = tri.at(k) == v ? collapse.target : old_p.at(k);
+          }
+          Vector old_n = triangle_normal(old_p.at(0), old_p.at(1), old_p.at(2));
+          Vector new_n = triangle_normal(new_p.at(0), new_p.at(1), new_p.at(2));
+          if(dot(old_n, new_n) <= 0.2f * length(old_n) * length(new_n)) {
+            return false;
+          }
+        }
+      }
+
+      std::vector<uint32_t> keep_tris;
+      for(uint32_t v: {keep, remove}) {
+        for(uint32_t tri_idx: this->vertex_tris.at(v)) {
+          if(!this->tri_alive.at(tri_idx)) {
+            continue;
+          }
+          auto& tri = this->tris.at(tri_idx);
+          bool has_keep = std::count(tri.begin(), tri.end(), keep) != 0;
+          bool has_remove = std::count(tri.begin(), tri.end(), remove) != 0;
+          if(has_keep && has_remove) {
+            this->tri_alive.at(tri_idx) = false;
+            this->alive_count -= 1;
+          } else {
+            std::replace(tri.begin(), tri.end(), remove, keep);
+            keep_tris.push_back(tri_idx);
+          }
+        }
+      }
+      std::sort(keep_tris.begin(), keep_tris.end());
+      keep_tris.erase(std::unique(keep_tris.begin(), keep_tris.end()), keep_tris.end());
+
+      this->points.at(keep) = collapse.target;
+      this->quadrics.at(keep).add(this->quadrics.at(remove));
+      this->versions.at(keep) += 1;
+      this->removed.at(remove) = true;
+      this->vertex_tris.at(keep) = std::move(keep_tris);
+      this->vertex_tris.at(remove).clear();
+
+      std::vector<uint32_t> neighbors;
+      for(uint32_t tri_idx: this->vertex_tris.at(keep)) {
+        for(uint32_t v: this->tris.at(tri_idx)) {
+          if(v != keep) {
+            neighbors.push_back(v);
+          }
+        }
+      }
+      std::sort(neighbors.begin(), neighbors.end());
+      neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+      for(uint32_t v: neighbors) {
+        this->push_collapse(keep, v);
+      }
+      return true;
+    }
+
+    Mesh Simplifier::extract(const Mesh& mesh) const {
+      bool has_attrs = !mesh.uvs.empty() || !mesh.normals.empty();
+      std::unordered_map<uint64_t, uint32_t> out_vertices;
+      Mesh out_mesh;
+      for(uint32_t tri_idx = 0; tri_idx < this->tris.size(); ++tri_idx) {
+        if(!this->tri_alive.at(tri_idx)) {
+          continue;
+        }
+        for(uint32_t k = 0; k < 3; ++k) {
+          uint32_t v = this->tris.at(tri_idx).at(k);
+          uint32_t corner = this->tri_corners.at(tri_idx).at(k);
+          uint64_t key = (uint64_t(v) << 32) | (has_attrs ? corner : 0);
+          auto inserted = out_vertices.insert(std::make_pair(key,
+                uint32_t(out_mesh.points.size())));
+          if(inserted.second) {
+            out_mesh.points.push_back(this->points.at(v));
+            if(!mesh.uvs.empty()) {
+              out_mesh.uvs.push_back(mesh.uvs.at(corner));
+            }
+            if(!mesh.normals.empty()) {
+              out_mesh.normals.push_back(mesh.normals.at(corner));
+            }
+          }
+          out_mesh.vertices.push_back(inserted.first->second);
+        }
+      }
+      return out_mesh;
+    }
+  }
+
+  Mesh simplify_mesh(const Mesh& mesh, uint32_t target_triangles,
+      float& out_error)
+  {
+    Simplifier simplifier(mesh);
+    out_error = simplifier.simplify(target_triangles);
+    return simplifier.extract(mesh);
+  }
+}
@@ -70,6 +70,10 @@ namespace dort {
     return 1.f / length_squared(p_gen - pivot_fix);
   }
 
+  float OrthoCamera::pixel_footprint(Vec2 film_res, float) const {
+    return this->dimension / max(film_res.x, film_res.y);
+  }
+
   bool OrthoCamera::get_film_pos(Vec2 film_res, const Vec3& pivot,
       Vec2& out_film_pos) const
   {
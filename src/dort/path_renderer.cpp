@@ -1,3 +1,4 @@
+#include <array>
 #include "dort/camera.hpp"
 #include "dort/ctx.hpp"
 #include "dort/discrete_distrib_1d.hpp"
@@ -13,32 +14,52 @@ namespace dort {
     this->light_distrib = compute_light_distrib(*this->scene);
 
     parallel_for(*ctx.pool, this->iteration_count, [&](uint32_t i) {
-      this->iteration_tiled(ctx, [&](Vec2i pixel, Vec2& film_pos, Sampler& sampler) {
-        film_pos = Vec2(pixel) + (i == 0 ? Vec2(0.5f, 0.5f) : sampler.random_2d());
-        return this->sample(film_pos, sampler);
+      this->iteration_tiled_packet(ctx, [&](const Vec2i* pixels, uint32_t pixel_count,
+          Vec2* film_pos, Spectrum* contribs, Sampler& sampler)
+      {
+        // sample the camera rays and trace them together as a packet
+        std::array<Ray, RAY_PACKET_SIZE> rays;
+        std::array<Spectrum, RAY_PACKET_SIZE> importances;
+        std::array<float, RAY_PACKET_SIZE> ray_pdfs;
+        uint32_t ray_mask = 0;
+        for(uint32_t j = 0; j < pixel_count; ++j) {
+          film_pos[j] = Vec2(pixels[j]) + (i == 0 ? Vec2(0.5f, 0.5f) : sampler.random_2d());
+          float ray_pos_pdf;
+          float ray_dir_pdf;
+          importances.at(j) = this->camera->sample_ray_importance(
+              Vec2(this->film->res), film_pos[j], rays.at(j),
+              ray_pos_pdf, ray_dir_pdf, CameraSample(sampler.rng));
+          ray_pdfs.at(j) = ray_pos_pdf * ray_dir_pdf;
+          if(ray_pdfs.at(j) != 0.f && !importances.at(j).is_black()) {
+            ray_mask |= 1u << j;
+          }
+        }
+
+        std::array<Intersection, RAY_PACKET_SIZE> isects;
+        uint32_t hit_mask = this->scene->intersect_packet(
+            rays.data(), isects.data(), ray_mask);
+        for(uint32_t j = 0; j < pixel_count; ++j) {
+          if(!(ray_mask & (1u << j))) {
+            contribs[j] = Spectrum(0.f);
+            continue;
+          }
+          Spectrum radiance = this->sample_path(rays.at(j),
+              (hit_mask & (1u << j)) != 0, isects.at(j), sampler);
+          contribs[j] = radiance * importances.at(j) / ray_pdfs.at(j);
+        }
       });
     });
   }
 
-  Spectrum PathRenderer::sample(Vec2 film_pos, Sampler& sampler) const {
-    // sample the initial camera ray
-    Ray next_ray;
-    float ray_pos_pdf;
-    float ray_dir_pdf;
-    Spectrum importance = this->camera->sample_ray_importance(Vec2(this->film->res),
-        film_pos, next_ray, ray_pos_pdf, ray_dir_pdf, CameraSample(sampler.rng));
-    float ray_pdf = ray_pos_pdf * ray_dir_pdf;
-    if(ray_pdf == 0.f || importance.is_black()) { return Spectrum(0.f); }
-
+  Spectrum PathRenderer::sample_path(Ray next_ray, bool isected,
+      Intersection isect, Sampler& sampler) const
+  {
     Spectrum radiance_sum(0.f);
     Spectrum throughput(1.f);
 
     uint32_t bounces = 0;
     bool last_bounce_was_delta = false;
     for(;;) {
-      Intersection isect;
-      bool isected = this->scene->intersect(next_ray, isect);
-
       if((bounces == 0 || last_bounce_was_delta)
           && bounces >= this->min_depth && bounces <= this->max_depth) 
       {
@@ -105,9 +126,10 @@ namespace dort {
         throughput = throughput / survive_prob;
       }
       next_ray = Ray(geom.p, bsdf_wi, geom.p_epsilon);
+      isected = this->scene->intersect(next_ray, isect);
     }
 
-    return radiance_sum * importance / ray_pdf;
+    return radiance_sum;
   }
 
   Spectrum PathRenderer::sample_direct_lighting(const LightingGeom& geom,
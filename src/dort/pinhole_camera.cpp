@@ -103,6 +103,10 @@ namespace dort {
     return 1.f;
   }
 
+  float PinholeCamera::pixel_footprint(Vec2 film_res, float distance) const {
+    return distance * this->project_dimension / max(film_res.x, film_res.y);
+  }
+
   bool PinholeCamera::get_film_pos(Vec2 film_res,
       const Vec3& pivot, Vec2& out_film_pos) const 
   {
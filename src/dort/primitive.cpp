@@ -1,3 +1,4 @@
+#include <array>
 #include "dort/bsdf.hpp"
 #include "dort/light.hpp"
 #include "dort/material.hpp"
@@ -25,23 +26,24 @@ namespace dort {
     }
   }
 
-  bool ShapePrimitive::intersect(Ray& ray, Intersection& out_isect) const {
-    Ray new_ray(this->shape_to_frame.apply_inv(ray));
-    float t_hit;
-    if(!this->shape->hit(new_ray, t_hit, out_isect.ray_epsilon,
-        out_isect.frame_diff_geom)) {
-      return false;
+  uint32_t Primitive::intersect_packet(Ray* rays, Intersection* out_isects,
+      uint32_t ray_mask) const
+  {
+    uint32_t hit_mask = 0;
+    for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+      if((ray_mask & (1u << i)) && this->intersect(rays[i], out_isects[i])) {
+        hit_mask |= 1u << i;
+      }
     }
-    out_isect.world_diff_geom = out_isect.frame_diff_geom =
-      this->shape_to_frame.apply(out_isect.frame_diff_geom);
-    out_isect.primitive = this;
-    ray.t_max = t_hit;
-    return true;
+    return hit_mask;
+  }
+
+  bool ShapePrimitive::intersect(Ray& ray, Intersection& out_isect) const {
+    return this->intersect_shape<Shape>(ray, out_isect);
   }
 
   bool ShapePrimitive::intersect_p(const Ray& ray) const {
-    Ray new_ray(this->shape_to_frame.apply_inv(ray));
-    return this->shape->hit_p(new_ray);
+    return this->intersect_shape_p<Shape>(ray);
   }
 
   Box ShapePrimitive::bounds() const {
@@ -67,12 +69,52 @@ namespace dort {
     return true;
   }
 
+  uint32_t FramePrimitive::intersect_packet(Ray* rays,
+      Intersection* out_isects, uint32_t ray_mask) const
+  {
+    std::array<Ray, RAY_PACKET_SIZE> new_rays;
+    for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+      if(ray_mask & (1u << i)) {
+        new_rays.at(i) = this->in_to_out.apply_inv(rays[i]);
+      }
+    }
+
+    uint32_t hit_mask = this->inside->intersect_packet(
+        new_rays.data(), out_isects, ray_mask);
+    for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+      if(hit_mask & (1u << i)) {
+        rays[i].t_max = new_rays.at(i).t_max;
+        out_isects[i].world_diff_geom = this->in_to_out.apply(
+            out_isects[i].world_diff_geom);
+      }
+    }
+    return hit_mask;
+  }
+
   bool FramePrimitive::intersect_p(const Ray& ray) const {
     Ray new_ray(this->in_to_out.apply_inv(ray));
     return this->inside->intersect_p(new_ray);
   }
 
   Box FramePrimitive::bounds() const {
-    return this->in_to_out.apply(this->inside->bounds());
+    return this->inside->transformed_bounds(this->in_to_out);
+  }
+
+  Box FramePrimitive::transformed_bounds(const Transform& transform) const {
+    return this->inside->transformed_bounds(transform * this->in_to_out);
+  }
+
+  void FramePrimitive::refit(ThreadPool& pool, float rebuild_threshold,
+      RefittedSet& refitted)
+  {
+    refit_shared(*this->inside, pool, rebuild_threshold, refitted);
+  }
+
+  void refit_shared(Primitive& prim, ThreadPool& pool, float rebuild_threshold,
+      RefittedSet& refitted)
+  {
+    if(refitted.insert(&prim).second) {
+      prim.refit(pool, rebuild_threshold, refitted);
+    }
   }
 }
@@ -1,11 +1,21 @@
+#include <array>
 #include "dort/ctx.hpp"
 #include "dort/film.hpp"
+#include "dort/geometry.hpp"
 #include "dort/renderer.hpp"
 #include "dort/sampler.hpp"
 #include "dort/thread_pool.hpp"
 #include "dort/vec_2i.hpp"
 
 namespace dort {
+  Renderer::Renderer(std::shared_ptr<Scene> scene,
+      std::shared_ptr<Film> film,
+      std::shared_ptr<Sampler> sampler,
+      std::shared_ptr<Camera> camera):
+    scene(scene), film(film), sampler(sampler), camera(camera),
+    film_band_mutexes((film->res.y + FILM_BAND_ROWS - 1) / FILM_BAND_ROWS)
+  { }
+
   Vec2i Renderer::layout_tiles(const CtxG& ctx, Vec2i film_res) {
     uint32_t min_jobs_per_thread = 8;
     uint32_t max_pixels_per_job = 32*1024;
@@ -44,6 +54,41 @@ namespace dort {
     });
   }
 
+  void Renderer::iteration_tiled_packet(CtxG& ctx,
+      std::function<void(const Vec2i*, uint32_t, Vec2*, Spectrum*, Sampler&)>
+        render_packet)
+  {
+    this->iteration_tiled_per_job(ctx,
+      [&](Film& tile_film, Recti tile_rect, Recti tile_film_rect, Sampler& sampler)
+    {
+      for(int32_t y = tile_rect.p_min.y; y < tile_rect.p_max.y; y += 2) {
+        for(int32_t x = tile_rect.p_min.x; x < tile_rect.p_max.x; x += 2) {
+          std::array<Vec2i, RAY_PACKET_SIZE> pixels;
+          uint32_t pixel_count = 0;
+          for(int32_t dy = 0; dy < 2 && y + dy < tile_rect.p_max.y; ++dy) {
+            for(int32_t dx = 0; dx < 2 && x + dx < tile_rect.p_max.x; ++dx) {
+              pixels.at(pixel_count++) = Vec2i(x + dx, y + dy);
+            }
+          }
+
+          std::array<Vec2, RAY_PACKET_SIZE> film_pos;
+          std::array<Spectrum, RAY_PACKET_SIZE> contribs;
+          render_packet(pixels.data(), pixel_count,
+              film_pos.data(), contribs.data(), sampler);
+          for(uint32_t i = 0; i < pixel_count; ++i) {
+            const Spectrum& contrib = contribs.at(i);
+            assert(is_finite(contrib));
+            assert(is_nonnegative(contrib));
+            if(is_finite(contrib) && is_nonnegative(contrib)) {
+              Vec2 tile_film_pos = film_pos.at(i) - Vec2(tile_film_rect.p_min);
+              tile_film.add_sample(tile_film_pos, contrib);
+            }
+          }
+        }
+      }
+    });
+  }
+
   void Renderer::iteration_tiled_per_job(CtxG& ctx,
       std::function<void(Film&, Recti, Recti, Sampler&)> render_tile)
   {
@@ -75,13 +120,44 @@ namespace dort {
       sampler_lock.unlock();
 
       render_tile(tile_film, tile_rect, film_rect, *tile_sampler);
+      this->add_tile_to_film(film_rect.p_min, tile_film);
+    });
+  }
 
-      StatTimer lock_timer(TIMER_RENDERER_LOCK_FILM);
-      std::unique_lock<std::mutex> film_lock(this->film_mutex);
-      lock_timer.stop();
+  void Renderer::add_tile_to_film(Vec2i pos, const Film& tile_film) {
+    int32_t y_begin = max(0, pos.y);
+    int32_t y_end = min(this->film->res.y, pos.y + tile_film.res.y);
+    if(y_begin >= y_end) {
+      return;
+    }
 
+    // the bands that are locked by other threads are skipped in the first
+    // pass and we wait for them only after adding all the other bands
+    int32_t band_begin = y_begin / FILM_BAND_ROWS;
+    int32_t band_end = (y_end + FILM_BAND_ROWS - 1) / FILM_BAND_ROWS;
+    auto add_band = [&](int32_t band) {
       StatTimer tile_timer(TIMER_RENDERER_ADD_TILE);
-      this->film->add_tile(film_rect.p_min, tile_film);
-    });
+      this->film->add_tile_rows(pos, tile_film,
+          max(y_begin, band * FILM_BAND_ROWS),
+          min(y_end, (band + 1) * FILM_BAND_ROWS));
+    };
+
+    std::vector<int32_t> busy_bands;
+    for(int32_t band = band_begin; band < band_end; ++band) {
+      std::unique_lock<std::mutex> band_lock(
+          this->film_band_mutexes.at(band), std::try_to_lock);
+      if(!band_lock.owns_lock()) {
+        busy_bands.push_back(band);
+        continue;
+      }
+      add_band(band);
+    }
+
+    for(int32_t band: busy_bands) {
+      StatTimer lock_timer(TIMER_RENDERER_LOCK_FILM);
+      std::unique_lock<std::mutex> band_lock(this->film_band_mutexes.at(band));
+      lock_timer.stop();
+      add_band(band);
+    }
   }
 }
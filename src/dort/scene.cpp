@@ -17,6 +17,14 @@ namespace dort {
     return this->primitive->intersect_p(ray);
   }
 
+  uint32_t Scene::intersect_packet(Ray* rays, Intersection* out_isects,
+      uint32_t ray_mask) const
+  {
+    stat_count(COUNTER_SCENE_INTERSECT_PACKET);
+    StatTimer t(TIMER_SCENE_INTERSECT_PACKET);
+    return this->primitive->intersect_packet(rays, out_isects, ray_mask);
+  }
+
   DiscreteDistrib1d compute_light_distrib(const Scene& scene, bool only_background) {
     const auto& lights = only_background ? scene.background_lights : scene.lights;
     std::vector<float> powers(lights.size());
@@ -0,0 +1,162 @@
+#include <array>
+#include <type_traits>
+#include "dort/sphere_set_primitive.hpp"
+#include "dort/sphere_shape.hpp"
+
+namespace dort {
+  SphereSetPrimitive::SphereSetPrimitive(SphereSet spheres,
+      const BvhOpts& opts, ThreadPool& pool):
+    spheres(std::move(spheres)),
+    bvh(make_indices(this->spheres.size()), &this->spheres, opts, pool)
+  {
+    this->reorder_spheres();
+  }
+
+  std::vector<uint32_t> SphereSetPrimitive::make_indices(uint32_t count) {
+    std::vector<uint32_t> indices(count);
+    for(uint32_t i = 0; i < count; ++i) {
+      indices.at(i) = i;
+    }
+    return indices;
+  }
+
+  void SphereSetPrimitive::reorder_spheres() {
+    // the spheres are placed in the order of the leaves, so that they are
+    // fetched mostly sequentially during traversal
+    std::vector<uint32_t> old_indices;
+    old_indices.reserve(this->spheres.size());
+    this->bvh.for_each_elem([&](uint32_t& index) {
+      old_indices.push_back(index);
+      index = old_indices.size() - 1;
+    });
+
+    auto permute = [&](auto& values) {
+      if(values.empty()) {
+        return;
+      }
+      std::remove_reference_t<decltype(values)> new_values;
+      new_values.reserve(old_indices.size());
+      for(uint32_t old_index: old_indices) {
+        new_values.push_back(values.at(old_index));
+      }
+      values = std::move(new_values);
+    };
+    permute(this->spheres.center_x);
+    permute(this->spheres.center_y);
+    permute(this->spheres.center_z);
+    permute(this->spheres.radii);
+    permute(this->spheres.material_idxs);
+  }
+
+  bool SphereSetPrimitive::intersect(Ray& ray, Intersection& out_isect) const {
+    // we only record the closest hit and compute the diff geom at the end
+    uint32_t hit_idx = UINT32_MAX;
+    this->bvh.traverse_elems(ray, [&](uint32_t idx) {
+      float t_hit;
+      if(this->hit_sphere(idx, ray, t_hit)) {
+        ray.t_max = t_hit;
+        hit_idx = idx;
+      }
+      return true;
+    });
+    if(hit_idx == UINT32_MAX) {
+      return false;
+    }
+    this->get_diff_geom(hit_idx, ray, out_isect);
+    return true;
+  }
+
+  uint32_t SphereSetPrimitive::intersect_packet(Ray* rays,
+      Intersection* out_isects, uint32_t ray_mask) const
+  {
+    std::array<uint32_t, RAY_PACKET_SIZE> hit_idxs;
+    hit_idxs.fill(UINT32_MAX);
+    this->bvh.traverse_packet_elems(rays, ray_mask,
+      [&](uint32_t idx, uint32_t leaf_ray_mask) {
+        while(leaf_ray_mask != 0) {
+          uint32_t lane = __builtin_ctz(leaf_ray_mask);
+          leaf_ray_mask &= leaf_ray_mask - 1;
+          float t_hit;
+          if(this->hit_sphere(idx, rays[lane], t_hit)) {
+            rays[lane].t_max = t_hit;
+            hit_idxs.at(lane) = idx;
+          }
+        }
+        return true;
+      });
+
+    uint32_t hit_mask = 0;
+    for(uint32_t i = 0; i < RAY_PACKET_SIZE; ++i) {
+      if(hit_idxs.at(i) != UINT32_MAX) {
+        this->get_diff_geom(hit_idxs.at(i), rays[i], out_isects[i]);
+        hit_mask |= 1u << i;
+      }
+    }
+    return hit_mask;
+  }
+
+  bool SphereSetPrimitive::intersect_p(const Ray& ray) const {
+    bool found = false;
+    this->bvh.traverse_elems(ray, [&](uint32_t idx) {
+      float t_hit;
+      if(this->hit_sphere(idx, ray, t_hit)) {
+        found = true;
+        return false;
+      }
+      return true;
+    });
+    return found;
+  }
+
+  Box SphereSetPrimitive::bounds() const {
+    return this->bvh.bounds();
+  }
+
+  Box SphereSetPrimitive::transformed_bounds(const Transform& transform) const {
+    return this->bvh.transformed_bounds(transform);
+  }
+
+  const Material* SphereSetPrimitive::get_material(const Intersection& isect) const {
+    if(this->spheres.material_idxs.empty()) {
+      return this->spheres.materials.at(0).get();
+    }
+    uint32_t sphere_idx = isect.aux_uint32[0];
+    return this->spheres.materials.at(
+        this->spheres.material_idxs.at(sphere_idx)).get();
+  }
+
+  const Light* SphereSetPrimitive::get_area_light(const DiffGeom&) const {
+    return nullptr;
+  }
+
+  bool SphereSetPrimitive::hit_sphere(uint32_t idx,
+      const Ray& ray, float& out_t_hit) const
+  {
+    Ray sphere_ray(Point(ray.orig.v - this->spheres.center(idx).v),
+        ray.dir, ray.t_min, ray.t_max);
+    return SphereShape(this->spheres.radii[idx]).solve_hit_t(sphere_ray, out_t_hit);
+  }
+
+  void SphereSetPrimitive::get_diff_geom(uint32_t idx,
+      const Ray& ray, Intersection& out_isect) const
+  {
+    // the ray.t_max is the parameter of the hit, so SphereShape::hit() finds
+    // the same hit again
+    Vec3 center = this->spheres.center(idx).v;
+    Ray sphere_ray(Point(ray.orig.v - center), ray.dir, ray.t_min, ray.t_max);
+    float t_hit;
+    bool hit = SphereShape(this->spheres.radii[idx]).hit(sphere_ray, t_hit,
+        out_isect.ray_epsilon, out_isect.frame_diff_geom);
+    assert(hit); (void)hit;
+    // the normals are normalized again, as in ShapePrimitive (by the
+    // Transform), because the hit point of a small sphere far from the ray
+    // origin is imprecise
+    DiffGeom& diff_geom = out_isect.frame_diff_geom;
+    diff_geom.p = Point(diff_geom.p.v + center);
+    diff_geom.nn = normalize(diff_geom.nn);
+    diff_geom.nn_shading = normalize(diff_geom.nn_shading);
+    out_isect.world_diff_geom = out_isect.frame_diff_geom;
+    out_isect.primitive = this;
+    out_isect.aux_uint32[0] = idx;
+  }
+}
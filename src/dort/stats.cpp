@@ -14,8 +14,12 @@ namespace dort {
   const std::vector<StatCounterDef> STAT_COUNTER_DEFS = {
     { "scene isect" },
     { "scene isect_p" },
+    { "scene isect_packet" },
     { "bvh fast_box_isect_p" },
     { "bvh fast_box_isect_p hit" },
+    { "bvh wide node isect" },
+    { "bvh packet node isect" },
+    { "bvh packet fallback" },
     { "bvh prim isect" },
     { "bvh prim isect hit" },
     { "bvh prim isect_p" },
@@ -24,6 +28,8 @@ namespace dort {
     { "triangle hit hit" },
     { "triangle hit_p" },
     { "triangle hit_p hit" },
+    { "triangle block hit" },
+    { "triangle block hit hit" },
     { "pool jobs" },
     { "pool no-waits" },
     { "pool waits" },
@@ -31,11 +37,15 @@ namespace dort {
 
   const std::vector<StatDistribIntDef> STAT_DISTRIB_INT_DEFS = {
     { "bvh traverse count" },
+    { "bvh wide child hits" },
     { "bvh build_node parallel count" },
     { "bvh build_node serial count" },
     { "bvh build serial count" },
-    { "bvh build linear resize" },
     { "bvh split_middle jobs" },
+    { "bvh split_spatial duplicates" },
+    { "bvh node bytes" },
+    { "bvh node count" },
+    { "bvh refit rebuild elems" },
     { "bsdf number of bxdfs" },
     { "render jobs" },
   };
@@ -47,6 +57,7 @@ namespace dort {
     { "renderer add_tile", 4 },
     { "scene isect", 256 },
     { "scene isect_p", 256 },
+    { "scene isect_packet", 256 },
     { "film add_sample", 256 },
     { "film add_splat", 256 },
     { "film add_tile", 16 },
@@ -58,8 +69,6 @@ namespace dort {
     { "bvh build node serial", 256 },
     { "bvh build partition parallel", 0 },
     { "bvh build partition serial", 256 },
-    { "bvh write_linear_node", 1024 },
-    { "bvh write_linear_node resize", 0 },
     { "bvh split_middle", 256 },
     { "bvh split_middle bounds out parallel", 0 },
     { "bvh split_middle bounds out serial", 256 },
@@ -67,8 +76,22 @@ namespace dort {
     { "bvh split_middle bounds in serial", 1024 },
     { "bvh split_median", 256 },
     { "bvh split_sah", 256 },
+    { "bvh split_spatial", 256 },
+    { "bvh lbvh morton", 0 },
+    { "bvh lbvh sort", 0 },
+    { "bvh lbvh emit", 0 },
+    { "bvh collapse wide", 0 },
+    { "bvh quantize wide", 0 },
+    { "bvh layout nodes", 0 },
+    { "bvh refit", 0 },
+    { "bvh refit rebuild", 0 },
     { "bvh traverse node", 256 },
     { "bvh traverse elem", 256 },
+    { "wavefront sort", 0 },
+    { "wavefront extend", 0 },
+    { "wavefront shade", 0 },
+    { "wavefront direct", 0 },
+    { "mesh reorder", 0 },
     { "pool wait", 0 },
     { "pool work", 0 },
     { "pool job", 0 },
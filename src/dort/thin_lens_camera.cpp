@@ -98,6 +98,11 @@ namespace dort {
     return INV_PI / square(this->lens_radius);
   }
 
+  float ThinLensCamera::pixel_footprint(Vec2 film_res, float distance) const {
+    // the blur of the lens is ignored, so this is the footprint in focus
+    return distance * this->project_dimension / max(film_res.x, film_res.y);
+  }
+
   Vec3 ThinLensCamera::get_focus_point(Vec2 film_res, Vec2 film_pos) const {
     float film_dimension = max(film_res.x, film_res.y);
     Vec2 plane_pos(
@@ -1,22 +1,125 @@
-#include <future>
 #include "dort/stats.hpp"
 #include "dort/thread_pool.hpp"
 
 namespace dort {
+  namespace {
+    // the pool and the deque of the current thread, if the thread is a worker
+    // of the pool or if it currently executes a loop in the pool
+    thread_local ThreadPool* current_pool = nullptr;
+    thread_local uint32_t current_slot = 0;
+  }
+
+  ThreadPool::Deque::Deque() {
+    this->top.store(0);
+    this->bottom.store(0);
+  }
+
+  void ThreadPool::Deque::write_slot(int64_t idx, const Task& task) {
+    Slot& slot = this->slots[idx % CAPACITY];
+    slot.loop.store(task.loop, std::memory_order_relaxed);
+    slot.range.store((uint64_t(task.begin) << 32) | uint64_t(task.end),
+        std::memory_order_relaxed);
+  }
+
+  ThreadPool::Task ThreadPool::Deque::read_slot(int64_t idx) const {
+    const Slot& slot = this->slots[idx % CAPACITY];
+    uint64_t range = slot.range.load(std::memory_order_relaxed);
+    Task task;
+    task.loop = slot.loop.load(std::memory_order_relaxed);
+    task.begin = uint32_t(range >> 32);
+    task.end = uint32_t(range);
+    return task;
+  }
+
+  bool ThreadPool::Deque::push(const Task& task) {
+    int64_t b = this->bottom.load(std::memory_order_relaxed);
+    int64_t t = this->top.load(std::memory_order_acquire);
+    if(b - t >= CAPACITY) {
+      return false;
+    }
+    this->write_slot(b, task);
+    std::atomic_thread_fence(std::memory_order_release);
+    this->bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  bool ThreadPool::Deque::pop(Task& out_task) {
+    int64_t b = this->bottom.load(std::memory_order_relaxed) - 1;
+    this->bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = this->top.load(std::memory_order_relaxed);
+    if(t > b) {
+      this->bottom.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    out_task = this->read_slot(b);
+    if(t == b) {
+      // this is the last task in the deque, so we race with the thieves
+      bool won = this->top.compare_exchange_strong(t, t + 1,
+          std::memory_order_seq_cst, std::memory_order_relaxed);
+      this->bottom.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  bool ThreadPool::Deque::steal(Task& out_task) {
+    int64_t t = this->top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = this->bottom.load(std::memory_order_acquire);
+    if(t >= b) {
+      return false;
+    }
+
+    Task task = this->read_slot(t);
+    if(!this->top.compare_exchange_strong(t, t + 1,
+          std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return false;
+    }
+    out_task = task;
+    return true;
+  }
+
+  bool ThreadPool::Deque::is_empty() const {
+    return this->top.load() >= this->bottom.load();
+  }
+
   ThreadPool::ThreadPool() {
     this->stop_flag = false;
+    this->affinity = ThreadAffinity::None;
+    this->sleeping_count.store(0);
+    this->injected_count.store(0);
+    for(uint32_t i = 0; i < CALLER_SLOTS; ++i) {
+      this->deques.push_back(std::make_unique<Deque>());
+    }
+    this->deque_count = CALLER_SLOTS;
+    this->busy_callers = 0;
   }
 
   ThreadPool::~ThreadPool() {
     this->stop();
   }
 
-  void ThreadPool::start(uint32_t thread_count) {
+  void ThreadPool::start(uint32_t thread_count, ThreadAffinity affinity) {
+    // the deques cannot be reallocated while the workers are running
+    this->stop();
+
+    std::vector<uint32_t> cpus = assign_thread_cpus(
+        get_cpu_topology(), affinity, thread_count);
     std::unique_lock<std::mutex> lock(this->mutex);
     this->stop_flag = false;
-    while(this->workers.size() + 1 < thread_count) {
-      this->workers.push_back(std::thread([this]() {
-        ThreadPool::worker_body(*this); 
+    this->affinity = affinity;
+    uint32_t worker_count = std::max(thread_count, 1u) - 1;
+    while(this->deques.size() < CALLER_SLOTS + worker_count) {
+      this->deques.push_back(std::make_unique<Deque>());
+    }
+    this->deque_count = CALLER_SLOTS + worker_count;
+    for(uint32_t i = 1; i <= worker_count; ++i) {
+      uint32_t slot = CALLER_SLOTS + i - 1;
+      int64_t cpu = cpus.empty() ? -1 : int64_t(cpus.at(i));
+      this->workers.push_back(std::thread([this, slot, cpu]() {
+        ThreadPool::worker_body(*this, slot, cpu); 
       }));
     }
   }
@@ -38,7 +141,7 @@ namespace dort {
   void ThreadPool::restart() {
     uint32_t thread_count = this->thread_count();
     this->stop();
-    this->start(thread_count);
+    this->start(thread_count, this->affinity);
   }
 
   uint32_t ThreadPool::thread_count() {
@@ -46,106 +149,278 @@ namespace dort {
     return this->workers.size() + 1;
   }
 
+  uint32_t ThreadPool::current_thread_index() {
+    if(current_pool == nullptr || current_slot < CALLER_SLOTS) {
+      return 0;
+    }
+    return current_slot - CALLER_SLOTS + 1;
+  }
+
   void ThreadPool::loop(uint32_t count, std::function<void(uint32_t)> fun) {
+    this->loop(count, 1, [&](uint32_t begin, uint32_t end) {
+      for(uint32_t i = begin; i < end; ++i) {
+        fun(i);
+      }
+    });
+  }
+
+  void ThreadPool::loop(uint32_t count, uint32_t grain,
+      std::function<void(uint32_t, uint32_t)> fun)
+  {
+    if(count == 0) {
+      return;
+    }
+
+    bool entered;
+    uint32_t slot = this->enter_caller(entered);
+
     Loop loop;
-    loop.fun = fun;
+    loop.fun = &fun;
     loop.count = count;
+    // by default, every thread gets about 8 ranges to balance the load
+    uint32_t thread_count = this->deque_count - CALLER_SLOTS + 1;
+    loop.grain = grain != 0 ? grain : std::max(1u, count / (8 * thread_count));
+    this->run_task(slot, Task { &loop, 0, count });
+
+    // wait for the loop to finish, possibly doing other work in the meantime
+    this->help_until(slot, [&]() {
+      return loop.finished_count.load(std::memory_order_acquire) >= count;
+    });
+    this->leave_caller(slot, entered);
+  }
+
+  void ThreadPool::spawn(std::function<void()> fun) {
+    Loop* loop = new Loop;
+    loop->owned_fun = [fun](uint32_t, uint32_t) { fun(); };
+    loop->fun = &loop->owned_fun;
+    loop->count = 1;
+    loop->grain = 1;
+    loop->detached = true;
+
+    Task task { loop, 0, 1 };
+    if(current_pool == this && this->deques.at(current_slot)->push(task)) {
+      this->wakeup_sleeping();
+      return;
+    }
 
-    // add the loop to the stack and work on it until there are no iterations
-    // left
     std::unique_lock<std::mutex> lock(this->mutex);
-    this->loop_stack.push_front(&loop);
-    auto loop_iter = this->loop_stack.begin();
-    work_on_loop(*this, loop, loop_iter, lock, true);
-    assert(loop.removed_flag);
+    this->injected_tasks.push_back(task);
+    this->injected_count.fetch_add(1);
+    this->wakeup_condvar.notify_one();
+  }
 
-    // wait for the loop to finish, possibly doing other work in the meantime
-    while(!loop.finished_flag) {
-      if(this->loop_stack.empty()) {
+  void ThreadPool::wait_until(const std::function<bool()>& is_done) {
+    if(is_done()) {
+      return;
+    }
+    bool entered;
+    uint32_t slot = this->enter_caller(entered);
+    this->help_until(slot, is_done);
+    this->leave_caller(slot, entered);
+  }
+
+  uint32_t ThreadPool::enter_caller(bool& out_entered) {
+    // workers and the threads that already work in the pool (in a nested
+    // loop) keep their deque
+    out_entered = current_pool != this;
+    if(!out_entered) {
+      return current_slot;
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    const uint32_t all_busy = (uint32_t(1) << CALLER_SLOTS) - 1;
+    this->caller_condvar.wait(lock, [&]() {
+      return this->busy_callers != all_busy;
+    });
+    uint32_t slot = 0;
+    while(this->busy_callers & (uint32_t(1) << slot)) {
+      ++slot;
+    }
+    this->busy_callers |= uint32_t(1) << slot;
+    current_pool = this;
+    current_slot = slot;
+    return slot;
+  }
+
+  void ThreadPool::leave_caller(uint32_t slot, bool entered) {
+    if(!entered) {
+      return;
+    }
+    // the tasks spawned by the caller may be left in the deque; they are
+    // stolen by the workers or popped by the next caller of this slot
+    current_pool = nullptr;
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->busy_callers &= ~(uint32_t(1) << slot);
+    this->caller_condvar.notify_one();
+  }
+
+  void ThreadPool::help_until(uint32_t slot, const std::function<bool()>& is_done) {
+    while(!is_done()) {
+      Task task;
+      if(this->find_task(slot, task)) {
+        this->run_task(slot, task);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->sleeping_count.fetch_add(1);
+      if(!is_done() && !this->has_tasks()) {
         stat_count(COUNTER_POOL_WAITS);
         StatTimer t(TIMER_POOL_WAIT);
-        loop.finished_condvar.wait(lock);
-      } else {
-        auto loop_iter = this->loop_stack.begin();
-        ThreadPool::work_on_loop(*this, **loop_iter, loop_iter, lock, false);
+        this->wakeup_condvar.wait(lock);
       }
+      this->sleeping_count.fetch_sub(1);
     }
   }
 
-  void ThreadPool::worker_body(ThreadPool& pool) {
+  void ThreadPool::worker_body(ThreadPool& pool, uint32_t slot, int64_t cpu) {
+    if(cpu >= 0) {
+      pin_current_thread(uint32_t(cpu));
+    }
     stat_init_thread();
+    current_pool = &pool;
+    current_slot = slot;
 
-    std::unique_lock<std::mutex> lock(pool.mutex);
     for(;;) {
-      assert(lock.owns_lock());
-      if(pool.stop_flag && pool.loop_stack.empty()) {
+      Task task;
+      if(pool.find_task(slot, task)) {
+        stat_count(COUNTER_POOL_NO_WAITS);
+        pool.run_task(slot, task);
+        continue;
+      }
+
+      // register as sleeping before checking the deques for the last time, so
+      // that a thread that pushes a task after the check will wake us up
+      std::unique_lock<std::mutex> lock(pool.mutex);
+      pool.sleeping_count.fetch_add(1);
+      bool has_tasks = pool.has_tasks();
+      if(!has_tasks && pool.stop_flag) {
+        pool.sleeping_count.fetch_sub(1);
         break;
-      } if(pool.loop_stack.empty()) {
+      } else if(!has_tasks) {
         stat_count(COUNTER_POOL_WAITS);
         StatTimer t(TIMER_POOL_WAIT);
         pool.wakeup_condvar.wait(lock);
-      } else {
-        stat_count(COUNTER_POOL_NO_WAITS);
       }
+      pool.sleeping_count.fetch_sub(1);
+    }
+
+    current_pool = nullptr;
+    stat_finish_thread();
+  }
+
+  bool ThreadPool::find_task(uint32_t slot, Task& out_task) {
+    if(this->deques.at(slot)->pop(out_task)) {
+      return true;
+    }
 
-      if(!pool.loop_stack.empty()) {
-        auto loop_iter = pool.loop_stack.begin();
-        ThreadPool::work_on_loop(pool, **loop_iter, loop_iter, lock, false);
+    if(this->injected_count.load() > 0) {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      if(!this->injected_tasks.empty()) {
+        out_task = this->injected_tasks.front();
+        this->injected_tasks.pop_front();
+        this->injected_count.fetch_sub(1);
+        return true;
       }
     }
 
-    stat_finish_thread();
+    for(uint32_t i = 1; i < this->deque_count; ++i) {
+      if(this->deques.at((slot + i) % this->deque_count)->steal(out_task)) {
+        return true;
+      }
+    }
+    return false;
   }
 
-  void ThreadPool::work_on_loop(ThreadPool& pool, Loop& loop,
-      std::list<Loop*>::iterator loop_iter, std::unique_lock<std::mutex>& lock,
-      bool wakeup_others)
-  {
-    lock.unlock();
-    if(wakeup_others) {
-      pool.wakeup_condvar.notify_all();
+  bool ThreadPool::has_tasks() const {
+    if(this->injected_count.load() > 0) {
+      return true;
+    }
+    for(uint32_t i = 0; i < this->deque_count; ++i) {
+      if(!this->deques.at(i)->is_empty()) {
+        return true;
+      }
     }
+    return false;
+  }
 
+  void ThreadPool::run_task(uint32_t slot, Task task) {
+    Deque& deque = *this->deques.at(slot);
     StatTimer work_timer(TIMER_POOL_WORK);
-    auto fun = loop.fun;
-    uint32_t count = loop.count;
-    for(;;) {
-      // perform iterations until the loop is emptied (the fast path needs no
-      // locking)
-      uint32_t iter = loop.started_count.fetch_add(1);
-      if(iter < count) {
-        StatTimer job_timer(TIMER_POOL_JOB);
-        fun(iter);
-      } else {
-        work_timer.stop();
-        lock.lock();
+
+    // split the range in halves and leave the upper halves in our deque, so
+    // that idle threads can steal them
+    while(task.end - task.begin > task.loop->grain) {
+      uint32_t mid = task.begin + (task.end - task.begin) / 2;
+      if(!deque.push(Task { task.loop, mid, task.end })) {
         break;
       }
+      this->wakeup_sleeping();
+      task.end = mid;
+    }
 
-      uint32_t finished_count = loop.finished_count.fetch_add(1) + 1;
-      assert(finished_count <= count);
-      if(finished_count >= count) {
-        // we finished the last iteration of the loop, so we signal that the
-        // loop is finished, possibly waking up the thread that waits for the
-        // loop to finish.
-        work_timer.stop();
-        lock.lock();
-        if(!loop.finished_flag) {
-          loop.finished_flag = true;
-          loop.finished_condvar.notify_all();
-        }
-        break;
+    {
+      StatTimer job_timer(TIMER_POOL_JOB);
+      (*task.loop->fun)(task.begin, task.end);
+    }
+    work_timer.stop();
+
+    // the loop may be destroyed as soon as the thread that waits for it sees
+    // the last iteration finished, so we must not touch it afterwards
+    uint32_t task_count = task.end - task.begin;
+    uint32_t count = task.loop->count;
+    bool detached = task.loop->detached;
+    uint32_t finished_count = task.loop->finished_count.fetch_add(
+        task_count, std::memory_order_acq_rel) + task_count;
+    assert(finished_count <= count);
+    if(finished_count == count) {
+      if(detached) {
+        delete task.loop;
       }
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->wakeup_condvar.notify_all();
+    }
+  }
+
+  void ThreadPool::wakeup_sleeping() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(this->sleeping_count.load(std::memory_order_relaxed) > 0) {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->wakeup_condvar.notify_one();
+    }
+  }
+
+  void FutureStateBase::set_ready() {
+    std::vector<std::function<void()>> continuations;
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->ready_flag.store(true, std::memory_order_release);
+      continuations = std::move(this->continuations);
+    }
+    for(auto& continuation: continuations) {
+      continuation();
+    }
+  }
+
+  void FutureStateBase::set_exception(std::exception_ptr exception) {
+    this->exception = exception;
+    this->set_ready();
+  }
+
+  void FutureStateBase::rethrow_exception() const {
+    if(this->exception) {
+      std::rethrow_exception(this->exception);
     }
+  }
 
-    assert(lock.owns_lock());
-    // the loop has no iterations left, we will race to remove the loop from the
-    // stack. note that the loop may not be finished, other threads may still
-    // work on the last iterations.
-    if(!loop.removed_flag) {
-      loop.removed_flag = true;
-      pool.loop_stack.erase(loop_iter);
+  void FutureStateBase::on_ready(std::function<void()> fun) {
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      if(!this->ready_flag.load(std::memory_order_relaxed)) {
+        this->continuations.push_back(std::move(fun));
+        return;
+      }
     }
-    return;
+    fun();
   }
 }
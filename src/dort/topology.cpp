@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "dort/topology.hpp"
+
+namespace dort {
+  namespace {
+    // from <numaif.h>, which is a part of libnuma
+    const int MPOL_INTERLEAVE = 3;
+    const unsigned MPOL_MF_MOVE = 1 << 1;
+    const size_t MIN_INTERLEAVE_BYTES = 4 << 20;
+
+    bool read_sysfs_uint(const std::string& path, uint32_t& out_value) {
+      FILE* file = std::fopen(path.c_str(), "r");
+      if(!file) {
+        return false;
+      }
+      bool ok = std::fscanf(file, "%u", &out_value) == 1;
+      std::fclose(file);
+      return ok;
+    }
+
+    // parses lists like "0-3,8-11"
+    std::vector<uint32_t> read_sysfs_cpu_list(const std::string& path) {
+      std::vector<uint32_t> cpus;
+      FILE* file = std::fopen(path.c_str(), "r");
+      if(!file) {
+        return cpus;
+      }
+
+      uint32_t first;
+      while(std::fscanf(file, "%u", &first) == 1) {
+        uint32_t last = first;
+        int c = std::fgetc(file);
+        if(c == '-') {
+          if(std::fscanf(file, "%u", &last) != 1) {
+            break;
+          }
+          c = std::fgetc(file);
+        }
+        for(uint32_t cpu = first; cpu <= last; ++cpu) {
+          cpus.push_back(cpu);
+        }
+        if(c != ',') {
+          break;
+        }
+      }
+      std::fclose(file);
+      return cpus;
+    }
+
+    CpuTopology read_cpu_topology() {
+      CpuTopology topology;
+      cpu_set_t allowed;
+      CPU_ZERO(&allowed);
+      if(::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        uint32_t cpu_count = std::max(1u, std::thread::hardware_concurrency());
+        for(uint32_t cpu = 0; cpu < cpu_count; ++cpu) {
+          CPU_SET(cpu, &allowed);
+        }
+      }
+
+      std::map<uint32_t, uint32_t> cpu_nodes;
+      if(DIR* dir = ::opendir("/sys/devices/system/node")) {
+        while(struct dirent* entry = ::readdir(dir)) {
+          uint32_t node;
+          if(std::sscanf(entry->d_name, "node%u", &node) != 1) {
+            continue;
+          }
+          std::string path = std::string("/sys/devices/system/node/")
+            + entry->d_name + "/cpulist";
+          for(uint32_t cpu: read_sysfs_cpu_list(path)) {
+            cpu_nodes[cpu] = node;
+          }
+        }
+        ::closedir(dir);
+      }
+
+      std::map<std::pair<uint32_t, uint32_t>, uint32_t> core_indices;
+      std::set<uint32_t> nodes;
+      for(uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if(!CPU_ISSET(cpu, &allowed)) {
+          continue;
+        }
+
+        std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu)
+          + "/topology/";
+        uint32_t core_id = cpu;
+        uint32_t package_id = 0;
+        if(!read_sysfs_uint(dir + "core_id", core_id) ||
+            !read_sysfs_uint(dir + "physical_package_id", package_id)) {
+          core_id = cpu;
+          package_id = 0;
+        }
+
+        auto core_key = std::make_pair(package_id, core_id);
+        auto core_iter = core_indices.insert(
+            std::make_pair(core_key, uint32_t(core_indices.size()))).first;
+        auto node_iter = cpu_nodes.find(cpu);
+        uint32_t node = node_iter != cpu_nodes.end() ? node_iter->second : 0;
+        nodes.insert(node);
+
+        CpuInfo info;
+        info.cpu = cpu;
+        info.core = core_iter->second;
+        info.package = package_id;
+        info.node = node;
+        topology.cpus.push_back(info);
+      }
+
+      topology.core_count = core_indices.size();
+      topology.node_count = std::max(size_t(1), nodes.size());
+      return topology;
+    }
+  }
+
+  const CpuTopology& get_cpu_topology() {
+    static const CpuTopology topology = read_cpu_topology();
+    return topology;
+  }
+
+  bool parse_thread_affinity(const std::string& name, ThreadAffinity& out_affinity) {
+    if(name == "none") {
+      out_affinity = ThreadAffinity::None;
+    } else if(name == "compact") {
+      out_affinity = ThreadAffinity::Compact;
+    } else if(name == "scatter") {
+      out_affinity = ThreadAffinity::Scatter;
+    } else if(name == "cores") {
+      out_affinity = ThreadAffinity::Cores;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  std::vector<uint32_t> assign_thread_cpus(const CpuTopology& topology,
+      ThreadAffinity affinity, uint32_t thread_count)
+  {
+    if(affinity == ThreadAffinity::None || topology.cpus.empty()) {
+      return {};
+    }
+
+    // the rank of every CPU among the hardware threads of its core and the rank
+    // of its core among the cores of its package
+    std::vector<CpuInfo> cpus = topology.cpus;
+    std::sort(cpus.begin(), cpus.end(), [](const CpuInfo& a, const CpuInfo& b) {
+      return std::make_tuple(a.package, a.core, a.cpu)
+        < std::make_tuple(b.package, b.core, b.cpu);
+    });
+    std::vector<uint32_t> smt_ranks(cpus.size());
+    std::vector<uint32_t> core_ranks(cpus.size());
+    for(uint32_t i = 1; i < cpus.size(); ++i) {
+      const CpuInfo& prev = cpus.at(i - 1);
+      const CpuInfo& cpu = cpus.at(i);
+      if(cpu.package != prev.package) {
+        continue;
+      } else if(cpu.core == prev.core) {
+        smt_ranks.at(i) = smt_ranks.at(i - 1) + 1;
+        core_ranks.at(i) = core_ranks.at(i - 1);
+      } else {
+        core_ranks.at(i) = core_ranks.at(i - 1) + 1;
+      }
+    }
+
+    std::vector<uint32_t> order(cpus.size());
+    for(uint32_t i = 0; i < order.size(); ++i) {
+      order.at(i) = i;
+    }
+    if(affinity == ThreadAffinity::Scatter) {
+      std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return std::make_tuple(smt_ranks.at(a), core_ranks.at(a), cpus.at(a).package)
+          < std::make_tuple(smt_ranks.at(b), core_ranks.at(b), cpus.at(b).package);
+      });
+    } else if(affinity == ThreadAffinity::Cores) {
+      order.erase(std::remove_if(order.begin(), order.end(), [&](uint32_t i) {
+        return smt_ranks.at(i) != 0;
+      }), order.end());
+    }
+
+    std::vector<uint32_t> thread_cpus(thread_count);
+    for(uint32_t i = 0; i < thread_count; ++i) {
+      thread_cpus.at(i) = cpus.at(order.at(i % order.size())).cpu;
+    }
+    return thread_cpus;
+  }
+
+  void pin_current_thread(uint32_t cpu) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    // the pinning is only a hint for performance, so we ignore the errors
+    ::pthread_setaffinity_np(::pthread_self(), sizeof(cpu_set), &cpu_set);
+  }
+
+  void numa_interleave(const void* ptr, size_t size) {
+    const CpuTopology& topology = get_cpu_topology();
+    if(topology.node_count <= 1 || size < MIN_INTERLEAVE_BYTES) {
+      return;
+    }
+
+    // only the pages that lie entirely inside the array are interleaved, the
+    // pages at the edges may be shared with other allocations
+    uintptr_t page_size = ::sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t(ptr) + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = (uintptr_t(ptr) + size) & ~(page_size - 1);
+    if(end <= begin) {
+      return;
+    }
+
+    const uint32_t MASK_BITS = 8 * sizeof(unsigned long);
+    uint32_t max_node = 0;
+    for(const auto& cpu: topology.cpus) {
+      max_node = std::max(max_node, cpu.node);
+    }
+    std::vector<unsigned long> node_mask(max_node / MASK_BITS + 1);
+    for(const auto& cpu: topology.cpus) {
+      node_mask.at(cpu.node / MASK_BITS) |= 1ul << (cpu.node % MASK_BITS);
+    }
+
+    // the memory policy is only a hint for performance, so we ignore the
+    // errors (mbind() fails for example when the kernel is built without NUMA
+    // support)
+    ::syscall(SYS_mbind, begin, end - begin, MPOL_INTERLEAVE,
+        node_mask.data(), node_mask.size() * MASK_BITS + 1, MPOL_MF_MOVE);
+  }
+}
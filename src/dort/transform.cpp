@@ -25,6 +25,27 @@ namespace dort {
   }
 
   Box Transform::apply(bool inv, const Box& box) const {
+    // every coordinate of the result is a sum of the contributions of the
+    // three input axes, so we take the extremes of each contribution
+    // separately (Arvo, "Transforming axis-aligned bounding boxes")
+    const auto& m = this->get_mat(inv).cols;
+    if(m[0][3] != 0.f || m[1][3] != 0.f || m[2][3] != 0.f || m[3][3] != 1.f) {
+      return this->apply_projective(inv, box);
+    }
+
+    Box ret(Point(m[3][0], m[3][1], m[3][2]), Point(m[3][0], m[3][1], m[3][2]));
+    for(uint32_t i = 0; i < 3; ++i) {
+      for(uint32_t j = 0; j < 3; ++j) {
+        float a = m[j][i] * box.p_min.v[j];
+        float b = m[j][i] * box.p_max.v[j];
+        ret.p_min.v[i] += min(a, b);
+        ret.p_max.v[i] += max(a, b);
+      }
+    }
+    return ret;
+  }
+
+  Box Transform::apply_projective(bool inv, const Box& box) const {
     Vector radius = (box.p_max - box.p_min) * 0.5f;
     Point mid = box.p_min + radius;
 
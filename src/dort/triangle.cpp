@@ -1,46 +1,76 @@
 #include "dort/box.hpp"
+#include "dort/compressed_mesh.hpp"
 #include "dort/mesh.hpp"
 #include "dort/shape.hpp"
 #include "dort/stats.hpp"
 #include "dort/triangle.hpp"
 
 namespace dort {
+  namespace {
+    // Moller-Trumbore ray-triangle intersection
+    bool hit_triangle(const std::array<Point, 3>& p, const Ray& ray,
+        float& out_t, float& out_b1, float& out_b2)
+    {
+      Vector e1 = p[1] - p[0];
+      Vector e2 = p[2] - p[0];
+      Vector s1 = cross(ray.dir, e2);
+      float det = dot(s1, e1);
+      if(det == 0.f) {
+        return false;
+      }
+      float inv_det = 1.f / det;
+
+      Vector s = ray.orig - p[0];
+      float b1 = inv_det * dot(s1, s);
+      if(b1 < 0.f || b1 > 1.f) {
+        return false;
+      }
+
+      Vector s2 = cross(s, e1);
+      float b2 = inv_det * dot(s2, ray.dir);
+      if(b2 < 0.f || b1 + b2 > 1.f) {
+        return false;
+      }
+
+      float t = inv_det * dot(s2, e2);
+      if(t < ray.t_min || t > ray.t_max) {
+        return false;
+      }
+
+      out_t = t;
+      out_b1 = b1;
+      out_b2 = b2;
+      return true;
+    }
+  }
+
   Triangle::Triangle(const Mesh& mesh, uint32_t index) {
     this->p[0] = mesh.points.at(mesh.vertices.at(index));
     this->p[1] = mesh.points.at(mesh.vertices.at(index + 1));
     this->p[2] = mesh.points.at(mesh.vertices.at(index + 2));
   }
 
-  bool Triangle::hit_p(const Ray& ray) const {
-    stat_count(COUNTER_TRIANGLE_HIT_P);
-    const auto& p = this->p;
-
-    Vector e1 = p[1] - p[0];
-    Vector e2 = p[2] - p[0];
-    Vector s1 = cross(ray.dir, e2);
-    float det = dot(s1, e1);
-    if(det == 0.f) {
-      return false;
-    }
-    float inv_det = 1.f / det;
-
-    Vector s = ray.orig - p[0];
-    float b1 = inv_det * dot(s1, s);
-    if(b1 < 0.f || b1 > 1.f) {
-      return false;
-    }
+  Triangle::Triangle(const CompressedMesh& mesh, uint32_t index) {
+    mesh.triangle_points(index, this->p);
+  }
 
-    Vector s2 = cross(s, e1);
-    float b2 = inv_det * dot(s2, ray.dir);
-    if(b2 < 0.f || b1 + b2 > 1.f) {
+  bool Triangle::hit(const Ray& ray, float& out_t,
+      float& out_b1, float& out_b2) const
+  {
+    stat_count(COUNTER_TRIANGLE_HIT);
+    if(!hit_triangle(this->p, ray, out_t, out_b1, out_b2)) {
       return false;
     }
+    stat_count(COUNTER_TRIANGLE_HIT_HIT);
+    return true;
+  }
 
-    float t = inv_det * dot(s2, e2);
-    if(t < ray.t_min || t > ray.t_max) {
+  bool Triangle::hit_p(const Ray& ray) const {
+    stat_count(COUNTER_TRIANGLE_HIT_P);
+    float t, b1, b2;
+    if(!hit_triangle(this->p, ray, t, b1, b2)) {
       return false;
     }
-
     stat_count(COUNTER_TRIANGLE_HIT_P_HIT);
     return true;
   }
@@ -53,6 +83,51 @@ namespace dort {
     return bound;
   }
 
+  Box Triangle::clipped_bounds(const Box& clip) const {
+    // clip the triangle against the six planes of the box (Sutherland-Hodgman)
+    // and return the bounds of the remaining polygon
+    std::array<Point, 9> poly;
+    std::array<Point, 9> clipped;
+    uint32_t poly_len = 3;
+    poly.at(0) = this->p[0];
+    poly.at(1) = this->p[1];
+    poly.at(2) = this->p[2];
+
+    for(uint32_t axis = 0; axis < 3; ++axis) {
+      for(uint32_t side = 0; side < 2; ++side) {
+        float plane = clip[side].v[axis];
+        float sign = side == 0 ? 1.f : -1.f;
+        uint32_t clipped_len = 0;
+        for(uint32_t i = 0; i < poly_len; ++i) {
+          const Point& p0 = poly.at(i);
+          const Point& p1 = poly.at(i + 1 == poly_len ? 0 : i + 1);
+          float d0 = sign * (p0.v[axis] - plane);
+          float d1 = sign * (p1.v[axis] - plane);
+          if(d0 >= 0.f) {
+            clipped.at(clipped_len++) = p0;
+          }
+          if((d0 < 0.f && d1 > 0.f) || (d0 > 0.f && d1 < 0.f)) {
+            Point p_cut = p0 + (p1 - p0) * (d0 / (d0 - d1));
+            p_cut.v[axis] = plane;
+            clipped.at(clipped_len++) = p_cut;
+          }
+        }
+
+        poly_len = clipped_len;
+        std::swap(poly, clipped);
+        if(poly_len == 0) {
+          return Box();
+        }
+      }
+    }
+
+    Box bound;
+    for(uint32_t i = 0; i < poly_len; ++i) {
+      bound = union_box(bound, poly.at(i));
+    }
+    return intersect_box(bound, clip);
+  }
+
   float Triangle::area() const {
     Vector e1 = this->p[1] - this->p[0];
     Vector e2 = this->p[2] - this->p[0];
@@ -99,40 +174,48 @@ namespace dort {
     }
   }
 
-  bool TriangleUv::hit(const Ray& ray, float& out_t_hit,
-      float& out_ray_epsilon, DiffGeom& out_diff_geom) const
+  TriangleUv::TriangleUv(const CompressedMesh& mesh, uint32_t index):
+    Triangle(mesh, index)
   {
-    stat_count(COUNTER_TRIANGLE_HIT);
-    const auto& p = this->p;
-    const auto& uv = this->uv;
-
-    Vector e1 = p[1] - p[0];
-    Vector e2 = p[2] - p[0];
-    Vector s1 = cross(ray.dir, e2);
-    float det = dot(s1, e1);
-    if(det == 0.f) {
-      return false;
-    }
-    float inv_det = 1.f / det;
-
-    Vector s = ray.orig - p[0];
-    float b1 = inv_det * dot(s1, s);
-    if(b1 < 0.f || b1 > 1.f) {
-      return false;
+    std::array<uint32_t, 3> vertices = {{
+      mesh.vertex(index), mesh.vertex(index + 1), mesh.vertex(index + 2),
+    }};
+
+    if(mesh.has_uvs()) {
+      for(uint32_t i = 0; i < 3; ++i) {
+        this->uv[i] = mesh.uv(vertices[i]);
+      }
+    } else {
+      this->uv[0] = Vec2(0.f, 0.f);
+      this->uv[1] = Vec2(1.f, 0.f);
+      this->uv[2] = Vec2(0.f, 1.f);
     }
 
-    Vector s2 = cross(s, e1);
-    float b2 = inv_det * dot(s2, ray.dir);
-    if(b2 < 0.f || b1 + b2 > 1.f) {
-      return false;
+    if((this->has_shading_normals = mesh.has_normals())) {
+      for(uint32_t i = 0; i < 3; ++i) {
+        this->n[i] = mesh.normal(vertices[i]);
+      }
     }
+  }
 
-    float t = inv_det * dot(s2, e2);
-    if(t < ray.t_min || t > ray.t_max) {
+  bool TriangleUv::hit(const Ray& ray, float& out_t_hit,
+      float& out_ray_epsilon, DiffGeom& out_diff_geom) const
+  {
+    float b1, b2;
+    if(!Triangle::hit(ray, out_t_hit, b1, b2)) {
       return false;
     }
+    this->get_diff_geom(out_t_hit, b1, b2, out_ray_epsilon, out_diff_geom);
+    return true;
+  }
 
-    stat_count(COUNTER_TRIANGLE_HIT_HIT);
+  void TriangleUv::get_diff_geom(float t, float b1, float b2,
+      float& out_ray_epsilon, DiffGeom& out_diff_geom) const
+  {
+    const auto& p = this->p;
+    const auto& uv = this->uv;
+    Vector e1 = p[1] - p[0];
+    Vector e2 = p[2] - p[0];
 
     float du1 = uv[1][0] - uv[0][0];
     float du2 = uv[2][0] - uv[0][0];
@@ -151,7 +234,6 @@ namespace dort {
     float u = b0 * uv[0][0] + b1 * uv[1][0] + b2 * uv[2][0];
     float v = b0 * uv[0][1] + b1 * uv[1][1] + b2 * uv[2][1];
 
-    out_t_hit = t;
     out_ray_epsilon = abs(1e-3f * t);
     out_diff_geom.p = b0 * p[0] + b1 * p[1] + b2 * p[2];
     out_diff_geom.nn = normalize(Normal(cross(e2, e1)));
@@ -169,6 +251,5 @@ namespace dort {
       out_diff_geom.dpdu_shading = out_diff_geom.dpdu;
       out_diff_geom.dpdv_shading = out_diff_geom.dpdv;
     }
-    return true;
   }
 }
@@ -1,5 +1,6 @@
 #include <shared_mutex>
 #include "dort/camera.hpp"
+#include "dort/ctx.hpp"
 #include "dort/film.hpp"
 #include "dort/primitive.hpp"
 #include "dort/vcm_renderer.hpp"
@@ -15,6 +16,7 @@ namespace dort {
           scene->lights.at(i).get(), this->light_distrib.pdf(i)));
     }
     this->init_debug_films();
+    this->film->init_splat_planes(*ctx.pool);
 
     std::vector<Photon> photons;
     for(uint32_t i = 0; i < this->iteration_count; ++i) {
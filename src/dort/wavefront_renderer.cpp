@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <array>
+#include "dort/bsdf.hpp"
+#include "dort/camera.hpp"
+#include "dort/ctx.hpp"
+#include "dort/film.hpp"
+#include "dort/light.hpp"
+#include "dort/material.hpp"
+#include "dort/scene.hpp"
+#include "dort/stats.hpp"
+#include "dort/thread_pool.hpp"
+#include "dort/vec_2i.hpp"
+#include "dort/wavefront_renderer.hpp"
+
+namespace dort {
+  namespace {
+    uint32_t expand_morton_bits(uint32_t x) {
+      x = (x | (x << 16)) & 0x030000ff;
+      x = (x | (x << 8)) & 0x0300f00f;
+      x = (x | (x << 4)) & 0x030c30c3;
+      x = (x | (x << 2)) & 0x09249249;
+      return x;
+    }
+  }
+
+  void WavefrontRenderer::render(CtxG& ctx, Progress&) {
+    StatTimer t(TIMER_RENDER);
+    this->light_distrib = compute_light_distrib(*this->scene);
+
+    parallel_for(*ctx.pool, this->iteration_count, [&](uint32_t i) {
+      this->iteration_tiled_per_job(ctx, [&](Film& tile_film,
+            Recti tile_rect, Recti tile_film_rect, Sampler& sampler)
+      {
+        this->render_tile(tile_film, tile_rect, tile_film_rect, sampler, i != 0);
+      });
+    });
+  }
+
+  void WavefrontRenderer::render_tile(Film& tile_film, Recti tile_rect,
+      Recti tile_film_rect, Sampler& sampler, bool jitter) const
+  {
+    Batch batch;
+    this->generate_paths(batch, tile_rect, sampler, jitter);
+    while(!batch.active.empty()) {
+      this->sort_rays(batch);
+      this->trace_extension_rays(batch);
+      this->add_emitted_radiance(batch);
+      this->sort_hits(batch);
+      this->shade_hits(batch, sampler);
+      this->trace_shadow_rays(batch);
+      this->trace_bsdf_rays(batch);
+    }
+
+    for(const PathState& path: batch.paths) {
+      Spectrum contrib = path.radiance * path.weight;
+      assert(is_finite(contrib));
+      assert(is_nonnegative(contrib));
+      if(is_finite(contrib) && is_nonnegative(contrib)) {
+        Vec2 tile_film_pos = path.film_pos - Vec2(tile_film_rect.p_min);
+        tile_film.add_sample(tile_film_pos, contrib);
+      }
+    }
+  }
+
+  void WavefrontRenderer::generate_paths(Batch& batch, Recti tile_rect,
+      Sampler& sampler, bool jitter) const
+  {
+    Vec2i tile_size = tile_rect.p_max - tile_rect.p_min;
+    batch.paths.resize(tile_size.x * tile_size.y);
+    batch.active.reserve(batch.paths.size());
+
+    uint32_t path_idx = 0;
+    for(int32_t y = tile_rect.p_min.y; y < tile_rect.p_max.y; ++y) {
+      for(int32_t x = tile_rect.p_min.x; x < tile_rect.p_max.x; ++x) {
+        PathState& path = batch.paths.at(path_idx);
+        path.film_pos = Vec2(Vec2i(x, y)) +
+          (jitter ? sampler.random_2d() : Vec2(0.5f, 0.5f));
+        path.throughput = Spectrum(1.f);
+        path.radiance = Spectrum(0.f);
+        path.bounces = 0;
+        path.last_bounce_was_delta = false;
+
+        float ray_pos_pdf;
+        float ray_dir_pdf;
+        Spectrum importance = this->camera->sample_ray_importance(
+            Vec2(this->film->res), path.film_pos, path.ray,
+            ray_pos_pdf, ray_dir_pdf, CameraSample(sampler.rng));
+        float ray_pdf = ray_pos_pdf * ray_dir_pdf;
+        if(ray_pdf == 0.f || importance.is_black()) {
+          path.weight = Spectrum(0.f);
+        } else {
+          path.weight = importance / ray_pdf;
+          batch.active.push_back(path_idx);
+        }
+        path_idx += 1;
+      }
+    }
+  }
+
+  void WavefrontRenderer::sort_rays(Batch& batch) const {
+    StatTimer t(TIMER_WAVEFRONT_SORT);
+    // the rays are ordered by the octant of their direction and then by the
+    // Morton code of their origin in the scene bounds
+    const Box& bounds = this->scene->bounds;
+    Vector extent = bounds.p_max - bounds.p_min;
+    assert(batch.paths.size() < (1u << 31));
+    std::vector<uint64_t> keys;
+    keys.reserve(batch.active.size());
+    for(uint32_t path_idx: batch.active) {
+      const Ray& ray = batch.paths.at(path_idx).ray;
+      uint32_t octant = (ray.dir.v.x < 0.f ? 1 : 0)
+        | (ray.dir.v.y < 0.f ? 2 : 0) | (ray.dir.v.z < 0.f ? 4 : 0);
+      uint32_t morton = 0;
+      for(uint32_t axis = 0; axis < 3; ++axis) {
+        float cell = 1024.f * (ray.orig.v[axis] - bounds.p_min.v[axis]) / extent.v[axis];
+        uint32_t cell_idx = cell >= 1.f ? uint32_t(min(cell, 1023.f)) : 0;
+        morton |= expand_morton_bits(cell_idx) << (2 - axis);
+      }
+      keys.push_back((uint64_t(octant) << 61) | (uint64_t(morton) << 31) | path_idx);
+    }
+
+    std::sort(keys.begin(), keys.end());
+    for(uint32_t i = 0; i < keys.size(); ++i) {
+      batch.active.at(i) = uint32_t(keys.at(i) & 0x7fffffff);
+    }
+  }
+
+  void WavefrontRenderer::trace_extension_rays(Batch& batch) const {
+    StatTimer t(TIMER_WAVEFRONT_EXTEND);
+    // consecutive rays are coherent after the sort, so they are traced in
+    // packets
+    for(uint32_t begin = 0; begin < batch.active.size(); begin += RAY_PACKET_SIZE) {
+      uint32_t count = min(RAY_PACKET_SIZE, uint32_t(batch.active.size() - begin));
+      std::array<Ray, RAY_PACKET_SIZE> rays;
+      for(uint32_t i = 0; i < count; ++i) {
+        rays.at(i) = batch.paths.at(batch.active.at(begin + i)).ray;
+      }
+
+      std::array<Intersection, RAY_PACKET_SIZE> isects;
+      uint32_t hit_mask = this->scene->intersect_packet(
+          rays.data(), isects.data(), (1u << count) - 1);
+      for(uint32_t i = 0; i < count; ++i) {
+        PathState& path = batch.paths.at(batch.active.at(begin + i));
+        path.isected = (hit_mask & (1u << i)) != 0;
+        if(path.isected) {
+          path.isect = isects.at(i);
+        }
+      }
+    }
+  }
+
+  void WavefrontRenderer::add_emitted_radiance(Batch& batch) const {
+    uint32_t active_count = 0;
+    for(uint32_t path_idx: batch.active) {
+      PathState& path = batch.paths.at(path_idx);
+      if((path.bounces == 0 || path.last_bounce_was_delta)
+          && path.bounces >= this->min_depth && path.bounces <= this->max_depth)
+      {
+        // see PathRenderer::sample_path() for the explanation
+        if(path.isected) {
+          path.radiance += path.throughput * path.isect.eval_radiance(path.ray.orig);
+        } else {
+          for(const auto& light: this->scene->background_lights) {
+            path.radiance += path.throughput * light->background_radiance(path.ray);
+          }
+        }
+      }
+
+      path.bounces += 1;
+      if(path.isected && path.bounces <= this->max_depth) {
+        batch.active.at(active_count++) = path_idx;
+      }
+    }
+    batch.active.resize(active_count);
+  }
+
+  void WavefrontRenderer::sort_hits(Batch& batch) const {
+    StatTimer t(TIMER_WAVEFRONT_SORT);
+    std::vector<std::pair<const Material*, uint32_t>> keys;
+    keys.reserve(batch.active.size());
+    for(uint32_t path_idx: batch.active) {
+      const Intersection& isect = batch.paths.at(path_idx).isect;
+      keys.emplace_back(isect.primitive->get_material(isect), path_idx);
+    }
+
+    std::stable_sort(keys.begin(), keys.end(),
+      [](const std::pair<const Material*, uint32_t>& a,
+          const std::pair<const Material*, uint32_t>& b) {
+        return std::less<const Material*>()(a.first, b.first);
+      });
+    for(uint32_t i = 0; i < keys.size(); ++i) {
+      batch.active.at(i) = keys.at(i).second;
+    }
+  }
+
+  void WavefrontRenderer::shade_hits(Batch& batch, Sampler& sampler) const {
+    StatTimer t(TIMER_WAVEFRONT_SHADE);
+    batch.shadow_rays.clear();
+    batch.bsdf_rays.clear();
+
+    uint32_t active_count = 0;
+    for(uint32_t path_idx: batch.active) {
+      PathState& path = batch.paths.at(path_idx);
+      const Intersection& isect = path.isect;
+      Point p = isect.world_diff_geom.p;
+      float p_epsilon = isect.ray_epsilon;
+      Normal nn = isect.world_diff_geom.nn;
+      Vector wo_camera = normalize(-path.ray.dir);
+      auto bsdf = isect.get_bsdf();
+
+      if(path.bounces >= this->min_depth) {
+        // the direct lighting is added later by trace_shadow_rays() and
+        // trace_bsdf_rays()
+        this->sample_direct_lighting(batch, path_idx, *bsdf, sampler);
+      }
+
+      Vector bsdf_wi;
+      float bsdf_pdf;
+      BxdfFlags bsdf_flags;
+      Spectrum bsdf_f = bsdf->sample_light_f(wo_camera,
+          (this->only_direct || path.bounces == this->max_depth)
+            ? BSDF_MODES | BSDF_DELTA : BSDF_ALL,
+          bsdf_wi, bsdf_pdf, bsdf_flags, BsdfSample(sampler.rng));
+      if(bsdf_f.is_black() || bsdf_pdf == 0.f) { continue; }
+
+      Spectrum bounce_contrib = bsdf_f * (abs_dot(bsdf_wi, nn) / bsdf_pdf);
+      path.last_bounce_was_delta = bsdf_flags & BSDF_DELTA;
+      assert(is_finite(bounce_contrib)); assert(is_nonnegative(bounce_contrib));
+      path.throughput = path.throughput * bounce_contrib;
+
+      if(path.bounces == this->max_depth && !path.last_bounce_was_delta) {
+        continue;
+      } else if(path.bounces >= 2 && path.bounces > this->min_depth) {
+        float survive_prob = clamp(bounce_contrib.average(), 0.1f, 0.99f);
+        if(sampler.random_1d() > survive_prob) { continue; }
+        path.throughput = path.throughput / survive_prob;
+      }
+      path.ray = Ray(p, bsdf_wi, p_epsilon);
+      batch.active.at(active_count++) = path_idx;
+    }
+    batch.active.resize(active_count);
+  }
+
+  void WavefrontRenderer::trace_shadow_rays(Batch& batch) const {
+    StatTimer t(TIMER_WAVEFRONT_DIRECT);
+    for(const DirectRay& shadow_ray: batch.shadow_rays) {
+      if(!this->scene->intersect_p(shadow_ray.ray)) {
+        batch.paths.at(shadow_ray.path).radiance += shadow_ray.contrib;
+      }
+    }
+  }
+
+  void WavefrontRenderer::trace_bsdf_rays(Batch& batch) const {
+    StatTimer t(TIMER_WAVEFRONT_DIRECT);
+    for(DirectRay& bsdf_ray: batch.bsdf_rays) {
+      const Light& light = *bsdf_ray.light;
+      Intersection light_isect;
+      bool isected = this->scene->intersect(bsdf_ray.ray, light_isect);
+
+      Spectrum radiance(0.f);
+      if(isected && (light.flags & LIGHT_AREA)) {
+        if(light_isect.get_area_light() == &light) {
+          radiance = light.eval_radiance(light_isect.world_diff_geom.p,
+              light_isect.world_diff_geom.nn, bsdf_ray.ray.orig);
+        }
+      } else if(!isected && (light.flags & LIGHT_BACKGROUND)) {
+        radiance = light.background_radiance(bsdf_ray.ray);
+      }
+      batch.paths.at(bsdf_ray.path).radiance += bsdf_ray.contrib * radiance;
+    }
+  }
+
+  void WavefrontRenderer::sample_direct_lighting(Batch& batch,
+      uint32_t path_idx, const Bsdf& bsdf, Sampler& sampler) const
+  {
+    if(bsdf.bxdf_count(BSDF_ALL & (~BSDF_DELTA)) == 0) { return; }
+
+    if(this->sample_all_lights) {
+      for(const auto& light: this->scene->lights) {
+        this->sample_direct(batch, path_idx, *light, bsdf, 1.f, sampler);
+      }
+    } else {
+      uint32_t light_i = this->light_distrib.sample(sampler.random_1d());
+      float light_pick_pdf = this->light_distrib.pdf(light_i);
+      if(light_pick_pdf == 0.f) { return; }
+      const Light& light = *this->scene->lights.at(light_i);
+      this->sample_direct(batch, path_idx, light, bsdf, light_pick_pdf, sampler);
+    }
+  }
+
+  void WavefrontRenderer::sample_direct(Batch& batch, uint32_t path_idx,
+      const Light& light, const Bsdf& bsdf, float light_pick_pdf,
+      Sampler& sampler) const
+  {
+    // the same estimators as PathRenderer::estimate_direct(), but the rays are
+    // only queued
+    const PathState& path = batch.paths.at(path_idx);
+    Point p = path.isect.world_diff_geom.p;
+    float p_epsilon = path.isect.ray_epsilon;
+    Normal nn = path.isect.world_diff_geom.nn;
+    Vector wo_camera = normalize(-path.ray.dir);
+    Spectrum weight = path.throughput / light_pick_pdf;
+
+    bool use_bsdf = this->direct_strategy != DirectStrategy::SAMPLE_LIGHT
+      && !(light.flags & LIGHT_DELTA) && (light.flags & (LIGHT_AREA | LIGHT_BACKGROUND));
+    bool use_light = this->direct_strategy != DirectStrategy::SAMPLE_BSDF;
+
+    if(use_bsdf) {
+      Vector wi_light;
+      float wi_dir_pdf;
+      BxdfFlags bsdf_flags;
+      Spectrum bsdf_f = bsdf.sample_light_f(wo_camera, BSDF_ALL & (~BSDF_DELTA),
+          wi_light, wi_dir_pdf, bsdf_flags, BsdfSample(sampler.rng));
+      if(wi_dir_pdf != 0.f && !bsdf_f.is_black()) {
+        assert(!(bsdf_flags & BSDF_DELTA));
+        float mis_weight = 1.f;
+        if(use_light) {
+          float wi_light_dir_pdf = light.pivot_radiance_pdf(wi_light, p);
+          mis_weight = wi_dir_pdf / (wi_dir_pdf + wi_light_dir_pdf);
+        }
+        batch.bsdf_rays.push_back(DirectRay {
+          path_idx, Ray(p, wi_light, p_epsilon),
+          bsdf_f * (mis_weight * abs_dot(nn, wi_light) / wi_dir_pdf) * weight,
+          &light,
+        });
+      }
+    }
+
+    if(use_light) {
+      Vector wi_light;
+      float wi_dir_pdf;
+      ShadowTest shadow;
+      Spectrum radiance = light.sample_pivot_radiance(p, p_epsilon,
+          wi_light, wi_dir_pdf, shadow, LightSample(sampler.rng));
+      if(wi_dir_pdf == 0.f || radiance.is_black()) { return; }
+
+      Spectrum bsdf_f = bsdf.eval_f(wi_light, wo_camera, BSDF_ALL & (~BSDF_DELTA));
+      if(bsdf_f.is_black() || shadow.invisible) { return; }
+
+      float mis_weight = 1.f;
+      if(use_bsdf) {
+        float wi_bsdf_dir_pdf = bsdf.light_f_pdf(wi_light,
+            wo_camera, BSDF_ALL & (~BSDF_DELTA));
+        mis_weight = wi_dir_pdf / (wi_dir_pdf + wi_bsdf_dir_pdf);
+      }
+      batch.shadow_rays.push_back(DirectRay {
+        path_idx, shadow.ray,
+        bsdf_f * radiance * (mis_weight * abs_dot(nn, wi_light) / wi_dir_pdf) * weight,
+        &light,
+      });
+    }
+  }
+}
@@ -120,7 +120,8 @@ local function run_test(test_def)
     if opts.verbose then dort.std.printf("  %s...", render_def.name) end
     io.stdout:flush()
 
-    local out_image, test_time_s = render(test_def.scene, render_def.opts)
+    local out_image, test_time_s = render(render_def.scene or test_def.scene,
+      render_def.opts)
     dort.image.write_rgbe(string.format("%s/%s.hdr",
       out_dir_path, render_def.name), out_image)
 
@@ -208,4 +209,5 @@ parse_argv(dort.env.get_argv())
 load_tests("test_simple.lua")
 load_tests("test_box.lua")
 load_tests("test_bsdf.lua")
+load_tests("test_prims.lua")
 run_tests()
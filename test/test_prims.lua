@@ -0,0 +1,475 @@
+-- Tests of the specialized primitives: each scene is rendered using the
+-- primitive and compared with a reference that is rendered from the same
+-- geometry built from ordinary shapes and meshes.
+
+local base_opts = {
+  min_depth = 0,
+  max_depth = 3,
+  x_res = 256, y_res = 256,
+  sampler = dort.sampler.make_random { samples_per_pixel = 1 },
+  filter = dort.filter.make_box { radius = 0.5 },
+}
+
+local render_opts = dort.std.merge(base_opts, {
+  renderer = "pt",
+  iterations = 32,
+})
+
+local ref_opts = dort.std.merge(base_opts, {
+  renderer = "pt",
+  iterations = 200,
+})
+
+-- the scenes are rendered from the same geometry as the references, so we
+-- can compare them much more strictly than the default
+local function prim_render(name, scene)
+  return {
+    name = name,
+    scene = scene,
+    opts = render_opts,
+    variation = 1.5,
+    min_tile_size = 16,
+  }
+end
+
+local sphere_defs = {
+  {-1.2, -0.6, 0.5, 0.6, 1},
+  {0.3, -0.8, 0.2, 0.4, 2},
+  {1.2, 0.2, 0.8, 0.7, 3},
+  {-0.4, 0.7, 0.3, 0.5, 2},
+  {0.5, 0.4, -0.6, 0.3, 1},
+  {-0.1, -0.1, 1.8, 0.9, 3},
+}
+
+-- kind is "shapes" (the reference), "table" or "packed" (the arrays are
+-- passed to add_spheres as tables or as packed strings)
+local function spheres_scene(kind)
+  local _ENV = require "dort/dsl"
+  return define_scene(function()
+    local materials = {
+      lambert_material { albedo = rgb(0.5, 0.2, 0.2) },
+      phong_material { albedo = rgb(0.3, 0.5, 0.3), exponent = 30 },
+      lambert_material { albedo = rgb(0.2, 0.3, 0.6) },
+    }
+
+    if kind == "shapes" then
+      for _, def in ipairs(sphere_defs) do
+        block(function()
+          material(materials[def[5]])
+          transform(translate(def[1], def[2], def[3]))
+          add_shape(sphere { radius = def[4] })
+        end)
+      end
+    else
+      local centers, radii, indices = {}, {}, {}
+      for _, def in ipairs(sphere_defs) do
+        centers[#centers + 1] = def[1]
+        centers[#centers + 1] = def[2]
+        centers[#centers + 1] = def[3]
+        radii[#radii + 1] = def[4]
+        indices[#indices + 1] = def[5]
+      end
+
+      if kind == "packed" then
+        centers = string.pack(string.rep("f", #centers), table.unpack(centers))
+        radii = string.pack(string.rep("f", #radii), table.unpack(radii))
+        indices = string.pack(string.rep("I4", #indices), table.unpack(indices))
+      elseif kind ~= "table" then
+        error(kind)
+      end
+
+      add_spheres {
+        centers = centers,
+        radii = radii,
+        materials = materials,
+        material_indices = indices,
+      }
+    end
+
+    add_light(point_light {
+      point = point(-2, -3, -3),
+      intensity = rgb(20),
+    })
+    add_light(directional_light {
+      direction = vector(1, 1, 2),
+      radiance = rgb(1),
+    })
+
+    camera(pinhole_camera {
+      transform = look_at(
+        point(0, 0, -5),
+        point(0, 0, 0),
+        vector(0, 1, 0)),
+      fov = pi/3,
+    })
+  end)
+end
+
+-- odd resolutions, so that the blocks on the edges of the min/max pyramid
+-- are only partially filled
+local hf_x_res, hf_y_res = 37, 23
+local hf_heights = {}
+for y = 0, hf_y_res - 1 do
+  for x = 0, hf_x_res - 1 do
+    local u, v = x / (hf_x_res - 1), y / (hf_y_res - 1)
+    hf_heights[#hf_heights + 1] = 0.3 * math.sin(9*u) * math.cos(7*v) + 0.2*u
+  end
+end
+
+-- kind is "mesh" (the reference, the same grid of triangles as a mesh BVH)
+-- or "heightfield"; camera_kind is "top" (vertical rays) or "low" (rays that
+-- graze the terrain)
+local function heightfield_scene(kind, camera_kind)
+  local _ENV = require "dort/dsl"
+  return define_scene(function()
+    local x_res, y_res = hf_x_res, hf_y_res
+    local x_size, y_size = 4, 4
+    local function height(x, y)
+      return hf_heights[y * x_res + x + 1]
+    end
+
+    material(lambert_material { albedo = rgb(0.6, 0.5, 0.3) })
+    transform(translate(-0.5*x_size, -0.5*y_size, 0) * scale(x_size, y_size, 1))
+
+    if kind == "heightfield" then
+      add_heightfield {
+        heights = hf_heights,
+        x_res = x_res,
+        y_res = y_res,
+      }
+    elseif kind == "mesh" then
+      -- the normals must be computed in the same way as in the heightfield
+      -- (central differences over the grid), but in the space of the frame,
+      -- because the transform of the mesh is applied only to the points
+      local points, uvs, normals, vertices = {}, {}, {}, {}
+      for y = 0, y_res - 1 do
+        for x = 0, x_res - 1 do
+          local u, v = x / (x_res - 1), y / (y_res - 1)
+          local x0, x1 = math.max(x - 1, 0), math.min(x + 1, x_res - 1)
+          local y0, y1 = math.max(y - 1, 0), math.min(y + 1, y_res - 1)
+          local dhdx = (height(x1, y) - height(x0, y)) / (x1 - x0)
+          local dhdy = (height(x, y1) - height(x, y0)) / (y1 - y0)
+          local nx = -dhdx * (x_res - 1) / x_size
+          local ny = -dhdy * (y_res - 1) / y_size
+          local len = math.sqrt(nx*nx + ny*ny + 1)
+          points[#points + 1] = point(u, v, height(x, y))
+          uvs[#uvs + 1] = vec2(u, v)
+          normals[#normals + 1] = dort.geometry.normal(nx/len, ny/len, 1/len)
+        end
+      end
+
+      local cell_triangles = {
+        {{0, 0}, {1, 1}, {1, 0}},
+        {{0, 0}, {0, 1}, {1, 1}},
+      }
+      for y = 0, y_res - 2 do
+        for x = 0, x_res - 2 do
+          for _, tri in ipairs(cell_triangles) do
+            for _, offset in ipairs(tri) do
+              vertices[#vertices + 1] = (y + offset[2]) * x_res + (x + offset[1])
+            end
+          end
+        end
+      end
+
+      add_mesh_as_bvh(mesh {
+        points = points,
+        uvs = uvs,
+        normals = normals,
+        vertices = vertices,
+      })
+    else
+      error(kind)
+    end
+
+    transform(identity())
+    add_light(point_light {
+      point = point(-1, -3, 4),
+      intensity = rgb(60),
+    })
+    add_light(directional_light {
+      direction = vector(-1, 0.5, -1),
+      radiance = rgb(2),
+    })
+
+    if camera_kind == "top" then
+      camera(ortho_camera {
+        transform = look_at(
+          point(0, 0, 5),
+          point(0, 0, 0),
+          vector(0, 1, 0)),
+        dimension = 4.5,
+      })
+    elseif camera_kind == "low" then
+      camera(pinhole_camera {
+        transform = look_at(
+          point(-2.6, -3.2, 0.5),
+          point(1, 0.5, 0),
+          vector(0, 0, 1)),
+        fov = pi/3,
+      })
+    else
+      error(camera_kind)
+    end
+  end)
+end
+
+local bumpy_u_segments, bumpy_v_segments = 48, 24
+
+-- the points of a bumpy sphere, twisted around the Y axis by `twist` radians
+-- per unit of Y and stretched along the X axis: the top pole, the rings from
+-- the top to the bottom and the bottom pole
+local function bumpy_sphere_points(twist)
+  local _ENV = require "dort/dsl"
+  local u_segments, v_segments = bumpy_u_segments, bumpy_v_segments
+  local points = { point(0, 1, 0) }
+  for j = 1, v_segments - 1 do
+    local theta = pi * j / v_segments
+    for i = 0, u_segments - 1 do
+      local phi = 2 * pi * i / u_segments
+      local r = 1 + 0.15 * math.sin(5*phi) * math.sin(4*theta)
+      local x = r * math.sin(theta) * math.cos(phi)
+      local y = r * math.cos(theta)
+      local z = r * math.sin(theta) * math.sin(phi)
+      local angle = twist * y
+      points[#points + 1] = point(
+        (x * math.cos(angle) - z * math.sin(angle)) * (1 + 0.5*twist),
+        y,
+        x * math.sin(angle) + z * math.cos(angle))
+    end
+  end
+  points[#points + 1] = point(0, -1, 0)
+  return points
+end
+
+-- a bumpy sphere with enough triangles to be simplified to several levels
+local function bumpy_sphere_mesh(twist)
+  local _ENV = require "dort/dsl"
+  local u_segments, v_segments = bumpy_u_segments, bumpy_v_segments
+  local points = bumpy_sphere_points(twist or 0)
+  local vertices = {}
+  local function add_triangle(a, b, c)
+    vertices[#vertices + 1] = a
+    vertices[#vertices + 1] = b
+    vertices[#vertices + 1] = c
+  end
+  local function ring_point(j, i)
+    return 1 + (j - 1) * u_segments + i % u_segments
+  end
+
+  local bottom = #points - 1
+  for i = 0, u_segments - 1 do
+    add_triangle(0, ring_point(1, i), ring_point(1, i + 1))
+    add_triangle(ring_point(v_segments - 1, i), bottom,
+      ring_point(v_segments - 1, i + 1))
+  end
+  for j = 1, v_segments - 2 do
+    for i = 0, u_segments - 1 do
+      local a, b = ring_point(j, i), ring_point(j, i + 1)
+      local c, d = ring_point(j + 1, i), ring_point(j + 1, i + 1)
+      add_triangle(a, c, b)
+      add_triangle(b, c, d)
+    end
+  end
+
+  return mesh {
+    points = points,
+    vertices = vertices,
+    transform = identity(),
+  }
+end
+
+-- kind is "plain" (the reference, the mesh is added as an ordinary BVH) or
+-- "lod" (the mesh is added with levels of detail); lod_pixel_error is the
+-- option that is set for the "lod" scene
+local function lod_scene(kind, lod_pixel_error)
+  local _ENV = require "dort/dsl"
+  return define_scene(function()
+    material(lambert_material { albedo = rgb(0.4, 0.5, 0.6) })
+
+    local prim
+    if kind == "lod" then
+      option("lod_pixel_error", lod_pixel_error)
+      option("lod_x_res", base_opts.x_res)
+      option("lod_y_res", base_opts.y_res)
+      prim = mesh_lod(bumpy_sphere_mesh(), { levels = 4, ratio = 0.25 })
+    elseif kind == "plain" then
+      prim = frame(function()
+        add_mesh_as_bvh(bumpy_sphere_mesh())
+      end)
+    else
+      error(kind)
+    end
+
+    -- instances at different distances from the camera
+    for i, z in ipairs { 0, 4, 12, 30 } do
+      block(function()
+        transform(translate(-1.5 + 0.2*z, -0.6, z) * scale(0.5 + 0.1*z))
+        add_primitive(prim)
+      end)
+    end
+
+    -- a frame with several instances and an ordinary shape, nested in a
+    -- frame with a single instance, which is added twice
+    local group = frame(function()
+      for i = 0, 2 do
+        block(function()
+          transform(translate(0.8*i, 0, 0.5*i) * scale(0.35))
+          add_primitive(prim)
+        end)
+      end
+      block(function()
+        material(lambert_material { albedo = rgb(0.6, 0.3, 0.2) })
+        transform(translate(0.8, -0.6, 0.5) * scale(0.2))
+        add_shape(sphere { radius = 1 })
+      end)
+    end)
+    local outer = frame(function()
+      transform(rotate_y(0.3))
+      add_primitive(group)
+    end)
+    for _, offset in ipairs { {0.2, 0.8, 1}, {-2, 3, 20} } do
+      block(function()
+        transform(translate(offset[1], offset[2], offset[3]) * scale(1 + 0.1*offset[3]))
+        add_primitive(outer)
+      end)
+    end
+
+    add_light(point_light {
+      point = point(-3, 4, -4),
+      intensity = rgb(60),
+    })
+    add_light(directional_light {
+      direction = vector(1, -1, 1),
+      radiance = rgb(1),
+    })
+
+    camera(pinhole_camera {
+      transform = look_at(
+        point(0, 1, -6),
+        point(0, 0.5, 10),
+        vector(0, 1, 0)),
+      fov = pi/3,
+    })
+  end)
+end
+
+-- kind is "fresh" (the reference, the scene is built from the twisted mesh),
+-- "refit" or "rebuild" (the scene is built from the original mesh, then the
+-- points are twisted and the scene is refitted, with or without a
+-- rebuild_threshold)
+local function refitted_scene(kind)
+  local _ENV = require "dort/dsl"
+  local twist = 1.2
+  local sphere_mesh
+  local scene = define_scene(function()
+    material(lambert_material { albedo = rgb(0.5, 0.5, 0.4) })
+    sphere_mesh = bumpy_sphere_mesh(kind == "fresh" and twist or 0)
+
+    -- the mesh BVH is added directly and also shared by frames: by several
+    -- frames with a single instance (which share the mesh BVH through
+    -- another frame) and by a frame with multiple instances
+    add_mesh_as_bvh(sphere_mesh)
+    local shared = frame(function()
+      add_mesh_as_bvh(sphere_mesh)
+    end)
+    for i, x in ipairs { -2.2, 2.2 } do
+      local single = frame(function()
+        transform(rotate_x(0.4 * i))
+        add_primitive(shared)
+      end)
+      block(function()
+        transform(translate(x, 0.5, 1) * scale(0.6))
+        add_primitive(single)
+      end)
+    end
+    local multiple = frame(function()
+      for i = 0, 3 do
+        block(function()
+          transform(translate(1.1*i - 1.65, 0, 0) * scale(0.4))
+          add_primitive(shared)
+        end)
+      end
+    end)
+    block(function()
+      transform(translate(0, -1.6, 0))
+      add_primitive(multiple)
+    end)
+
+    add_light(point_light {
+      point = point(-3, 4, -4),
+      intensity = rgb(60),
+    })
+    add_light(directional_light {
+      direction = vector(1, -1, 1),
+      radiance = rgb(1),
+    })
+
+    camera(pinhole_camera {
+      transform = look_at(
+        point(0, 0.5, -6),
+        point(0, -0.2, 0),
+        vector(0, 1, 0)),
+      fov = pi/3,
+    })
+  end)
+
+  if kind == "refit" or kind == "rebuild" then
+    set_mesh_points(sphere_mesh, bumpy_sphere_points(twist))
+    if kind == "rebuild" then
+      refit_scene(scene, 1.1)
+    else
+      refit_scene(scene)
+    end
+  elseif kind ~= "fresh" then
+    error(kind)
+  end
+  return scene
+end
+
+return function(t)
+  t:test {
+    name = "prims_spheres",
+    scene = spheres_scene("shapes"),
+    renders = {
+      prim_render("table", spheres_scene("table")),
+      prim_render("packed", spheres_scene("packed")),
+    },
+    ref_opts = ref_opts,
+  }
+
+  for _, camera_kind in ipairs { "top", "low" } do
+    t:test {
+      name = "prims_heightfield_" .. camera_kind,
+      scene = heightfield_scene("mesh", camera_kind),
+      renders = {
+        prim_render("heightfield",
+          heightfield_scene("heightfield", camera_kind)),
+      },
+      ref_opts = ref_opts,
+    }
+  end
+
+  -- with lod_pixel_error = 0 the finest levels are traced through the LOD
+  -- primitives; with a tiny error the levels are selected for each instance,
+  -- but the finest levels must be selected everywhere
+  t:test {
+    name = "prims_lod",
+    scene = lod_scene("plain"),
+    renders = {
+      prim_render("zero", lod_scene("lod", 0)),
+      prim_render("tiny", lod_scene("lod", 1e-6)),
+    },
+    ref_opts = ref_opts,
+  }
+
+  t:test {
+    name = "prims_refit",
+    scene = refitted_scene("fresh"),
+    renders = {
+      prim_render("refit", refitted_scene("refit")),
+      prim_render("rebuild", refitted_scene("rebuild")),
+    },
+    ref_opts = ref_opts,
+  }
+end
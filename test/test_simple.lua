@@ -3,9 +3,29 @@ local surface_kinds = {"diff", "glos", "mirr"}
 local light_kinds = {"poin_fwd", "poin_blw", "area_fwd", "dire_blw", "mixd_2", "mixd_3"}
 local camera_kinds = {"pin"}
 
-local function simple_scene(geom_kind, surface_kind, light_kind, camera_kind)
+-- the scenes are also rendered with these builder options, which select
+-- other BVH layouts and build methods; the cube is then added as a mesh, so
+-- that the mesh BVHs are covered too
+local bvh_variants = {
+  {"full_sah", {bvh_split_method = "full_sah"}},
+  {"spatial_sah", {bvh_split_method = "spatial_sah"}},
+  {"lbvh", {bvh_split_method = "lbvh"}},
+  {"branch4", {bvh_branch_factor = 4}},
+  {"branch8", {bvh_branch_factor = 8}},
+  {"quant8", {bvh_quantization_bits = 8}},
+  {"quant16", {bvh_quantization_bits = 16}},
+  {"tri_blocks", {bvh_triangle_blocks = true}},
+  {"compressed", {compress_meshes = true}},
+}
+
+local function simple_scene(geom_kind, surface_kind, light_kind, camera_kind,
+    bvh_options)
   local _ENV = require "dort/dsl"
   return define_scene(function()
+    for key, value in pairs(bvh_options or {}) do
+      option(key, value)
+    end
+
     if surface_kind == "diff" then
       material(lambert_material { albedo = rgb(0.5) })
     elseif surface_kind == "glos" then
@@ -24,7 +44,11 @@ local function simple_scene(geom_kind, surface_kind, light_kind, camera_kind)
       block(function()
         transform(rotate_y(pi/4))
         transform(rotate_x(pi/6))
-        add_shape(cube())
+        if bvh_options then
+          add_read_ply_mesh_as_bvh("test/data/cube.ply")
+        else
+          add_shape(cube())
+        end
       end)
     elseif geom_kind == "disk2" then
       block(function()
@@ -146,6 +170,10 @@ local render_optss = {
     renderer = "pt",
     iterations = 6,
   }),
+  dort.std.merge(base_opts, {
+    renderer = "wpt",
+    iterations = 6,
+  }),
   dort.std.merge(base_opts, {
     renderer = "lt",
     iterations = 15,
@@ -224,6 +252,18 @@ return function(t)
             ::skip_render::
           end
 
+          for _, variant in ipairs(bvh_variants) do
+            test_renders[#test_renders + 1] = {
+              name = "pt_" .. variant[1],
+              scene = simple_scene(geom_kind, surface_kind, light_kind,
+                camera_kind, variant[2]),
+              opts = render_optss[1],
+              variation = 1,
+              bias = 0,
+              min_tile_size = 32,
+            }
+          end
+
           local name = string.format("simple_%s_%s_%s_%s", geom_kind,
             surface_kind, light_kind, camera_kind)
           local scene = simple_scene(geom_kind,